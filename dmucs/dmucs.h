@@ -46,6 +46,15 @@ extern bool debugMode;
 #define SERVER_PORT_NUM 9714
 #endif
 
+/*
+ * The port the distccd daemons on the compilation hosts listen on.  The
+ * server probes this port to find out whether a host can take compiles.
+ * It can be changed per dprop with "probe-port" in the dprops-info file.
+ */
+#ifndef DISTCCD_PORT_NUM
+#define DISTCCD_PORT_NUM 3632
+#endif
+
 #include "COSMIC/HDR/sockets.h"
 
 void addFd(Socket *sock);
@@ -0,0 +1,223 @@
+/*
+ * dmucs_admin.cc: batches of administrative operations on many hosts, sent
+ * over one connection and applied all at once.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs.h"
+#include "dmucs_admin.h"
+#include "dmucs_db.h"
+#include "dmucs_host.h"
+#include "dmucs_hosts_file.h"
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <set>
+#include <sstream>
+
+extern std::string hostsInfoFile;
+
+
+DmucsAdmin *DmucsAdmin::instance_ = NULL;
+
+
+DmucsAdmin *
+DmucsAdmin::getInstance()
+{
+    if (instance_ == NULL) {
+	instance_ = new DmucsAdmin();
+    }
+    return instance_;
+}
+
+
+/* Add the ';'-separated operations in ops to the connection's batch. */
+void
+DmucsAdmin::add(const Socket *sock, const char *ops)
+{
+    DmucsBatch &batch = batches_[sock];
+
+    std::istringstream instr(ops);
+    std::string str;
+    while (std::getline(instr, str, ';')) {
+	std::string::size_type start = str.find_first_not_of(" \t");
+	if (start == std::string::npos) {
+	    continue;
+	}
+	str = str.substr(start, str.find_last_not_of(" \t") - start + 1);
+	DmucsAdminOp op;
+	if (!parseOp(str, op)) {
+	    if (batch.error_.empty()) {
+		std::ostringstream err;
+		err << batch.ops_.size() + 1 << ": bad operation '" << str
+		    << "'";
+		batch.error_ = err.str();
+	    }
+	    continue;
+	}
+	batch.ops_.push_back(op);
+    }
+}
+
+
+bool
+DmucsAdmin::parseOp(const std::string &str, DmucsAdminOp &op)
+{
+    std::istringstream instr(str);
+    std::string name, ip, word;
+    if (!(instr >> name >> ip)) {
+	return false;
+    }
+    op.host_.s_addr = inet_addr(ip.c_str());
+    if (op.host_.s_addr == INADDR_NONE) {
+	return false;
+    }
+    op.arg_ = 0;
+
+    if (name == "up") {
+	op.op_ = ADMIN_UP;
+    } else if (name == "down") {
+	op.op_ = ADMIN_DOWN;
+    } else if (name == "drain") {
+	op.op_ = ADMIN_DRAIN;
+    } else if (name == "pindex" || name == "ncpus") {
+	op.op_ = (name == "pindex") ? ADMIN_PINDEX : ADMIN_NCPUS;
+	if (!(instr >> op.arg_) || op.arg_ < 1) {
+	    return false;
+	}
+    } else if (name == "slots") {
+	op.op_ = ADMIN_SLOTS;
+	if (!(instr >> op.arg_) || op.arg_ < 0) {
+	    return false;
+	}
+    } else {
+	return false;
+    }
+
+    while (instr >> word) {
+	if (op.op_ == ADMIN_DRAIN && word.compare(0, 9, "deadline=") == 0) {
+	    op.arg_ = atoi(word.c_str() + 9);
+	} else if (op.dprop_.empty() && word.find('=') == std::string::npos) {
+	    op.dprop_ = word.substr(0, DPROP_MAX_STRLEN);
+	} else {
+	    return false;
+	}
+    }
+    return true;
+}
+
+
+/*
+ * Do all of the operations in the connection's batch, or none of them,
+ * and return the reply for the client.
+ */
+std::string
+DmucsAdmin::commit(const Socket *sock)
+{
+    DmucsBatch batch = batches_[sock];
+    batches_.erase(sock);
+
+    std::ostringstream reply;
+    if (!batch.error_.empty()) {
+	reply << "error " << batch.error_;
+	return reply.str();
+    }
+
+    DmucsDb *db = DmucsDb::getInstance();
+
+    /* Hold the db's lock over the whole batch, so that no one sees only
+       some of it done. */
+    MutexMonitor m(DmucsDb::getMutex());
+
+    /* A host that is not in the db can only be brought up if the
+       hosts-info file has it.  Once an op of the batch has brought it up,
+       the ops after it may change it. */
+    DmucsHostsFile *hostsFile = DmucsHostsFile::getInstance(hostsInfoFile);
+    std::set<std::pair<unsigned int, DmucsDprop> > broughtUp;
+    for (unsigned int i = 0; i < batch.ops_.size(); i++) {
+	const DmucsAdminOp &op = batch.ops_[i];
+	std::pair<unsigned int, DmucsDprop> key(op.host_.s_addr, op.dprop_);
+	if (db->haveHost(op.host_, op.dprop_) || broughtUp.count(key) > 0) {
+	    continue;
+	}
+	int numCpus, powerIndex, memMb, slots;
+	if (op.op_ != ADMIN_UP) {
+	    reply << "error " << i + 1 << ": no host " << inet_ntoa(op.host_)
+		  << " in db \"" << op.dprop_ << "\"";
+	    return reply.str();
+	}
+	if (!hostsFile->getDataForHost(op.host_, &numCpus, &powerIndex,
+				       &memMb, &slots)) {
+	    reply << "error " << i + 1 << ": no host " << inet_ntoa(op.host_)
+		  << " in the hosts-info file";
+	    return reply.str();
+	}
+	broughtUp.insert(key);
+    }
+
+    time_t now = time(NULL);
+    for (unsigned int i = 0; i < batch.ops_.size(); i++) {
+	const DmucsAdminOp &op = batch.ops_[i];
+	DMUCS_DEBUG((stderr, "admin: op %d on %s, arg %d, dprop '%s'\n",
+		     op.op_, inet_ntoa(op.host_), op.arg_,
+		     dprop2cstr(op.dprop_)));
+	if (op.op_ == ADMIN_UP) {
+	    if (db->haveHost(op.host_, op.dprop_)) {
+		db->getHost(op.host_, op.dprop_)->avail();
+	    } else {
+		DmucsHost::createHost(op.host_, op.dprop_, hostsInfoFile);
+	    }
+	    continue;
+	}
+	DmucsHost *host = db->getHost(op.host_, op.dprop_);
+	switch (op.op_) {
+	case ADMIN_DOWN:
+	    host->unavail();
+	    break;
+	case ADMIN_DRAIN:
+	    host->drain(op.arg_ > 0 ? now + op.arg_ : 0);
+	    break;
+	case ADMIN_PINDEX:
+	    host->reconfigure(0, op.arg_);
+	    break;
+	case ADMIN_NCPUS:
+	    host->reconfigure(op.arg_, 0);
+	    break;
+	case ADMIN_SLOTS:
+	    host->setSlots(op.arg_);
+	    break;
+	default:
+	    break;
+	}
+    }
+    fprintf(stderr, "Applied %d admin operations\n",
+	    (int) batch.ops_.size());
+
+    reply << "ok " << batch.ops_.size();
+    return reply.str();
+}
+
+
+/* A connection is being closed: throw away its batch. */
+void
+DmucsAdmin::removeSocket(const Socket *sock)
+{
+    batches_.erase(sock);
+}
@@ -0,0 +1,97 @@
+#ifndef _DMUCS_ADMIN_H_
+#define _DMUCS_ADMIN_H_ 1
+
+/*
+ * dmucs_admin.h: batches of administrative operations on many hosts, sent
+ * over one connection and applied all at once.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include "dmucs_dprop.h"
+#include "COSMIC/HDR/sockets.h"
+
+
+/*
+ * Reconfiguring many hosts with addhost and remhost takes a connection,
+ * and a trip through the server's event loop, for each.  Instead, an
+ * administrator's client may send "admin" messages, each with some
+ * operations, on one connection, and then "admin commit".  The operations
+ * are:
+ *
+ *	up <host-IP-address> [<dprop>]
+ *	down <host-IP-address> [<dprop>]
+ *	drain <host-IP-address> [<dprop>] [deadline=<secs>]
+ *	pindex <host-IP-address> <power index> [<dprop>]
+ *	ncpus <host-IP-address> <#cpus> [<dprop>]
+ *	slots <host-IP-address> <#slots> [<dprop>]
+ *
+ * separated by ';'.  (0 slots gives a host its cpus times its dprop's
+ * oversubscription factor again -- see dmucs_host.h.)  Nothing is done
+ * until the commit: then, if every operation is well-formed and names a
+ * host in the db, or one an "up" before it brings up (an "up" adds a host
+ * that is in the hosts-info file), all of them are done, holding the db's
+ * lock, and the reply is "ok <#operations>".  Otherwise none of them is,
+ * and the reply is "error <n>: <why>", for the first bad operation.  A
+ * connection that closes before its commit has its batch thrown away.
+ */
+
+class DmucsAdmin
+{
+public:
+    static DmucsAdmin *getInstance();
+
+    void add(const Socket *sock, const char *ops);
+    std::string commit(const Socket *sock);
+    void removeSocket(const Socket *sock);
+
+private:
+    DmucsAdmin() {}
+
+    static DmucsAdmin *instance_;
+
+    enum dmucs_admin_op_t {
+	ADMIN_UP, ADMIN_DOWN, ADMIN_DRAIN, ADMIN_PINDEX, ADMIN_NCPUS,
+	ADMIN_SLOTS
+    };
+
+    struct DmucsAdminOp {
+	dmucs_admin_op_t op_;
+	struct in_addr	host_;
+	DmucsDprop	dprop_;
+	int		arg_;		// the power index, #cpus, #slots, or
+					// the secs to a drain's deadline.
+    };
+
+    /* The operations sent on a connection so far, and the first that
+       could not be parsed. */
+    struct DmucsBatch {
+	std::vector<DmucsAdminOp> ops_;
+	std::string	error_;
+    };
+
+    std::map<const Socket *, DmucsBatch> batches_;
+
+    bool parseOp(const std::string &str, DmucsAdminOp &op);
+};
+
+#endif
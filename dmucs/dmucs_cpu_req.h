@@ -0,0 +1,173 @@
+#ifndef _DMUCS_CPU_REQ_H_
+#define _DMUCS_CPU_REQ_H_ 1
+
+/*
+ * dmucs_cpu_req.h: what a "gethost" client asks for, beyond the dprop.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <string>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+/*
+ * The priority classes of host requests, highest first: a developer
+ * waiting on a compile, a CI build, and background work like nightly
+ * rebuilds (see dmucs_fair.h).
+ */
+enum {
+    DMUCS_PRIO_INTERACTIVE = 0,
+    DMUCS_PRIO_CI,
+    DMUCS_PRIO_BACKGROUND,
+    DMUCS_NUM_PRIOS
+};
+
+inline const char *
+dmucsPrioName(int prio)
+{
+    static const char *names[DMUCS_NUM_PRIOS] = {
+	"interactive", "ci", "background"
+    };
+    return (prio >= 0 && prio < DMUCS_NUM_PRIOS) ? names[prio] : "?";
+}
+
+/* Return the class named (or numbered) s, or -1. */
+inline int
+dmucsPrioFromName(const std::string &s)
+{
+    for (int p = 0; p < DMUCS_NUM_PRIOS; p++) {
+	if (s == dmucsPrioName(p)) {
+	    return p;
+	}
+    }
+    if (s.size() == 1 && s[0] >= '0' && s[0] < '0' + DMUCS_NUM_PRIOS) {
+	return s[0] - '0';
+    }
+    return -1;
+}
+
+
+/*
+ * The options in a host request: each is sent as a "<name>=<value>" word
+ * after the dprop.  Options this server does not know about are ignored,
+ * so that newer clients can talk to older servers.
+ */
+struct DmucsCpuReq
+{
+    long	cost_;		// how expensive the job is (e.g., the size
+				// of its source), 0 if not known.
+    std::string	key_;		// affinity key: jobs with the same key go
+				// to the same hosts, when they can.
+    bool	fromPeer_;	// sent on by another server, which is
+				// borrowing the cpu (see dmucs_peers.h).
+    std::string	user_;		// the user the client runs as, for the
+				// quotas (see dmucs_fair.h).
+    int		prio_;		// the priority class: DMUCS_PRIO_*.
+    int		gang_;		// the number of cpus wanted, all at once.
+    std::string	same_;		// "dprop" or "tier", if the gang's cpus
+				// must all be of one.
+    int		mem_;		// the memory the job needs, in MB, 0 if
+				// not known (see dmucs_host.h).
+    unsigned int hedge_;	// for a hedge, the cpu the compile to race
+				// is running on, else 0 (see dmucs_db.h).
+
+    DmucsCpuReq() : cost_(0), fromPeer_(false),
+		    prio_(DMUCS_PRIO_INTERACTIVE), gang_(1), mem_(0),
+		    hedge_(0) {}
+
+    /* Set the option "name" from its string value: return false if this
+       is not an option we know about. */
+    bool setOption(const std::string &name, const std::string &value) {
+	if (name == "cost") {
+	    cost_ = atol(value.c_str());
+	    return true;
+	}
+	if (name == "key") {
+	    key_ = value;
+	    return true;
+	}
+	if (name == "peer") {
+	    fromPeer_ = (atoi(value.c_str()) != 0);
+	    return true;
+	}
+	if (name == "user") {
+	    user_ = value;
+	    return true;
+	}
+	if (name == "gang") {
+	    gang_ = atoi(value.c_str());
+	    if (gang_ < 1) {
+		gang_ = 1;
+	    }
+	    return true;
+	}
+	if (name == "mem") {
+	    mem_ = atoi(value.c_str());
+	    if (mem_ < 0) {
+		mem_ = 0;
+	    }
+	    return true;
+	}
+	if (name == "same") {
+	    same_ = value;
+	    return true;
+	}
+	if (name == "hedge") {
+	    hedge_ = inet_addr(value.c_str());
+	    if (hedge_ == INADDR_NONE) {
+		hedge_ = 0;
+	    }
+	    return true;
+	}
+	if (name == "prio") {
+	    int p = dmucsPrioFromName(value);
+	    if (p >= 0) {
+		prio_ = p;
+	    }
+	    return true;
+	}
+	return false;
+    }
+};
+
+
+/*
+ * The 32-bit FNV-1a hash of a string, used for the affinity keys and for
+ * placing hosts on the server's hash ring.  The final mixing spreads the
+ * hashes of short, similar strings (like "<ip>#<n>") around the ring.
+ */
+inline unsigned int
+dmucsHash(const std::string &s)
+{
+    unsigned int h = 2166136261U;
+    for (std::string::const_iterator itr = s.begin(); itr != s.end(); ++itr) {
+	h ^= (unsigned char) *itr;
+	h *= 16777619U;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+#endif
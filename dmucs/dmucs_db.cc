@@ -20,6 +20,9 @@
 
 #include "dmucs.h"
 #include "dmucs_db.h"
+#include "dmucs_dprops_file.h"
+#include "dmucs_fair.h"
+#include "dmucs_repl.h"
 #include <algorithm>
 #include <stdio.h>
 #include <exception>
@@ -31,6 +34,9 @@
 DmucsDb *DmucsDb::instance_ = NULL;
 pthread_mutex_t DmucsDb::mutex_;
 pthread_mutexattr_t DmucsDb::attr_;
+unsigned long DmucsDpropDb::nextLeaseId_ = 1;
+
+extern std::string dpropsInfoFile;
 
 const char *
 dprop2cstr(DmucsDprop d) {
@@ -61,144 +67,1443 @@ DmucsDb::getInstance()
 
 
 void
-DmucsDb::assignCpuToClient(const unsigned int clientIp,
-                           const DmucsDprop dprop,
-                           const Socket *sock)
+DmucsDb::assignCpuToClient(const unsigned int clientIp,
+                           const DmucsDprop dprop,
+                           const Socket *sock, int memMb, bool hedge)
+{
+    MutexMonitor m(&mutex_);
+
+    /* add sock -> dprop mapping */
+    mapSockToDprop(sock, dprop);
+    return dbDb_.find(dprop)->second.assignCpuToClient(clientIp, sock,
+							memMb, hedge);
+}
+
+
+/* Add the sock -> dprop mapping, if the client has no cpu there yet. */
+void
+DmucsDb::mapSockToDprop(const Socket *sock, const DmucsDprop &dprop)
+{
+    std::pair<dmucs_sock_dprop_db_iter_t, dmucs_sock_dprop_db_iter_t> range =
+	sock2DpropDb_.equal_range(sock);
+    for (dmucs_sock_dprop_db_iter_t itr = range.first; itr != range.second;
+	 ++itr) {
+	if (itr->second == dprop) {
+	    return;
+	}
+    }
+    sock2DpropDb_.insert(std::make_pair(sock, dprop));
+}
+
+
+/*
+ * getBestAvailCpu: find a free cpu for a request whose labels are "dprop"
+ * (see dmucs_labels.h).  Of the DpropDbs that match, the one with a free
+ * cpu in the best tier gives it out, and dprop is set to its dprop.  Only
+ * the cpus of hosts with req.mem_ of memory to spare are counted.
+ * Return 0 if no DpropDb matches.
+ */
+unsigned int
+DmucsDb::getBestAvailCpu(DmucsDprop &dprop, const DmucsCpuReq &req)
+{
+    MutexMonitor m(&mutex_);
+
+    DmucsBitset match = matchPools(dprop);
+    if (! match.any()) {
+	fprintf(stderr, "nothing in this db!: dprop %s\n", dprop2cstr(dprop));
+	return 0L;		// 32-bits of zeros = 0.0.0.0 
+    }
+
+    DmucsDpropDb *best = NULL;
+    int bestTier = -1, bestFree = 0;
+    for (int i = match.next(0); i >= 0; i = match.next(i + 1)) {
+	int tier = pools_[i]->getBestFreeTier(req.mem_);
+	if (tier < 0) {
+	    continue;
+	}
+	int numFree = pools_[i]->getNumFreeCpus(req.mem_);
+	if (tier > bestTier || (tier == bestTier && numFree > bestFree)) {
+	    best = pools_[i];
+	    bestTier = tier;
+	    bestFree = numFree;
+	}
+    }
+    if (best == NULL) {
+	throw DmucsNoMoreHosts();
+    }
+    dprop = best->getDprop();
+    return best->getBestAvailCpu(req);
+}
+
+
+/*
+ * getHedgeCpu: take a free cpu that matches dprop, to race the compile the
+ * client on sock is running on req.hedge_ -- the client must hold that
+ * cpu.  The cpu is from the best tier of the DpropDbs under their
+ * hedge-max, and not on the host the compile is on.  Set dprop to the
+ * DpropDb it is from.  Return 0 if there is none.
+ */
+unsigned int
+DmucsDb::getHedgeCpu(const Socket *sock, DmucsDprop &dprop,
+		     const DmucsCpuReq &req)
+{
+    MutexMonitor m(&mutex_);
+
+    if (findPool(sock, req.hedge_) == NULL) {
+	struct in_addr in;
+	in.s_addr = req.hedge_;
+	fprintf(stderr, "Client asked for a hedge for %s, which it does not "
+		"hold\n", inet_ntoa(in));
+	return 0;
+    }
+
+    DmucsBitset match = matchPools(dprop);
+    DmucsDpropDb *best = NULL;
+    int bestTier = -1;
+    for (int i = match.next(0); i >= 0; i = match.next(i + 1)) {
+	if (! pools_[i]->canHedge()) {
+	    continue;
+	}
+	int tier = pools_[i]->getHedgeTier(req.hedge_, req.mem_);
+	if (tier > bestTier) {
+	    best = pools_[i];
+	    bestTier = tier;
+	}
+    }
+    if (best == NULL) {
+	return 0;
+    }
+    dprop = best->getDprop();
+    return best->takeHedgeCpu(bestTier, req.hedge_, req.mem_);
+}
+
+
+/* The DpropDbs with the best free tiers first, for a gang. */
+static bool
+betterFreeTier(const std::pair<int, DmucsDpropDb *> &lhs,
+	       const std::pair<int, DmucsDpropDb *> &rhs)
+{
+    return lhs.first > rhs.first;
+}
+
+
+/*
+ * getGang: take req.gang_ free cpus that match pred, all at once, from
+ * the DpropDbs with the best tiers.  If req.same_ is "dprop" they must
+ * all be from one DpropDb, or if it is "tier", from one tier of one.
+ * Return false, having taken none, if there are not enough free.  The
+ * gang's cost goes into the cost history (see pickTierForCost()) once.
+ */
+bool
+DmucsDb::getGang(const DmucsDprop &pred, const DmucsCpuReq &req,
+		 dmucs_gang_t &gang)
+{
+    MutexMonitor m(&mutex_);
+
+    unsigned int n = req.gang_;
+    DmucsBitset match = matchPools(pred);
+    std::vector<std::pair<int, DmucsDpropDb *> > pools;
+    int tier = -1;
+    if (req.same_ == "dprop" || req.same_ == "tier") {
+	DmucsDpropDb *best = NULL;
+	int bestTier = -1;
+	for (int i = match.next(0); i >= 0; i = match.next(i + 1)) {
+	    int t = (req.same_ == "tier") ?
+		pools_[i]->getGangTier(n, req.mem_) :
+		((pools_[i]->getNumFreeCpus(req.mem_) >= (int) n) ?
+		 pools_[i]->getBestFreeTier(req.mem_) : -1);
+	    if (t > bestTier) {
+		best = pools_[i];
+		bestTier = t;
+	    }
+	}
+	if (best == NULL) {
+	    return false;
+	}
+	pools.push_back(std::make_pair(bestTier, best));
+	if (req.same_ == "tier") {
+	    tier = bestTier;
+	}
+    } else {
+	if (getNumFreeCpus(pred, req.mem_) < (int) n) {
+	    return false;
+	}
+	for (int i = match.next(0); i >= 0; i = match.next(i + 1)) {
+	    int t = pools_[i]->getBestFreeTier(req.mem_);
+	    if (t >= 0) {
+		pools.push_back(std::make_pair(t, pools_[i]));
+	    }
+	}
+	std::stable_sort(pools.begin(), pools.end(), betterFreeTier);
+    }
+
+    /* Each DpropDb gives what it can of what is still wanted.  Hosts
+       short of memory can leave the gang short: then the cpus taken go
+       back. */
+    for (unsigned int i = 0; i < pools.size() && gang.size() < n; i++) {
+	DmucsDpropDb *pool = pools[i].second;
+	std::vector<unsigned int> cpus;
+	pool->takeGang(n - gang.size(), tier, req.mem_, cpus);
+	for (unsigned int j = 0; j < cpus.size(); j++) {
+	    gang.push_back(std::make_pair(pool->getDprop(), cpus[j]));
+	}
+    }
+    if (gang.size() < n) {
+	for (unsigned int i = 0; i < gang.size(); i++) {
+	    dbDb_.find(gang[i].first)->second.untakeCpu(gang[i].second,
+							 req.mem_);
+	}
+	gang.clear();
+	return false;
+    }
+    if (req.cost_ > 0) {
+	dbDb_.find(gang[0].first)->second.recordCost(req.cost_);
+    }
+    return true;
+}
+
+
+/*
+ * Could a gang like req's ever be given out, if all the cpus that match
+ * pred were free?  (The cpus of a tier come and go with the load, so
+ * "same=tier" is taken as "same=dprop" here.)
+ */
+bool
+DmucsDb::canFitGang(const DmucsDprop &pred, const DmucsCpuReq &req)
+{
+    MutexMonitor m(&mutex_);
+
+    DmucsBitset match = matchPools(pred);
+    int total = 0;
+    for (int i = match.next(0); i >= 0; i = match.next(i + 1)) {
+	int n = pools_[i]->getNumCpus(req.mem_);
+	if (n >= req.gang_ && (req.same_ == "dprop" || req.same_ == "tier")) {
+	    return true;
+	}
+	total += n;
+    }
+    return req.same_ != "dprop" && req.same_ != "tier" && total >= req.gang_;
+}
+
+
+/* A new DpropDb: add it to the label index. */
+void
+DmucsDb::indexPool(DmucsDpropDb *pool)
+{
+    unsigned int i = pools_.size();
+    pools_.push_back(pool);
+
+    DmucsLabels labels = dprop2labels(pool->getDprop());
+    if (labels.empty()) {
+	labelIndex_[""].set(i);
+    }
+    for (DmucsLabels::iterator itr = labels.begin(); itr != labels.end();
+	 ++itr) {
+	labelIndex_[*itr].set(i);
+    }
+}
+
+
+/* Return the set of DpropDbs whose labels satisfy the predicate. */
+DmucsBitset
+DmucsDb::matchPools(const DmucsDprop &pred)
+{
+    DmucsBitset match;
+    DmucsLabels labels = dprop2labels(pred);
+    if (labels.empty()) {
+	dmucs_label_index_iter_t itr = labelIndex_.find("");
+	if (itr != labelIndex_.end()) {
+	    match = itr->second;
+	}
+	return match;
+    }
+
+    match.fill(pools_.size());
+    for (DmucsLabels::iterator itr = labels.begin(); itr != labels.end();
+	 ++itr) {
+	bool negated = ((*itr)[0] == '!');
+	dmucs_label_index_iter_t itr2 =
+	    labelIndex_.find(negated ? itr->substr(1) : *itr);
+	if (itr2 == labelIndex_.end()) {
+	    if (! negated) {
+		return DmucsBitset();	// no host has the label.
+	    }
+	} else if (negated) {
+	    match.subtract(itr2->second);
+	} else {
+	    match.intersect(itr2->second);
+	}
+    }
+    return match;
+}
+
+
+/*
+ * Return the DpropDb in which the client on sock holds a cpu on hostIp --
+ * or, if hostIp is 0, any cpu -- or NULL if it holds none.
+ */
+DmucsDpropDb *
+DmucsDb::findPool(const Socket *sock, unsigned int hostIp)
+{
+    std::pair<dmucs_sock_dprop_db_iter_t, dmucs_sock_dprop_db_iter_t> range =
+	sock2DpropDb_.equal_range(sock);
+    for (dmucs_sock_dprop_db_iter_t itr = range.first; itr != range.second;
+	 ++itr) {
+	DmucsDpropDb *pool = &dbDb_.find(itr->second)->second;
+	if (pool->holdsLease(sock, hostIp)) {
+	    return pool;
+	}
+    }
+    return NULL;
+}
+
+
+void
+DmucsDb::releaseCpu(const Socket *sock)
+{
+    /* Get the dprops so that we can release the cpus back into the
+       correct sub-dbs in the DmucsDb. */
+    std::pair<dmucs_sock_dprop_db_iter_t, dmucs_sock_dprop_db_iter_t> range =
+	sock2DpropDb_.equal_range(sock);
+    if (range.first == range.second) {
+        DMUCS_DEBUG((stderr, "No sock->dprop mapping found!\n"));
+        return;
+    }
+    for (dmucs_sock_dprop_db_iter_t itr = range.first; itr != range.second;
+	 ++itr) {
+	dbDb_.find(itr->second)->second.releaseCpu(sock);
+    }
+    sock2DpropDb_.erase(range.first, range.second);
+}
+
+
+/*
+ * releaseCpu: a client that holds more than one cpu is giving one of them
+ * back, and keeping its connection.
+ */
+bool
+DmucsDb::releaseCpu(const Socket *sock, unsigned int hostIp)
+{
+    MutexMonitor m(&mutex_);
+
+    DmucsDpropDb *pool = findPool(sock, hostIp);
+    if (pool == NULL) {
+        DMUCS_DEBUG((stderr, "No sock->dprop mapping found!\n"));
+        return false;
+    }
+    return pool->releaseCpu(sock, hostIp);
+}
+
+
+bool
+DmucsDb::renewLease(const Socket *sock, unsigned int hostIp)
+{
+    MutexMonitor m(&mutex_);
+
+    bool renewed = false;
+    std::pair<dmucs_sock_dprop_db_iter_t, dmucs_sock_dprop_db_iter_t> range =
+	sock2DpropDb_.equal_range(sock);
+    for (dmucs_sock_dprop_db_iter_t itr = range.first; itr != range.second;
+	 ++itr) {
+	if (dbDb_.find(itr->second)->second.renewLease(sock, hostIp)) {
+	    renewed = true;
+	}
+    }
+    return renewed;
+}
+
+
+/*
+ * claimLease: a client that got a cpu on hostIp from the server we have
+ * taken over from is claiming it on its new connection to us.
+ */
+bool
+DmucsDb::claimLease(const Socket *sock, unsigned int hostIp)
+{
+    MutexMonitor m(&mutex_);
+
+    for (dmucs_dprop_db_iter_t itr = dbDb_.begin();
+	 itr != dbDb_.end(); ++itr) {
+	if (itr->second.adoptLease(sock, hostIp)) {
+	    mapSockToDprop(sock, itr->first);
+	    return true;
+	}
+    }
+    return false;
+}
+
+
+/*
+ * recordOutcome: a client has told us how its compile went on the cpu it
+ * was given.  hostIp is 0 unless the client holds more than one cpu.
+ */
+void
+DmucsDb::recordOutcome(const Socket *sock, unsigned int hostIp, bool failed)
+{
+    MutexMonitor m(&mutex_);
+
+    DmucsDpropDb *pool = findPool(sock, hostIp);
+    if (pool == NULL) {
+        DMUCS_DEBUG((stderr, "No sock->dprop mapping found!\n"));
+        return;
+    }
+    pool->recordOutcome(sock, hostIp, failed);
+}
+
+
+/*
+ * recordTiming: a client has told us how long its compile took on the cpu
+ * it was given, and how big the source was, or 0 if it does not know.
+ */
+void
+DmucsDb::recordTiming(const Socket *sock, unsigned int hostIp,
+		      int msecs, long bytes)
+{
+    MutexMonitor m(&mutex_);
+
+    DmucsDpropDb *pool = findPool(sock, hostIp);
+    if (pool == NULL) {
+        DMUCS_DEBUG((stderr, "No sock->dprop mapping found!\n"));
+        return;
+    }
+    pool->recordTiming(sock, hostIp, msecs, bytes);
+}
+
+
+/*
+ * handleTimers: move hosts we have not heard from in time to the silent
+ * state, and take back any expired leases.  The sockets of the clients
+ * left holding no lease are appended to "expired" so that the caller can
+ * close them.
+ */
+void
+DmucsDb::handleTimers(time_t now, std::list<const Socket *> &expired)
+{
+    MutexMonitor m(&mutex_);
+
+    std::list<const Socket *> socks;
+    for (dmucs_dprop_db_iter_t itr = dbDb_.begin();
+	 itr != dbDb_.end(); ++itr) {
+	itr->second.handleTimers(now, socks);
+    }
+
+    /* Those clients have no leases left here.  The connections are
+       closed next, so release the clients' cpus in the other DpropDbs,
+       and forget the sockets.  A client may be in the list once for
+       each. */
+    socks.sort();
+    socks.unique();
+    for (std::list<const Socket *>::iterator itr = socks.begin();
+	 itr != socks.end(); ++itr) {
+	releaseCpu(*itr);
+    }
+    expired.splice(expired.end(), socks);
+}
+
+
+/*
+ * A host has left the draining state: queue the replies to the clients
+ * waiting for it, for the event loop to send.  The reply is "drained <n>",
+ * where n is the number of compiles still on the host (more than 0 only
+ * if it was taken out at its deadline, or by a status "down" message), or
+ * "cancelled" if it was put back in service.
+ */
+void
+DmucsDb::drainEnded(DmucsHost *host)
+{
+    MutexMonitor m(&mutex_);
+
+    std::pair<dmucs_drain_waiters_iter_t, dmucs_drain_waiters_iter_t> range =
+	drainWaiters_.equal_range(host);
+    if (range.first == range.second) {
+	return;
+    }
+    std::ostringstream reply;
+    if (host->isUnavailable()) {
+	reply << "drained " << host->getNumLeased();
+    } else {
+	reply << "cancelled";
+    }
+    for (dmucs_drain_waiters_iter_t itr = range.first; itr != range.second;
+	 ++itr) {
+	drainReplies_.push_back(std::make_pair(itr->second, reply.str()));
+    }
+    drainWaiters_.erase(range.first, range.second);
+}
+
+
+/* A connection is being closed: it is not waiting for a drain any more. */
+void
+DmucsDb::removeDrainWaiter(const Socket *sock)
+{
+    MutexMonitor m(&mutex_);
+
+    for (dmucs_drain_waiters_iter_t itr = drainWaiters_.begin();
+	 itr != drainWaiters_.end();) {
+	if (itr->second == sock) {
+	    drainWaiters_.erase(itr++);
+	} else {
+	    ++itr;
+	}
+    }
+    for (dmucs_drain_replies_t::iterator itr = drainReplies_.begin();
+	 itr != drainReplies_.end();) {
+	if (itr->first == sock) {
+	    itr = drainReplies_.erase(itr);
+	} else {
+	    ++itr;
+	}
+    }
+}
+
+
+/* ---------------------------------------------------------------------- */
+/* DmucsDpropDb methods.						  */
+/* ---------------------------------------------------------------------- */
+   
+
+/*
+ * getHost: search for the DmucsHost object in the various sets, and return
+ * it when it is found.  If it is not found, throw a DmucsHostNotFound
+ * exception. 
+ */
+DmucsHost *
+DmucsDpropDb::getHost(const struct in_addr &ipAddr)
+{
+    DmucsHost host(ipAddr, dprop_, 0, 0);
+    dmucs_host_set_iter_t hptr = allHosts_.find(&host);
+    if (hptr == allHosts_.end()) {
+	throw DmucsHostNotFound(/* ipaddr */);
+    }
+    return *hptr;
+}
+
+
+bool
+DmucsDpropDb::haveHost(const struct in_addr &ipAddr)
+{
+    DmucsHost host(ipAddr, dprop_, 0, 0);
+    return (allHosts_.find(&host) != allHosts_.end());
+}
+
+
+/*
+ * return the IP address of a randomly-selected available cpu.  Jobs with
+ * no cost get a cpu from the highest tier.  Jobs with a cost are spread
+ * over the tiers that have free cpus by how they rank against recent
+ * jobs: the most expensive go to the highest tier, and the cheapest to
+ * the lowest, which keeps the fast cpus free for the jobs that would
+ * otherwise be the critical path of the build.
+ */
+unsigned int
+DmucsDpropDb::getBestAvailCpu(const DmucsCpuReq &req)
+{
+    std::vector<dmucs_avail_cpus_riter_t> tiers;	// best first.
+    for (dmucs_avail_cpus_riter_t itr = availCpus_.rbegin();
+	 itr != availCpus_.rend(); ++itr) {
+	if (countFits(itr->second, req.mem_) > 0) {
+	    tiers.push_back(itr);
+	}
+    }
+    if (tiers.empty()) {
+	throw DmucsNoMoreHosts();
+    }
+
+    if (! req.key_.empty()) {
+	unsigned int result = getAffinityCpu(req.key_, req.mem_);
+	if (result != 0) {
+	    return result;
+	}
+    }
+
+    unsigned int which = 0;
+    if (req.cost_ > 0) {
+	which = pickTierForCost(req.cost_, tiers.size());
+    }
+
+    switch (getPolicy()) {
+    case DMUCS_POLICY_RANDOM:
+	return pickCpu<DmucsRandomPolicy>(tiers, which, req.mem_);
+    case DMUCS_POLICY_LEAST_LOADED:
+	return pickCpu<DmucsLeastLoadedPolicy>(tiers, which, req.mem_);
+    case DMUCS_POLICY_PACKED:
+	return pickCpu<DmucsPackedPolicy>(tiers, which, req.mem_);
+    case DMUCS_POLICY_POWER_WEIGHTED:
+	return pickCpu<DmucsPowerWeightedPolicy>(tiers, which, req.mem_);
+    case DMUCS_POLICY_TIERED:
+    default:
+	return pickCpu<DmucsTieredPolicy>(tiers, which, req.mem_);
+    }
+}
+
+
+dmucs_policy_t
+DmucsDpropDb::getPolicy()
+{
+    return str2policy(DmucsDpropsFile::getInstance(dpropsInfoFile)->
+		      getString(dprop_, "policy", "tiered"));
+}
+
+
+dmucs_policy_t
+str2policy(const std::string &str)
+{
+    if (str == "random") {
+	return DMUCS_POLICY_RANDOM;
+    } else if (str == "least-loaded") {
+	return DMUCS_POLICY_LEAST_LOADED;
+    } else if (str == "packed" || str == "pack") {
+	return DMUCS_POLICY_PACKED;
+    } else if (str == "power-weighted") {
+	return DMUCS_POLICY_POWER_WEIGHTED;
+    } else if (str != "tiered" && str != "spread") {
+	fprintf(stderr, "Unknown policy \"%s\": using \"tiered\"\n",
+		str.c_str());
+    }
+    return DMUCS_POLICY_TIERED;
+}
+
+
+/*
+ * Pick a free cpu, on a host with memMb of memory to spare, by the policy:
+ * from the tier given (an index into tiers, which are best first, and
+ * have such a cpu in them), if the policy only looks at one tier, or else
+ * from all of them.
+ */
+template <class Policy>
+unsigned int
+DmucsDpropDb::pickCpu(std::vector<dmucs_avail_cpus_riter_t> &tiers,
+		      unsigned int which, int memMb)
+{
+    cands_.clear();
+    for (unsigned int i = 0; i < tiers.size(); i++) {
+	if (! Policy::byTier || i == which) {
+	    addCandidates(tiers[i]->first, tiers[i]->second, memMb);
+	}
+    }
+    if (cands_.empty()) {
+	throw DmucsNoMoreHosts();
+    }
+
+    double total = 0.0;
+    unsigned int best = 0;
+    for (unsigned int i = 0; i < cands_.size(); i++) {
+	cands_[i].score_ = Policy::score(cands_[i].host_, cands_[i].tier_,
+					 cands_[i].numFree_);
+	if (cands_[i].score_ > 0.0) {
+	    total += cands_[i].score_;
+	}
+	if (cands_[i].score_ > cands_[best].score_) {
+	    best = i;
+	}
+    }
+
+    /* random() is seeded once, when the server starts. */
+    unsigned int n = best;
+    if (Policy::pick == DMUCS_PICK_WEIGHTED) {
+	if (total <= 0.0) {
+	    n = random() % cands_.size();
+	} else {
+	    double r = total * (random() / ((double) RAND_MAX + 1.0));
+	    for (n = 0; n < cands_.size() - 1; n++) {
+		if (cands_[n].score_ > 0.0 && (r -= cands_[n].score_) < 0.0) {
+		    break;
+		}
+	    }
+	}
+    }
+    return takeCpu(*cands_[n].cpus_, cands_[n].cpu_, memMb);
+}
+
+
+/*
+ * Return the best tier that has a free cpu on a host with memMb of memory
+ * to spare, or -1 if none do.
+ */
+int
+DmucsDpropDb::getBestFreeTier(int memMb)
+{
+    for (dmucs_avail_cpus_riter_t itr = availCpus_.rbegin();
+	 itr != availCpus_.rend(); ++itr) {
+	if (countFits(itr->second, memMb) > 0) {
+	    return itr->first;
+	}
+    }
+    return -1;
+}
+
+
+/*
+ * Return the best tier that has n free cpus, with memMb of memory each, or
+ * -1 if none do.
+ */
+int
+DmucsDpropDb::getGangTier(unsigned int n, int memMb)
+{
+    for (dmucs_avail_cpus_riter_t itr = availCpus_.rbegin();
+	 itr != availCpus_.rend(); ++itr) {
+	if (countFits(itr->second, memMb) >= (int) n) {
+	    return itr->first;
+	}
+    }
+    return -1;
+}
+
+
+/*
+ * Add a candidate to cands_ for each host that has a free cpu in the
+ * tier's list, and memMb of memory to spare.  A host's free cpus are next
+ * to each other in the list (see addCpusToTier()), so each run of them is
+ * one candidate.
+ */
+void
+DmucsDpropDb::addCandidates(int tier, dmucs_cpus_t &cpus, int memMb)
+{
+    dmucs_cpus_iter_t itr = cpus.begin();
+    while (itr != cpus.end()) {
+	dmucs_cpus_iter_t first = itr;
+	int numFree = 0;
+	for (; itr != cpus.end() && *itr == *first; ++itr) {
+	    numFree++;
+	}
+	if (! cpuFits(*first, memMb)) {
+	    continue;
+	}
+	struct in_addr in;
+	in.s_addr = *first;
+	DmucsCandidate cand;
+	try {
+	    cand.host_ = getHost(in);
+	} catch (DmucsHostNotFound &e) {
+	    continue;
+	}
+	cand.tier_ = tier;
+	cand.cpus_ = &cpus;
+	cand.cpu_ = first;
+	cand.numFree_ = numFree;
+	cand.score_ = 0.0;
+	cands_.push_back(cand);
+    }
+}
+
+
+bool
+DmucsDpropDb::betterScore(const DmucsCandidate &lhs,
+			  const DmucsCandidate &rhs)
+{
+    return lhs.score_ > rhs.score_;
+}
+
+
+/*
+ * Take up to n free cpus, with memMb of memory each, out of the tier
+ * given, or, if it is -1, out of the best tiers.  If the dprop's policy
+ * packs, the cpus are taken in the order
+ * it picks single cpus in (see dmucs_policy.h): the most powerful hosts,
+ * and of those the fullest, first.
+ */
+void
+DmucsDpropDb::takeGang(unsigned int n, int tier, int memMb,
+		       std::vector<unsigned int> &cpus)
+{
+    if (getPolicy() == DMUCS_POLICY_PACKED) {
+	cands_.clear();
+	for (dmucs_avail_cpus_iter_t itr = availCpus_.begin();
+	     itr != availCpus_.end(); ++itr) {
+	    if (tier < 0 || itr->first == tier) {
+		addCandidates(itr->first, itr->second, memMb);
+	    }
+	}
+	for (unsigned int i = 0; i < cands_.size(); i++) {
+	    cands_[i].score_ = DmucsPackedPolicy::score(cands_[i].host_,
+							cands_[i].tier_,
+							cands_[i].numFree_);
+	}
+	std::stable_sort(cands_.begin(), cands_.end(), betterScore);
+	for (unsigned int i = 0; i < cands_.size() && cpus.size() < n; i++) {
+	    DmucsCandidate &cand = cands_[i];
+	    for (int k = 0; k < cand.numFree_ && cpus.size() < n &&
+		     cpuFits(*cand.cpu_, memMb); k++) {
+		dmucs_cpus_iter_t next = cand.cpu_;
+		++next;
+		cpus.push_back(takeCpu(*cand.cpus_, cand.cpu_, memMb));
+		cand.cpu_ = next;
+	    }
+	}
+	return;
+    }
+
+    for (dmucs_avail_cpus_riter_t itr = availCpus_.rbegin();
+	 itr != availCpus_.rend() && cpus.size() < n; ++itr) {
+	if (tier >= 0 && itr->first != tier) {
+	    continue;
+	}
+	for (dmucs_cpus_iter_t itr2 = itr->second.begin();
+	     itr2 != itr->second.end() && cpus.size() < n;) {
+	    if (cpuFits(*itr2, memMb)) {
+		cpus.push_back(takeCpu(itr->second, itr2++, memMb));
+	    } else {
+		++itr2;
+	    }
+	}
+    }
+}
+
+
+/*
+ * Take this free cpu out of its tier, and memMb of its host's memory.
+ * Return its IP address.
+ */
+unsigned int
+DmucsDpropDb::takeCpu(dmucs_cpus_t &cpus, dmucs_cpus_iter_t itr, int memMb)
+{
+    unsigned int ipAddr = *itr;
+    cpus.erase(itr);
+    if (memMb > 0) {
+	struct in_addr in;
+	in.s_addr = ipAddr;
+	try {
+	    getHost(in)->takeMem(memMb);
+	} catch (DmucsHostNotFound &e) {
+	}
+    }
+    return ipAddr;
+}
+
+
+/*
+ * Put back a cpu taken with takeCpu() that is not to be given out after
+ * all, and its host's memMb of memory.
+ */
+void
+DmucsDpropDb::untakeCpu(unsigned int ipAddr, int memMb)
+{
+    struct in_addr in;
+    in.s_addr = ipAddr;
+    try {
+	DmucsHost *host = getHost(in);
+	host->returnMem(memMb);
+	addCpusToTier(host->getTier(), ipAddr, 1);
+    } catch (DmucsHostNotFound &e) {
+    }
+}
+
+
+/* Does the host of this free cpu have memMb of memory to spare? */
+bool
+DmucsDpropDb::cpuFits(unsigned int ipAddr, int memMb)
+{
+    if (memMb <= 0) {
+	return true;
+    }
+    struct in_addr in;
+    in.s_addr = ipAddr;
+    try {
+	return getHost(in)->hasMemFor(memMb);
+    } catch (DmucsHostNotFound &e) {
+	return false;
+    }
+}
+
+
+/*
+ * Return how many of these free cpus could be given out at once to jobs
+ * that need memMb of memory each: a host's memory may run out before its
+ * cpus do.
+ */
+int
+DmucsDpropDb::countFits(const dmucs_cpus_t &cpus, int memMb)
+{
+    if (memMb <= 0) {
+	return (int) cpus.size();
+    }
+    std::map<unsigned int, int> counted;	// MB, by host.
+    int n = 0;
+    for (dmucs_cpus_t::const_iterator itr = cpus.begin(); itr != cpus.end();
+	 ++itr) {
+	int &mem = counted[*itr];
+	if (cpuFits(*itr, mem + memMb)) {
+	    mem += memMb;
+	    n++;
+	}
+    }
+    return n;
+}
+
+
+/*
+ * Return a free cpu from one of the hosts that own this key on the hash
+ * ring, or 0 if they are all busy.  Only the first "affinity-hosts" hosts
+ * clockwise from the key are tried: past that, a cpu is no more likely to
+ * have a warm cache than any other, and the normal placement is better.
+ */
+unsigned int
+DmucsDpropDb::getAffinityCpu(const std::string &key, int memMb)
+{
+    if (ring_.empty()) {
+	return 0;
+    }
+    int numToTry = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "affinity-hosts", 2);
+
+    std::set<DmucsHost *> tried;
+    dmucs_hash_ring_iter_t itr = ring_.lower_bound(dmucsHash(key));
+    for (unsigned int i = 0;
+	 i < ring_.size() && (int) tried.size() < numToTry; i++, ++itr) {
+	if (itr == ring_.end()) {
+	    itr = ring_.begin();	// wrap around the ring.
+	}
+	DmucsHost *host = itr->second;
+	if (! tried.insert(host).second) {
+	    continue;
+	}
+	if (takeCpuFromHost(host, memMb)) {
+	    DMUCS_DEBUG((stderr, "key %s: affinity host %s\n", key.c_str(),
+			 host->getName().c_str()));
+	    return host->getIpAddrInt();
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * Take one free cpu of this host out of its tier, and memMb of its memory.
+ * Return false if it has no cpu, or not the memory, free.
+ */
+bool
+DmucsDpropDb::takeCpuFromHost(DmucsHost *host, int memMb)
+{
+    if (! host->isAvailable() || ! host->hasMemFor(memMb)) {
+	return false;
+    }
+    dmucs_avail_cpus_iter_t itr = availCpus_.find(host->getTier());
+    if (itr == availCpus_.end()) {
+	return false;
+    }
+    dmucs_cpus_iter_t itr2 = std::find(itr->second.begin(),
+				       itr->second.end(),
+				       host->getIpAddrInt());
+    if (itr2 == itr->second.end()) {
+	return false;
+    }
+    takeCpu(itr->second, itr2, memMb);
+    return true;
+}
+
+
+/*
+ * May another of this dprop's cpus be given out as a hedge?  Only if it
+ * has a straggler time, and fewer than its hedge-max percent of its cpus
+ * are hedges already.
+ */
+bool
+DmucsDpropDb::canHedge()
+{
+    if (hedgeMsecs_ <= 0) {
+	return false;
+    }
+    int pct = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "hedge-max", 10);
+    return numHedged_ < getNumCpus() * pct / 100;
+}
+
+
+/*
+ * Return the best tier with a free cpu, with memMb of memory to spare,
+ * that is not on the host avoidIp, or -1 if there is none.
+ */
+int
+DmucsDpropDb::getHedgeTier(unsigned int avoidIp, int memMb)
+{
+    for (dmucs_avail_cpus_riter_t itr = availCpus_.rbegin();
+	 itr != availCpus_.rend(); ++itr) {
+	for (dmucs_cpus_iter_t itr2 = itr->second.begin();
+	     itr2 != itr->second.end(); ++itr2) {
+	    if (*itr2 != avoidIp && cpuFits(*itr2, memMb)) {
+		return itr->first;
+	    }
+	}
+    }
+    return -1;
+}
+
+
+/* Take the cpu getHedgeTier() found in the tier. */
+unsigned int
+DmucsDpropDb::takeHedgeCpu(int tier, unsigned int avoidIp, int memMb)
+{
+    dmucs_avail_cpus_iter_t itr = availCpus_.find(tier);
+    if (itr == availCpus_.end()) {
+	return 0;
+    }
+    for (dmucs_cpus_iter_t itr2 = itr->second.begin();
+	 itr2 != itr->second.end(); ++itr2) {
+	if (*itr2 != avoidIp && cpuFits(*itr2, memMb)) {
+	    return takeCpu(itr->second, itr2, memMb);
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * Return which of numTiers tiers (0 being the best) a job of the given
+ * cost should go to: the fraction of recent jobs that cost more than this
+ * one picks it.
+ */
+unsigned int
+DmucsDpropDb::pickTierForCost(long cost, unsigned int numTiers)
+{
+    unsigned int numHeavier = 0;
+    for (std::deque<long>::const_iterator itr = recentCosts_.begin();
+	 itr != recentCosts_.end(); ++itr) {
+	if (*itr > cost) {
+	    numHeavier++;
+	}
+    }
+    unsigned int which = recentCosts_.empty() ? 0 :
+	numHeavier * numTiers / recentCosts_.size();
+    if (which >= numTiers) {
+	which = numTiers - 1;
+    }
+
+    recordCost(cost);
+    return which;
+}
+
+
+/* Add a job's cost to the recent ones, which are kept for cost-window
+   jobs. */
+void
+DmucsDpropDb::recordCost(long cost)
+{
+    unsigned int window = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "cost-window", 100);
+    recentCosts_.push_back(cost);
+    while (recentCosts_.size() > window) {
+	recentCosts_.pop_front();
+    }
+}
+
+
+void
+DmucsDpropDb::assignCpuToClient(const unsigned int hostIp,
+                                const Socket *sock, int memMb,
+				bool hedge)
+{
+    struct in_addr t2;
+    t2.s_addr = hostIp;
+
+    DMUCS_DEBUG((stderr, "assignCpu hostip %s\n", inet_ntoa(t2)));
+
+    /* If the dprop has a lease-time, take the cpu back after that many
+       seconds even if the client never closes its connection. */
+    int leaseTime = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "lease-time", 0);
+    time_t expires = (leaseTime > 0) ? time(NULL) + leaseTime : 0;
+
+    DmucsLease lease(nextLeaseId_++, hostIp, expires, memMb, hedge);
+    assignedCpus_.insert(std::make_pair(sock, lease));
+    if (hedge) {
+	numHedged_++;
+    }
+    DmucsReplicator::getInstance()->leaseChanged(dprop_, lease);
+    DmucsFairShare::getInstance()->leaseGranted(sock);
+    try {
+	getHost(t2)->leaseCpu();
+    } catch (DmucsHostNotFound &e) {
+    }
+    if (expires != 0) {
+	leaseTimers_.insert(std::make_pair(expires, sock));
+    }
+    numAssignedCpus_++;
+
+    int t;
+    if ((t = (int)assignedCpus_.size()) > numConcurrentAssigned_) {
+	numConcurrentAssigned_ = t;
+    }
+}
+
+
+/*
+ * Release all the cpus assigned to the client on this socket.
+ */
+void
+DmucsDpropDb::releaseCpu(const Socket *sock)
+{
+    DMUCS_DEBUG((stderr, "releaseCpu for socket %p\n", sock));
+
+    dmucs_assigned_cpus_iter_t itr = assignedCpus_.find(sock);
+    if (itr == assignedCpus_.end()) {
+	DMUCS_DEBUG((stderr, "No cpu found in assignedCpus for sock %p\n",
+		     sock));
+	return;
+    }
+    while (itr != assignedCpus_.end() && itr->first == sock) {
+	releaseLease(itr++);
+    }
+}
+
+
+/*
+ * Release one cpu of the host hostIp from the client on this socket,
+ * which holds others.  Return false if it did not hold one.
+ */
+bool
+DmucsDpropDb::releaseCpu(const Socket *sock, unsigned int hostIp)
+{
+    std::pair<dmucs_assigned_cpus_iter_t, dmucs_assigned_cpus_iter_t> range =
+	assignedCpus_.equal_range(sock);
+    for (dmucs_assigned_cpus_iter_t itr = range.first;
+	 itr != range.second; ++itr) {
+	if (itr->second.hostIp_ == hostIp) {
+	    releaseLease(itr);
+	    return true;
+	}
+    }
+    return false;
+}
+
+
+void
+DmucsDpropDb::releaseLease(dmucs_assigned_cpus_iter_t itr)
+{
+    unsigned int hostIp = itr->second.hostIp_;
+    int memMb = itr->second.memMb_;
+    if (itr->second.hedge_) {
+	numHedged_--;
+    }
+    DmucsReplicator::getInstance()->leaseReleased(dprop_, itr->second);
+    DmucsFairShare::getInstance()->leaseReleased(itr->first);
+    removeLeaseTimer(itr);
+    assignedCpus_.erase(itr);
+
+    struct in_addr in;
+    in.s_addr = hostIp;
+
+
+    try {
+	DmucsHost *host = getHost(in);
+	/* Put this message out on the console, so the administrator can see
+	   when a host is released back to the db. */
+	fprintf(stderr, "Got %s back\n", host->getName().c_str());
+	host->returnCpu();
+	host->returnMem(memMb);
+	if (host->isDraining() && host->getNumLeased() == 0) {
+	    host->drained();
+	}
+	
+	/* The host may be marked unavailable while one of the cpus
+	   was assigned.  In this case, don't add the cpu back.  Don't add
+	   it back while the host's breaker is open either, or if the host
+	   has had its slots cut to fewer than it has given out. */
+	if (host->isAvailable() && host->getNumAssignable() > 0) {
+	    int tier = host->getTier();
+	    addCpusToTier(tier, hostIp, 1);
+	}
+    } catch (DmucsHostNotFound &e) {
+	/* The host may have been removed from the db while a cpu
+	   was assigned.  In this case, just don't add the cpu back
+	   to the availCpus_ db table. */
+    }
+    
+}
+
+
+void
+DmucsDpropDb::removeLeaseTimer(dmucs_assigned_cpus_iter_t itr)
+{
+    if (itr->second.expires_ == 0) {
+	return;
+    }
+    std::pair<dmucs_lease_timers_iter_t, dmucs_lease_timers_iter_t> range =
+	leaseTimers_.equal_range(itr->second.expires_);
+    for (dmucs_lease_timers_iter_t itr2 = range.first;
+	 itr2 != range.second; ++itr2) {
+	if (itr2->second == itr->first) {
+	    leaseTimers_.erase(itr2);
+	    break;
+	}
+    }
+}
+
+
+/*
+ * Start the lease-time of the client's cpu on hostIp (or of all its cpus,
+ * if hostIp is 0) again.  Return false if it holds no such cpu.
+ */
+bool
+DmucsDpropDb::renewLease(const Socket *sock, unsigned int hostIp)
+{
+    int leaseTime = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "lease-time", 0);
+    bool found = false;
+    std::pair<dmucs_assigned_cpus_iter_t, dmucs_assigned_cpus_iter_t> range =
+	assignedCpus_.equal_range(sock);
+    for (dmucs_assigned_cpus_iter_t itr = range.first;
+	 itr != range.second; ++itr) {
+	if (hostIp != 0 && itr->second.hostIp_ != hostIp) {
+	    continue;
+	}
+	found = true;
+	removeLeaseTimer(itr);
+	itr->second.expires_ = (leaseTime > 0) ? time(NULL) + leaseTime : 0;
+	if (itr->second.expires_ != 0) {
+	    leaseTimers_.insert(std::make_pair(itr->second.expires_, sock));
+	}
+	DmucsReplicator::getInstance()->leaseChanged(dprop_, itr->second);
+	if (hostIp != 0) {
+	    break;
+	}
+    }
+    return found;
+}
+
+
+/*
+ * A client is claiming a cpu on hostIp that it got from the server we have
+ * taken over from: give it one of the orphaned leases on hostIp, and start
+ * its lease-time again.
+ */
+bool
+DmucsDpropDb::adoptLease(const Socket *sock, unsigned int hostIp)
+{
+    dmucs_assigned_cpus_iter_t itr = findLease(NULL, hostIp);
+    if (itr == assignedCpus_.end()) {
+	return false;
+    }
+    DmucsLease lease = itr->second;
+    removeLeaseTimer(itr);
+    assignedCpus_.erase(itr);
+
+    int leaseTime = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "lease-time", 0);
+    lease.expires_ = (leaseTime > 0) ? time(NULL) + leaseTime : 0;
+    assignedCpus_.insert(std::make_pair(sock, lease));
+    DmucsFairShare::getInstance()->leaseGranted(sock);
+    if (lease.expires_ != 0) {
+	leaseTimers_.insert(std::make_pair(lease.expires_, sock));
+    }
+    DmucsReplicator::getInstance()->leaseChanged(dprop_, lease);
+
+    struct in_addr in;
+    in.s_addr = hostIp;
+    fprintf(stderr, "Client claimed its lease on %s\n", inet_ntoa(in));
+    return true;
+}
+
+
+/*
+ * The primary server has given out (or renewed) a lease: hold the cpu
+ * here too, as an orphan.
+ */
+void
+DmucsDpropDb::addOrphanLease(unsigned long id, unsigned int hostIp,
+			     time_t expires, int memMb)
 {
-    MutexMonitor m(&mutex_);
+    if (id >= nextLeaseId_) {
+	nextLeaseId_ = id + 1;		// in case we take over.
+    }
 
-    /* add sock -> dprop mapping */
-    sock2DpropDb_.insert(std::make_pair(sock, dprop));
-    return dbDb_.find(dprop)->second.assignCpuToClient(clientIp, sock);
+    std::pair<dmucs_assigned_cpus_iter_t, dmucs_assigned_cpus_iter_t> range =
+	assignedCpus_.equal_range(NULL);
+    for (dmucs_assigned_cpus_iter_t itr = range.first;
+	 itr != range.second; ++itr) {
+	if (itr->second.id_ == id) {
+	    /* A renewal. */
+	    removeLeaseTimer(itr);
+	    itr->second.expires_ = expires;
+	    if (expires != 0) {
+		leaseTimers_.insert(std::make_pair(expires,
+						   (const Socket *) NULL));
+	    }
+	    DmucsReplicator::getInstance()->leaseChanged(dprop_, itr->second);
+	    return;
+	}
+    }
+
+    struct in_addr in;
+    in.s_addr = hostIp;
+    DmucsHost *host;
+    try {
+	host = getHost(in);
+    } catch (DmucsHostNotFound &e) {
+	return;
+    }
+    DmucsLease lease(id, hostIp, expires, memMb);
+    assignedCpus_.insert(std::make_pair((const Socket *) NULL, lease));
+    takeCpuFromHost(host, 0);
+    host->takeMem(memMb);
+    host->leaseCpu();
+    if (expires != 0) {
+	leaseTimers_.insert(std::make_pair(expires, (const Socket *) NULL));
+    }
+    DmucsReplicator::getInstance()->leaseChanged(dprop_, lease);
 }
 
 
 void
-DmucsDb::releaseCpu(const Socket *sock)
+DmucsDpropDb::releaseOrphanLease(unsigned long id)
 {
-    /* Get the dprop so that we can release the cpu back into the
-       correct sub-db in the DmucsDb. */
-    dmucs_sock_dprop_db_iter_t itr = sock2DpropDb_.find(sock);
-    if (itr == sock2DpropDb_.end()) {
-        DMUCS_DEBUG((stderr, "No sock->dprop mapping found!\n"));
-        return;
+    std::pair<dmucs_assigned_cpus_iter_t, dmucs_assigned_cpus_iter_t> range =
+	assignedCpus_.equal_range(NULL);
+    for (dmucs_assigned_cpus_iter_t itr = range.first;
+	 itr != range.second; ++itr) {
+	if (itr->second.id_ == id) {
+	    releaseLease(itr);
+	    return;
+	}
     }
-    DmucsDprop dprop = itr->second;
-    sock2DpropDb_.erase(itr);
-    dbDb_.find(dprop)->second.releaseCpu(sock);
 }
 
 
-/* ---------------------------------------------------------------------- */
-/* DmucsDpropDb methods.						  */
-/* ---------------------------------------------------------------------- */
-   
-
 /*
- * getHost: search for the DmucsHost object in the various sets, and return
- * it when it is found.  If it is not found, throw a DmucsHostNotFound
- * exception. 
+ * We are taking over from the primary server, and all the leases it gave
+ * out are orphans: give their clients "orphan-time" seconds to claim them
+ * on a connection to us before we take the cpus back.
  */
-DmucsHost *
-DmucsDpropDb::getHost(const struct in_addr &ipAddr)
+void
+DmucsDpropDb::takeOver(time_t now)
 {
-    DmucsHost host(ipAddr, dprop_, 0, 0);
-    dmucs_host_set_iter_t hptr = allHosts_.find(&host);
-    if (hptr == allHosts_.end()) {
-	throw DmucsHostNotFound(/* ipaddr */);
+    int orphanTime = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "orphan-time", 60);
+    time_t deadline = now + orphanTime;
+
+    std::pair<dmucs_assigned_cpus_iter_t, dmucs_assigned_cpus_iter_t> range =
+	assignedCpus_.equal_range(NULL);
+    for (dmucs_assigned_cpus_iter_t itr = range.first;
+	 itr != range.second; ++itr) {
+	if (itr->second.expires_ != 0 && itr->second.expires_ <= deadline) {
+	    continue;
+	}
+	removeLeaseTimer(itr);
+	itr->second.expires_ = deadline;
+	leaseTimers_.insert(std::make_pair(deadline, (const Socket *) NULL));
     }
-    return *hptr;
 }
 
 
-bool
-DmucsDpropDb::haveHost(const struct in_addr &ipAddr)
+/* Tell the replicator about all our hosts and leases, for a new standby. */
+void
+DmucsDpropDb::replicate()
 {
-    DmucsHost host(ipAddr, dprop_, 0, 0);
-    return (allHosts_.find(&host) != allHosts_.end());
+    DmucsReplicator *repl = DmucsReplicator::getInstance();
+    for (dmucs_host_set_iter_t itr = allHosts_.begin();
+	 itr != allHosts_.end(); ++itr) {
+	repl->hostChanged(*itr);
+    }
+    for (dmucs_assigned_cpus_iter_t itr = assignedCpus_.begin();
+	 itr != assignedCpus_.end(); ++itr) {
+	repl->leaseChanged(dprop_, itr->second);
+    }
 }
 
 
 /*
- * return the IP address of a randomly-selected, highest-tier available cpu
+ * Find the lease of the client on this socket for a cpu on hostIp, or its
+ * first lease if hostIp is 0.
  */
-unsigned int
-DmucsDpropDb::getBestAvailCpu()
+DmucsDpropDb::dmucs_assigned_cpus_iter_t
+DmucsDpropDb::findLease(const Socket *sock, unsigned int hostIp)
 {
-    unsigned int result = 0UL;
-    for (dmucs_avail_cpus_riter_t itr = availCpus_.rbegin();
-	 itr != availCpus_.rend(); ++itr) {
-	if (itr->second.empty()) {
-	    continue;
+    std::pair<dmucs_assigned_cpus_iter_t, dmucs_assigned_cpus_iter_t> range =
+	assignedCpus_.equal_range(sock);
+    for (dmucs_assigned_cpus_iter_t itr = range.first;
+	 itr != range.second; ++itr) {
+	if (hostIp == 0 || itr->second.hostIp_ == hostIp) {
+	    return itr;
 	}
-	srandom((unsigned int) time(NULL));
-	unsigned long n = random() % itr->second.size();
-	dmucs_cpus_iter_t itr2 = itr->second.begin();
-	for (int i = 0; i < n; ++itr2, i++) ;
-	result = *itr2;	// get the IP address of the nth element in the list
-	/* Remove the nth element from the list. */
-	itr->second.erase(itr2);
-	return result;
     }
-    throw DmucsNoMoreHosts();
+    return assignedCpus_.end();
 }
 
 
 void
-DmucsDpropDb::assignCpuToClient(const unsigned int hostIp,
-                                const Socket *sock)
+DmucsDpropDb::recordOutcome(const Socket *sock, unsigned int hostIp,
+			    bool failed)
 {
-    struct in_addr t2;
-    t2.s_addr = hostIp;
-
-    DMUCS_DEBUG((stderr, "assignCpu hostip %s\n", inet_ntoa(t2)));
-
-    assignedCpus_.insert(std::make_pair(sock, hostIp));
-    numAssignedCpus_++;
-
-    int t;
-    if ((t = (int)assignedCpus_.size()) > numConcurrentAssigned_) {
-	numConcurrentAssigned_ = t;
+    dmucs_assigned_cpus_iter_t itr = findLease(sock, hostIp);
+    if (itr == assignedCpus_.end()) {
+	DMUCS_DEBUG((stderr, "No cpu found in assignedCpus for sock %p\n",
+		     sock));
+	return;
+    }
+    struct in_addr in;
+    in.s_addr = itr->second.hostIp_;
+    try {
+	getHost(in)->recordOutcome(failed);
+    } catch (DmucsHostNotFound &e) {
     }
 }
 
 
 void
-DmucsDpropDb::releaseCpu(const Socket *sock)
+DmucsDpropDb::recordTiming(const Socket *sock, unsigned int hostIp,
+			   int msecs, long bytes)
 {
-    DMUCS_DEBUG((stderr, "releaseCpu for socket %p\n", sock));
-
-    dmucs_assigned_cpus_iter_t itr = assignedCpus_.find(sock);
+    dmucs_assigned_cpus_iter_t itr = findLease(sock, hostIp);
     if (itr == assignedCpus_.end()) {
-	DMUCS_DEBUG((stderr, "No cpu found in assignedCpus for sock %p\n",
-		     sock));
 	return;
     }
-    unsigned int hostIp = itr->second;
-    assignedCpus_.erase(itr);
 
+    /* Every compile counts for the latencies, with or without its size:
+       the slow ones are the ones to learn about.  The client only reports
+       a hedge that won, and then its whole compile ran on the hedge. */
+    recordLatency(msecs);
+    if (bytes <= 0 || allHosts_.empty()) {
+	return;
+    }
     struct in_addr in;
-    in.s_addr = hostIp;
+    in.s_addr = itr->second.hostIp_;
 
+    /* Normalize by the size of the source, so that big and small compiles
+       can be compared. */
+    float msecsPerKb = (float) msecs * 1024.0 / (float) bytes;
+    float alpha = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getFloat(dprop_, "speed-alpha", 0.2);
+    refSpeed_ = (refSpeed_ == 0.0) ? msecsPerKb :
+	alpha * msecsPerKb + (1.0 - alpha) * refSpeed_;
 
     try {
-	DmucsHost *host = getHost(in);
-	/* Put this message out on the console, so the administrator can see
-	   when a host is released back to the db. */
-	fprintf(stderr, "Got %s back\n", host->getName().c_str());
-	
-	/* The host may be marked unavailable while one of the cpus
-	   was assigned.  In this case, don't add the cpu back. */
-	if (host->getStateAsInt() == STATUS_AVAILABLE) {
-	    int tier = host->getTier();
-	    addCpusToTier(tier, hostIp, 1);
-	}
+	getHost(in)->recordTiming(msecsPerKb, refSpeed_,
+				  (float) pindexSum_ / allHosts_.size());
     } catch (DmucsHostNotFound &e) {
-	/* The host may have been removed from the db while a cpu
-	   was assigned.  In this case, just don't add the cpu back
-	   to the availCpus_ db table. */
     }
-    
+}
+
+
+/*
+ * Add a compile's wall time to the latest ones, and work out again the
+ * time after which a compile is a straggler: the dprop's hedge-percentile
+ * of them.  It is 0, so that there is no hedging, until there are
+ * DMUCS_HEDGE_MIN_SAMPLES of them.
+ */
+void
+DmucsDpropDb::recordLatency(int msecs)
+{
+    DmucsDpropsFile *dprops = DmucsDpropsFile::getInstance(dpropsInfoFile);
+    int pct = dprops->getInt(dprop_, "hedge-percentile", 0);
+    if (pct <= 0 || pct > 100) {
+	recentMsecs_.clear();
+	hedgeMsecs_ = 0;
+	return;
+    }
+
+    unsigned int window = dprops->getInt(dprop_, "hedge-window", 100);
+    recentMsecs_.push_back(msecs);
+    while (recentMsecs_.size() > window) {
+	recentMsecs_.pop_front();
+    }
+    if (recentMsecs_.size() < DMUCS_HEDGE_MIN_SAMPLES) {
+	hedgeMsecs_ = 0;
+	return;
+    }
+    std::vector<int> sorted(recentMsecs_.begin(), recentMsecs_.end());
+    std::vector<int>::iterator nth =
+	sorted.begin() + (sorted.size() - 1) * pct / 100;
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    hedgeMsecs_ = *nth;
 }
 
 
@@ -210,6 +1515,11 @@ DmucsDpropDb::serialize()
      * with newlines in it.  The lines will look like this:
      * D: <distingishingProp>       (the string that distinguishes these hosts)
      * H: <ip-addr> <int> <state>
+     * B: <ip-addr> open|half-open  (only for hosts whose breaker isn't
+     *				     closed)
+     * R: <ip-addr> <#leases> <secs>  (only for draining hosts: the
+     *				     compiles still on it, and the seconds
+     *				     to its deadline, 0 if it has none)
      * C <tier>: <ipaddr>/<#cpus>
      *
      * o The state is represented by an integer representing the
@@ -228,6 +1538,29 @@ DmucsDpropDb::serialize()
 	       << "\n";
     }
 
+    for (dmucs_host_set_iter_t itr = allHosts_.begin();
+	 itr != allHosts_.end(); ++itr) {
+	if ((*itr)->getBreaker() == BREAKER_CLOSED) {
+	    continue;
+	}
+	struct in_addr in;
+	in.s_addr = (*itr)->getIpAddrInt();
+	result << "B: " << inet_ntoa(in) << " "
+	       << ((*itr)->getBreaker() == BREAKER_OPEN ? "open" : "half-open")
+	       << "\n";
+    }
+
+    time_t now = time(NULL);
+    for (dmucs_host_set_iter_t itr = drainingHosts_.begin();
+	 itr != drainingHosts_.end(); ++itr) {
+	struct in_addr in;
+	in.s_addr = (*itr)->getIpAddrInt();
+	time_t deadline = (*itr)->getDrainDeadline();
+	result << "R: " << inet_ntoa(in) << " " << (*itr)->getNumLeased()
+	       << " " << ((deadline > now) ? (long) (deadline - now) : 0L)
+	       << "\n";
+    }
+
     for (dmucs_avail_cpus_riter_t itr = availCpus_.rbegin();
 	 itr != availCpus_.rend(); ++itr) {
 	if (itr->second.empty()) {
@@ -277,8 +1610,17 @@ DmucsDpropDb::addNewHost(DmucsHost *host)
      * Add the host to the allHosts_ set and then also to the availHosts_
      * sub-set.
      */
+    host->initSlots();
     addToHostSet(&allHosts_, host);
+    pindexSum_ += host->getHandPowerIndex();
+    for (int i = 0; i < DMUCS_RING_VNODES; i++) {
+	std::ostringstream point;
+	point << host->getIpAddrInt() << '#' << i;
+	ring_[dmucsHash(point.str())] = host;
+    }
     addToAvailDb(host);
+    resetSilentTimer(host);
+    DmucsReplicator::getInstance()->hostChanged(host);
 }
 
 
@@ -309,7 +1651,10 @@ void
 DmucsDpropDb::addToAvailDb(DmucsHost *host)
 {
     addToHostSet(&availHosts_, host);
-    addCpusToTier(host->getTier(), host->getIpAddrInt(), host->getNumCpus());
+    /* Cpus that are still assigned to clients are added back when they
+       are released. */
+    addCpusToTier(host->getTier(), host->getIpAddrInt(),
+		  host->getNumAssignable());
 }
 
 
@@ -369,8 +1714,74 @@ DmucsDpropDb::delFromUnavailDb(DmucsHost *host)
 }
 
 
+void
+DmucsDpropDb::addToUnreachableDb(DmucsHost *host)
+{
+    addToHostSet(&unreachableHosts_, host);
+}
+
+
+void
+DmucsDpropDb::delFromUnreachableDb(DmucsHost *host)
+{
+    delFromHostSet(&unreachableHosts_, host);
+}
+
+
+void
+DmucsDpropDb::addToDrainingDb(DmucsHost *host)
+{
+    addToHostSet(&drainingHosts_, host);
+}
+
+
+void
+DmucsDpropDb::delFromDrainingDb(DmucsHost *host)
+{
+    delFromHostSet(&drainingHosts_, host);
+}
+
+
+/*
+ * Read the dprop's probe-port.  Only the main thread does this: the
+ * prober thread gets the port from getProbeTargets().
+ */
+void
+DmucsDpropDb::setProbePort()
+{
+    probePort_ = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "probe-port", DISTCCD_PORT_NUM);
+}
+
+
+/*
+ * Fill in a probe for each host whose distccd we want to check: the hosts
+ * that are handing out cpus (or could be, but for their load), and the
+ * unreachable hosts, which need good probes to get back in.  This runs in
+ * the prober thread.
+ */
+void
+DmucsDpropDb::getProbeTargets(std::vector<DmucsProbe> &probes)
+{
+    int port = probePort_;
+
+    const dmucs_host_set_t *sets[] = { &availHosts_, &overloadedHosts_,
+				       &unreachableHosts_ };
+    for (unsigned int i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+	for (dmucs_host_set_t::const_iterator itr = sets[i]->begin();
+	     itr != sets[i]->end(); ++itr) {
+	    probes.push_back(DmucsProbe(*itr, (*itr)->getIpAddrInt(), port));
+	}
+    }
+}
+
+
 
-/* Add "numCpus" copies of the ipaddress to the list in the given tier. */
+/*
+ * Add "numCpus" copies of the ipaddress to the list in the given tier,
+ * next to the copies that are there already: pickCpu() counts a host's
+ * free cpus as a run.
+ */
 void
 DmucsDpropDb::addCpusToTier(int tierNum, const unsigned int ipAddr,
 			    const int numCpus)
@@ -389,7 +1800,8 @@ DmucsDpropDb::addCpusToTier(int tierNum, const unsigned int ipAddr,
 	itr = status.first;
     }
 
-    itr->second.insert(itr->second.end(), numCpus, ipAddr);
+    itr->second.insert(std::find(itr->second.begin(), itr->second.end(),
+				 ipAddr), numCpus, ipAddr);
 }
 
 void
@@ -424,15 +1836,166 @@ DmucsDpropDb::delCpusFromTier(int tier, unsigned int ipAddr)
 }
 
 
+/*
+ * (Re)start the clock on a host: if we don't hear from it again within the
+ * dprop's silent-time, it will be moved to the silent state.
+ */
+void
+DmucsDpropDb::resetSilentTimer(DmucsHost *host)
+{
+    cancelSilentTimer(host);
+
+    int silentTime = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "silent-time", DMUCS_HOST_SILENT_TIME);
+    time_t deadline = host->getLastUpdate() + silentTime;
+    host->setSilentDeadline(deadline);
+    silentTimers_.insert(std::make_pair(deadline, host));
+}
+
+
 void
-DmucsDpropDb::handleSilentHosts()
+DmucsDpropDb::cancelSilentTimer(DmucsHost *host)
 {
-    for (dmucs_host_set_iter_t itr = allHosts_.begin();
-	 itr != allHosts_.end(); ++itr) {
-	if ((*itr)->seemsDown()) {
-	    (*itr)->silent();
+    eraseTimer(&silentTimers_, host->getSilentDeadline(), host);
+    host->setSilentDeadline(0);
+}
+
+
+/* Start the cool-down of a host whose breaker has just opened. */
+void
+DmucsDpropDb::startBreakerTimer(DmucsHost *host, time_t deadline)
+{
+    eraseTimer(&breakerTimers_, host->getBreakerDeadline(), host);
+    host->setBreakerDeadline(deadline);
+    breakerTimers_.insert(std::make_pair(deadline, host));
+}
+
+
+void
+DmucsDpropDb::cancelBreakerTimer(DmucsHost *host)
+{
+    eraseTimer(&breakerTimers_, host->getBreakerDeadline(), host);
+    host->setBreakerDeadline(0);
+}
+
+
+void
+DmucsDpropDb::startDrainTimer(DmucsHost *host, time_t deadline)
+{
+    eraseTimer(&drainTimers_, host->getDrainDeadline(), host);
+    host->setDrainDeadline(deadline);
+    drainTimers_.insert(std::make_pair(deadline, host));
+}
+
+
+void
+DmucsDpropDb::cancelDrainTimer(DmucsHost *host)
+{
+    eraseTimer(&drainTimers_, host->getDrainDeadline(), host);
+    host->setDrainDeadline(0);
+}
+
+
+void
+DmucsDpropDb::eraseTimer(dmucs_host_timers_t *timers, time_t deadline,
+			 DmucsHost *host)
+{
+    if (deadline == 0) {
+	return;
+    }
+    std::pair<dmucs_host_timers_iter_t, dmucs_host_timers_iter_t> range =
+	timers->equal_range(deadline);
+    for (dmucs_host_timers_iter_t itr = range.first; itr != range.second;
+	 ++itr) {
+	if (itr->second == host) {
+	    timers->erase(itr);
+	    break;
+	}
+    }
+}
+
+
+/*
+ * Fire every timer whose deadline is at or before "now".  Only the expired
+ * entries are looked at, so this is cheap no matter how many hosts or
+ * leases there are.
+ */
+void
+DmucsDpropDb::handleTimers(time_t now, std::list<const Socket *> &expired)
+{
+    while (!silentTimers_.empty() && silentTimers_.begin()->first <= now) {
+	DmucsHost *host = silentTimers_.begin()->second;
+	silentTimers_.erase(silentTimers_.begin());
+	host->setSilentDeadline(0);
+	DMUCS_DEBUG((stderr, "host %s is silent\n", host->getName().c_str()));
+	host->silent();
+    }
+
+    while (!breakerTimers_.empty() && breakerTimers_.begin()->first <= now) {
+	DmucsHost *host = breakerTimers_.begin()->second;
+	breakerTimers_.erase(breakerTimers_.begin());
+	host->setBreakerDeadline(0);
+	host->halfOpenBreaker();
+    }
+
+    while (!drainTimers_.empty() && drainTimers_.begin()->first <= now) {
+	DmucsHost *host = drainTimers_.begin()->second;
+	drainTimers_.erase(drainTimers_.begin());
+	host->setDrainDeadline(0);
+	host->drained();
+    }
+
+    /* Take back just the one lease that expired: a client (a jobserver,
+       or a hostbroker) may hold others that it has renewed.  Only when
+       the client has none left is its connection closed. */
+    while (!leaseTimers_.empty() && leaseTimers_.begin()->first <= now) {
+	const Socket *sock = leaseTimers_.begin()->second;
+	time_t t = leaseTimers_.begin()->first;
+	std::pair<dmucs_assigned_cpus_iter_t, dmucs_assigned_cpus_iter_t>
+	    range = assignedCpus_.equal_range(sock);
+	dmucs_assigned_cpus_iter_t itr = range.first;
+	while (itr != range.second && itr->second.expires_ != t) {
+	    ++itr;
+	}
+	if (itr == range.second) {
+	    leaseTimers_.erase(leaseTimers_.begin());
+	    continue;
 	}
+	if (sock == NULL) {
+	    fprintf(stderr, "Lease %lu was not claimed\n", itr->second.id_);
+	} else {
+	    fprintf(stderr, "Lease %lu for socket %p expired\n",
+		    itr->second.id_, sock);
+	}
+	releaseLease(itr);	// this removes the lease timer, too.
+	if (sock != NULL && assignedCpus_.find(sock) == assignedCpus_.end()) {
+	    expired.push_back(sock);
+	}
+    }
+}
+
+
+/* Return the earliest pending deadline, or 0 if there is none. */
+time_t
+DmucsDpropDb::getNextDeadline()
+{
+    time_t next = 0;
+    if (!silentTimers_.empty()) {
+	next = silentTimers_.begin()->first;
     }
+    if (!breakerTimers_.empty() &&
+	(next == 0 || breakerTimers_.begin()->first < next)) {
+	next = breakerTimers_.begin()->first;
+    }
+    if (!drainTimers_.empty() &&
+	(next == 0 || drainTimers_.begin()->first < next)) {
+	next = drainTimers_.begin()->first;
+    }
+    if (!leaseTimers_.empty() &&
+	(next == 0 || leaseTimers_.begin()->first < next)) {
+	next = leaseTimers_.begin()->first;
+    }
+    return next;
 }
 
 
@@ -470,8 +2033,9 @@ DmucsDpropDb::dump()
     for (dmucs_assigned_cpus_iter_t itr = assignedCpus_.begin();
 	 itr != assignedCpus_.end(); ++itr) {
 	struct in_addr t;
-	t.s_addr = itr->second;
-	fprintf(stderr, "%s assigned to %p", inet_ntoa(t), itr->first);
+	t.s_addr = itr->second.hostIp_;
+	fprintf(stderr, "%s assigned to %p%s ", inet_ntoa(t), itr->first,
+		itr->second.hedge_ ? " (hedge)" : "");
     }
     fprintf(stderr, "\n");
 
@@ -490,6 +2054,16 @@ DmucsDpropDb::dump()
 	 itr != unavailHosts_.end(); ++itr) {
 	(*itr)->dump();
     }
+    fprintf(stderr, "UNREACHABLE HOSTS:\n");
+    for (dmucs_host_set_iter_t itr = unreachableHosts_.begin();
+	 itr != unreachableHosts_.end(); ++itr) {
+	(*itr)->dump();
+    }
+    fprintf(stderr, "DRAINING HOSTS:\n");
+    for (dmucs_host_set_iter_t itr = drainingHosts_.begin();
+	 itr != drainingHosts_.end(); ++itr) {
+	(*itr)->dump();
+    }
 }
 
 
@@ -504,12 +2078,15 @@ DmucsDpropDb::dump()
  * collection period.
  */
 void
-DmucsDpropDb::getStatsFromDb(int *served, int *max, int *totalCpus)
+DmucsDpropDb::getStatsFromDb(int *served, int *max, int *totalCpus,
+			     int *tierMoves)
 {
     *served = numAssignedCpus_;
     numAssignedCpus_ = 0;
     *max = numConcurrentAssigned_;
     numConcurrentAssigned_ = 0;
+    *tierMoves = numTierMoves_;
+    numTierMoves_ = 0;
     *totalCpus = 0;
     for (dmucs_avail_cpus_iter_t itr = availCpus_.begin();
 	 itr != availCpus_.end(); ++itr) {
@@ -517,3 +2094,41 @@ DmucsDpropDb::getStatsFromDb(int *served, int *max, int *totalCpus)
     }
     *totalCpus += assignedCpus_.size();
 }
+
+
+/*
+ * Return the number of cpus that are free to be given out, to jobs that
+ * need memMb of memory each.
+ */
+int
+DmucsDpropDb::getNumFreeCpus(int memMb)
+{
+    int n = 0;
+    for (dmucs_avail_cpus_iter_t itr = availCpus_.begin();
+	 itr != availCpus_.end(); ++itr) {
+	n += countFits(itr->second, memMb);
+    }
+    return n;
+}
+
+
+/*
+ * Return the number of cpus here, free or not, that could all run jobs
+ * that need memMb of memory each at once.
+ */
+int
+DmucsDpropDb::getNumCpus(int memMb)
+{
+    int n = getNumCpus();
+    if (memMb <= 0) {
+	return n;
+    }
+    int fits = 0;
+    for (dmucs_host_set_iter_t itr = allHosts_.begin();
+	 itr != allHosts_.end(); ++itr) {
+	int ncpus = (*itr)->getNumSlots();
+	int mem = (*itr)->getMemMb();
+	fits += (mem <= 0 || mem / memMb >= ncpus) ? ncpus : mem / memMb;
+    }
+    return (fits < n) ? fits : n;
+}
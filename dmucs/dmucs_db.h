@@ -24,12 +24,67 @@
 #include <set>
 #include <map>
 #include <list>
+#include <deque>
+#include <vector>
 #include "dmucs_host.h"
+#include "dmucs_probe.h"
+#include "dmucs_cpu_req.h"
+#include "dmucs_labels.h"
+#include "dmucs_policy.h"
 #include <pthread.h>
 #include <stdio.h>
 #include "COSMIC/HDR/sockets.h"
 
 
+/*
+ * A lease is a cpu that has been given out to a "gethost" client.  It is
+ * held until the client closes its connection to the server, or until it
+ * expires (when the dprop has a lease-time configured).
+ *
+ * A lease whose client is connected to another server -- the primary, on
+ * a standby server (see dmucs_repl.h) -- is an orphan, and is held under
+ * a NULL socket, until the client claims it or it expires.
+ */
+struct DmucsLease
+{
+    unsigned long	id_;		// the same on the standby servers.
+    unsigned int	hostIp_;	// the cpu given out.
+    time_t		expires_;	// 0 if the lease never expires.
+    int			memMb_;		// the host's memory held for it.
+    bool		hedge_;		// a second cpu, to race a straggling
+					// compile on.
+
+    DmucsLease(unsigned long id, unsigned int hostIp, time_t expires,
+	       int memMb, bool hedge = false) :
+	id_(id), hostIp_(hostIp), expires_(expires), memMb_(memMb),
+	hedge_(hedge) {}
+};
+
+
+/*
+ * Hedging: a compile that lands on a slow or busy host can take many
+ * times as long as it would elsewhere, and the build waits on it.  When
+ * the dprop has a "hedge-percentile" in the dprops-info file, the server
+ * keeps the wall times of the latest "hedge-window" (default 100)
+ * compiles, and once it has DMUCS_HEDGE_MIN_SAMPLES of them, each host
+ * reply has "hedge=<msecs>": that percentile of them.  A client whose
+ * compile is still running then may ask for a second cpu, on another
+ * host, with "hedge=<IP address of the first>", race the compile there,
+ * and give back the cpu of the one that loses.
+ *
+ * Hedges come after all first attempts: a hedge is only given when no one
+ * is waiting for the dprop (see DmucsFairShare::admitHedge()), and while
+ * fewer than the dprop's "hedge-max" percent (default 10) of its cpus
+ * are hedges.  Every compile reported done counts in the wall times,
+ * whether or not the client knows the size of its source, and a hedge
+ * that wins counts with the time it took.
+ */
+#define DMUCS_HEDGE_MIN_SAMPLES	20
+
+
+#define DMUCS_RING_VNODES	64
+
+
 class DmucsDpropDb
 {
 private:
@@ -54,19 +109,48 @@ private:
     typedef dmucs_avail_cpus_t::reverse_iterator dmucs_avail_cpus_riter_t;
 
 
-    /* This is a mapping from sock address to host ip address -- the socket
+    /* This is a mapping from sock address to the leases -- the socket
        of the connection from the "gethost" application to the dmucs server,
-       and the hostip of the cpu assigned to the "gethost" application. */
-    typedef std::map<const Socket *, const unsigned int>
-    		dmucs_assigned_cpus_t;
+       and the hostip of the cpu(s) assigned to the "gethost" application.
+       Most clients hold one cpu, but a "gethost" acting as a make
+       jobserver holds many on one connection. */
+    typedef std::multimap<const Socket *, DmucsLease> dmucs_assigned_cpus_t;
     typedef dmucs_assigned_cpus_t::iterator dmucs_assigned_cpus_iter_t;
 
+    /* Deadlines, sorted by time: the time by which we must hear from a
+       host before it is considered silent, and the time at which a lease
+       is taken back from its client.  Keeping these sorted means the
+       event loop only ever looks at the entries that have expired. */
+    typedef std::multimap<time_t, DmucsHost *> dmucs_host_timers_t;
+    typedef dmucs_host_timers_t::iterator dmucs_host_timers_iter_t;
+    typedef std::multimap<time_t, const Socket *> dmucs_lease_timers_t;
+    typedef dmucs_lease_timers_t::iterator dmucs_lease_timers_iter_t;
+
+    /* A host a policy may pick a cpu from (see dmucs_policy.h): the first
+       of its free cpus, how many it has free, and its score. */
+    struct DmucsCandidate {
+	DmucsHost *	host_;
+	int		tier_;
+	dmucs_cpus_t *	cpus_;
+	dmucs_cpus_iter_t cpu_;
+	int		numFree_;
+	double		score_;
+    };
+
+    /* A consistent-hash ring of the hosts: each host is on it at
+       DMUCS_RING_VNODES points, so that adding a host only takes a small
+       share of the keys from each of the others. */
+    typedef std::map<unsigned int, DmucsHost *> dmucs_hash_ring_t;
+    typedef dmucs_hash_ring_t::iterator dmucs_hash_ring_iter_t;
+
     /* 
      * Databases of hosts.
      * o a collection of available hosts, sorted by tier.
      * o a collection of assigned hosts.
      * o a collection of silent hosts.
      * o a collection of overloaded hosts.
+     * o a collection of unreachable hosts.
+     * o a collection of draining hosts.
      *
      * o a collectoin of available (unassigned) cpus.
      * o a collection of assigned cpus.
@@ -79,32 +163,102 @@ private:
     dmucs_host_set_t	unavailHosts_;	// unavail hosts are also here.
     dmucs_host_set_t 	silentHosts_;	// silent hosts are also here
     dmucs_host_set_t	overloadedHosts_;// overloaded hosts are here.
+    dmucs_host_set_t	unreachableHosts_;// unreachable hosts are here.
+    dmucs_host_set_t	drainingHosts_;	// draining hosts are here.
 
-    dmucs_avail_cpus_t	availCpus_;	// unassigned cpus are here.
+    dmucs_avail_cpus_t	availCpus_;	// unassigned cpus are here, each
+					// host's next to each other.
+    dmucs_hash_ring_t	ring_;		// all hosts, for affinity requests.
     dmucs_assigned_cpus_t assignedCpus_; // assigned cpus are here.
 
+    dmucs_host_timers_t	silentTimers_;	// when each host goes silent.
+    dmucs_host_timers_t	breakerTimers_;	// when open breakers go half-open.
+    dmucs_host_timers_t	drainTimers_;	// when draining hosts are taken out.
+    dmucs_lease_timers_t leaseTimers_;	// when each lease expires.
+
     /* Statistics */
     int numAssignedCpus_;	/* the # of assigned CPUs during a collection
 				   period */
     int numConcurrentAssigned_; /* the max number of assigned CPUs at one
 				   time. */
+    int numTierMoves_;		/* the # of times hosts changed tiers. */
+    int numHedged_;		/* the # of leases that are hedges. */
+
+    static unsigned long nextLeaseId_;
+
+    /* The costs of the latest host requests that had one, oldest first:
+       a job's cost is ranked against these to pick its tier. */
+    std::deque<long>	recentCosts_;
+
+    /* The wall times of the latest compiles, oldest first, and the time
+       after which a compile is a straggler (see hedging, above). */
+    std::deque<int>	recentMsecs_;
+    int			hedgeMsecs_;
+
+    /* What the hosts' learned power indices are measured against. */
+    float refSpeed_;		/* EWMA of msecs per KB over all hosts. */
+    int pindexSum_;		/* sum of the hosts-info power indices. */
+    int probePort_;		/* the dprop's probe-port, read by the main
+				   thread for the prober's. */
+
+    /* The candidates of pickCpu() and takeGang(), kept so that they need
+       not be allocated again for each request. */
+    std::vector<DmucsCandidate> cands_;
     
 
 public:
 
     DmucsDpropDb(DmucsDprop dprop) :
-        dprop_(dprop), numAssignedCpus_(0), numConcurrentAssigned_(0) {}
+        dprop_(dprop), numAssignedCpus_(0), numConcurrentAssigned_(0),
+	numTierMoves_(0), numHedged_(0), hedgeMsecs_(0), refSpeed_(0),
+	pindexSum_(0), probePort_(0) {}
 
     DmucsHost * getHost(const struct in_addr &ipAddr);
     bool 	haveHost(const struct in_addr &ipAddr);
-    unsigned int getBestAvailCpu();
+    const DmucsDprop &getDprop() const { return dprop_; }
+    unsigned int getBestAvailCpu(const DmucsCpuReq &req);
+    int		getBestFreeTier(int memMb = 0);
+    int		getGangTier(unsigned int n, int memMb);
+    void	takeGang(unsigned int n, int tier, int memMb,
+			 std::vector<unsigned int> &cpus);
+    unsigned int pickTierForCost(long cost, unsigned int numTiers);
+    void	recordCost(long cost);
+    unsigned int getAffinityCpu(const std::string &key, int memMb);
+    bool	takeCpuFromHost(DmucsHost *host, int memMb);
+    unsigned int takeCpu(dmucs_cpus_t &cpus, dmucs_cpus_iter_t itr,
+			 int memMb);
+    void	untakeCpu(unsigned int ipAddr, int memMb);
+    dmucs_policy_t getPolicy();
+    template <class Policy>
+    unsigned int pickCpu(std::vector<dmucs_avail_cpus_riter_t> &tiers,
+			 unsigned int which, int memMb);
+    void	addCandidates(int tier, dmucs_cpus_t &cpus, int memMb);
+    static bool	betterScore(const DmucsCandidate &lhs,
+			    const DmucsCandidate &rhs);
+    bool	cpuFits(unsigned int ipAddr, int memMb);
+    int		countFits(const dmucs_cpus_t &cpus, int memMb);
+    bool	canHedge();
+    int		getHedgeTier(unsigned int avoidIp, int memMb);
+    unsigned int takeHedgeCpu(int tier, unsigned int avoidIp, int memMb);
+    int		getHedgeMsecs() const { return hedgeMsecs_; }
     void	assignCpuToClient(const unsigned int clientIp,
-				  const Socket *cpuIp);
+				  const Socket *cpuIp, int memMb,
+				  bool hedge = false);
     void 	moveCpus(DmucsHost *host, int oldTier, int newTier);
     int 	delCpusFromTier(int tier, unsigned int ipAddr);
 
     void 	addNewHost(DmucsHost *host);
     void	releaseCpu(const Socket *sock);
+    bool	releaseCpu(const Socket *sock, unsigned int hostIp);
+    void	releaseLease(dmucs_assigned_cpus_iter_t itr);
+    void	removeLeaseTimer(dmucs_assigned_cpus_iter_t itr);
+    bool	renewLease(const Socket *sock, unsigned int hostIp);
+    bool	adoptLease(const Socket *sock, unsigned int hostIp);
+    void	addOrphanLease(unsigned long id, unsigned int hostIp,
+			       time_t expires, int memMb);
+    void	releaseOrphanLease(unsigned long id);
+    void	takeOver(time_t now);
+    void	replicate();
 
     void 	addToHostSet(dmucs_host_set_t *theSet, DmucsHost *host);
     void 	delFromHostSet(dmucs_host_set_t *theSet, DmucsHost *host);
@@ -119,10 +273,42 @@ public:
     void 	delFromSilentDb(DmucsHost *host);
     void 	addToUnavailDb(DmucsHost *host);
     void 	delFromUnavailDb(DmucsHost *host);
-    
-    void	handleSilentHosts();
+    void 	addToUnreachableDb(DmucsHost *host);
+    void 	delFromUnreachableDb(DmucsHost *host);
+    void 	addToDrainingDb(DmucsHost *host);
+    void 	delFromDrainingDb(DmucsHost *host);
+
+    void	setProbePort();
+    void	getProbeTargets(std::vector<DmucsProbe> &probes);
+    void	resetSilentTimer(DmucsHost *host);
+    void	cancelSilentTimer(DmucsHost *host);
+    void	startBreakerTimer(DmucsHost *host, time_t deadline);
+    void	cancelBreakerTimer(DmucsHost *host);
+    void	startDrainTimer(DmucsHost *host, time_t deadline);
+    void	cancelDrainTimer(DmucsHost *host);
+    void	eraseTimer(dmucs_host_timers_t *timers, time_t deadline,
+			   DmucsHost *host);
+    dmucs_assigned_cpus_iter_t findLease(const Socket *sock,
+					 unsigned int hostIp);
+    bool	holdsLease(const Socket *sock, unsigned int hostIp) {
+	return findLease(sock, hostIp) != assignedCpus_.end();
+    }
+    void	recordOutcome(const Socket *sock, unsigned int hostIp,
+			      bool failed);
+    void	recordTiming(const Socket *sock, unsigned int hostIp,
+			     int msecs, long bytes);
+    void	recordLatency(int msecs);
+    void	handleTimers(time_t now, std::list<const Socket *> &expired);
+    time_t	getNextDeadline();
     std::string	serialize();
-    void	getStatsFromDb(int *served, int *max, int *totalCpus);
+    void	getStatsFromDb(int *served, int *max, int *totalCpus,
+			       int *tierMoves);
+    void	tierMoved() { numTierMoves_++; }
+    int		getNumFreeCpus(int memMb = 0);
+    int		getNumCpus() {
+	return getNumFreeCpus() + (int) assignedCpus_.size();
+    }
+    int		getNumCpus(int memMb);
     void	dump();
 };
 
@@ -144,6 +330,10 @@ class MutexMonitor
 
 class DmucsDb
 {
+public:
+    typedef std::list<std::pair<const Socket *, std::string> >
+		dmucs_drain_replies_t;
+
 private:
     typedef std::map<DmucsDprop, DmucsDpropDb> dmucs_dprop_db_t;
     typedef dmucs_dprop_db_t::iterator dmucs_dprop_db_iter_t;
@@ -154,12 +344,37 @@ private:
 
     /* A mapping of socket to distinguishing property -- so that when a
        host is released and all we have is the socket information, we can
-       figure out which DpropDb to put the host back into. */
-    typedef std::map<const Socket *, DmucsDprop> dmucs_sock_dprop_db_t;
+       figure out which DpropDb to put the host back into.  A client that
+       holds several cpus may hold them in more than one DpropDb, when
+       its requests' labels match several (see dmucs_labels.h). */
+    typedef std::multimap<const Socket *, DmucsDprop> dmucs_sock_dprop_db_t;
     typedef dmucs_sock_dprop_db_t::iterator dmucs_sock_dprop_db_iter_t;
 
     dmucs_sock_dprop_db_t sock2DpropDb_;
 
+    /* The DpropDbs, in the order they were made, and for each label the
+       set of the DpropDbs (by their index in pools_) that have it.  The
+       DpropDbs with no labels are under "".  A request is matched against
+       all the DpropDbs at once, with a few ANDs of these sets. */
+    typedef std::map<std::string, DmucsBitset> dmucs_label_index_t;
+    typedef dmucs_label_index_t::iterator dmucs_label_index_iter_t;
+
+    std::vector<DmucsDpropDb *> pools_;
+    dmucs_label_index_t	labelIndex_;
+
+    void indexPool(DmucsDpropDb *pool);
+    DmucsBitset matchPools(const DmucsDprop &pred);
+    DmucsDpropDb *findPool(const Socket *sock, unsigned int hostIp);
+    void mapSockToDprop(const Socket *sock, const DmucsDprop &dprop);
+
+    /* The connections waiting for a draining host to be drained, and the
+       replies for the hosts that are, which the event loop sends. */
+    typedef std::multimap<DmucsHost *, const Socket *> dmucs_drain_waiters_t;
+    typedef dmucs_drain_waiters_t::iterator dmucs_drain_waiters_iter_t;
+
+    dmucs_drain_waiters_t drainWaiters_;
+    dmucs_drain_replies_t drainReplies_;
+
     static DmucsDb *instance_;
     static pthread_mutexattr_t attr_;
     static pthread_mutex_t mutex_;
@@ -169,6 +384,8 @@ private:
 
 public:
     static DmucsDb *getInstance();
+    /* For those that must change many hosts as one. */
+    static pthread_mutex_t *getMutex() { return &mutex_; }
 
     DmucsHost *getHost(const struct in_addr &ipAddr, DmucsDprop dprop) {
 	MutexMonitor m(&mutex_);
@@ -186,19 +403,22 @@ public:
 	}
 	return itr->second.haveHost(ipAddr);
     }
-    unsigned int getBestAvailCpu(DmucsDprop dprop) {
+    unsigned int getBestAvailCpu(DmucsDprop &dprop, const DmucsCpuReq &req);
+    typedef std::vector<std::pair<DmucsDprop, unsigned int> > dmucs_gang_t;
+    bool getGang(const DmucsDprop &pred, const DmucsCpuReq &req,
+		 dmucs_gang_t &gang);
+    bool canFitGang(const DmucsDprop &pred, const DmucsCpuReq &req);
+    void assignCpuToClient(const unsigned int clientIp,
+                           const DmucsDprop dprop,
+                           const Socket *sock, int memMb,
+			   bool hedge = false);
+    unsigned int getHedgeCpu(const Socket *sock, DmucsDprop &dprop,
+			     const DmucsCpuReq &req);
+    int getHedgeMsecs(const DmucsDprop &dprop) {
 	MutexMonitor m(&mutex_);
 	dmucs_dprop_db_iter_t itr = dbDb_.find(dprop);
-	if (itr == dbDb_.end()) {
-            fprintf(stderr, "nothing in this db!: dprop %s\n",
-                         dprop2cstr(dprop));
-	    return 0L;		// 32-bits of zeros = 0.0.0.0 
-	}
-	return itr->second.getBestAvailCpu();
+	return (itr == dbDb_.end()) ? 0 : itr->second.getHedgeMsecs();
     }
-    void assignCpuToClient(const unsigned int clientIp,
-                           const DmucsDprop dprop,
-                           const Socket *sock);
     void moveCpus(DmucsHost *host, int oldTier, int newTier) {
 	MutexMonitor m(&mutex_);
 	// Assume the DmucsDpropDb is definitely there.
@@ -226,9 +446,16 @@ public:
 		return;
 	    }
 	    itr = status.first;
+	    itr->second.setProbePort();
+	    indexPool(&itr->second);
 	}
 	return itr->second.addNewHost(host);
     }
+    void addCpusToTier(DmucsHost *host, int tier, int numCpus) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.addCpusToTier(tier,
+					host->getIpAddrInt(), numCpus);
+    }
     void addToAvailDb(DmucsHost *host) {
 	MutexMonitor m(&mutex_);
 	return dbDb_.find(host->getDprop())->second.addToAvailDb(host);
@@ -261,15 +488,124 @@ public:
 	MutexMonitor m(&mutex_);
 	return dbDb_.find(host->getDprop())->second.delFromUnavailDb(host);
     }
+    void addToUnreachableDb(DmucsHost *host) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.addToUnreachableDb(host);
+    }
+    void delFromUnreachableDb(DmucsHost *host) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.delFromUnreachableDb(host);
+    }
+    void addToDrainingDb(DmucsHost *host) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.addToDrainingDb(host);
+    }
+    void delFromDrainingDb(DmucsHost *host) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.delFromDrainingDb(host);
+    }
+    /* Called by the main thread, so that the prober thread need never
+       look at the dprops-info file, which the main thread may be
+       reading again. */
+    void setProbePorts() {
+	MutexMonitor m(&mutex_);
+	for (dmucs_dprop_db_iter_t itr = dbDb_.begin();
+             itr != dbDb_.end(); ++itr) {
+	    itr->second.setProbePort();
+	}
+    }
+    void getProbeTargets(std::vector<DmucsProbe> &probes) {
+	MutexMonitor m(&mutex_);
+	for (dmucs_dprop_db_iter_t itr = dbDb_.begin();
+             itr != dbDb_.end(); ++itr) {
+	    itr->second.getProbeTargets(probes);
+	}
+    }
 
     void releaseCpu(const Socket *sock);
+    bool releaseCpu(const Socket *sock, unsigned int hostIp);
+    bool renewLease(const Socket *sock, unsigned int hostIp);
+    bool claimLease(const Socket *sock, unsigned int hostIp);
 
-    void handleSilentHosts() {
+    void resetSilentTimer(DmucsHost *host) {
+	MutexMonitor m(&mutex_);
+	dmucs_dprop_db_iter_t itr = dbDb_.find(host->getDprop());
+	if (itr != dbDb_.end()) {
+	    itr->second.resetSilentTimer(host);
+	}
+    }
+    void startBreakerTimer(DmucsHost *host, time_t deadline) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.startBreakerTimer(host,
+								    deadline);
+    }
+    void cancelBreakerTimer(DmucsHost *host) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.cancelBreakerTimer(host);
+    }
+    void startDrainTimer(DmucsHost *host, time_t deadline) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.startDrainTimer(host,
+								  deadline);
+    }
+    void cancelDrainTimer(DmucsHost *host) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.cancelDrainTimer(host);
+    }
+    void waitForDrain(DmucsHost *host, const Socket *sock) {
+	MutexMonitor m(&mutex_);
+	drainWaiters_.insert(std::make_pair(host, sock));
+    }
+    void drainEnded(DmucsHost *host);
+    void getDrainReplies(dmucs_drain_replies_t &replies) {
+	MutexMonitor m(&mutex_);
+	replies.splice(replies.end(), drainReplies_);
+    }
+    void removeDrainWaiter(const Socket *sock);
+    void addOrphanLease(const DmucsDprop &dprop, unsigned long id,
+			unsigned int hostIp, time_t expires, int memMb) {
+	MutexMonitor m(&mutex_);
+	dmucs_dprop_db_iter_t itr = dbDb_.find(dprop);
+	if (itr != dbDb_.end()) {
+	    itr->second.addOrphanLease(id, hostIp, expires, memMb);
+	}
+    }
+    void releaseOrphanLease(const DmucsDprop &dprop, unsigned long id) {
+	MutexMonitor m(&mutex_);
+	dmucs_dprop_db_iter_t itr = dbDb_.find(dprop);
+	if (itr != dbDb_.end()) {
+	    itr->second.releaseOrphanLease(id);
+	}
+    }
+    void takeOver(time_t now) {
+	MutexMonitor m(&mutex_);
+	for (dmucs_dprop_db_iter_t itr = dbDb_.begin();
+             itr != dbDb_.end(); ++itr) {
+	    itr->second.takeOver(now);
+	}
+    }
+    void replicate() {
 	MutexMonitor m(&mutex_);
 	for (dmucs_dprop_db_iter_t itr = dbDb_.begin();
              itr != dbDb_.end(); ++itr) {
-	    itr->second.handleSilentHosts();
+	    itr->second.replicate();
+	}
+    }
+    void recordOutcome(const Socket *sock, unsigned int hostIp, bool failed);
+    void recordTiming(const Socket *sock, unsigned int hostIp,
+		      int msecs, long bytes);
+    void handleTimers(time_t now, std::list<const Socket *> &expired);
+    time_t getNextDeadline() {
+	MutexMonitor m(&mutex_);
+	time_t next = 0;
+	for (dmucs_dprop_db_iter_t itr = dbDb_.begin();
+             itr != dbDb_.end(); ++itr) {
+	    time_t t = itr->second.getNextDeadline();
+	    if (t != 0 && (next == 0 || t < next)) {
+		next = t;
+	    }
 	}
+	return next;
     }
     std::string	serialize() {
 	MutexMonitor m(&mutex_);
@@ -280,18 +616,49 @@ public:
 	}
 	return res;
     }
-    void getStatsFromDb(int *served, int *max, int *totalCpus) {
+    int getNumFreeCpus(const DmucsDprop &pred, int memMb = 0) {
+	MutexMonitor m(&mutex_);
+	DmucsBitset match = matchPools(pred);
+	int n = 0;
+	for (int i = match.next(0); i >= 0; i = match.next(i + 1)) {
+	    n += pools_[i]->getNumFreeCpus(memMb);
+	}
+	return n;
+    }
+    int getNumCpus(const DmucsDprop &pred) {
+	MutexMonitor m(&mutex_);
+	DmucsBitset match = matchPools(pred);
+	int n = 0;
+	for (int i = match.next(0); i >= 0; i = match.next(i + 1)) {
+	    n += pools_[i]->getNumCpus();
+	}
+	return n;
+    }
+    void getFreeCpus(std::map<DmucsDprop, int> &freeCpus) {
 	MutexMonitor m(&mutex_);
-        int t_serv, t_max, t_total;
-        *served = 0; *max = 0; *totalCpus = 0;
 	for (dmucs_dprop_db_iter_t itr = dbDb_.begin();
 	     itr != dbDb_.end(); ++itr) {
-	    itr->second.getStatsFromDb(&t_serv, &t_max, &t_total);
+	    freeCpus[itr->first] = itr->second.getNumFreeCpus();
+	}
+    }
+    void getStatsFromDb(int *served, int *max, int *totalCpus,
+			int *tierMoves) {
+	MutexMonitor m(&mutex_);
+        int t_serv, t_max, t_total, t_moves;
+        *served = 0; *max = 0; *totalCpus = 0; *tierMoves = 0;
+	for (dmucs_dprop_db_iter_t itr = dbDb_.begin();
+	     itr != dbDb_.end(); ++itr) {
+	    itr->second.getStatsFromDb(&t_serv, &t_max, &t_total, &t_moves);
             *served += t_serv;
             *max += t_max;
             *totalCpus += t_total;
+            *tierMoves += t_moves;
 	}
     }
+    void tierMoved(DmucsHost *host) {
+	MutexMonitor m(&mutex_);
+	return dbDb_.find(host->getDprop())->second.tierMoved();
+    }
     void	dump();
 };
 
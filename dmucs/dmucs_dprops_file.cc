@@ -0,0 +1,159 @@
+/*
+ * dmucs_dprops_file.cc: code to read the dprops-info configuration file.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs.h"
+#include "dmucs_dprops_file.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+
+DmucsDpropsFile *DmucsDpropsFile::instance_ = NULL;
+
+
+DmucsDpropsFile *
+DmucsDpropsFile::getInstance(const std::string &file)
+{
+    if (instance_ == NULL) {
+	instance_ = new DmucsDpropsFile(file);
+    }
+    return instance_;
+}
+
+
+DmucsDpropsFile::DmucsDpropsFile(const std::string &dpropsInfoFile) :
+    dpropsInfoFile_(dpropsInfoFile),
+    lastFileChangeTime_(0),
+    lastCheckTime_(0)
+{
+    (void) hasFileChanged();
+    readFileIntoDb();
+}
+
+
+void
+DmucsDpropsFile::readFileIntoDb() const
+{
+    db_.clear();
+
+    std::ifstream instr(dpropsInfoFile_.c_str());
+    if (!instr) {
+	DMUCS_DEBUG((stderr, "Unable to open dprops-info file \"%s\"\n",
+		     dpropsInfoFile_.c_str()));
+	return;
+    }
+
+    std::string line;
+    for (int lineno = 1; std::getline(instr, line); lineno++) {
+
+	/*
+	 * Each line is: dprop key value.  Comment lines start with #, and
+	 * these are skipped, as are lines containing only whitespace.
+	 */
+	std::istringstream linestr(line);
+	std::string dprop, key, value;
+	if (!(linestr >> dprop) || dprop[0] == '#') {
+	    continue;
+	}
+	if (!(linestr >> key >> value)) {
+	    std::cout << "Bad input in line " << lineno << " of file " <<
+		dpropsInfoFile_ << std::endl;
+	    continue;
+	}
+	if (dprop == "''") {
+	    dprop = "";
+	}
+	db_[std::make_pair(dprop, key)] = value;
+    }
+}
+
+
+/* If the file modification time has changed since the last time this
+   was called, then return true AND update lastFileChangeTime_ to the
+   new modification time.  The file is stat'ed at most once a second, as
+   this is called on the server's hot paths. */
+bool
+DmucsDpropsFile::hasFileChanged() const
+{
+    time_t now = time(NULL);
+    if (now == lastCheckTime_) {
+	return false;
+    }
+    lastCheckTime_ = now;
+
+    struct stat st;
+    if (stat(dpropsInfoFile_.c_str(), &st) != 0) {
+	/* No file means no settings: only re-read if we had some. */
+	return !db_.empty();
+    }
+
+    if (lastFileChangeTime_ != st.st_ctime) {
+	lastFileChangeTime_ = st.st_ctime;
+	return true;
+    }
+    return false;
+}
+
+
+const std::string *
+DmucsDpropsFile::lookup(const DmucsDprop &dprop, const std::string &key) const
+{
+    if (hasFileChanged()) {
+	readFileIntoDb();
+    }
+
+    dprop_info_db_iter_t itr = db_.find(std::make_pair(dprop, key));
+    if (itr == db_.end()) {
+	itr = db_.find(std::make_pair(DmucsDprop("*"), key));
+    }
+    if (itr == db_.end()) {
+	return NULL;
+    }
+    return &itr->second;
+}
+
+
+int
+DmucsDpropsFile::getInt(const DmucsDprop &dprop, const std::string &key,
+			int defaultVal) const
+{
+    const std::string *val = lookup(dprop, key);
+    return (val == NULL) ? defaultVal : atoi(val->c_str());
+}
+
+
+float
+DmucsDpropsFile::getFloat(const DmucsDprop &dprop, const std::string &key,
+			  float defaultVal) const
+{
+    const std::string *val = lookup(dprop, key);
+    return (val == NULL) ? defaultVal : (float) atof(val->c_str());
+}
+
+
+std::string
+DmucsDpropsFile::getString(const DmucsDprop &dprop, const std::string &key,
+			   const std::string &defaultVal) const
+{
+    const std::string *val = lookup(dprop, key);
+    return (val == NULL) ? defaultVal : *val;
+}
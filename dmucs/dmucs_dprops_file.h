@@ -0,0 +1,87 @@
+#ifndef _DMUCS_DPROPS_FILE_H_
+#define _DMUCS_DPROPS_FILE_H_ 1
+
+/*
+ * dmucs_dprops_file.h: code to read the dprops-info configuration file.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <map>
+#include <string>
+#include <stdlib.h>
+#include <time.h>
+#include "dmucs_dprop.h"
+
+#ifdef PKGDATADIR
+const std::string DPROPS_INFO_FILE = std::string(PKGDATADIR) + \
+	std::string("/") + std::string("dprops-info");
+#else
+const std::string DPROPS_INFO_FILE = std::string(getenv("HOME")) + std::string("/.dmucs/dprops-info");
+#endif
+
+
+/*
+ * The dprops-info file holds per-dprop tunables for the server.  Each line
+ * is:
+ *
+ *	<dprop> <key> <value>
+ *
+ * where <dprop> is the distinguishing property the setting applies to,
+ * '' for hosts that have no dprop, or * for every dprop that does not
+ * have its own setting for <key>.  Comment lines start with #.
+ *
+ * The file is optional: every caller supplies the default to use when a
+ * key has not been set.
+ */
+class DmucsDpropsFile
+{
+public:
+
+    static DmucsDpropsFile *getInstance(const std::string &dpropsInfoFile);
+
+    int		getInt(const DmucsDprop &dprop, const std::string &key,
+		       int defaultVal) const;
+    float	getFloat(const DmucsDprop &dprop, const std::string &key,
+			 float defaultVal) const;
+    std::string getString(const DmucsDprop &dprop, const std::string &key,
+			  const std::string &defaultVal) const;
+
+private:
+    // this is private so that it cannot be used (this is a Singleton).
+    DmucsDpropsFile(const std::string &dpropsInfoFile);
+    ~DmucsDpropsFile();
+
+    static DmucsDpropsFile *instance_;
+    std::string dpropsInfoFile_;
+
+    /* Maps (dprop, key) to the value string found in the file. */
+    typedef std::map<std::pair<DmucsDprop, std::string>, std::string>
+		dprop_info_db_t;
+    typedef dprop_info_db_t::const_iterator dprop_info_db_iter_t;
+
+    mutable dprop_info_db_t db_;
+    mutable time_t lastFileChangeTime_;
+    mutable time_t lastCheckTime_;
+
+    void readFileIntoDb() const;
+    bool hasFileChanged() const;
+    const std::string *lookup(const DmucsDprop &dprop,
+			      const std::string &key) const;
+};
+
+#endif
@@ -0,0 +1,465 @@
+/*
+ * dmucs_fair.cc: per-user and per-client limits on the cpus held, and a
+ * fair share of the free cpus among those waiting for them.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs.h"
+#include "dmucs_fair.h"
+#include "dmucs_db.h"
+#include "dmucs_dprops_file.h"
+#include "dmucs_quotas_file.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+extern std::string dpropsInfoFile;
+extern std::string quotasInfoFile;
+
+
+DmucsFairShare *DmucsFairShare::instance_ = NULL;
+
+
+DmucsFairShare *
+DmucsFairShare::getInstance()
+{
+    if (instance_ == NULL) {
+	instance_ = new DmucsFairShare();
+    }
+    return instance_;
+}
+
+
+/*
+ * May the client on sock have a cpu that matches pred now?  Return false,
+ * with overQuota set, if its user or its machine holds its max-cpus
+ * already; or false if the free cpus are all held for other requesters,
+ * or kept for the classes above its own, after which the client is
+ * waiting.
+ */
+bool
+DmucsFairShare::admit(const Socket *sock, struct in_addr clientIp,
+		      const DmucsDprop &pred, const DmucsCpuReq &req,
+		      bool &overQuota)
+{
+    DmucsOwner &owner = owners_[sock];
+    owner.ip_ = std::string("ip:") + inet_ntoa(clientIp);
+    owner.user_ = req.user_.empty() ? "" : "user:" + req.user_;
+    owner.prio_ = req.prio_;
+    owner.gang_ = req.gang_;
+
+    dmucs_flows_iter_t itr = flows_.find(flowKey(pred, owner));
+    overQuota = (!underQuota(owner.ip_, req.gang_ - 1) ||
+		 (!owner.user_.empty() &&
+		  !underQuota(owner.user_, req.gang_ - 1)));
+    if (overQuota) {
+	if (itr != flows_.end()) {
+	    itr->second.waiting_.erase(sock);
+	}
+	return false;
+    }
+
+    if (itr != flows_.end() && itr->second.reserved_ >= req.gang_) {
+	return true;			// the cpus are held for us.
+    }
+    int headroom[DMUCS_NUM_PRIOS];
+    getHeadroom(pred, headroom);
+    if (DmucsDb::getInstance()->getNumFreeCpus(pred) -
+	reservedForOthers(pred, flowKey(pred, owner).second) -
+	headroom[owner.prio_] >= req.gang_) {
+	return true;
+    }
+    waiting(sock, pred);
+    return false;
+}
+
+
+/*
+ * May a peer server have a cpu for one of its clients (see
+ * dmucs_peers.h)?  Not one held for our own waiting clients, nor one of
+ * those kept back for the classes above the request's, or for our own
+ * clients by the dprop's "peer-reserve".
+ */
+bool
+DmucsFairShare::admitPeer(const DmucsDprop &pred, const DmucsCpuReq &req)
+{
+    int headroom[DMUCS_NUM_PRIOS];
+    getHeadroom(pred, headroom);
+    int reserve = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(pred, "peer-reserve", 0);
+    return (DmucsDb::getInstance()->getNumFreeCpus(pred) -
+	    reservedForOthers(pred, std::string()) -
+	    std::max(headroom[req.prio_], reserve) > 0);
+}
+
+
+/*
+ * May the client on sock have a hedge?  It must be under its quotas, and
+ * the hedge must not take a cpu any first attempt could have.
+ */
+bool
+DmucsFairShare::admitHedge(const Socket *sock, struct in_addr clientIp,
+			   const DmucsDprop &pred, const DmucsCpuReq &req)
+{
+    DmucsOwner &owner = owners_[sock];
+    owner.ip_ = std::string("ip:") + inet_ntoa(clientIp);
+    owner.user_ = req.user_.empty() ? "" : "user:" + req.user_;
+
+    if (!underQuota(owner.ip_, 0) ||
+	(!owner.user_.empty() && !underQuota(owner.user_, 0))) {
+	return false;
+    }
+    for (dmucs_flows_iter_t itr = flows_.lower_bound(std::make_pair(pred,
+	     std::string())); itr != flows_.end() && itr->first.first == pred;
+	 ++itr) {
+	if (!itr->second.waiting_.empty() || itr->second.reserved_ > 0) {
+	    return false;
+	}
+    }
+    int headroom[DMUCS_NUM_PRIOS];
+    getHeadroom(pred, headroom);
+    return (DmucsDb::getInstance()->getNumFreeCpus(pred) >
+	    headroom[DMUCS_NUM_PRIOS - 1]);
+}
+
+
+/* The client on sock got the cpus it was admitted for. */
+void
+DmucsFairShare::granted(const Socket *sock, const DmucsDprop &pred)
+{
+    std::map<const Socket *, DmucsOwner>::iterator o = owners_.find(sock);
+    if (o == owners_.end()) {
+	return;
+    }
+    dmucs_flows_iter_t itr = flows_.find(flowKey(pred, o->second));
+    if (itr == flows_.end()) {
+	return;
+    }
+    itr->second.reserved_ -= o->second.gang_;
+    if (itr->second.reserved_ < 0) {
+	itr->second.reserved_ = 0;
+    }
+    itr->second.waiting_.erase(sock);
+}
+
+
+/* The client on sock was admitted, but there was no cpu for it. */
+void
+DmucsFairShare::waiting(const Socket *sock, const DmucsDprop &pred)
+{
+    std::map<const Socket *, DmucsOwner>::iterator o = owners_.find(sock);
+    if (o == owners_.end()) {
+	return;
+    }
+    time_t now = time(NULL);
+    DmucsFlow &flow = flows_[flowKey(pred, o->second)];
+    if (flow.since_ == 0) {
+	flow.who_ = requester(o->second);
+	flow.prio_ = o->second.prio_;
+	flow.since_ = now;
+    }
+    DmucsWaiter &w = flow.waiting_[sock];
+    w.at_ = now;
+    w.gang_ = o->second.gang_;
+}
+
+
+/*
+ * The db has given a cpu to, or taken one back from, the client on sock.
+ * Leases that no client we know of holds (e.g., a peer server's, or the
+ * orphans a standby keeps) are not counted.
+ */
+void
+DmucsFairShare::leaseGranted(const Socket *sock)
+{
+    std::map<const Socket *, DmucsOwner>::iterator o = owners_.find(sock);
+    if (o == owners_.end()) {
+	return;
+    }
+    o->second.held_++;
+    held_[o->second.ip_]++;
+    if (!o->second.user_.empty()) {
+	held_[o->second.user_]++;
+    }
+}
+
+
+void
+DmucsFairShare::leaseReleased(const Socket *sock)
+{
+    std::map<const Socket *, DmucsOwner>::iterator o = owners_.find(sock);
+    if (o == owners_.end() || o->second.held_ <= 0) {
+	return;
+    }
+    o->second.held_--;
+    held_[o->second.ip_]--;
+    if (!o->second.user_.empty()) {
+	held_[o->second.user_]--;
+    }
+}
+
+
+/* The client has closed its connection (its cpus are released already). */
+void
+DmucsFairShare::removeSocket(const Socket *sock)
+{
+    owners_.erase(sock);
+    for (dmucs_flows_iter_t itr = flows_.begin(); itr != flows_.end(); ++itr) {
+	itr->second.waiting_.erase(sock);
+    }
+}
+
+
+/*
+ * Forget the clients that have stopped asking, and the cpus held for
+ * requesters that did not come for them; then hold the free cpus for the
+ * requesters still waiting.
+ */
+void
+DmucsFairShare::dispatch(time_t now)
+{
+    if (flows_.empty()) {
+	return;
+    }
+
+    std::set<DmucsDprop> preds;
+    for (dmucs_flows_iter_t itr = flows_.begin(); itr != flows_.end(); ) {
+	DmucsFlow &flow = itr->second;
+	dmucs_waiters_t::iterator w = flow.waiting_.begin();
+	while (w != flow.waiting_.end()) {
+	    if (w->second.at_ + DMUCS_FAIR_LINGER <= now) {
+		flow.waiting_.erase(w++);
+	    } else {
+		++w;
+	    }
+	}
+	if (flow.waiting_.empty() && flow.reservedUntil_ <= now) {
+	    flow.reserved_ = 0;
+	}
+	if (flow.waiting_.empty() && flow.reserved_ == 0) {
+	    flows_.erase(itr++);
+	    continue;
+	}
+	preds.insert(itr->first.first);
+	++itr;
+    }
+
+    for (std::set<DmucsDprop>::iterator itr = preds.begin();
+	 itr != preds.end(); ++itr) {
+	share(*itr, now);
+    }
+}
+
+
+/*
+ * Hold the free cpus that match pred, and are not held already, for the
+ * requesters waiting for them: for those of the highest class first,
+ * counting the classes they have moved up while waiting.
+ */
+void
+DmucsFairShare::share(const DmucsDprop &pred, time_t now)
+{
+    std::vector<dmucs_flows_iter_t> all;
+    int spare = DmucsDb::getInstance()->getNumFreeCpus(pred);
+    for (dmucs_flows_iter_t itr = flows_.lower_bound(std::make_pair(pred,
+	     std::string())); itr != flows_.end() && itr->first.first == pred;
+	 ++itr) {
+	all.push_back(itr);
+	spare -= itr->second.reserved_;
+    }
+    if (spare <= 0) {
+	return;
+    }
+
+    int headroom[DMUCS_NUM_PRIOS];
+    getHeadroom(pred, headroom);
+    int aging = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(pred, "prio-aging", DMUCS_PRIO_AGING);
+
+    for (int prio = 0; prio < DMUCS_NUM_PRIOS && spare > 0; prio++) {
+	std::vector<dmucs_flows_iter_t> flows;
+	for (unsigned int i = 0; i < all.size(); i++) {
+	    const DmucsFlow &flow = all[i]->second;
+	    int p = flow.prio_;
+	    if (aging > 0) {
+		p -= (int) ((now - flow.since_) / aging);
+	    }
+	    if ((p < 0 ? 0 : p) == prio) {
+		flows.push_back(all[i]);
+	    }
+	}
+	if (!flows.empty()) {
+	    roundRobin(pred, flows, spare, headroom, now);
+	}
+    }
+}
+
+
+/*
+ * Hold spare cpus for the flows, by deficit round robin: in its turn a
+ * requester may have "weight" cpus, and if the cpus run out during its
+ * turn it finishes its turn when more come free.  A flow may not take
+ * the headroom kept for the classes above its own.
+ */
+void
+DmucsFairShare::roundRobin(const DmucsDprop &pred,
+			   std::vector<dmucs_flows_iter_t> &flows, int &spare,
+			   const int headroom[], time_t now)
+{
+    unsigned int n = flows.size();
+    unsigned int start = 0;
+    while (start < n && flows[start]->first.second < turn_[pred]) {
+	start++;
+    }
+    if (start >= n) {
+	start = 0;
+    }
+
+    DmucsQuotasFile *quotas = DmucsQuotasFile::getInstance(quotasInfoFile);
+    unsigned int i = start;
+    for (unsigned int idle = 0; spare > 0 && idle < n; i = (i + 1) % n) {
+	DmucsFlow &flow = flows[i]->second;
+	if (!wants(flow, spare, headroom)) {
+	    flow.deficit_ = 0;
+	    flow.inTurn_ = false;
+	    idle++;
+	    continue;
+	}
+	idle = 0;
+	if (!flow.inTurn_) {
+	    int weight = quotas->getInt(flow.who_, "weight", 1);
+	    flow.deficit_ += (weight > 0) ? weight : 1;
+	    flow.inTurn_ = true;
+	}
+	bool more = true;
+	while (more && flow.deficit_ > 0) {
+	    flow.reserved_++;
+	    flow.reservedUntil_ = now + DMUCS_FAIR_LINGER;
+	    flow.deficit_--;
+	    spare--;
+	    more = wants(flow, spare, headroom);
+	}
+	DMUCS_DEBUG((stderr, "fair share: holding %d cpus for %s (%s)\n",
+		     flow.reserved_, flow.who_.c_str(),
+		     dmucsPrioName(flow.prio_)));
+	if (spare == 0 && flow.deficit_ > 0 &&
+	    wants(flow, headroom[flow.prio_] + 1, headroom)) {
+	    break;			// its turn goes on next time.
+	}
+	if (!more) {
+	    flow.deficit_ = 0;
+	}
+	flow.inTurn_ = false;
+    }
+    turn_[pred] = flows[i]->first.second;
+}
+
+
+time_t
+DmucsFairShare::getNextDeadline() const
+{
+    time_t next = 0;
+    for (dmucs_flows_t::const_iterator itr = flows_.begin();
+	 itr != flows_.end(); ++itr) {
+	const DmucsFlow &flow = itr->second;
+	for (dmucs_waiters_t::const_iterator w = flow.waiting_.begin();
+	     w != flow.waiting_.end(); ++w) {
+	    if (next == 0 || w->second.at_ + DMUCS_FAIR_LINGER < next) {
+		next = w->second.at_ + DMUCS_FAIR_LINGER;
+	    }
+	}
+	if (flow.reserved_ > 0 && (next == 0 || flow.reservedUntil_ < next)) {
+	    next = flow.reservedUntil_;
+	}
+    }
+    return next;
+}
+
+
+bool
+DmucsFairShare::underQuota(const std::string &who, int extra)
+{
+    int cap = DmucsQuotasFile::getInstance(quotasInfoFile)->
+	getInt(who, "max-cpus", 0);
+    return cap <= 0 || held_[who] + extra < cap;
+}
+
+
+DmucsFairShare::dmucs_flow_key_t
+DmucsFairShare::flowKey(const DmucsDprop &pred, const DmucsOwner &owner) const
+{
+    std::string key(1, (char) ('0' + owner.prio_));
+    return std::make_pair(pred, key + "/" + requester(owner));
+}
+
+
+/*
+ * Set headroom[prio] to the number of the cpus matching pred that are
+ * kept for the classes above prio.
+ */
+void
+DmucsFairShare::getHeadroom(const DmucsDprop &pred, int headroom[])
+{
+    DmucsDpropsFile *dprops = DmucsDpropsFile::getInstance(dpropsInfoFile);
+    int total = DmucsDb::getInstance()->getNumCpus(pred);
+    headroom[0] = 0;
+    for (int prio = 1; prio < DMUCS_NUM_PRIOS; prio++) {
+	int pct = dprops->getInt(pred, std::string("reserve-") +
+				 dmucsPrioName(prio - 1), 0);
+	headroom[prio] = headroom[prio - 1] + (total * pct + 99) / 100;
+    }
+}
+
+
+/*
+ * Should another of the spare cpus be held for the flow?  Only if its
+ * waiting clients want more than are held for them, it may take the
+ * cpu without going into the headroom kept for the classes above it, and
+ * it would not go over its quota.
+ */
+bool
+DmucsFairShare::wants(const DmucsFlow &flow, int spare, const int headroom[])
+{
+    int wanted = 0;
+    for (dmucs_waiters_t::const_iterator w = flow.waiting_.begin();
+	 w != flow.waiting_.end(); ++w) {
+	wanted += w->second.gang_;
+    }
+    return (wanted > flow.reserved_ && spare > headroom[flow.prio_] &&
+	    underQuota(flow.who_, flow.reserved_));
+}
+
+
+int
+DmucsFairShare::reservedForOthers(const DmucsDprop &pred,
+				  const std::string &key)
+{
+    int n = 0;
+    for (dmucs_flows_iter_t itr = flows_.lower_bound(std::make_pair(pred,
+	     std::string())); itr != flows_.end() && itr->first.first == pred;
+	 ++itr) {
+	if (itr->first.second != key) {
+	    n += itr->second.reserved_;
+	}
+    }
+    return n;
+}
@@ -0,0 +1,163 @@
+#ifndef _DMUCS_FAIR_H_
+#define _DMUCS_FAIR_H_ 1
+
+/*
+ * dmucs_fair.h: per-user and per-client limits on the cpus held, and a
+ * fair share of the free cpus among those waiting for them.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <time.h>
+#include "dmucs_dprop.h"
+#include "dmucs_cpu_req.h"
+#include "COSMIC/HDR/sockets.h"
+
+
+/*
+ * A host request comes from a user (the "user=" option, which newer
+ * clients send) on a client machine.  Neither may hold more cpus than its
+ * "max-cpus" in the quotas-info file (see dmucs_quotas_file.h): a request
+ * over either limit gets 0.0.0.0, as if there were no cpus free.
+ *
+ * When there are fewer free cpus than clients asking for them, the first
+ * to ask would get them all.  Instead, the requesters (the user, or the
+ * client machine if no user was sent) asking for each dprop take turns,
+ * by weighted deficit round robin: each turn, a requester may have as
+ * many cpus as its "weight".
+ *
+ * Clients don't wait at the server, though -- they ask again every half
+ * second until they get a cpu.  So a client that was refused is counted
+ * as waiting for DMUCS_FAIR_LINGER seconds, and when cpus come free
+ * they are held for the waiting requesters, in turn, for as long.  A
+ * requester's next request takes the cpu held for it; the others go only
+ * to requests that would not take a held cpu.
+ *
+ * A request also has a priority class (the "prio=" option: interactive,
+ * the default, ci or background).  The waiting requesters of a higher
+ * class get the cpus that come free before those of a lower one; but a
+ * requester moves up a class for every "prio-aging" seconds (in the
+ * dprops-info file, default DMUCS_PRIO_AGING) it has been waiting, so
+ * that background work is not starved.  And the dprop's
+ * "reserve-interactive" and "reserve-ci" percent of its cpus are kept
+ * for the requests of that class or a higher one: e.g., with
+ * "reserve-interactive 10", CI and background work may not take the last
+ * tenth of the cpus.
+ *
+ * A request for a gang of cpus ("gang=<n>") gets them all at once or none
+ * of them.  While it waits, the cpus that come free are held for it, in
+ * its turns, until it has enough, so that the single requests do not
+ * keep it from ever starting.  The cpus that do not match its dprop stay
+ * free for others, and a gang that could never fit, even in an empty
+ * db, is refused outright rather than made to wait.
+ *
+ * A hedge (a second cpu to race a straggling compile on -- see
+ * dmucs_db.h) is only given when no one is waiting, no cpu is held for
+ * anyone, and the dprop's headroom for every class is left.  A client
+ * refused a hedge is not counted as waiting.
+ */
+
+#define DMUCS_FAIR_LINGER	2	/* seconds. */
+#define DMUCS_PRIO_AGING	30	/* seconds a waiting requester takes
+					   to move up a class. */
+
+
+class DmucsFairShare
+{
+public:
+    static DmucsFairShare *getInstance();
+
+    bool admit(const Socket *sock, struct in_addr clientIp,
+	       const DmucsDprop &pred, const DmucsCpuReq &req,
+	       bool &overQuota);
+    bool admitHedge(const Socket *sock, struct in_addr clientIp,
+		    const DmucsDprop &pred, const DmucsCpuReq &req);
+    bool admitPeer(const DmucsDprop &pred, const DmucsCpuReq &req);
+    void granted(const Socket *sock, const DmucsDprop &pred);
+    void waiting(const Socket *sock, const DmucsDprop &pred);
+
+    void leaseGranted(const Socket *sock);
+    void leaseReleased(const Socket *sock);
+    void removeSocket(const Socket *sock);
+
+    void dispatch(time_t now);
+    time_t getNextDeadline() const;
+
+private:
+    DmucsFairShare() {}
+
+    static DmucsFairShare *instance_;
+
+    /* Who a client connection asks for cpus for, and how many it holds. */
+    struct DmucsOwner {
+	std::string	user_;		// "user:<login>", or "".
+	std::string	ip_;		// "ip:<address>".
+	int		prio_;		// of its last request,
+	int		gang_;		// and the cpus it wanted.
+	int		held_;
+	DmucsOwner() : prio_(DMUCS_PRIO_INTERACTIVE), gang_(1), held_(0) {}
+    };
+
+    /* A client that was refused, when, and the cpus it wanted. */
+    struct DmucsWaiter {
+	time_t		at_;
+	int		gang_;
+    };
+    typedef std::map<const Socket *, DmucsWaiter> dmucs_waiters_t;
+
+    /* The requests of one requester, of one class, for one dprop.  The
+       flows are keyed by dprop, then by "<class>/<requester>". */
+    struct DmucsFlow {
+	std::string	who_;		// the requester.
+	int		prio_;
+	time_t		since_;		// waiting since.
+	dmucs_waiters_t	waiting_;
+	int		deficit_;
+	bool		inTurn_;
+	int		reserved_;	// cpus held for this flow,
+	time_t		reservedUntil_;	// until then.
+	DmucsFlow() : prio_(DMUCS_PRIO_INTERACTIVE), since_(0), deficit_(0),
+		      inTurn_(false), reserved_(0), reservedUntil_(0) {}
+    };
+    typedef std::pair<DmucsDprop, std::string> dmucs_flow_key_t;
+    typedef std::map<dmucs_flow_key_t, DmucsFlow> dmucs_flows_t;
+    typedef dmucs_flows_t::iterator dmucs_flows_iter_t;
+
+    std::map<const Socket *, DmucsOwner> owners_;
+    std::map<std::string, int>	held_;		// by user and by client.
+    dmucs_flows_t		flows_;
+    std::map<DmucsDprop, std::string> turn_;	// whose turn, by dprop.
+
+    const std::string &requester(const DmucsOwner &owner) const {
+	return owner.user_.empty() ? owner.ip_ : owner.user_;
+    }
+    dmucs_flow_key_t flowKey(const DmucsDprop &pred,
+			     const DmucsOwner &owner) const;
+    bool underQuota(const std::string &who, int extra);
+    bool wants(const DmucsFlow &flow, int spare, const int headroom[]);
+    int reservedForOthers(const DmucsDprop &pred, const std::string &key);
+    void getHeadroom(const DmucsDprop &pred, int headroom[]);
+    void share(const DmucsDprop &pred, time_t now);
+    void roundRobin(const DmucsDprop &pred,
+		    std::vector<dmucs_flows_iter_t> &flows, int &spare,
+		    const int headroom[], time_t now);
+};
+
+#endif
@@ -24,8 +24,10 @@
 #include "dmucs_host.h"
 #include "dmucs_db.h"
 #include "dmucs_hosts_file.h"
+#include "dmucs_dprops_file.h"
 #include "dmucs_host_state.h"
 #include "dmucs_resolve.h"
+#include "dmucs_repl.h"
 #include <stdio.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -36,14 +38,25 @@
 #include <config.h>
 #endif
 
+extern std::string dpropsInfoFile;
+
 
 DmucsHost::DmucsHost(const struct in_addr &ipAddr,
 		     const DmucsDprop dprop,
-		     const int numCpus, const int powerIndex) :
-    ipAddr_(ipAddr), dprop_(dprop), ncpus_(numCpus), pindex_(powerIndex),
+		     const int numCpus, const int powerIndex,
+		     const int memMb, const int slots) :
+    ipAddr_(ipAddr), dprop_(dprop), ncpus_(numCpus), slots_(slots),
+    numSlots_(0), pindex_(powerIndex),
     ldavg1_(0), ldavg5_(0), ldavg10_(0),
-    lastUpdate_(0)
+    lastUpdate_(time(0)), silentDeadline_(0), probeSuccesses_(0),
+    numLeased_(0), breaker_(BREAKER_CLOSED), breakerDeadline_(0),
+    speed_(0), numTimings_(0), learnedPindex_(0), nextPindex_(0),
+    memMb_(memMb), memFromFile_(memMb > 0), memTaken_(0), drainDeadline_(0),
+    loadLevel_(0), loadSeen_(false), numTierMoves_(0)
 {
+    /* The db makes hosts to look others up by, too: the slots, which take
+       a look at the dprops-info file, are set by initSlots() when the
+       host goes into the db. */
     state_ = DmucsHostStateAvail::getInstance();
 }
 
@@ -59,11 +72,15 @@ DmucsHost::createHost(const struct in_addr &ipAddr,
     DmucsHostsFile *hostsFile = DmucsHostsFile::getInstance(hostsInfoFile);
     int numCpus = 1;
     int powerIndex = 1;
+    int memMb = 0;
+    int slots = 0;
 	DmucsHost *newHost = NULL;
     
-	if(hostsFile->getDataForHost(ipAddr, &numCpus, &powerIndex))
+	if(hostsFile->getDataForHost(ipAddr, &numCpus, &powerIndex, &memMb,
+				     &slots))
 	{
-		DmucsHost *newHost = new DmucsHost(ipAddr, dprop, numCpus, powerIndex);
+		DmucsHost *newHost = new DmucsHost(ipAddr, dprop, numCpus,
+				powerIndex, memMb, slots);
 
 		DmucsDb::getInstance()->addNewHost(newHost);
 	}
@@ -80,56 +97,124 @@ DmucsHost::getStateAsInt() const
 int
 DmucsHost::getTier() const
 {
-    return calcTier(ldavg1_, ldavg5_, ldavg10_, pindex_);
+    return calcTier(loadLevel_, getPowerIndex());
 }
 
+
+/*
+ * The power index from the hosts-info file is only a starting point: once
+ * we have timed enough compiles on the host, we use the one we learned.
+ */
 int
-DmucsHost::calcTier(float ldavg1, float ldavg5, float ldavg10,
-		    int pindex) const
+DmucsHost::getPowerIndex() const
 {
-    if (ldavg1 < 0.9) {
-	return pindex;
-    } else if (ldavg5 < 0.7) {
+    return (learnedPindex_ > 0) ? learnedPindex_ : pindex_;
+}
+
+int
+DmucsHost::calcTier(int loadLevel, int pindex) const
+{
+    switch (loadLevel) {
+    case 0:
 	return pindex;
-    } else if (ldavg10 < 0.8) {
+    case 1:
 	return pindex - 1;
-    } else {
+    default:
 	return 0;	// 0 means don't use this host.
     }
 }
 
 
+/*
+ * The load level for the given (per-cpu) load averages, with the
+ * thresholds moved up by slack.
+ */
+static int
+loadLevelFor(float ldavg1, float ldavg5, float ldavg10, float slack)
+{
+    if (ldavg1 < 0.9 + slack) {
+	return 0;
+    } else if (ldavg5 < 0.7 + slack) {
+	return 0;
+    } else if (ldavg10 < 0.8 + slack) {
+	return 1;
+    } else {
+	return 2;
+    }
+}
+
+
+/*
+ * Work out the load level for the new load averages.  The host only moves
+ * to a worse level once the loads are past its thresholds by the dprop's
+ * "tier-hysteresis", and back to a better one once they are that far
+ * below them, so that a host whose load hovers around a threshold is not
+ * moved from tier to tier on every report.
+ */
+int
+DmucsHost::calcLoadLevel(float ldavg1, float ldavg5, float ldavg10) const
+{
+    DmucsDpropsFile *conf = DmucsDpropsFile::getInstance(dpropsInfoFile);
+    float band = loadSeen_ ? conf->getFloat(dprop_, "tier-hysteresis", 0.0)
+			   : 0.0;
+
+    int worse = loadLevelFor(ldavg1, ldavg5, ldavg10, band);
+    int better = loadLevelFor(ldavg1, ldavg5, ldavg10, -band);
+    if (worse > loadLevel_) {
+	return worse;
+    } else if (better < loadLevel_) {
+	return better;
+    }
+    return loadLevel_;
+}
+
+
 void
 DmucsHost::updateTier(float ldAvg1, float ldAvg5, float ldAvg10)
 {
     ldAvg1 /= (float) ncpus_;
     ldAvg5 /= (float) ncpus_;
     ldAvg10 /= (float) ncpus_;
-    int newTier = calcTier(ldAvg1, ldAvg5, ldAvg10, pindex_);
+
+    /* The loads may be smoothed, by the dprop's "load-alpha": the weight
+       of the new report against those before it. */
+    if (loadSeen_) {
+	DmucsDpropsFile *conf = DmucsDpropsFile::getInstance(dpropsInfoFile);
+	float alpha = conf->getFloat(dprop_, "load-alpha", 1.0);
+	ldAvg1 = alpha * ldAvg1 + (1.0 - alpha) * ldavg1_;
+	ldAvg5 = alpha * ldAvg5 + (1.0 - alpha) * ldavg5_;
+	ldAvg10 = alpha * ldAvg10 + (1.0 - alpha) * ldavg10_;
+    }
+
     int oldTier = getTier();
+    int newLevel = calcLoadLevel(ldAvg1, ldAvg5, ldAvg10);
+    /* Pick up a newly learned power index here, so that the cpus are moved
+       between tiers just as they are for a change in load. */
+    learnedPindex_ = nextPindex_;
+    int newTier = calcTier(newLevel, getPowerIndex());
 
     if (newTier != oldTier) {
         DMUCS_DEBUG((stderr, "oldTier %d, newTier %d\n", oldTier, newTier));
+	numTierMoves_++;
+	DmucsDb::getInstance()->tierMoved(this);
 	if (newTier == 0) {
 	    /* This host is completely overloaded: remove the CPU objects
 	       from their current tier, and move this host object to the
 	       overloaded state. */
 	    overloaded();
-	    ldavg1_ = ldAvg1; ldavg5_ = ldAvg5; ldavg10_ = ldAvg10;
-	} else if (oldTier == 0) {
-	    /* This host was overloaded, but now it is not. 
-	       Move the cpu objects from one tier to another. */
-	    DmucsDb::getInstance()->moveCpus(this, oldTier, newTier);
-	    ldavg1_ = ldAvg1; ldavg5_ = ldAvg5; ldavg10_ = ldAvg10;
 	} else {
-	    /* Move the cpu objects from one tier to another. */
+	    /* Move the cpu objects from one tier to another (from none, if
+	       the host was overloaded but now it is not). */
 	    DmucsDb::getInstance()->moveCpus(this, oldTier, newTier);
-	    ldavg1_ = ldAvg1; ldavg5_ = ldAvg5; ldavg10_ = ldAvg10;
 	}
-    } else {
-	ldavg1_ = ldAvg1; ldavg5_ = ldAvg5; ldavg10_ = ldAvg10;
     }
+    loadLevel_ = newLevel;
+    loadSeen_ = true;
+    ldavg1_ = ldAvg1; ldavg5_ = ldAvg5; ldavg10_ = ldAvg10;
     lastUpdate_ = time(0);
+    DmucsDb::getInstance()->resetSilentTimer(this);
+    updateSlots();
+    changed();
 }
 
 
@@ -162,21 +247,413 @@ DmucsHost::overloaded()
 }
 
 
+void
+DmucsHost::unreachable()
+{
+    state_->unreachable(this);
+}
+
+
+/*
+ * Take the host out of service gently: it gets no new leases, but the
+ * compiles running on it go on.  When the last of them is done -- or at
+ * the deadline, if there is one -- the host is drained, and unavailable.
+ */
+void
+DmucsHost::drain(time_t deadline)
+{
+    state_->drain(this);
+    DmucsDb *db = DmucsDb::getInstance();
+    if (deadline != 0) {
+	db->startDrainTimer(this, deadline);
+    } else {
+	db->cancelDrainTimer(this);
+    }
+    changed();
+    if (numLeased_ == 0) {
+	drained();
+    }
+}
+
+
+void
+DmucsHost::drained()
+{
+    if (numLeased_ == 0) {
+	fprintf(stderr, "Host %s is drained\n", getName().c_str());
+    } else {
+	fprintf(stderr, "Host %s: drain deadline passed, with %d compiles "
+		"still on it\n", getName().c_str(), numLeased_);
+    }
+    unavail();
+}
+
+
+/*
+ * Handle the result of probing the host's distccd port.  One failed probe
+ * takes the host's cpus out of the db right away; we only put them back
+ * after "probe-successes" probes in a row have succeeded.
+ */
+void
+DmucsHost::handleProbe(bool reachable)
+{
+    if (!reachable) {
+	probeSuccesses_ = 0;
+	if (!isUnreachable()) {
+	    fprintf(stderr, "Host %s: distccd is not answering\n",
+		    getName().c_str());
+	    unreachable();
+	}
+	return;
+    }
+
+    if (!isUnreachable()) {
+	return;
+    }
+    int needed = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "probe-successes", 2);
+    if (++probeSuccesses_ >= needed) {
+	fprintf(stderr, "Host %s: distccd is answering again\n",
+		getName().c_str());
+	probeSuccesses_ = 0;
+	avail();
+    }
+}
+
+
 void
 DmucsHost::changeState(DmucsHostState *state)
 {
+    bool wasDraining = isDraining();
     state_ = state;
     state_->addToDb(this);
+    if (wasDraining && !isDraining()) {
+	/* Drained, or put back in service: tell whoever is waiting. */
+	DmucsDb *db = DmucsDb::getInstance();
+	db->cancelDrainTimer(this);
+	db->drainEnded(this);
+    }
+    changed();
+}
+
+
+/* Tell the standby servers, if there are any, about this host again. */
+void
+DmucsHost::changed()
+{
+    DmucsReplicator::getInstance()->hostChanged(this);
+}
+
+
+/*
+ * An administrator has given this host a new number of cpus, or a new
+ * power index (0 leaves either as it was).  If the host is available, its
+ * cpus are taken out of their tier and put back into the one it is in
+ * now.  A power index set by hand replaces the learned one, which is
+ * learned again from the compiles timed from here on.
+ */
+void
+DmucsHost::reconfigure(int ncpus, int pindex)
+{
+    DmucsDb *db = DmucsDb::getInstance();
+
+    int newPindex = (pindex > 0) ? pindex : getPowerIndex();
+    if (isAvailable() && calcTier(loadLevel_, newPindex) == 0) {
+	/* Its cpus are taken out of their tier with the old power index. */
+	overloaded();
+    }
+    bool wasAvail = isAvailable();
+    if (wasAvail) {
+	db->delCpusFromTier(this, getTier(), ipAddr_.s_addr);
+    }
+    if (ncpus > 0) {
+	ncpus_ = ncpus;
+	numSlots_ = calcNumSlots();
+    }
+    if (pindex > 0) {
+	pindex_ = pindex;
+	learnedPindex_ = nextPindex_ = 0;
+	numTimings_ = 0;
+    }
+    if (wasAvail) {
+	db->addCpusToTier(this, getTier(), getNumAssignable());
+    }
+    changed();
+}
+
+
+/*
+ * The number of compiles the host may run at once: its slots set by
+ * hand, or else its cpus times the dprop's oversubscription factor, but
+ * at least 1.
+ */
+int
+DmucsHost::calcNumSlots() const
+{
+    if (slots_ > 0) {
+	return slots_;
+    }
+    float factor = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getFloat(dprop_, "oversubscribe", 1.0);
+    int n = (int) (ncpus_ * factor + 0.5);
+    return (n > 0) ? n : 1;
+}
+
+
+/* An administrator has set the host's slots (0 to go back to its cpus
+   times the oversubscription factor). */
+void
+DmucsHost::setSlots(int slots)
+{
+    slots_ = slots;
+    updateSlots();
+    changed();
+}
+
+
+/*
+ * Work out the host's slots again.  If it now has more or fewer, and it
+ * is available, its free ones are put back into its tier.  Those it has
+ * given out past a smaller number are not put back when they are
+ * returned.
+ */
+void
+DmucsHost::updateSlots()
+{
+    int n = calcNumSlots();
+    if (n == numSlots_) {
+	return;
+    }
+    fprintf(stderr, "Host %s now has %d slots (was %d)\n",
+	    getName().c_str(), n, numSlots_);
+
+    DmucsDb *db = DmucsDb::getInstance();
+    bool wasAvail = isAvailable();
+    if (wasAvail) {
+	db->delCpusFromTier(this, getTier(), ipAddr_.s_addr);
+    }
+    numSlots_ = n;
+    if (wasAvail) {
+	db->addCpusToTier(this, getTier(), getNumAssignable());
+    }
+}
+
+
+/*
+ * Make this host the same as the primary server's copy of it.  This is
+ * done on a standby server, for each host record the primary sends.
+ */
+void
+DmucsHost::restore(int state, int ncpus, int pindex, float ldAvg1,
+		   float ldAvg5, float ldAvg10, time_t lastUpdate,
+		   int learnedPindex, int nextPindex,
+		   host_breaker_t breaker, time_t breakerDeadline, float speed,
+		   int numTimings, time_t drainDeadline, int loadLevel,
+		   int slots)
+{
+    /* Take the host out of the db while it changes, so that its cpus go
+       back into the right tier -- if any. */
+    state_->removeFromDb(this);
+
+    ncpus_ = ncpus;
+    slots_ = slots;
+    numSlots_ = calcNumSlots();
+    pindex_ = pindex;
+    ldavg1_ = ldAvg1; ldavg5_ = ldAvg5; ldavg10_ = ldAvg10;
+    loadLevel_ = (loadLevel >= 0) ? loadLevel :
+	loadLevelFor(ldAvg1, ldAvg5, ldAvg10, 0.0);
+    loadSeen_ = true;
+    lastUpdate_ = lastUpdate;
+    learnedPindex_ = learnedPindex;
+    nextPindex_ = nextPindex;
+    breaker_ = breaker;
+    speed_ = speed;
+    numTimings_ = numTimings;
+
+    state_ = DmucsHostState::fromInt(state);
+    state_->addToDb(this);
+
+    DmucsDb *db = DmucsDb::getInstance();
+    db->resetSilentTimer(this);
+    if (breaker_ == BREAKER_OPEN) {
+	db->startBreakerTimer(this, breakerDeadline);
+    } else {
+	db->cancelBreakerTimer(this);
+    }
+    if (isDraining() && drainDeadline != 0) {
+	db->startDrainTimer(this, drainDeadline);
+    } else {
+	db->cancelDrainTimer(this);
+    }
 }
 
 
 bool
 DmucsHost::seemsDown() const
 {
-    return (time(0) - lastUpdate_ > DMUCS_HOST_SILENT_TIME);
+    return (silentDeadline_ != 0 && time(0) >= silentDeadline_);
+}
+
+
+/*
+ * The number of this host's cpus that should be in the available cpus db
+ * when the host is available -- this depends on how many are assigned to
+ * clients right now, and on the state of the circuit breaker.
+ */
+int
+DmucsHost::getNumAssignable() const
+{
+    switch (breaker_) {
+    case BREAKER_CLOSED:
+	return (numSlots_ > numLeased_) ? numSlots_ - numLeased_ : 0;
+    case BREAKER_HALF_OPEN:
+	/* Only one trial compile at a time. */
+	return (numLeased_ == 0) ? 1 : 0;
+    case BREAKER_OPEN:
+    default:
+	return 0;
+    }
+}
+
+
+/*
+ * A client has told us how long a compile on this host took, per KB of
+ * source.  Keep an exponentially weighted moving average of that, and
+ * once there are enough samples, work out the host's power index from
+ * how it compares to the dprop as a whole: a host that compiles twice as
+ * fast as the average (refMsecsPerKb) gets twice the average power index
+ * (refPindex).
+ */
+void
+DmucsHost::recordTiming(float msecsPerKb, float refMsecsPerKb,
+			float refPindex)
+{
+    DmucsDpropsFile *conf = DmucsDpropsFile::getInstance(dpropsInfoFile);
+
+    float alpha = conf->getFloat(dprop_, "speed-alpha", 0.2);
+    speed_ = (numTimings_ == 0) ? msecsPerKb :
+	alpha * msecsPerKb + (1.0 - alpha) * speed_;
+    numTimings_++;
+
+    if (numTimings_ < conf->getInt(dprop_, "speed-min-samples", 5) ||
+	speed_ <= 0.0 || refMsecsPerKb <= 0.0) {
+	return;
+    }
+    nextPindex_ = (int) (refPindex * refMsecsPerKb / speed_ + 0.5);
+    if (nextPindex_ < 1) {
+	nextPindex_ = 1;
+    }
+    DMUCS_DEBUG((stderr, "%s: %.1f msecs/KB (avg %.1f), power index %d\n",
+		 inet_ntoa(ipAddr_), speed_, refMsecsPerKb, nextPindex_));
+    changed();
+}
+
+
+/*
+ * A client has told us how a compile on this host went.  Feed it to the
+ * circuit breaker.
+ */
+void
+DmucsHost::recordOutcome(bool failed)
+{
+    DmucsDpropsFile *conf = DmucsDpropsFile::getInstance(dpropsInfoFile);
+
+    switch (breaker_) {
+    case BREAKER_HALF_OPEN:
+	/* This was the trial compile. */
+	if (failed) {
+	    tripBreaker();
+	} else {
+	    closeBreaker();
+	}
+	return;
+    case BREAKER_OPEN:
+	/* A compile that was started before we opened the breaker. */
+	return;
+    case BREAKER_CLOSED:
+	break;
+    }
+
+    unsigned int window = conf->getInt(dprop_, "breaker-window", 10);
+    outcomes_.push_back(failed);
+    while (outcomes_.size() > window) {
+	outcomes_.pop_front();
+    }
+
+    int minSamples = conf->getInt(dprop_, "breaker-min-samples", 5);
+    if ((int) outcomes_.size() < minSamples) {
+	return;
+    }
+    int numFailed = 0;
+    for (std::deque<bool>::const_iterator itr = outcomes_.begin();
+	 itr != outcomes_.end(); ++itr) {
+	if (*itr) {
+	    numFailed++;
+	}
+    }
+    float threshold = conf->getFloat(dprop_, "breaker-failure-rate", 0.5);
+    if ((float) numFailed / outcomes_.size() >= threshold) {
+	tripBreaker();
+    }
+}
+
+
+void
+DmucsHost::tripBreaker()
+{
+    fprintf(stderr, "Host %s: too many failed compiles -- not using it\n",
+	    getName().c_str());
+
+    breaker_ = BREAKER_OPEN;
+    outcomes_.clear();
+
+    DmucsDb *db = DmucsDb::getInstance();
+    if (isAvailable()) {
+	db->delCpusFromTier(this, getTier(), getIpAddrInt());
+    }
+    int cooldown = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	getInt(dprop_, "breaker-cooldown", 30);
+    db->startBreakerTimer(this, time(0) + cooldown);
+    changed();
+}
+
+
+/* Called when the cool-down period of an open breaker is over. */
+void
+DmucsHost::halfOpenBreaker()
+{
+    DMUCS_DEBUG((stderr, "Host %s: trying it again\n", getName().c_str()));
+
+    breaker_ = BREAKER_HALF_OPEN;
+    if (isAvailable() && getNumAssignable() > 0) {
+	DmucsDb::getInstance()->addCpusToTier(this, getTier(),
+					      getNumAssignable());
+    }
+    changed();
+}
+
+
+void
+DmucsHost::closeBreaker()
+{
+    fprintf(stderr, "Host %s: compiles are working again\n",
+	    getName().c_str());
+
+    breaker_ = BREAKER_CLOSED;
+    if (isAvailable() && getNumAssignable() > 0) {
+	DmucsDb::getInstance()->addCpusToTier(this, getTier(),
+					      getNumAssignable());
+    }
+    changed();
 }
 
 
+bool
+DmucsHost::isAvailable() const
+{
+    return (state_->asInt() == STATUS_AVAILABLE);
+}
+
 bool
 DmucsHost::isUnavailable() const
 {
@@ -195,14 +672,39 @@ DmucsHost::isOverloaded() const
     return (state_->asInt() == STATUS_OVERLOADED);
 }
 
+bool
+DmucsHost::isUnreachable() const
+{
+    return (state_->asInt() == STATUS_UNREACHABLE);
+}
+
+bool
+DmucsHost::isDraining() const
+{
+    return (state_->asInt() == STATUS_DRAINING);
+}
+
+
+/* The host's agent has told us its memory: the hosts-info file, if it
+   has the host's memory, wins. */
+void
+DmucsHost::setMemMb(int memMb)
+{
+    if (! memFromFile_ && memMb > 0) {
+	memMb_ = memMb;
+    }
+}
+
 
 void
 DmucsHost::dump()
 {
     fprintf(stderr,
-	    "Host: %20.20s  Dprop: %8.8s  State: %s Pindex: %d Ncpus %d\n",
+	    "Host: %20.20s  Dprop: %8.8s  State: %s Pindex: %d (learned %d, "
+	    "%.1f msecs/KB) Ncpus %d Slots %d Mem %d/%d MB Tier moves %d\n",
 	    inet_ntoa(ipAddr_), dprop2cstr(dprop_), state_->dump(),
-	    pindex_, ncpus_);
+	    pindex_, learnedPindex_, speed_, ncpus_, numSlots_, memTaken_,
+	    memMb_, numTierMoves_);
 }
 
 
@@ -27,6 +27,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string>
+#include <deque>
 #include "dmucs_dprop.h"
 
 
@@ -35,16 +36,70 @@ enum host_status_t {
     STATUS_AVAILABLE = 1,
     STATUS_UNAVAILABLE,
     STATUS_OVERLOADED,
-    STATUS_SILENT
+    STATUS_SILENT,
+    STATUS_UNREACHABLE,
+    STATUS_DRAINING
 };
 
 class DmucsHostState;
 
 
+/*
+ * Each host has a circuit breaker, driven by what the "gethost" clients
+ * tell us about the compiles they ran on it.  If too many of them could
+ * not use the host (distcc fell back to compiling locally), the breaker
+ * opens and we stop handing out the host's cpus.  After a cool-down, it
+ * goes half-open: a single trial cpu is handed out, and the outcome of
+ * that compile closes the breaker again or re-opens it.
+ */
+enum host_breaker_t {
+    BREAKER_CLOSED = 0,
+    BREAKER_OPEN,
+    BREAKER_HALF_OPEN
+};
+
+
+/*
+ * A host may also have a known amount of memory, in MB: from the fourth
+ * column of its line in the hosts-info file, or else from its loadavg
+ * agent ("loadavg -m").  A request may say how much memory its job needs
+ * ("mem=<MB>"), and a cpu is then only given out if its host has that
+ * much left over from the jobs it is already running, so that a few big
+ * compiles never make a host swap.  The memory of a host that has none
+ * known, and the need of a job that does not say, are not counted.
+ */
+
+/*
+ * A host's "cpus" in the db are really its slots: the compiles it may run
+ * at once.  A host has as many as its fifth column in the hosts-info
+ * file, or the admin "slots" operation (see dmucs_admin.h), says; or else
+ * its number of cpus times its dprop's "oversubscribe" in the dprops-info
+ * file (default 1.0) -- e.g., more than 1 for hosts with SMT, or whose
+ * compiles mostly wait on the network, or less for hosts short of
+ * memory.  The factor is looked at again on each load report, so a change
+ * to it is picked up while the server runs.  The hosts' loads are still
+ * per cpu.  The number of slots is sent to the client in the host reply,
+ * for DISTCC_HOSTS.
+ */
+
+/*
+ * A host's cpus are put in the tier of its power index while it is
+ * lightly loaded, in the one below that as its load goes up, and in none
+ * (the host is overloaded) past that.  Its reported loads may be smoothed
+ * (the dprop's "load-alpha" in the dprops-info file, the weight of each
+ * new report: 1.0, the default, is no smoothing), and it may be made to
+ * stay at its level until its load is past a threshold by the
+ * "tier-hysteresis" (default 0), so that a host whose load hovers around
+ * one does not change tiers on every report.  The number of times the
+ * hosts changed tiers is logged with the other statistics.
+ */
+
 #define DMUCS_HOST_SILENT_TIME	60	/* if we don't hear from a host for
 					   60 seconds, we consider it to be
 					   silent, and we remove it from the
-					   list of available hosts. */
+					   list of available hosts.  This is
+					   the default for the "silent-time"
+					   key in the dprops-info file. */
 
 class DmucsHost
 {
@@ -61,16 +116,45 @@ private:
     DmucsDprop		dprop_;
     std::string		resolvedName_;
     int 		ncpus_;
+    int			slots_;		// set by hand, 0 if not.
+    int			numSlots_;	// the compiles it may run at once.
     int			pindex_;
     float		ldavg1_, ldavg5_, ldavg10_;
     time_t		lastUpdate_;
+    time_t		silentDeadline_;	// 0 if no timer is running.
+    int			probeSuccesses_;	// consecutive good probes
+						// while unreachable.
+    int			numLeased_;	// cpus assigned to clients now.
+    host_breaker_t	breaker_;
+    std::deque<bool>	outcomes_;	// recent compiles: true = failed.
+    time_t		breakerDeadline_; // when an open breaker goes
+					  // half-open, 0 if not open.
+    float		speed_;		// EWMA of msecs per KB compiled.
+    int			numTimings_;	// compiles timed so far.
+    int			learnedPindex_;	// 0 until we have learned one.
+    int			nextPindex_;	// applied at the next tier update.
+    int			memMb_;		// memory, in MB: 0 if not known.
+    bool		memFromFile_;	// memMb_ is from the hosts-info file.
+    int			memTaken_;	// MB held for the jobs on it now.
+    time_t		drainDeadline_;	// when a draining host is taken out
+					// anyway, 0 if never.
+    int			loadLevel_;	// 0: its full tier, 1: the one
+					// below, 2: overloaded.
+    bool		loadSeen_;	// we've had a load report.
+    int			numTierMoves_;	// times it changed tiers.
 
     friend class DmucsHostState;
+    friend class DmucsReplicator;	// it sends all of the above.
     void changeState(DmucsHostState *state);
+    void tripBreaker();
+    void closeBreaker();
+    void changed();
+    int calcNumSlots() const;
 
 public:
     DmucsHost(const struct in_addr &ipAddr, DmucsDprop dprop,
-	      const int numCpus, const int powerIndex);
+	      const int numCpus, const int powerIndex, const int memMb = 0,
+	      const int slots = 0);
 
     void updateTier(float ldAvg1, float ldAvg5, float ldAvg10);
 
@@ -78,6 +162,47 @@ public:
     void unavail();
     void silent();
     void overloaded();
+    void unreachable();
+    void drain(time_t deadline);
+    void drained();
+    void reconfigure(int ncpus, int pindex);
+    void setSlots(int slots);
+    void updateSlots();
+
+    void handleProbe(bool reachable);
+
+    void restore(int state, int ncpus, int pindex, float ldAvg1,
+		 float ldAvg5, float ldAvg10, time_t lastUpdate,
+		 int learnedPindex, int nextPindex,
+		 host_breaker_t breaker, time_t breakerDeadline, float speed,
+		 int numTimings, time_t drainDeadline, int loadLevel,
+		 int slots);
+
+    void recordOutcome(bool failed);
+    void recordTiming(float msecsPerKb, float refMsecsPerKb, float refPindex);
+    int getPowerIndex() const;
+    int getHandPowerIndex() const { return pindex_; }
+    float getSpeed() const { return speed_; }
+    void halfOpenBreaker();
+    host_breaker_t getBreaker() const { return breaker_; }
+    time_t getBreakerDeadline() const { return breakerDeadline_; }
+    void setBreakerDeadline(time_t t) { breakerDeadline_ = t; }
+    time_t getDrainDeadline() const { return drainDeadline_; }
+    void setDrainDeadline(time_t t) { drainDeadline_ = t; }
+    int getNumAssignable() const;
+    void leaseCpu() { numLeased_++; }
+    void returnCpu() { if (numLeased_ > 0) numLeased_--; }
+    int getNumLeased() const { return numLeased_; }
+    int getMemMb() const { return memMb_; }
+    int getMemTaken() const { return memTaken_; }
+    void setMemMb(int memMb);
+    bool hasMemFor(int memMb) const {
+	return memMb <= 0 || memMb_ <= 0 || memTaken_ + memMb <= memMb_;
+    }
+    void takeMem(int memMb) { memTaken_ += memMb; }
+    void returnMem(int memMb) {
+	memTaken_ = (memTaken_ > memMb) ? memTaken_ - memMb : 0;
+    }
 
     static DmucsHost *createHost(const struct in_addr &ipAddr,
 				  const DmucsDprop dprop,
@@ -85,16 +210,26 @@ public:
 
     const int getStateAsInt() const;
     int getTier() const;
-    int calcTier(float ldavg1, float ldavg5, float ldavg10, int pindex) const;
+    int calcTier(int loadLevel, int pindex) const;
+    int calcLoadLevel(float ldavg1, float ldavg5, float ldavg10) const;
     const std::string &getName();
     const DmucsDprop getDprop() const { return dprop_; }
 
     unsigned int getIpAddrInt() const { return ipAddr_.s_addr; }
     int getNumCpus() const { return ncpus_; }
+    int getNumSlots() const { return numSlots_; }
+    void initSlots() { numSlots_ = calcNumSlots(); }
+    float getLdAvg1() const { return ldavg1_; }	// per cpu.
+    time_t getLastUpdate() const { return lastUpdate_; }
+    time_t getSilentDeadline() const { return silentDeadline_; }
+    void setSilentDeadline(time_t t) { silentDeadline_ = t; }
     bool seemsDown() const;
+    bool isAvailable() const;
     bool isUnavailable() const;
     bool isSilent() const;
     bool isOverloaded() const;
+    bool isUnreachable() const;
+    bool isDraining() const;
 
     static std::string resolveIp2Name(unsigned int ipAddr, DmucsDprop dprop);
     static const std::string &getName(std::string &resolvedName,
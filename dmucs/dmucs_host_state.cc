@@ -75,6 +75,32 @@ DmucsHostStateAvail::overloaded(DmucsHost *host)
 }
 
 
+void
+DmucsHostStateAvail::unreachable(DmucsHost *host)
+{
+    /* Remove the CPUs from the cpus database. */
+    DmucsDb::getInstance()->delCpusFromTier(host, host->getTier(),
+					    host->getIpAddrInt());
+    /* Move the host to the unreachable state: remove from availHosts_ and
+       add to unreachableHosts_. */
+    removeFromDb(host);
+    DmucsHostState::changeState(host,
+				DmucsHostStateUnreachable::getInstance());
+}
+
+
+void
+DmucsHostStateAvail::drain(DmucsHost *host)
+{
+    /* Remove the CPUs from the cpus database: the ones that are leased
+       out are not put back when they are released, either. */
+    DmucsDb::getInstance()->delCpusFromTier(host, host->getTier(),
+					    host->getIpAddrInt());
+    removeFromDb(host);
+    DmucsHostState::changeState(host, DmucsHostStateDraining::getInstance());
+}
+
+
 void
 DmucsHostStateAvail::removeFromDb(DmucsHost *host)
 {
@@ -116,6 +142,14 @@ DmucsHostStateUnavail::avail(DmucsHost *host)
 }
 
 
+void
+DmucsHostStateUnavail::drain(DmucsHost *host)
+{
+    removeFromDb(host);
+    DmucsHostState::changeState(host, DmucsHostStateDraining::getInstance());
+}
+
+
 void
 DmucsHostStateUnavail::addToDb(DmucsHost *host)
 {
@@ -159,6 +193,14 @@ DmucsHostStateSilent::unavail(DmucsHost *host)
 }
 
 
+void
+DmucsHostStateSilent::drain(DmucsHost *host)
+{
+    removeFromDb(host);
+    DmucsHostState::changeState(host, DmucsHostStateDraining::getInstance());
+}
+
+
 void
 DmucsHostStateSilent::addToDb(DmucsHost *host)
 {
@@ -212,6 +254,14 @@ DmucsHostStateOverloaded::silent(DmucsHost *host)
 }
 
 
+void
+DmucsHostStateOverloaded::drain(DmucsHost *host)
+{
+    removeFromDb(host);
+    DmucsHostState::changeState(host, DmucsHostStateDraining::getInstance());
+}
+
+
 void
 DmucsHostStateOverloaded::addToDb(DmucsHost *host)
 {
@@ -224,3 +274,156 @@ DmucsHostStateOverloaded::removeFromDb(DmucsHost *host)
 {
     DmucsDb::getInstance()->delFromOverloadedDb(host);
 }
+
+
+void
+DmucsHostStateOverloaded::unreachable(DmucsHost *host)
+{
+    removeFromDb(host);
+    DmucsHostState::changeState(host,
+				DmucsHostStateUnreachable::getInstance());
+}
+
+
+
+/* ====================================================================== */
+
+
+DmucsHostStateUnreachable *DmucsHostStateUnreachable::instance_ = NULL;
+
+DmucsHostStateUnreachable *
+DmucsHostStateUnreachable::getInstance()
+{
+    if (instance_ == NULL) {
+	instance_ = new DmucsHostStateUnreachable();
+    }
+    return instance_;
+}
+
+void
+DmucsHostStateUnreachable::avail(DmucsHost *host)
+{
+    removeFromDb(host);
+
+    int tier = host->getTier();
+    if (tier == 0) {
+	DmucsHostState::changeState(host,
+				    DmucsHostStateOverloaded::getInstance());
+    } else {
+	DmucsHostState::changeState(host, DmucsHostStateAvail::getInstance());
+    }
+}
+
+
+void
+DmucsHostStateUnreachable::unavail(DmucsHost *host)
+{
+    removeFromDb(host);
+    DmucsHostState::changeState(host, DmucsHostStateUnavail::getInstance());
+}
+
+
+void
+DmucsHostStateUnreachable::silent(DmucsHost *host)
+{
+    removeFromDb(host);
+    DmucsHostState::changeState(host, DmucsHostStateSilent::getInstance());
+}
+
+
+void
+DmucsHostStateUnreachable::drain(DmucsHost *host)
+{
+    removeFromDb(host);
+    DmucsHostState::changeState(host, DmucsHostStateDraining::getInstance());
+}
+
+
+void
+DmucsHostStateUnreachable::addToDb(DmucsHost *host)
+{
+    DmucsDb::getInstance()->addToUnreachableDb(host);
+}
+
+
+void
+DmucsHostStateUnreachable::removeFromDb(DmucsHost *host)
+{
+    DmucsDb::getInstance()->delFromUnreachableDb(host);
+}
+
+
+/* ====================================================================== */
+
+
+DmucsHostStateDraining *DmucsHostStateDraining::instance_ = NULL;
+
+DmucsHostStateDraining *
+DmucsHostStateDraining::getInstance()
+{
+    if (instance_ == NULL) {
+	instance_ = new DmucsHostStateDraining();
+    }
+    return instance_;
+}
+
+void
+DmucsHostStateDraining::avail(DmucsHost *host)
+{
+    removeFromDb(host);
+
+    int tier = host->getTier();
+    if (tier == 0) {
+	DmucsHostState::changeState(host,
+				    DmucsHostStateOverloaded::getInstance());
+    } else {
+	DmucsHostState::changeState(host, DmucsHostStateAvail::getInstance());
+    }
+}
+
+
+void
+DmucsHostStateDraining::unavail(DmucsHost *host)
+{
+    removeFromDb(host);
+    DmucsHostState::changeState(host, DmucsHostStateUnavail::getInstance());
+}
+
+
+void
+DmucsHostStateDraining::addToDb(DmucsHost *host)
+{
+    DmucsDb::getInstance()->addToDrainingDb(host);
+}
+
+
+void
+DmucsHostStateDraining::removeFromDb(DmucsHost *host)
+{
+    DmucsDb::getInstance()->delFromDrainingDb(host);
+}
+
+
+/* ====================================================================== */
+
+
+/* Return the state that asInt() returns "state" for. */
+DmucsHostState *
+DmucsHostState::fromInt(int state)
+{
+    switch (state) {
+    case STATUS_UNAVAILABLE:
+	return DmucsHostStateUnavail::getInstance();
+    case STATUS_OVERLOADED:
+	return DmucsHostStateOverloaded::getInstance();
+    case STATUS_SILENT:
+	return DmucsHostStateSilent::getInstance();
+    case STATUS_UNREACHABLE:
+	return DmucsHostStateUnreachable::getInstance();
+    case STATUS_DRAINING:
+	return DmucsHostStateDraining::getInstance();
+    case STATUS_AVAILABLE:
+    default:
+	return DmucsHostStateAvail::getInstance();
+    }
+}
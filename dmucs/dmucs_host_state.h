@@ -40,6 +40,12 @@
  *   machine is very busy, and shouldn't be used for compiles.
  * o silent -- we got a status "avail" message from the host, but now we
  *   are not getting any load average messages from it.
+ * o unreachable -- we are getting load average messages from the host,
+ *   but its distccd port is not accepting connections.
+ * o draining -- we got a status "drain" message for the host: it gets no
+ *   new leases, and once the compiles on it are done (or its deadline has
+ *   passed) it is made unavailable.  A status "up" message puts it back in
+ *   service instead.
  */
 
 class DmucsHostState
@@ -49,11 +55,15 @@ public:
     virtual void unavail(DmucsHost *host) {}
     virtual void silent(DmucsHost *host) {}
     virtual void overloaded(DmucsHost *host) {}
+    virtual void unreachable(DmucsHost *host) {}
+    virtual void drain(DmucsHost *host) {}
     virtual void addToDb(DmucsHost *host) {}
     virtual void removeFromDb(DmucsHost *host) {}
     virtual const char *dump() { return "Unknown"; }
     virtual int asInt() { return (int) STATUS_UNKNOWN; }
 
+    static DmucsHostState *fromInt(int state);
+
 protected:
     void changeState(DmucsHost *host, DmucsHostState *newState) {
 	host->changeState(newState);
@@ -67,6 +77,8 @@ public:
     virtual void unavail(DmucsHost *host);
     virtual void silent(DmucsHost *host);
     virtual void overloaded(DmucsHost *host);
+    virtual void unreachable(DmucsHost *host);
+    virtual void drain(DmucsHost *host);
     virtual int asInt() { return (int) STATUS_AVAILABLE; }
     virtual void addToDb(DmucsHost *host);
     virtual void removeFromDb(DmucsHost *host);
@@ -84,6 +96,7 @@ class DmucsHostStateUnavail : public DmucsHostState
 {
 public:
     virtual void avail(DmucsHost *host);
+    virtual void drain(DmucsHost *host);
     virtual int asInt() { return (int) STATUS_UNAVAILABLE; }
     virtual void addToDb(DmucsHost *host);
     virtual void removeFromDb(DmucsHost *host);
@@ -102,6 +115,7 @@ class DmucsHostStateSilent : public DmucsHostState
 public:
     virtual void avail(DmucsHost *host);
     virtual void unavail(DmucsHost *host);
+    virtual void drain(DmucsHost *host);
     virtual int asInt() { return (int) STATUS_SILENT; };
     virtual void addToDb(DmucsHost *host);
     virtual void removeFromDb(DmucsHost *host);
@@ -121,6 +135,8 @@ public:
     virtual void avail(DmucsHost *host);
     virtual void unavail(DmucsHost *host);
     virtual void silent(DmucsHost *host);
+    virtual void unreachable(DmucsHost *host);
+    virtual void drain(DmucsHost *host);
     virtual int asInt() { return (int) STATUS_OVERLOADED; }
     virtual void addToDb(DmucsHost *host);
     virtual void removeFromDb(DmucsHost *host);
@@ -134,5 +150,43 @@ private:
     static DmucsHostStateOverloaded *instance_;
 };
 
+class DmucsHostStateUnreachable : public DmucsHostState
+{
+public:
+    virtual void avail(DmucsHost *host);
+    virtual void unavail(DmucsHost *host);
+    virtual void silent(DmucsHost *host);
+    virtual void drain(DmucsHost *host);
+    virtual int asInt() { return (int) STATUS_UNREACHABLE; }
+    virtual void addToDb(DmucsHost *host);
+    virtual void removeFromDb(DmucsHost *host);
+    virtual const char *dump() { return "Unreachable"; }
+
+    static DmucsHostStateUnreachable *getInstance();
+
+private:
+    DmucsHostStateUnreachable() {}
+    
+    static DmucsHostStateUnreachable *instance_;
+};
+
+class DmucsHostStateDraining : public DmucsHostState
+{
+public:
+    virtual void avail(DmucsHost *host);
+    virtual void unavail(DmucsHost *host);
+    virtual int asInt() { return (int) STATUS_DRAINING; }
+    virtual void addToDb(DmucsHost *host);
+    virtual void removeFromDb(DmucsHost *host);
+    virtual const char *dump() { return "Draining"; }
+
+    static DmucsHostStateDraining *getInstance();
+
+private:
+    DmucsHostStateDraining() {}
+    
+    static DmucsHostStateDraining *instance_;
+};
+
 #endif
 
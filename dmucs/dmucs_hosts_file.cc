@@ -68,9 +68,12 @@ DmucsHostsFile::readFileIntoDb() const
     for (int lineno = 1; ; lineno++) {
 
 	/*
-	 * Each line is: machine-or-ipaddr numcpus power-index.
-	 * Comment lines start with #, and these are skipped.  Lines
-	 * containing only whitespace are also skipped.
+	 * Each line is: machine-or-ipaddr numcpus power-index [mem-MB
+	 * [slots]].  Comment lines start with #, and these are skipped.
+	 * Lines containing only whitespace are also skipped.  The memory
+	 * is optional: without it (or with 0), the host's agent may tell
+	 * us.  So are the slots: without them (or with 0), the host has
+	 * numcpus times its dprop's "oversubscribe" (see dmucs_host.h).
 	 */
 	char firstChar;
 	instr >> firstChar;		// this will skip empty lines.
@@ -91,9 +94,9 @@ DmucsHostsFile::readFileIntoDb() const
 	std::getline(instr, line);
 
 	char machine[256];
-	int numcpus, powerIndex;
-	if (sscanf(line.c_str(), "%s %d %d", machine, &numcpus,
-		   &powerIndex) != 3) {
+	int numcpus, powerIndex, memMb = 0, slots = 0;
+	if (sscanf(line.c_str(), "%s %d %d %d %d", machine, &numcpus,
+		   &powerIndex, &memMb, &slots) < 3) {
 	    std::cout << "Bad input in line " << lineno << " of file " <<
 		hostsInfoFile_ << std::endl;
 	    break;
@@ -120,7 +123,8 @@ DmucsHostsFile::readFileIntoDb() const
 
 	/* Insert the info into the database of host info. */
 	host_info_db_t::value_type object(in.s_addr,
-					  info_t(numcpus, powerIndex));
+					  info_t(numcpus, powerIndex, memMb,
+						 slots));
 	db_.insert(object);
     }
 }
@@ -128,7 +132,7 @@ DmucsHostsFile::readFileIntoDb() const
 
 bool
 DmucsHostsFile::getDataForHost(const struct in_addr &ipAddr, int *numCpus,
-			       int *powerIndex) const
+			       int *powerIndex, int *memMb, int *slots) const
 {
 	bool found = false;
     if (hasFileChanged()) {
@@ -140,6 +144,8 @@ DmucsHostsFile::getDataForHost(const struct in_addr &ipAddr, int *numCpus,
      */
     *numCpus = 1;
     *powerIndex = 1;
+    *memMb = 0;
+    *slots = 0;
 
     host_info_db_iter_t itr = db_.find(ipAddr.s_addr);
 	if (itr == db_.end())
@@ -151,6 +157,8 @@ DmucsHostsFile::getDataForHost(const struct in_addr &ipAddr, int *numCpus,
     if (itr != db_.end()) {
 		*numCpus = itr->second.numCpus_;
 		*powerIndex = itr->second.powerIndex_;
+		*memMb = itr->second.memMb_;
+		*slots = itr->second.slots_;
 		found = true;
     }
 	return found;
@@ -38,7 +38,7 @@ public:
 
     static DmucsHostsFile *getInstance(const std::string &hostsInfoFile);
     bool getDataForHost(const struct in_addr &ipAddr, int *numCpus,
-			int *powerIndex) const;
+			int *powerIndex, int *memMb, int *slots) const;
 
     /*
      * This class implements the singleton pattern, as only one instance of
@@ -54,16 +54,19 @@ private:
     struct info_t {
 	int numCpus_;
 	int powerIndex_;
-	info_t(int ncpus, int pindex) :
-	    numCpus_(ncpus), powerIndex_(pindex) {};
+	int memMb_;
+	int slots_;
+	info_t(int ncpus, int pindex, int memMb, int slots) :
+	    numCpus_(ncpus), powerIndex_(pindex), memMb_(memMb),
+	    slots_(slots) {};
     };
 
     static DmucsHostsFile *instance_;
     std::string hostsInfoFile_;
 
     /*
-     * This maps an IP address (in 32-bit format) to the pair of values:
-     * numCpus and powerIndex.
+     * This maps an IP address (in 32-bit format) to the values: numCpus,
+     * powerIndex, memMb and slots.
      */
     typedef std::map<unsigned int, info_t> host_info_db_t;
     typedef host_info_db_t::iterator host_info_db_iter_t;
@@ -0,0 +1,295 @@
+/*
+ * dmucs_jobserver.cc: gethost's GNU make jobserver mode.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "dmucs.h"
+#include "dmucs_jobserver.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#ifdef HAVE_SYS_FILIO_H
+#include <sys/filio.h>		// FIONREAD on Solaris.
+#endif
+
+
+extern char **environ;
+
+
+DmucsJobserver::DmucsJobserver(dmucs_client *client, const char *dprop,
+			       int maxCpus) :
+    client_(client), dprop_(dprop), maxCpus_(maxCpus), fd_(-1),
+    idleSince_(0), noAcquireUntil_(0), renewedAt_(0)
+{
+    makeFds_[0] = makeFds_[1] = -1;
+}
+
+
+DmucsJobserver::~DmucsJobserver()
+{
+    cleanup();
+}
+
+
+/*
+ * Run the command as a jobserver client, and return its exit status.
+ */
+int
+DmucsJobserver::run(char *argv[])
+{
+    if (! setup()) {
+	return -1;
+    }
+
+    pid_t child;
+    int err = posix_spawnp(&child, argv[0], NULL, NULL, argv, environ);
+    if (err != 0) {
+	fprintf(stderr, "posix_spawnp %s failed: err %s\n", argv[0],
+		strerror(err));
+	return -1;
+    }
+
+    int status = 0;
+    renewedAt_ = time(NULL);
+    while (waitpid(child, &status, WNOHANG) == 0) {
+	bool gotOne = false;
+	time_t now = time(NULL);
+
+	if (now - renewedAt_ >= DMUCS_JOBSERVER_RENEW) {
+	    renew();
+	    renewedAt_ = now;
+	}
+
+	if (numIdleTokens() > 0) {
+	    if (idleSince_ == 0) {
+		idleSince_ = now;
+	    } else if (now - idleSince_ >= DMUCS_JOBSERVER_IDLE) {
+		release();
+		idleSince_ = now;
+		noAcquireUntil_ = now + DMUCS_JOBSERVER_IDLE;
+	    }
+	} else {
+	    idleSince_ = 0;
+	    if ((int) held_.size() < maxCpus_ && now >= noAcquireUntil_) {
+		gotOne = acquire();
+		if (! gotOne) {
+		    noAcquireUntil_ = now + 1;	// the server is out of cpus.
+		}
+	    }
+	}
+
+	/* Check again soon after adding a token: if make took it, it may
+	   want more. */
+	struct timeval t = { 0L, gotOne ? 10000L : 100000L };
+	select(0, NULL, NULL, NULL, &t);
+    }
+
+    return WEXITSTATUS(status);
+}
+
+
+/*
+ * Make our DISTCC_DIR and the jobserver FIFO in it, and put them in the
+ * environment for the build.
+ */
+bool
+DmucsJobserver::setup()
+{
+    char dir[] = "/tmp/dmucs-jobserver.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+	perror("mkdtemp");
+	return false;
+    }
+    dir_ = dir;
+    fifo_ = dir_ + "/jobserver";
+    if (mkfifo(fifo_.c_str(), 0600) < 0) {
+	perror("mkfifo");
+	return false;
+    }
+
+    /*
+     * Our end is opened read-write first, so that make's ends open without
+     * blocking.  It is a separate open file from make's ends, so it can be
+     * non-blocking without changing how make sees the FIFO.
+     */
+    fd_ = open(fifo_.c_str(), O_RDWR | O_NONBLOCK);
+    makeFds_[0] = open(fifo_.c_str(), O_RDONLY);
+    makeFds_[1] = open(fifo_.c_str(), O_WRONLY);
+    if (fd_ < 0 || makeFds_[0] < 0 || makeFds_[1] < 0) {
+	perror("open jobserver");
+	return false;
+    }
+    fcntl(fd_, F_SETFD, FD_CLOEXEC);
+
+    std::ostringstream makeflags;
+    const char *old = getenv("MAKEFLAGS");
+    if (old != NULL) {
+	makeflags << old << " ";
+    }
+    makeflags << "-j --jobserver-fds=" << makeFds_[0] << "," << makeFds_[1];
+    setenv("MAKEFLAGS", makeflags.str().c_str(), 1);
+    setenv("DISTCC_DIR", dir_.c_str(), 1);
+    unsetenv("DISTCC_HOSTS");		// so distcc reads our hosts file.
+    DMUCS_DEBUG((stderr, "MAKEFLAGS is -->%s<--, DISTCC_DIR is %s\n",
+		 makeflags.str().c_str(), dir_.c_str()));
+
+    writeHostsFile();
+    return true;
+}
+
+
+static int
+removeEntry(const char *path, const struct stat *st, int flag,
+	    struct FTW *ftw)
+{
+    return remove(path);
+}
+
+
+void
+DmucsJobserver::cleanup()
+{
+    if (fd_ >= 0) {
+	close(fd_);
+	close(makeFds_[0]);
+	close(makeFds_[1]);
+	fd_ = -1;
+    }
+    if (! dir_.empty()) {
+	/* distcc leaves its lock and state files in here, too. */
+	nftw(dir_.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+	dir_.clear();
+    }
+}
+
+
+/*
+ * Start the leases on the cpus we hold again.
+ */
+void
+DmucsJobserver::renew()
+{
+    if (client_ == NULL || held_.empty()) {
+	return;
+    }
+    if (dmucs_renew(client_, NULL) < 0) {
+	client_ = NULL;		// keep building with what we have.
+    }
+}
+
+
+/*
+ * Ask the server for one more cpu.  Return false if it has none for us.
+ */
+bool
+DmucsJobserver::acquire()
+{
+    if (client_ == NULL) {
+	return false;
+    }
+
+    dmucs_slot slot;
+    int got = dmucs_acquire(client_, 1, dprop_.c_str(), 0, &slot);
+    if (got < 0) {
+	client_ = NULL;		// keep building with what we have.
+	return false;
+    }
+    if (got == 0) {
+	return false;
+    }
+
+    DMUCS_DEBUG((stderr, "Got %s from the server: %d cpus\n", slot.name,
+		 (int) held_.size() + 1));
+    held_.push_back(slot);
+    writeHostsFile();
+    if (write(fd_, "+", 1) != 1) {
+	perror("write jobserver token");
+    }
+    return true;
+}
+
+
+/*
+ * Take back an unused token, and give a cpu back to the server.
+ */
+void
+DmucsJobserver::release()
+{
+    char token;
+    if (held_.empty() || read(fd_, &token, 1) != 1) {
+	return;			// make got there first.
+    }
+    dmucs_slot slot = held_.back();
+    held_.pop_back();
+    writeHostsFile();
+
+    DMUCS_DEBUG((stderr, "Giving %s back to the server\n", slot.name));
+    if (client_ != NULL && dmucs_release(client_, &slot) < 0) {
+	client_ = NULL;
+    }
+}
+
+
+/*
+ * Write the hosts file distcc reads: each host we hold cpus on, with the
+ * number of them, and localhost.  It is renamed into place, so distcc
+ * never sees it half-written.
+ */
+void
+DmucsJobserver::writeHostsFile()
+{
+    char hosts[BUFSIZ];
+    if (held_.empty() ||
+	dmucs_distcc_hosts(&held_[0], held_.size(), hosts, sizeof(hosts)) < 0) {
+	hosts[0] = '\0';
+    }
+
+    std::string tmp = dir_ + "/hosts.tmp";
+    std::ofstream out(tmp.c_str());
+    out << hosts << (hosts[0] ? " " : "") << "localhost/1" << std::endl;
+    out.close();
+
+    std::string path = dir_ + "/hosts";
+    if (rename(tmp.c_str(), path.c_str()) < 0) {
+	perror("rename hosts file");
+    }
+}
+
+
+/* Return the number of tokens sitting in the jobserver. */
+int
+DmucsJobserver::numIdleTokens()
+{
+    int n = 0;
+    if (ioctl(fd_, FIONREAD, &n) < 0) {
+	return 0;
+    }
+    return n;
+}
@@ -0,0 +1,87 @@
+#ifndef _DMUCS_JOBSERVER_H_
+#define _DMUCS_JOBSERVER_H_ 1
+
+/*
+ * dmucs_jobserver.h: gethost's GNU make jobserver mode.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <string>
+#include <vector>
+#include <time.h>
+#include "libdmucs.h"
+
+
+#define DMUCS_JOBSERVER_IDLE	2	/* give a cpu back to the server when
+					   a token has gone unused for this
+					   many seconds. */
+#define DMUCS_JOBSERVER_RENEW	10	/* renew the leases on the cpus we
+					   hold this often, in seconds: a
+					   lease-time must be longer. */
+
+
+/*
+ * In jobserver mode, gethost runs a whole build (e.g., "make") instead of
+ * one compile.  It holds cpus from the server on a single connection, and
+ * hands make one jobserver token for each one:
+ *
+ * o When make has taken all the tokens, ask the server for another cpu,
+ *   and add a token for it.
+ * o When a token sits unused for DMUCS_JOBSERVER_IDLE seconds, take it
+ *   back and give its cpu back to the server.
+ * o Every DMUCS_JOBSERVER_RENEW seconds, renew the leases on all the cpus
+ *   we hold, so that the server does not take them back from under a
+ *   long build.
+ *
+ * The jobserver is a FIFO passed to make in MAKEFLAGS.  The cpus we hold
+ * are written to the "hosts" file in a private DISTCC_DIR, with the number
+ * of cpus held on each, so distcc runs no more compiles on a host than we
+ * hold cpus for.  localhost is listed too, for the job make runs without a
+ * token.
+ */
+class DmucsJobserver
+{
+public:
+    DmucsJobserver(dmucs_client *client, const char *dprop, int maxCpus);
+    ~DmucsJobserver();
+
+    int run(char *argv[]);
+
+private:
+    dmucs_client *	client_;	// NULL if the server has gone.
+    std::string		dprop_;		// the dprop to ask for.
+    int			maxCpus_;	// the most cpus to hold at once.
+    std::vector<dmucs_slot> held_;	// the cpus we hold.
+    std::string		dir_;		// our DISTCC_DIR.
+    std::string		fifo_;		// the jobserver.
+    int			fd_;		// our end of the jobserver.
+    int			makeFds_[2];	// make's ends: read, write.
+    time_t		idleSince_;	// when tokens started going unused.
+    time_t		noAcquireUntil_;
+    time_t		renewedAt_;	// when we last renewed our leases.
+
+    bool setup();
+    void cleanup();
+    bool acquire();
+    void renew();
+    void release();
+    void writeHostsFile();
+    int numIdleTokens();
+};
+
+#endif
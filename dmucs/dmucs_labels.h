@@ -0,0 +1,163 @@
+#ifndef _DMUCS_LABELS_H_
+#define _DMUCS_LABELS_H_ 1
+
+/*
+ * dmucs_labels.h: dprops as sets of labels, and host requests as
+ * predicates over them.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * A host's dprop is a set of labels, "<label>[,<label> ...]": a host that
+ * loadavg reports as "linux-x86_64,linux-generic" can take the jobs of
+ * either kind.  A host request's dprop is a predicate over the labels:
+ * the labels the host must have, and "!<label>" for those it must not.
+ * So "gethost -t linux-generic" may be given any host that has that
+ * label, whatever else it has.
+ *
+ * The empty dprop is the default pool, as before: a request with no
+ * dprop matches only the hosts that have no labels.
+ */
+
+#include <string>
+#include <vector>
+#include "dmucs_dprop.h"
+
+
+typedef std::vector<std::string> DmucsLabels;
+
+
+/* Split a dprop (or a predicate) into its labels. */
+inline DmucsLabels
+dprop2labels(const DmucsDprop &dprop)
+{
+    DmucsLabels labels;
+    std::string::size_type start = 0;
+    while (start <= dprop.size()) {
+	std::string::size_type comma = dprop.find(',', start);
+	if (comma == std::string::npos) {
+	    comma = dprop.size();
+	}
+	if (comma > start) {
+	    labels.push_back(dprop.substr(start, comma - start));
+	}
+	start = comma + 1;
+    }
+    return labels;
+}
+
+
+/*
+ * Return true if a host with the dprop "dprop" satisfies the predicate
+ * "pred".  The server uses a DmucsBitset index instead; this is for a
+ * few dprops at a time.
+ */
+inline bool
+dpropMatches(const DmucsDprop &dprop, const DmucsDprop &pred)
+{
+    if (pred.empty()) {
+	return dprop.empty();
+    }
+    DmucsLabels have = dprop2labels(dprop);
+    DmucsLabels want = dprop2labels(pred);
+    for (DmucsLabels::iterator itr = want.begin(); itr != want.end(); ++itr) {
+	bool negated = ((*itr)[0] == '!');
+	std::string label = negated ? itr->substr(1) : *itr;
+	bool found = false;
+	for (DmucsLabels::iterator h = have.begin(); h != have.end(); ++h) {
+	    if (*h == label) {
+		found = true;
+		break;
+	    }
+	}
+	if (found == negated) {
+	    return false;
+	}
+    }
+    return true;
+}
+
+
+/*
+ * A set of small non-negative integers, as a bit per integer, so that
+ * intersecting two sets is an AND of a word at a time.
+ */
+class DmucsBitset
+{
+public:
+    void set(unsigned int i) {
+	if (i / WORD_BITS >= words_.size()) {
+	    words_.resize(i / WORD_BITS + 1, 0UL);
+	}
+	words_[i / WORD_BITS] |= (1UL << (i % WORD_BITS));
+    }
+    bool test(unsigned int i) const {
+	return i / WORD_BITS < words_.size() &&
+	    (words_[i / WORD_BITS] & (1UL << (i % WORD_BITS))) != 0;
+    }
+    /* Make this the set of 0 .. n-1. */
+    void fill(unsigned int n) {
+	words_.assign((n + WORD_BITS - 1) / WORD_BITS, ~0UL);
+	if (n % WORD_BITS != 0) {
+	    words_.back() = (1UL << (n % WORD_BITS)) - 1;
+	}
+    }
+    void intersect(const DmucsBitset &other) {
+	if (words_.size() > other.words_.size()) {
+	    words_.resize(other.words_.size());
+	}
+	for (unsigned int w = 0; w < words_.size(); w++) {
+	    words_[w] &= other.words_[w];
+	}
+    }
+    void subtract(const DmucsBitset &other) {
+	for (unsigned int w = 0;
+	     w < words_.size() && w < other.words_.size(); w++) {
+	    words_[w] &= ~other.words_[w];
+	}
+    }
+    bool any() const {
+	for (unsigned int w = 0; w < words_.size(); w++) {
+	    if (words_[w] != 0) {
+		return true;
+	    }
+	}
+	return false;
+    }
+    /* Return the first member that is >= i, or -1 if there is none. */
+    int next(unsigned int i) const {
+	for (unsigned int w = i / WORD_BITS; w < words_.size(); w++) {
+	    unsigned long bits = words_[w];
+	    if (w == i / WORD_BITS) {
+		bits &= ~0UL << (i % WORD_BITS);
+	    }
+	    for (unsigned int b = 0; bits != 0; b++, bits >>= 1) {
+		if (bits & 1UL) {
+		    return w * WORD_BITS + b;
+		}
+	    }
+	}
+	return -1;
+    }
+
+private:
+    enum { WORD_BITS = 8 * sizeof(unsigned long) };
+    std::vector<unsigned long> words_;
+};
+
+#endif
@@ -21,7 +21,12 @@
 #include "dmucs.h"
 #include "dmucs_msg.h"
 #include "dmucs_db.h"
+#include "dmucs_repl.h"
+#include "dmucs_peers.h"
+#include "dmucs_fair.h"
+#include "dmucs_admin.h"
 #include <exception>
+#include <sstream>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -37,6 +42,20 @@ extern std::string hostsInfoFile;
 class DmucsBadMsg : public std::exception {};
 
 
+/* The number of slots of the host of a cpu given out, or 0. */
+static int
+getNumSlots(unsigned int cpuIpAddr, const DmucsDprop &dprop)
+{
+    struct in_addr in;
+    in.s_addr = cpuIpAddr;
+    try {
+	return DmucsDb::getInstance()->getHost(in, dprop)->getNumSlots();
+    } catch (DmucsHostNotFound &e) {
+	return 0;
+    }
+}
+
+
 
 DmucsMsg *
 DmucsMsg::parseMsg(Socket *sock, const char *buffer)
@@ -48,53 +67,92 @@ DmucsMsg::parseMsg(Socket *sock, const char *buffer)
 
     /*
      * The first word in the buffer must be one of: "host", "load",
-     * "status", or "monitor".
+     * "status", "monitor", "done", "release", "renew", "claim",
+     * "replicate", "peer", or "admin".
      */
     if (strncmp(buffer, "host", 4) == 0) {
-        /* The string is "host <clientIpAddr> [<typeStr>]" where the
-           typeStr is an optional string that is the distinguishing property
-           of the host the client wants. */
-        char cliIpStr[64];
-	int res = sscanf(buffer, "host %s %s", cliIpStr, dpropstr);
-	if (res != 2 && res != 1) {
+        /* The string is "host <clientIpAddr> [<typeStr>] [<name>=<value>
+	   ...]" where the typeStr is an optional string that is the
+	   distinguishing property of the host the client wants, and the
+	   name=value words are options for the request. */
+	std::istringstream instr(buffer);
+	std::string word, cliIpStr, dprop;
+	instr >> word >> cliIpStr;
+	if (cliIpStr.empty()) {
 	    fprintf(stderr, "Got a bad host request message ->%s<--\n",buffer);
 	    return NULL;
 	}
-	return new DmucsHostReqMsg(clientIp, dpropstr);
+	DmucsCpuReq req;
+	while (instr >> word) {
+	    std::string::size_type eq = word.find('=');
+	    if (eq == std::string::npos) {
+		dprop = word.substr(0, DPROP_MAX_STRLEN);
+	    } else if (!req.setOption(word.substr(0, eq), word.substr(eq + 1))) {
+		DMUCS_DEBUG((stderr, "Ignoring host request option %s\n",
+			     word.c_str()));
+	    }
+	}
+	return new DmucsHostReqMsg(clientIp, dprop, req);
     } else if (strncmp(buffer, "load", 4) == 0) {
 
 	/* The buffer must hold:
 	 * load <host-IP-address> <3 floating pt numbers>
-	 * followed by an optional <dprop>.
+	 * followed by an optional <dprop>, and an optional mem=<MB>, the
+	 * host's memory.
 	 */
 	char machname[64];
 	float ldavg1, ldavg5, ldavg10;
-        if (sscanf(buffer, "load %s %f %f %f %s", machname, &ldavg1,
-                   &ldavg5, &ldavg10, dpropstr) != 5) {
-            if (sscanf(buffer, "load %s %f %f %f", machname, &ldavg1,
-                       &ldavg5, &ldavg10) != 4) {
-                fprintf(stderr, "Got a bad load avg msg!!!\n");
-		return NULL;
+	int n = 0;
+        if (sscanf(buffer, "load %63s %f %f %f %n", machname, &ldavg1,
+                   &ldavg5, &ldavg10, &n) != 4 || n == 0) {
+	    fprintf(stderr, "Got a bad load avg msg!!!\n");
+	    return NULL;
+	}
+	std::istringstream instr(buffer + n);
+	std::string word;
+	int memMb = 0;
+	while (instr >> word) {
+	    if (word.compare(0, 4, "mem=") == 0) {
+		memMb = atoi(word.c_str() + 4);
+	    } else {
+		strncpy(dpropstr, word.c_str(), DPROP_MAX_STRLEN);
+		dpropstr[DPROP_MAX_STRLEN] = '\0';
 	    }
 	}
 	struct in_addr host;
 	host.s_addr = inet_addr(machname);
 	DMUCS_DEBUG((stderr, "host %s: ldAvg1 %2.2f, ldAvg5 %2.2f, "
-		     "ldAvg10 %2.2f, dprop '%s'\n",
-		     machname, ldavg1, ldavg5, ldavg10, dpropstr));
+		     "ldAvg10 %2.2f, dprop '%s', mem %d MB\n",
+		     machname, ldavg1, ldavg5, ldavg10, dpropstr, memMb));
 	return new DmucsLdAvgMsg(clientIp, host,
-				  ldavg1, ldavg5, ldavg10, dpropstr);
+				  ldavg1, ldavg5, ldavg10, dpropstr, memMb);
     } else if (strncmp(buffer, "status", 6) == 0) {
 	/* The buffer must hold:
-	 * status <host-IP-address> up|down [<dprop>]
+	 * status <host-IP-address> up|down|drain [<dprop>]
+	 * followed, for drain, by an optional deadline=<secs> and an
+	 * optional wait=1.
 	 * NOTE: the host-IP-address MUST be in "dot-notation".
 	 */
 	char machname[64];
 	char state[10];
-        if (sscanf(buffer, "status %s %s %s", machname, state, dpropstr)!= 3){
-            if (sscanf(buffer, "status %s %s", machname, state) != 2) {
-                fprintf(stderr, "Got a bad status msg!!!\n");
-                return NULL;
+	int n = 0;
+	if (sscanf(buffer, "status %63s %9s %n", machname, state, &n) != 2 ||
+	    n == 0) {
+	    fprintf(stderr, "Got a bad status msg!!!\n");
+	    return NULL;
+	}
+	std::istringstream instr(buffer + n);
+	std::string word;
+	int drainSecs = 0;
+	bool wait = false;
+	while (instr >> word) {
+	    if (word.compare(0, 9, "deadline=") == 0) {
+		drainSecs = atoi(word.c_str() + 9);
+	    } else if (word.compare(0, 5, "wait=") == 0) {
+		wait = (atoi(word.c_str() + 5) != 0);
+	    } else {
+		strncpy(dpropstr, word.c_str(), DPROP_MAX_STRLEN);
+		dpropstr[DPROP_MAX_STRLEN] = '\0';
 	    }
 	}
 	fprintf(stderr, "machname %s, state %s, dprop '%s'\n",
@@ -106,12 +164,88 @@ DmucsMsg::parseMsg(Socket *sock, const char *buffer)
 	    status = STATUS_AVAILABLE;
 	} else if (strncmp(state, "down", 4) == 0) {
 	    status = STATUS_UNAVAILABLE;
+	} else if (strncmp(state, "drain", 5) == 0) {
+	    status = STATUS_DRAINING;
 	} else {
 	    fprintf(stderr, "got unknown state %s\n", state);
 	}
-	return new DmucsStatusMsg(clientIp, host, status, dpropstr);
+	return new DmucsStatusMsg(clientIp, host, status, dpropstr,
+				  drainSecs, wait);
     } else if (strncmp(buffer, "monitor", 7) == 0) {
 	return new DmucsMonitorReqMsg(clientIp, dpropstr);
+    } else if (strncmp(buffer, "release", 7) == 0) {
+	/* The buffer must hold:
+	 * release <host-IP-address>
+	 */
+	char machname[64];
+	if (sscanf(buffer, "release %63s", machname) != 1) {
+	    fprintf(stderr, "Got a bad release msg!!!\n");
+	    return NULL;
+	}
+	struct in_addr host;
+	host.s_addr = inet_addr(machname);
+	return new DmucsReleaseMsg(clientIp, host);
+    } else if (strncmp(buffer, "admin", 5) == 0) {
+	/* The buffer must hold:
+	 * admin <operation>[; <operation> ...]
+	 * or
+	 * admin commit
+	 */
+	std::istringstream instr(buffer + 5);
+	std::string word;
+	if (!(instr >> word)) {
+	    fprintf(stderr, "Got a bad admin msg!!!\n");
+	    return NULL;
+	}
+	if (word == "commit" && !(instr >> word)) {
+	    return new DmucsAdminMsg(clientIp, "");
+	}
+	return new DmucsAdminMsg(clientIp, buffer + 5);
+    } else if (strncmp(buffer, "claim", 5) == 0) {
+	/* The buffer must hold:
+	 * claim <host-IP-address>
+	 */
+	char machname[64];
+	if (sscanf(buffer, "claim %63s", machname) != 1) {
+	    fprintf(stderr, "Got a bad claim msg!!!\n");
+	    return NULL;
+	}
+	struct in_addr host;
+	host.s_addr = inet_addr(machname);
+	return new DmucsClaimMsg(clientIp, host);
+    } else if (strncmp(buffer, "replicate", 9) == 0) {
+	return new DmucsReplicateMsg(clientIp);
+    } else if (strncmp(buffer, "peer", 4) == 0) {
+	return new DmucsPeerMsg(clientIp);
+    } else if (strncmp(buffer, "renew", 5) == 0) {
+	/* The buffer must hold:
+	 * renew [<host-IP-address>]
+	 */
+	char machname[64];
+	unsigned int hostIp = 0;
+	if (sscanf(buffer, "renew %63s", machname) == 1) {
+	    hostIp = inet_addr(machname);
+	}
+	return new DmucsRenewMsg(clientIp, hostIp);
+    } else if (strncmp(buffer, "done", 4) == 0) {
+	/* The buffer must hold:
+	 * done <exit-status> <fell-back> [<msecs> <bytes> [<host-IP>]]
+	 * where fell-back is 1 if distcc could not use the host it was
+	 * given, and the compile was done locally instead.  msecs is how
+	 * long the compile took, and bytes the size of the source file.
+	 */
+	int exitStatus, fellBack, msecs = 0;
+	long bytes = 0;
+	char machname[64];
+	machname[0] = '\0';
+	if (sscanf(buffer, "done %d %d %d %ld %63s", &exitStatus, &fellBack,
+		   &msecs, &bytes, machname) < 2) {
+	    fprintf(stderr, "Got a bad done msg!!!\n");
+	    return NULL;
+	}
+	unsigned int hostIp = (machname[0] == '\0') ? 0 : inet_addr(machname);
+	return new DmucsDoneMsg(clientIp, exitStatus, fellBack != 0,
+				msecs, bytes, hostIp);
     }
 
     fprintf(stderr, "request not recognized: ->%s<-\n", buffer);
@@ -124,17 +258,57 @@ DmucsHostReqMsg::handle(Socket *sock, const char *buf)
 {
     DMUCS_DEBUG((stderr, "Got host request: -->%s<--\n", buf));
 
+    if (req_.hedge_ != 0 && !req_.fromPeer_) {
+	handleHedge(sock);
+	return;
+    }
+    if (req_.gang_ > 1 && !req_.fromPeer_) {
+	handleGang(sock);
+	return;
+    }
+
     DmucsDb *db = DmucsDb::getInstance();
     unsigned int cpuIpAddr = 0;
+    std::string resolved_name;
+    DmucsDprop dprop = dprop_;	// the request's labels, then the host's.
+    DmucsFairShare *fair = DmucsFairShare::getInstance();
+    bool overQuota = false;
+    bool noneFree = false;	// and not just held for others.
 
     try {
-	cpuIpAddr = db->getBestAvailCpu(dprop_);
-	std::string resolved_name =
-	    DmucsHost::resolveIp2Name(cpuIpAddr, dprop_);
+	/* A peer may only have the cpus we don't keep back for our own
+	   clients. */
+	if (req_.fromPeer_ && !fair->admitPeer(dprop_, req_)) {
+	    throw DmucsNoMoreHosts();
+	}
+	/* The user, or client machine, may be over its quota, or the free
+	   cpus may be held for others who have been waiting, or for
+	   higher classes (a peer's requests are limited by admitPeer()
+	   only). */
+	if (!req_.fromPeer_ &&
+	    !fair->admit(sock, clientIp_, dprop_, req_, overQuota)) {
+	    if (overQuota) {
+		fprintf(stderr, "Client %s is over its quota\n",
+			inet_ntoa(clientIp_));
+	    } else if (db->getNumFreeCpus(dprop_) > 0) {
+		fprintf(stderr, "The free cpus in db \"%s\" are held for "
+			"others\n", dprop2cstr(dprop_));
+	    } else {
+		noneFree = true;
+	    }
+	    throw DmucsNoMoreHosts();
+	}
+	cpuIpAddr = db->getBestAvailCpu(dprop, req_);
+	if (cpuIpAddr == 0) {
+	    noneFree = true;
+	    throw DmucsNoMoreHosts();	// no host has the labels.
+	}
+	resolved_name = DmucsHost::resolveIp2Name(cpuIpAddr, dprop);
 
 	fprintf(stderr, "Giving out %s\n", resolved_name.c_str());
 
-	db->assignCpuToClient(cpuIpAddr, dprop_, sock);
+	db->assignCpuToClient(cpuIpAddr, dprop, sock, req_.mem_);
+	fair->granted(sock, dprop_);
 #if 0
 	fprintf(stderr, "The databases are now:\n");
 	db->dump();
@@ -152,9 +326,170 @@ DmucsHostReqMsg::handle(Socket *sock, const char *buf)
 	// Send 0.0.0.0 to the client.
     }
 
+    /* Borrow a cpu from the server of another site, if one has any: it
+       sends the reply.  Only when we have no cpu free for the request,
+       though: a client over its quota may not borrow, nor one whose
+       class may not have the cpus we keep back, or who must wait its
+       turn for the cpus we hold for others. */
+    if (cpuIpAddr == 0 && !req_.fromPeer_ && noneFree &&
+	DmucsPeers::getInstance()->borrow(sock, clientIp_, dprop_, req_)) {
+	fair->granted(sock, dprop_);
+	return;
+    }
+    if (cpuIpAddr == 0 && !req_.fromPeer_ && !overQuota &&
+	!lacksMemory()) {
+	fair->waiting(sock, dprop_);
+    }
+
+    /*
+     * The reply is "<ip-address> [<name>=<value> ...]".  Older clients
+     * only look at the address.  The values tell newer clients:
+     * o name=<hostname>: the host's name, so the client need not look
+     *   it up.
+     * o done=1: send a "done" message when the compile is over.
+     * o slots=<n>: the compiles the host may run at once, for
+     *   DISTCC_HOSTS (see dmucs_host.h).
+     * o hedge=<msecs>: the compile may ask for a hedge if it runs longer
+     *   than this (see dmucs_db.h).
+     */
+    struct in_addr c;
+    c.s_addr = cpuIpAddr;
+    std::ostringstream reply;
+    reply << inet_ntoa(c);
+    if (cpuIpAddr != 0) {
+	reply << " name=" << resolved_name << " done=1 slots=" <<
+	    getNumSlots(cpuIpAddr, dprop);
+	int hedgeMsecs = req_.fromPeer_ ? 0 : db->getHedgeMsecs(dprop);
+	if (hedgeMsecs > 0) {
+	    reply << " hedge=" << hedgeMsecs;
+	}
+    }
+    Sputs((char *) reply.str().c_str(), sock);
+}
+
+
+/*
+ * A request for a hedge: a second cpu, on another host, to race the
+ * compile the client is running on req_.hedge_.  The reply is in the same
+ * form as for a first cpu, or 0.0.0.0 if the client may not have one, and
+ * it then just waits for its compile.  A hedge is never borrowed from a
+ * peer.
+ */
+void
+DmucsHostReqMsg::handleHedge(Socket *sock)
+{
+    DmucsDb *db = DmucsDb::getInstance();
+    DmucsDprop dprop = dprop_;
+    unsigned int cpuIpAddr = 0;
+
+    if (DmucsFairShare::getInstance()->admitHedge(sock, clientIp_, dprop_,
+						  req_)) {
+	cpuIpAddr = db->getHedgeCpu(sock, dprop, req_);
+    }
+    if (cpuIpAddr == 0) {
+	fprintf(stderr, "No hedge for %s in db \"%s\"\n",
+		inet_ntoa(clientIp_), dprop2cstr(dprop_));
+	Sputs((char *) "0.0.0.0", sock);
+	return;
+    }
+
+    std::string name = DmucsHost::resolveIp2Name(cpuIpAddr, dprop);
+    fprintf(stderr, "Giving out %s (hedge)\n", name.c_str());
+    db->assignCpuToClient(cpuIpAddr, dprop, sock, req_.mem_, true);
+
     struct in_addr c;
     c.s_addr = cpuIpAddr;
-    Sputs(inet_ntoa(c), sock);
+    std::ostringstream reply;
+    reply << inet_ntoa(c) << " name=" << name << " done=1 slots=" <<
+	getNumSlots(cpuIpAddr, dprop);
+    Sputs((char *) reply.str().c_str(), sock);
+}
+
+
+/*
+ * Are there free cpus enough for the request, but not on hosts with the
+ * memory it needs?  Then it is not counted as waiting: holding the cpus
+ * that come free for it would only keep them from the others.
+ */
+bool
+DmucsHostReqMsg::lacksMemory()
+{
+    DmucsDb *db = DmucsDb::getInstance();
+    if (req_.mem_ <= 0 || db->getNumFreeCpus(dprop_) < req_.gang_ ||
+	db->getNumFreeCpus(dprop_, req_.mem_) >= req_.gang_) {
+	return false;
+    }
+    fprintf(stderr, "Not enough free cpus in db \"%s\" have %d MB of "
+	    "memory to spare\n", dprop2cstr(dprop_), req_.mem_);
+    return true;
+}
+
+
+/*
+ * A request for a gang of cpus: give the client all of them at once, or
+ * none.  The reply is a record for each cpu, in the same form as for one,
+ * and the first also has "gang=<n>", the number of records.  A gang is
+ * never borrowed from a peer.
+ */
+void
+DmucsHostReqMsg::handleGang(Socket *sock)
+{
+    DmucsDb *db = DmucsDb::getInstance();
+    DmucsFairShare *fair = DmucsFairShare::getInstance();
+    DmucsDb::dmucs_gang_t gang;
+    bool overQuota = false;
+
+    try {
+	if (! db->canFitGang(dprop_, req_)) {
+	    fprintf(stderr, "A gang of %d cpus will never fit in db "
+		    "\"%s\"\n", req_.gang_, dprop2cstr(dprop_));
+	} else if (! fair->admit(sock, clientIp_, dprop_, req_,
+				 overQuota)) {
+	    if (overQuota) {
+		fprintf(stderr, "Client %s is over its quota\n",
+			inet_ntoa(clientIp_));
+	    }
+	} else if (! db->getGang(dprop_, req_, gang)) {
+	    fprintf(stderr, "!!!!!   No gang of %d free in db \"%s\"   "
+		    "!!!!!\n", req_.gang_, dprop2cstr(dprop_));
+	    if (! lacksMemory()) {
+		fair->waiting(sock, dprop_);
+	    }
+	}
+    } catch (DmucsNoMoreHosts &e) {
+        fprintf(stderr, "!!!!!      Out of hosts in db \"%s\"   !!!!!\n",
+		dprop2cstr(dprop_));
+	gang.clear();
+    } catch (...) {
+	fprintf(stderr, "!!!!!  Some other error: %s!!!!!\n",
+		strerror(errno));
+	gang.clear();
+    }
+    if (gang.empty()) {
+	Sputs((char *) "0.0.0.0", sock);
+	return;
+    }
+
+    for (unsigned int i = 0; i < gang.size(); i++) {
+	db->assignCpuToClient(gang[i].second, gang[i].first, sock,
+			      req_.mem_);
+    }
+    fair->granted(sock, dprop_);
+
+    for (unsigned int i = 0; i < gang.size(); i++) {
+	std::string name = DmucsHost::resolveIp2Name(gang[i].second,
+						     gang[i].first);
+	fprintf(stderr, "Giving out %s (gang)\n", name.c_str());
+	struct in_addr c;
+	c.s_addr = gang[i].second;
+	std::ostringstream reply;
+	reply << inet_ntoa(c) << " name=" << name << " done=1 slots=" <<
+	    getNumSlots(gang[i].second, gang[i].first);
+	if (i == 0) {
+	    reply << " gang=" << gang.size();
+	}
+	Sputs((char *) reply.str().c_str(), sock);
+    }
 }
 
 
@@ -170,6 +505,7 @@ DmucsLdAvgMsg::handle(Socket *sock, const char *buf)
     try {
 		host = db->getHost(host_, dprop_);
 		hostname = host->getName();
+		host->setMemMb(memMb_);
         host->updateTier(ldAvg1_, ldAvg5_, ldAvg10_);
 		/* If the host hasn't been explicitly made unavailable,
 		 then make it available.  If the host is overloaded
@@ -183,6 +519,7 @@ DmucsLdAvgMsg::handle(Socket *sock, const char *buf)
 		if(host)
 		{
 			hostname = host->getName();
+			host->setMemMb(memMb_);
 			host->updateTier(ldAvg1_, ldAvg5_, ldAvg10_);
 			fprintf(stderr, "New host available: %s/%d, tier %d, type %s\n",
 					host->getName().c_str(), host->getNumCpus(), host->getTier(),
@@ -221,6 +558,28 @@ DmucsStatusMsg::handle(Socket *sock, const char *buf)
 			 inet_ntoa(host_), dprop2cstr(dprop_)));
 	    DmucsHost::createHost(host_, dprop_, hostsInfoFile);
 	}
+    } else if (status_ == STATUS_DRAINING) {
+	DmucsHost *host;
+	try {
+	    host = db->getHost(host_, dprop_);
+	} catch (...) {
+	    fprintf(stderr, "Can't drain %s: no such host in db \"%s\"\n",
+		    inet_ntoa(host_), dprop2cstr(dprop_));
+	    if (wait_) {
+		Sputs((char *) "unknown", sock);
+	    }
+	    removeFd(sock);
+	    return;
+	}
+	/* Keep the connection until the host is drained, if asked to -- the
+	   event loop sends the reply (see DmucsDb::drainEnded()). */
+	if (wait_) {
+	    db->waitForDrain(host, sock);
+	}
+	host->drain(drainSecs_ > 0 ? time(NULL) + drainSecs_ : 0);
+	if (wait_) {
+	    return;
+	}
     } else {    // status is unavailable.
 		try {
 			db->getHost(host_, dprop_)->unavail();
@@ -230,6 +589,111 @@ DmucsStatusMsg::handle(Socket *sock, const char *buf)
     removeFd(sock);
 }
 
+void
+DmucsDoneMsg::handle(Socket *sock, const char *buf)
+{
+    DMUCS_DEBUG((stderr, "Got done mesg: exit %d, fell back %d, "
+		 "%d msecs, %ld bytes\n", exitStatus_, fellBack_, msecs_,
+		 bytes_));
+
+    /* A borrowed cpu's host is the peer's to learn about. */
+    if (DmucsPeers::getInstance()->done(sock, hostIp_, exitStatus_,
+					fellBack_, msecs_, bytes_)) {
+	return;
+    }
+
+    DmucsDb *db = DmucsDb::getInstance();
+    db->recordOutcome(sock, hostIp_, fellBack_);
+
+    /* Only a compile that worked, on the host we gave out, tells us how
+       long compiles take, and (if we know the size of its source) how
+       fast that host is. */
+    if (!fellBack_ && exitStatus_ == 0 && msecs_ > 0) {
+	db->recordTiming(sock, hostIp_, msecs_, bytes_);
+    }
+
+    /* The client closes the connection next, and that is when the cpu is
+       released -- so leave the socket alone. */
+}
+
+
+void
+DmucsReleaseMsg::handle(Socket *sock, const char *buf)
+{
+    DMUCS_DEBUG((stderr, "Got release mesg for %s\n", inet_ntoa(host_)));
+
+    if (! DmucsDb::getInstance()->releaseCpu(sock, host_.s_addr) &&
+	! DmucsPeers::getInstance()->release(sock, host_.s_addr)) {
+	fprintf(stderr, "Client released %s, which it did not hold\n",
+		inet_ntoa(host_));
+    }
+    /* The client keeps its connection, and its other cpus. */
+}
+
+
+/*
+ * Add the operations to the connection's batch -- the client sends the
+ * next ones, or the commit, on the same connection.  The commit gets the
+ * reply, after which the connection is closed.
+ */
+void
+DmucsAdminMsg::handle(Socket *sock, const char *buf)
+{
+    DmucsAdmin *admin = DmucsAdmin::getInstance();
+    if (!ops_.empty()) {
+	admin->add(sock, ops_.c_str());
+	return;
+    }
+    std::string reply = admin->commit(sock);
+    DMUCS_DEBUG((stderr, "Admin commit: %s\n", reply.c_str()));
+    Sputs((char *) reply.c_str(), sock);
+    removeFd(sock);
+}
+
+
+void
+DmucsRenewMsg::handle(Socket *sock, const char *buf)
+{
+    DMUCS_DEBUG((stderr, "Got renew mesg\n"));
+
+    bool renewed = DmucsDb::getInstance()->renewLease(sock, hostIp_);
+    if (DmucsPeers::getInstance()->renew(sock, hostIp_)) {
+	renewed = true;
+    }
+    if (! renewed) {
+	fprintf(stderr, "Client renewed a lease it did not hold\n");
+    }
+}
+
+
+void
+DmucsClaimMsg::handle(Socket *sock, const char *buf)
+{
+    DMUCS_DEBUG((stderr, "Got claim mesg for %s\n", inet_ntoa(host_)));
+
+    if (! DmucsDb::getInstance()->claimLease(sock, host_.s_addr)) {
+	fprintf(stderr, "Client claimed %s, which has no orphaned lease\n",
+		inet_ntoa(host_));
+    }
+}
+
+
+void
+DmucsReplicateMsg::handle(Socket *sock, const char *buf)
+{
+    /* The connection stays open: the db goes down it from now on. */
+    DmucsReplicator::getInstance()->addStandby(sock);
+}
+
+
+void
+DmucsPeerMsg::handle(Socket *sock, const char *buf)
+{
+    /* The connection stays open: our free cpus are sent down it. */
+    DmucsPeers::getInstance()->addBorrower(sock);
+}
+
+
 void
 DmucsMonitorReqMsg::handle(Socket *sock, const char *buf)
 {
@@ -34,15 +34,55 @@ enum dmucs_req_t {
 /*
  * Format of packets that come in to the dmucs server:
  *
- * o host request:   "host <client IP address>
- * o load average:   "load <host IP address> <3 floating pt numbers>"
+ * o host request:   "host <client IP address> [<dprop>]
+ *		     [<name>=<value> ...]"  (the options are in
+ *		     dmucs_cpu_req.h)
+ * o load average:   "load <host IP address> <3 floating pt numbers>
+ *		     [<dprop>] [mem=<MB>]"  (the host's memory, from newer
+ *		     agents -- see dmucs_host.h)
  * o status message: "status <host IP address> up|down [n <numCpus>]
  *		[p <powerIndex>]"
+ *		     or "status <host IP address> drain [<dprop>]
+ *		     [deadline=<secs>] [wait=1]"  (the host gets no more
+ *		     compiles, and is taken out when those on it are done,
+ *		     or at the deadline.  With wait=1 the connection is
+ *		     kept, and gets "drained <#compiles left on it>" then,
+ *		     or "cancelled" if the host is put back first.)
  * o monistor req:   "monitor <client IP address>"
+ * o done message:   "done <exit status> <fell back: 0|1>
+ *		     [<wall msecs> <source bytes> [<host IP address>]]"
+ *		     (the host is only needed from a client that holds
+ *		     more than one cpu, like the hostbroker, or a gethost
+ *		     racing its compile on a hedge) (sent by the
+ *		     gethost client on its host request connection, when
+ *		     its compile is done, before it closes the connection,
+ *		     if the host reply had "done=1" in it)
+ * o release message: "release <host IP address>"  (sent by a gethost
+ *		     client that holds several cpus on one connection --
+ *		     see dmucs_jobserver.h -- to give one of them back.
+ *		     All the host requests on such a connection must be
+ *		     for the same dprop.)
+ * o renew message:  "renew [<host IP address>]"  (sent by a client that
+ *		     holds its cpus longer than the dprop's lease-time, to
+ *		     start the lease on one cpu, or all of them, again)
+ * o claim message:  "claim <host IP address>"  (sent by a client that has
+ *		     moved to a standby server that has taken over from
+ *		     the one it got the cpu from, to hold the cpu on its
+ *		     new connection)
+ * o replicate msg:  "replicate"  (sent by a standby server, which is then
+ *		     sent the db, and all changes to it, on this connection
+ *		     -- see dmucs_repl.h)
+ * o peer message:   "peer"  (sent by the server of another site, which is
+ *		     then sent what cpus we have free on this connection,
+ *		     so it can borrow them -- see dmucs_peers.h)
+ * o admin message:  "admin <operation>[; <operation> ...]" or
+ *		     "admin commit"  (sent by an administrator's client,
+ *		     to change many hosts at once -- see dmucs_admin.h)
  */
 
 #include "dmucs_host.h"
 #include "dmucs_dprop.h"
+#include "dmucs_cpu_req.h"
 
 class DmucsMsg {
 private:
@@ -70,12 +110,16 @@ private:
     host_status_t status_;
     int numCpus_;
     int powerIndex_;
+    int drainSecs_;		// a drain's deadline, 0 if none,
+    bool wait_;			// and whether to wait for it.
 
 public:
     DmucsStatusMsg(struct in_addr clientIp, struct in_addr host,
-		   host_status_t status, DmucsDprop dprop) :
+		   host_status_t status, DmucsDprop dprop,
+		   int drainSecs = 0, bool wait = false) :
 	DmucsMsg(clientIp, dprop), 
-	host_(host), status_(status), numCpus_(1), powerIndex_(1) {}
+	host_(host), status_(status), numCpus_(1), powerIndex_(1),
+	drainSecs_(drainSecs), wait_(wait) {}
 	virtual ~DmucsStatusMsg(){}
     void handle(Socket *sock, const char *buf);
 };
@@ -86,13 +130,15 @@ class DmucsLdAvgMsg : public DmucsMsg
 private:
     struct in_addr host_;
     float ldAvg1_, ldAvg5_, ldAvg10_;
+    int memMb_;			// the host's memory, 0 if not sent.
 
 public:
     DmucsLdAvgMsg(struct in_addr clientIp, struct in_addr host,
 		  float ldavg1, float ldavg5,
-		  float ldavg10, DmucsDprop dprop) :
+		  float ldavg10, DmucsDprop dprop, int memMb) :
 	DmucsMsg(clientIp, dprop), 
-	host_(host), ldAvg1_(ldavg1), ldAvg5_(ldavg5), ldAvg10_(ldavg10) {}
+	host_(host), ldAvg1_(ldavg1), ldAvg5_(ldavg5), ldAvg10_(ldavg10),
+	memMb_(memMb) {}
 	virtual ~DmucsLdAvgMsg(){}
     void handle(Socket *sock, const char *buf);
 };
@@ -100,14 +146,113 @@ public:
 
 class DmucsHostReqMsg : public DmucsMsg
 {
+private:
+    DmucsCpuReq req_;
+
+    void handleGang(Socket *sock);
+    void handleHedge(Socket *sock);
+    bool lacksMemory();
+
 public:
-    DmucsHostReqMsg(struct in_addr clientIp, DmucsDprop dprop) :
-	DmucsMsg(clientIp, dprop) {}
+    DmucsHostReqMsg(struct in_addr clientIp, DmucsDprop dprop,
+		    const DmucsCpuReq &req) :
+	DmucsMsg(clientIp, dprop), req_(req) {}
 	virtual ~DmucsHostReqMsg(){}
     void handle(Socket *sock, const char *buf);
 };
 
 
+class DmucsDoneMsg : public DmucsMsg
+{
+private:
+    int exitStatus_;
+    bool fellBack_;
+    int msecs_;		// wall time of the compile, 0 if not known.
+    long bytes_;	// size of the source, 0 if not known.
+    unsigned int hostIp_; // the cpu the compile ran on, 0 if not given.
+
+public:
+    DmucsDoneMsg(struct in_addr clientIp, int exitStatus, bool fellBack,
+		 int msecs, long bytes, unsigned int hostIp) :
+	DmucsMsg(clientIp, ""), exitStatus_(exitStatus), fellBack_(fellBack),
+	msecs_(msecs), bytes_(bytes), hostIp_(hostIp) {}
+	virtual ~DmucsDoneMsg(){}
+    void handle(Socket *sock, const char *buf);
+};
+
+
+class DmucsReleaseMsg : public DmucsMsg
+{
+private:
+    struct in_addr host_;
+
+public:
+    DmucsReleaseMsg(struct in_addr clientIp, struct in_addr host) :
+	DmucsMsg(clientIp, ""), host_(host) {}
+	virtual ~DmucsReleaseMsg(){}
+    void handle(Socket *sock, const char *buf);
+};
+
+
+class DmucsAdminMsg : public DmucsMsg
+{
+private:
+    std::string ops_;		// empty for the commit.
+
+public:
+    DmucsAdminMsg(struct in_addr clientIp, const std::string &ops) :
+	DmucsMsg(clientIp, ""), ops_(ops) {}
+	virtual ~DmucsAdminMsg(){}
+    void handle(Socket *sock, const char *buf);
+};
+
+
+class DmucsRenewMsg : public DmucsMsg
+{
+private:
+    unsigned int hostIp_;	// 0 for all the client's cpus.
+
+public:
+    DmucsRenewMsg(struct in_addr clientIp, unsigned int hostIp) :
+	DmucsMsg(clientIp, ""), hostIp_(hostIp) {}
+	virtual ~DmucsRenewMsg(){}
+    void handle(Socket *sock, const char *buf);
+};
+
+
+class DmucsClaimMsg : public DmucsMsg
+{
+private:
+    struct in_addr host_;
+
+public:
+    DmucsClaimMsg(struct in_addr clientIp, struct in_addr host) :
+	DmucsMsg(clientIp, ""), host_(host) {}
+	virtual ~DmucsClaimMsg(){}
+    void handle(Socket *sock, const char *buf);
+};
+
+
+class DmucsReplicateMsg : public DmucsMsg
+{
+public:
+    DmucsReplicateMsg(struct in_addr clientIp) :
+	DmucsMsg(clientIp, "") {}
+	virtual ~DmucsReplicateMsg(){}
+    void handle(Socket *sock, const char *buf);
+};
+
+
+class DmucsPeerMsg : public DmucsMsg
+{
+public:
+    DmucsPeerMsg(struct in_addr clientIp) :
+	DmucsMsg(clientIp, "") {}
+	virtual ~DmucsPeerMsg(){}
+    void handle(Socket *sock, const char *buf);
+};
+
+
 class DmucsMonitorReqMsg : public DmucsMsg
 {
 public:
@@ -0,0 +1,676 @@
+/*
+ * dmucs_peers.cc: borrowing cpus from the DMUCS servers of other sites
+ * when our own are all in use.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs.h"
+#include "dmucs_peers.h"
+#include "dmucs_db.h"
+#include "dmucs_dprops_file.h"
+#include "dmucs_fair.h"
+#include "dmucs_labels.h"
+#include "dmucs_msg.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+
+extern std::string dpropsInfoFile;
+
+
+DmucsPeers *DmucsPeers::instance_ = NULL;
+
+
+DmucsPeers *
+DmucsPeers::getInstance()
+{
+    if (instance_ == NULL) {
+	instance_ = new DmucsPeers();
+    }
+    return instance_;
+}
+
+
+DmucsPeers::DmucsPeers() : nextSend_(0), nextConnect_(0)
+{
+}
+
+
+void
+DmucsPeers::setPeers(const DmucsServerList &peers)
+{
+    peers_ = peers;
+
+    /* Look the peers up now: the resolver could keep the select loop
+       waiting for as long as it likes. */
+    addrs_.resize(peers_.size());
+    resolved_.assign(peers_.size(), false);
+    for (unsigned int i = 0; i < peers_.size(); i++) {
+	resolved_[i] = SresolveServer(peers_[i], &addrs_[i]);
+	if (! resolved_[i]) {
+	    fprintf(stderr, "Unknown peer server %s: not using it\n",
+		    peers_[i].name_.c_str());
+	}
+    }
+    capSocks_.assign(peers_.size(), (Socket *) NULL);
+    capConnectFds_.assign(peers_.size(), -1);
+    capStarted_.assign(peers_.size(), (time_t) 0);
+    capacity_.assign(peers_.size(), dmucs_capacity_t());
+    lastHeard_.assign(peers_.size(), (time_t) 0);
+    connectPeers();
+}
+
+
+/*
+ * Start the "peer" connection to each peer we don't have one to, to hear
+ * what it has free.  A peer that is down is tried again later.
+ */
+void
+DmucsPeers::connectPeers()
+{
+    time_t now = time(NULL);
+    for (unsigned int i = 0; i < peers_.size(); i++) {
+	if (! resolved_[i] || capSocks_[i] != NULL ||
+	    capConnectFds_[i] >= 0) {
+	    continue;
+	}
+	capConnectFds_[i] = SstartConnect(addrs_[i]);
+	if (capConnectFds_[i] < 0) {
+	    DMUCS_DEBUG((stderr, "Could not reach peer %s\n",
+			 peers_[i].name_.c_str()));
+	}
+	capStarted_[i] = now;
+    }
+    nextConnect_ = now + DMUCS_PEER_INTERVAL;
+    finishConnects(now);
+}
+
+
+/*
+ * See which of our connects to peers have gone through, or failed, or
+ * had DMUCS_PEER_INTERVAL seconds to.
+ */
+void
+DmucsPeers::finishConnects(time_t now)
+{
+    for (unsigned int i = 0; i < capConnectFds_.size(); i++) {
+	if (capConnectFds_[i] < 0) {
+	    continue;
+	}
+	bool failed;
+	Socket *sock = SfinishConnect(capConnectFds_[i], &failed);
+	if (sock == NULL) {
+	    if (! failed && now < capStarted_[i] + DMUCS_PEER_INTERVAL) {
+		continue;
+	    }
+	    if (! failed) {
+		close(capConnectFds_[i]);
+	    }
+	    DMUCS_DEBUG((stderr, "Could not reach peer %s\n",
+			 peers_[i].name_.c_str()));
+	    capConnectFds_[i] = -1;
+	    continue;
+	}
+	capConnectFds_[i] = -1;
+
+	/* This goes at once, into the new socket's empty send buffer. */
+	const char msg[] = "peer";
+	DmucsSendQueue out(sock, sizeof(msg), DMUCS_PEER_STALL);
+	if (! out.send(msg, sizeof(msg)) || ! out.empty()) {
+	    Sclose(sock);
+	    continue;
+	}
+	fprintf(stderr, "Connected to peer %s\n", peers_[i].name_.c_str());
+	capSocks_[i] = sock;
+	lastHeard_[i] = now;
+	Smaskset(sock);
+    }
+
+    /* closeConn() changes the list. */
+    std::list<DmucsPeerConn *> conns = conns_;
+    for (std::list<DmucsPeerConn *>::iterator itr = conns.begin();
+	 itr != conns.end(); ++itr) {
+	DmucsPeerConn *conn = *itr;
+	if (conn->sock_ != NULL) {
+	    continue;
+	}
+	bool failed;
+	Socket *sock = SfinishConnect(conn->connectFd_, &failed);
+	if (sock != NULL) {
+	    DMUCS_DEBUG((stderr, "Connected to peer %s for dprop '%s'\n",
+			 peers_[conn->peer_].name_.c_str(),
+			 dprop2cstr(conn->dprop_)));
+	    conn->sock_ = sock;
+	    conn->out_ = new DmucsSendQueue(sock, DMUCS_PEER_MAX_QUEUE,
+					    DMUCS_PEER_STALL);
+	    Smaskset(sock);
+	} else if (failed || now >= conn->started_ + DMUCS_PEER_INTERVAL) {
+	    closeConn(conn);
+	}
+    }
+}
+
+
+/*
+ * Send the host request on to the peer with the most free cpus that
+ * match its labels (see dmucs_labels.h).  Return false if no peer has
+ * any, as far as we know: the client is then sent 0.0.0.0, as usual.
+ * Otherwise the reply goes to the client when the peer sends it.
+ */
+bool
+DmucsPeers::borrow(Socket *client, struct in_addr clientIp,
+		   const DmucsDprop &dprop, const DmucsCpuReq &req)
+{
+    time_t now = time(NULL);
+    int best = -1, bestFree = 0;
+    for (unsigned int i = 0; i < peers_.size(); i++) {
+	/* What a peer told us long ago is not to be trusted. */
+	if (capSocks_[i] == NULL ||
+	    now > lastHeard_[i] + 3 * DMUCS_PEER_INTERVAL) {
+	    continue;
+	}
+	int numFree = 0;
+	for (dmucs_capacity_t::iterator itr = capacity_[i].begin();
+	     itr != capacity_[i].end(); ++itr) {
+	    if (dpropMatches(itr->first, dprop)) {
+		numFree += itr->second;
+	    }
+	}
+	if (numFree > bestFree) {
+	    best = i;
+	    bestFree = numFree;
+	}
+    }
+    if (best < 0) {
+	return false;
+    }
+
+    DmucsPeerConn *conn = NULL;
+    for (std::list<DmucsPeerConn *>::iterator itr = conns_.begin();
+	 itr != conns_.end(); ++itr) {
+	if ((*itr)->peer_ == (unsigned int) best && (*itr)->dprop_ == dprop) {
+	    conn = *itr;
+	    break;
+	}
+    }
+    if (conn == NULL) {
+	int fd = SstartConnect(addrs_[best]);
+	if (fd < 0) {
+	    fprintf(stderr, "Could not reach peer %s\n",
+		    peers_[best].name_.c_str());
+	    return false;
+	}
+	conn = new DmucsPeerConn;
+	conn->sock_ = NULL;
+	conn->out_ = NULL;
+	conn->connectFd_ = fd;
+	conn->started_ = now;
+	conn->peer_ = best;
+	conn->dprop_ = dprop;
+	conns_.push_back(conn);
+	finishConnects(now);
+    }
+    if (conn->sock_ == NULL) {
+	/* We don't wait: the connection is there for the next request. */
+	DMUCS_DEBUG((stderr, "Still connecting to peer %s\n",
+		     peers_[best].name_.c_str()));
+	return false;
+    }
+
+    std::ostringstream msg;
+    msg << "host " << inet_ntoa(clientIp);
+    if (! dprop.empty()) {
+	msg << " " << dprop;
+    }
+    msg << " peer=1";
+    if (req.prio_ != DMUCS_PRIO_INTERACTIVE) {
+	msg << " prio=" << dmucsPrioName(req.prio_);
+    }
+    if (req.cost_ > 0) {
+	msg << " cost=" << req.cost_;
+    }
+    if (! req.key_.empty()) {
+	msg << " key=" << req.key_;
+    }
+    if (req.mem_ > 0) {
+	msg << " mem=" << req.mem_;
+    }
+    if (! sendToPeer(conn, msg.str())) {
+	return false;
+    }
+    conn->waiting_.push_back(client);
+    /* Count the cpu as taken, until the peer tells us again. */
+    dmucs_capacity_t::iterator most = capacity_[best].end();
+    for (dmucs_capacity_t::iterator itr = capacity_[best].begin();
+	 itr != capacity_[best].end(); ++itr) {
+	if (dpropMatches(itr->first, dprop) &&
+	    (most == capacity_[best].end() || itr->second > most->second)) {
+	    most = itr;
+	}
+    }
+    most->second--;
+    DMUCS_DEBUG((stderr, "Asking peer %s for a cpu of dprop '%s'\n",
+		 peers_[best].name_.c_str(), dprop2cstr(dprop)));
+    return true;
+}
+
+
+/* A client gives back one cpu it borrowed.  Return false if it has none. */
+bool
+DmucsPeers::release(Socket *client, unsigned int hostIp)
+{
+    dmucs_borrowed_iter_t itr = findBorrowed(client, hostIp);
+    if (itr == borrowed_.end()) {
+	return false;
+    }
+    DmucsPeerConn *conn = itr->second.conn_;
+    borrowed_.erase(itr);
+    DmucsFairShare::getInstance()->leaseReleased(client);
+
+    struct in_addr in;
+    in.s_addr = hostIp;
+    sendToPeer(conn, std::string("release ") + inet_ntoa(in));
+    return true;
+}
+
+
+/* Renew the peer's leases on one borrowed cpu of the client, or on all of
+   them (hostIp 0).  Return false if it has none. */
+bool
+DmucsPeers::renew(Socket *client, unsigned int hostIp)
+{
+    bool found = false;
+    std::pair<dmucs_borrowed_iter_t, dmucs_borrowed_iter_t> range =
+	borrowed_.equal_range(client);
+    for (dmucs_borrowed_iter_t itr = range.first; itr != range.second;
+	 ++itr) {
+	if (hostIp == 0 || itr->second.hostIp_ == hostIp) {
+	    struct in_addr in;
+	    in.s_addr = itr->second.hostIp_;
+	    sendToPeer(itr->second.conn_,
+		       std::string("renew ") + inet_ntoa(in));
+	    found = true;
+	}
+    }
+    return found;
+}
+
+
+/* Pass the client's "done" on to the peer the cpu is from, so that it
+   learns how its host did.  Return false if the cpu is not borrowed. */
+bool
+DmucsPeers::done(Socket *client, unsigned int hostIp, int exitStatus,
+		 bool fellBack, int msecs, long bytes)
+{
+    dmucs_borrowed_iter_t itr = findBorrowed(client, hostIp);
+    if (itr == borrowed_.end()) {
+	return false;
+    }
+    struct in_addr in;
+    in.s_addr = itr->second.hostIp_;
+    std::ostringstream msg;
+    msg << "done " << exitStatus << " " << (fellBack ? 1 : 0) << " " <<
+	msecs << " " << bytes << " " << inet_ntoa(in);
+    sendToPeer(itr->second.conn_, msg.str());
+    return true;
+}
+
+
+/*
+ * Find the client's borrowed cpu on hostIp -- or, if hostIp is 0, the
+ * cpu of a client that holds just one.
+ */
+DmucsPeers::dmucs_borrowed_iter_t
+DmucsPeers::findBorrowed(Socket *client, unsigned int hostIp)
+{
+    std::pair<dmucs_borrowed_iter_t, dmucs_borrowed_iter_t> range =
+	borrowed_.equal_range(client);
+    for (dmucs_borrowed_iter_t itr = range.first; itr != range.second;
+	 ++itr) {
+	if (hostIp == 0 || itr->second.hostIp_ == hostIp) {
+	    return itr;
+	}
+    }
+    return borrowed_.end();
+}
+
+
+/*
+ * Queue a message for the peer.  If the connection has failed, it is
+ * closed in handleTimers(), or in readReplies().
+ */
+bool
+DmucsPeers::sendToPeer(DmucsPeerConn *conn, const std::string &msg)
+{
+    if (! conn->out_->send(msg.c_str(), msg.size() + 1)) {
+	fprintf(stderr, "Could not send to peer %s\n",
+		peers_[conn->peer_].name_.c_str());
+	return false;
+    }
+    return true;
+}
+
+
+/* Read what the peers have sent us. */
+void
+DmucsPeers::handleInput()
+{
+    for (unsigned int i = 0; i < capSocks_.size(); i++) {
+	if (capSocks_[i] != NULL && Smaskisset(capSocks_[i])) {
+	    readCapacity(i);
+	}
+    }
+    /* readReplies() may close the connection. */
+    std::list<DmucsPeerConn *> conns = conns_;
+    for (std::list<DmucsPeerConn *>::iterator itr = conns.begin();
+	 itr != conns.end(); ++itr) {
+	if ((*itr)->sock_ != NULL && Smaskisset((*itr)->sock_)) {
+	    readReplies(*itr);
+	}
+    }
+}
+
+
+void
+DmucsPeers::readCapacity(unsigned int peer)
+{
+    char buf[BUFSIZE];
+    do {
+	if (Sgets(buf, BUFSIZE, capSocks_[peer]) == NULL) {
+	    fprintf(stderr, "Lost peer %s\n", peers_[peer].name_.c_str());
+	    Smaskunset(capSocks_[peer]);
+	    Sclose(capSocks_[peer]);
+	    capSocks_[peer] = NULL;
+	    capacity_[peer].clear();
+	    return;
+	}
+	/* The dprop is last, in quotes, since it may be empty. */
+	int nfree;
+	const char *q1 = strchr(buf, '\'');
+	const char *q2 = strrchr(buf, '\'');
+	if (sscanf(buf, "capacity %d", &nfree) != 1 || q1 == NULL || q2 <= q1) {
+	    fprintf(stderr, "Got a bad record from peer %s ->%s<-\n",
+		    peers_[peer].name_.c_str(), buf);
+	    continue;
+	}
+	capacity_[peer][std::string(q1 + 1, q2 - q1 - 1)] = nfree;
+    } while (Stest(capSocks_[peer]) > 0);
+    lastHeard_[peer] = time(NULL);
+}
+
+
+/*
+ * The peer has replied to host requests we sent on: the replies come
+ * back in the order the requests went out.  Pass each on to its client,
+ * and hold the cpu for it.
+ */
+void
+DmucsPeers::readReplies(DmucsPeerConn *conn)
+{
+    char buf[BUFSIZE];
+    do {
+	if (Sgets(buf, BUFSIZE, conn->sock_) == NULL) {
+	    closeConn(conn);
+	    return;
+	}
+	if (conn->waiting_.empty()) {
+	    fprintf(stderr, "Got an unasked-for reply from peer %s ->%s<-\n",
+		    peers_[conn->peer_].name_.c_str(), buf);
+	    continue;
+	}
+	Socket *client = conn->waiting_.front();
+	conn->waiting_.pop_front();
+
+	char machname[64];
+	unsigned int hostIp = 0;
+	if (sscanf(buf, "%63s", machname) == 1) {
+	    hostIp = inet_addr(machname);
+	    if (hostIp == INADDR_NONE) {
+		hostIp = 0;
+	    }
+	}
+	if (client == NULL) {
+	    /* The client gave up waiting: give the cpu back. */
+	    if (hostIp != 0) {
+		sendToPeer(conn, std::string("release ") + machname);
+	    }
+	    continue;
+	}
+	if (hostIp != 0) {
+	    fprintf(stderr, "Borrowing %s from peer %s\n", machname,
+		    peers_[conn->peer_].name_.c_str());
+	    DmucsBorrowed b;
+	    b.conn_ = conn;
+	    b.hostIp_ = hostIp;
+	    borrowed_.insert(std::make_pair(client, b));
+	    DmucsFairShare::getInstance()->leaseGranted(client);
+	} else {
+	    fprintf(stderr, "Peer %s is out of hosts in db \"%s\" too\n",
+		    peers_[conn->peer_].name_.c_str(), dprop2cstr(conn->dprop_));
+	}
+	/* The reply is in the same form as our own. */
+	Sputs(buf, client);
+    } while (Stest(conn->sock_) > 0);
+}
+
+
+/*
+ * The peer has closed the connection (or we could not connect, or it has
+ * stopped taking what we send), and taken back the cpus we held on it.
+ * The clients keep running their compiles, but we no longer count the
+ * cpus as theirs.
+ */
+void
+DmucsPeers::closeConn(DmucsPeerConn *conn)
+{
+    if (conn->sock_ == NULL) {
+	DMUCS_DEBUG((stderr, "Could not reach peer %s\n",
+		     peers_[conn->peer_].name_.c_str()));
+	close(conn->connectFd_);
+	conns_.remove(conn);
+	delete conn;
+	return;
+    }
+    fprintf(stderr, "Lost the connection to peer %s\n",
+	    peers_[conn->peer_].name_.c_str());
+    for (std::deque<Socket *>::iterator itr = conn->waiting_.begin();
+	 itr != conn->waiting_.end(); ++itr) {
+	if (*itr != NULL) {
+	    Sputs((char *) "0.0.0.0", *itr);
+	}
+    }
+    for (dmucs_borrowed_iter_t itr = borrowed_.begin();
+	 itr != borrowed_.end(); ) {
+	if (itr->second.conn_ == conn) {
+	    DmucsFairShare::getInstance()->leaseReleased(itr->first);
+	    borrowed_.erase(itr++);
+	} else {
+	    ++itr;
+	}
+    }
+    Smaskunset(conn->sock_);
+    Sclose(conn->sock_);
+    delete conn->out_;
+    conns_.remove(conn);
+    delete conn;
+}
+
+
+/*
+ * Another server will borrow from us: tell it what we have free, now and
+ * every DMUCS_PEER_INTERVAL seconds.
+ */
+void
+DmucsPeers::addBorrower(Socket *sock)
+{
+    struct in_addr in;
+    in.s_addr = (in_addr_t) Speeraddr(sock);
+    fprintf(stderr, "Peer server %s connected\n", inet_ntoa(in));
+    if (borrowers_.empty()) {
+	nextSend_ = time(NULL) + DMUCS_PEER_INTERVAL;
+    }
+    /* If this fails, the borrower is dropped in handleTimers(). */
+    borrowers_.push_back(DmucsSendQueue(sock, DMUCS_PEER_MAX_QUEUE,
+					DMUCS_PEER_STALL));
+    sendCapacity(borrowers_.back());
+}
+
+
+bool
+DmucsPeers::sendCapacity(DmucsSendQueue &out)
+{
+    std::map<DmucsDprop, int> freeCpus;
+    DmucsDb::getInstance()->getFreeCpus(freeCpus);
+
+    std::ostringstream buf;
+    for (std::map<DmucsDprop, int>::iterator itr = freeCpus.begin();
+	 itr != freeCpus.end(); ++itr) {
+	int reserve = DmucsDpropsFile::getInstance(dpropsInfoFile)->
+	    getInt(itr->first, "peer-reserve", 0);
+	buf << "capacity " << std::max(itr->second - reserve, 0) << " '" <<
+	    itr->first << "'" << '\0';
+    }
+    return out.send(buf.str());
+}
+
+
+/*
+ * A connection to us has closed: it may be a borrower, or a client that
+ * holds borrowed cpus, or is waiting for one.
+ */
+void
+DmucsPeers::removeSocket(Socket *sock)
+{
+    for (std::list<DmucsSendQueue>::iterator itr = borrowers_.begin();
+	 itr != borrowers_.end(); ++itr) {
+	if (itr->getSocket() == sock) {
+	    borrowers_.erase(itr);
+	    break;
+	}
+    }
+
+    for (std::list<DmucsPeerConn *>::iterator itr = conns_.begin();
+	 itr != conns_.end(); ++itr) {
+	std::replace((*itr)->waiting_.begin(), (*itr)->waiting_.end(), sock,
+		     (Socket *) NULL);
+    }
+
+    std::pair<dmucs_borrowed_iter_t, dmucs_borrowed_iter_t> range =
+	borrowed_.equal_range(sock);
+    for (dmucs_borrowed_iter_t itr = range.first; itr != range.second;
+	 ++itr) {
+	struct in_addr in;
+	in.s_addr = itr->second.hostIp_;
+	DMUCS_DEBUG((stderr, "Giving %s back to peer %s\n", inet_ntoa(in),
+		     peers_[itr->second.conn_->peer_].name_.c_str()));
+	sendToPeer(itr->second.conn_, std::string("release ") + inet_ntoa(in));
+	DmucsFairShare::getInstance()->leaseReleased(sock);
+    }
+    borrowed_.erase(range.first, range.second);
+}
+
+
+/*
+ * Called once each time around the server's select loop: finish the
+ * connects, send what is queued, and drop the peers and borrowers that
+ * will not take it.
+ */
+void
+DmucsPeers::handleTimers(time_t now)
+{
+    finishConnects(now);
+
+    bool sendNow = (! borrowers_.empty() && now >= nextSend_);
+    std::vector<Socket *> dead;
+    for (std::list<DmucsSendQueue>::iterator itr = borrowers_.begin();
+	 itr != borrowers_.end(); ++itr) {
+	if (! (sendNow ? sendCapacity(*itr) : itr->flush())) {
+	    dead.push_back(itr->getSocket());
+	}
+    }
+    if (sendNow) {
+	nextSend_ = now + DMUCS_PEER_INTERVAL;
+    }
+    for (unsigned int i = 0; i < dead.size(); i++) {
+	struct in_addr in;
+	in.s_addr = (in_addr_t) Speeraddr(dead[i]);
+	fprintf(stderr, "Peer server %s is not keeping up: dropping it\n",
+		inet_ntoa(in));
+	removeFd(dead[i]);		// this calls removeSocket().
+    }
+
+    /* closeConn() changes the list. */
+    std::list<DmucsPeerConn *> conns = conns_;
+    for (std::list<DmucsPeerConn *>::iterator itr = conns.begin();
+	 itr != conns.end(); ++itr) {
+	if ((*itr)->out_ != NULL && ! (*itr)->out_->flush()) {
+	    closeConn(*itr);
+	}
+    }
+
+    if (now >= nextConnect_ &&
+	std::find(capSocks_.begin(), capSocks_.end(), (Socket *) NULL) !=
+	capSocks_.end()) {
+	connectPeers();
+    }
+}
+
+
+/* Return when handleTimers() has something to do, or 0 if never. */
+time_t
+DmucsPeers::getNextDeadline() const
+{
+    time_t next = borrowers_.empty() ? 0 : nextSend_;
+    if (std::find(capSocks_.begin(), capSocks_.end(), (Socket *) NULL) !=
+	capSocks_.end() && (next == 0 || nextConnect_ < next)) {
+	next = nextConnect_;
+    }
+    return next;
+}
+
+
+/* Return true if a connect is under way, or something is queued to send:
+   the select loop must then come back soon to see to it. */
+bool
+DmucsPeers::isBacklogged() const
+{
+    for (unsigned int i = 0; i < capConnectFds_.size(); i++) {
+	if (capConnectFds_[i] >= 0) {
+	    return true;
+	}
+    }
+    for (std::list<DmucsPeerConn *>::const_iterator itr = conns_.begin();
+	 itr != conns_.end(); ++itr) {
+	if ((*itr)->sock_ == NULL || ! (*itr)->out_->empty()) {
+	    return true;
+	}
+    }
+    for (std::list<DmucsSendQueue>::const_iterator itr = borrowers_.begin();
+	 itr != borrowers_.end(); ++itr) {
+	if (! itr->empty()) {
+	    return true;
+	}
+    }
+    return false;
+}
@@ -0,0 +1,160 @@
+#ifndef _DMUCS_PEERS_H_
+#define _DMUCS_PEERS_H_ 1
+
+/*
+ * dmucs_peers.h: borrowing cpus from the DMUCS servers of other sites
+ * when our own are all in use.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <time.h>
+#include "dmucs_dprop.h"
+#include "dmucs_cpu_req.h"
+#include "dmucs_sendq.h"
+#include "dmucs_servers.h"
+#include "COSMIC/HDR/sockets.h"
+
+
+/*
+ * A server started with "dmucs -R <peer>[,<peer> ...]" borrows cpus from
+ * its peers -- the servers of other sites -- when a host request finds
+ * none free in its own db.
+ *
+ * It connects to each peer and sends "peer".  The peer then sends it, on
+ * that connection, a "capacity <#free cpus> '<dprop>'" record for each of
+ * its dprops, every DMUCS_PEER_INTERVAL seconds.  The peer keeps back the
+ * dprop's "peer-reserve" cpus (from the dprops-info file, default 0) for
+ * its own clients, and does not count them.
+ *
+ * A host request we can't fill because we have no cpu free for it goes to
+ * the peer that has the most free cpus that match its dprop, as "host
+ * <client IP> <dprop> peer=1 [prio=<class>] ...", on a connection we keep
+ * open to that peer for that dprop.  (One refused for its quota, or
+ * because our free cpus are held for others or kept for higher classes,
+ * is not sent on.)  The peer gives out the cpu as it would to any client,
+ * but keeps back the cpus held for its own waiting clients, and its
+ * headroom for the classes above the request's, as well as its
+ * peer-reserve (see dmucs_fair.h).  It holds the cpu under a lease for
+ * that connection; we pass its reply on to our client, and hold the cpu
+ * for our client until it gives it back or closes its connection, when
+ * we send the peer "release <host IP>".  The client's "done" and "renew"
+ * messages for the cpu go on to the peer as well.
+ *
+ * A request from a peer (peer=1) is never sent on to another peer, so
+ * two servers can borrow from each other.
+ *
+ * A peer that is slow or down must not hold up the server's one select
+ * loop.  So we connect to peers without waiting, and see whether each
+ * connect has gone through each time around the loop; a host request that
+ * would go to a peer whose connection is not up yet gets 0.0.0.0.  What
+ * we send to peers and to borrowers goes through a DmucsSendQueue.
+ */
+
+#define DMUCS_PEER_INTERVAL	2	/* seconds between capacity records,
+					   and to give a connect. */
+#define DMUCS_PEER_MAX_QUEUE	(256 * 1024)	/* bytes we queue for a peer
+						   or borrower. */
+#define DMUCS_PEER_STALL	10	/* secs a peer or borrower may take
+					   no bytes, with some queued. */
+
+
+class DmucsPeers
+{
+public:
+    static DmucsPeers *getInstance();
+
+    /* As a borrower. */
+    void setPeers(const DmucsServerList &peers);
+    bool borrow(Socket *client, struct in_addr clientIp,
+		const DmucsDprop &dprop, const DmucsCpuReq &req);
+    bool release(Socket *client, unsigned int hostIp);
+    bool renew(Socket *client, unsigned int hostIp);
+    bool done(Socket *client, unsigned int hostIp, int exitStatus,
+	      bool fellBack, int msecs, long bytes);
+    void handleInput();
+
+    /* As a lender. */
+    void addBorrower(Socket *sock);
+
+    void removeSocket(Socket *sock);
+    void handleTimers(time_t now);
+    time_t getNextDeadline() const;
+    bool isBacklogged() const;
+
+private:
+    DmucsPeers();
+
+    static DmucsPeers *instance_;
+
+    /* The connection on which we borrow cpus of one dprop from a peer,
+       and the clients waiting for its replies, oldest first.  A client
+       that has gone away is left as NULL, so the cpu sent back for it is
+       given back to the peer.  Until the connect goes through, sock_ and
+       out_ are NULL, and connectFd_ is the fd. */
+    struct DmucsPeerConn {
+	Socket *		sock_;
+	DmucsSendQueue *	out_;
+	int			connectFd_;
+	time_t			started_;
+	unsigned int		peer_;
+	DmucsDprop		dprop_;
+	std::deque<Socket *>	waiting_;
+    };
+
+    /* A cpu we hold, for a client of ours, on a peer's connection. */
+    struct DmucsBorrowed {
+	DmucsPeerConn *		conn_;
+	unsigned int		hostIp_;
+    };
+    typedef std::multimap<Socket *, DmucsBorrowed> dmucs_borrowed_t;
+    typedef dmucs_borrowed_t::iterator dmucs_borrowed_iter_t;
+
+    /* What a peer last told us it has free, by dprop. */
+    typedef std::map<DmucsDprop, int> dmucs_capacity_t;
+
+    DmucsServerList		peers_;
+    std::vector<struct sockaddr_in> addrs_;	// looked up once.
+    std::vector<bool>		resolved_;
+    std::vector<Socket *>	capSocks_;	// the "peer" connections.
+    std::vector<int>		capConnectFds_;	// or their connects, or -1.
+    std::vector<time_t>		capStarted_;
+    std::vector<dmucs_capacity_t> capacity_;
+    std::vector<time_t>		lastHeard_;
+    std::list<DmucsPeerConn *>	conns_;
+    dmucs_borrowed_t		borrowed_;
+    std::list<DmucsSendQueue>	borrowers_;	// peers that borrow from us.
+    time_t			nextSend_;
+    time_t			nextConnect_;
+
+    void connectPeers();
+    void finishConnects(time_t now);
+    void flush();
+    void readCapacity(unsigned int peer);
+    void readReplies(DmucsPeerConn *conn);
+    void closeConn(DmucsPeerConn *conn);
+    bool sendCapacity(DmucsSendQueue &out);
+    dmucs_borrowed_iter_t findBorrowed(Socket *client, unsigned int hostIp);
+    bool sendToPeer(DmucsPeerConn *conn, const std::string &msg);
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef _DMUCS_POLICY_H_
+#define _DMUCS_POLICY_H_ 1
+
+/*
+ * dmucs_policy.h: the policies for picking which free cpu a host request
+ * gets.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <string>
+#include "dmucs_host.h"
+
+
+/*
+ * The "policy" key of a dprop in the dprops-info file picks how a cpu is
+ * chosen from those that are free (once a request with a "key=" has had
+ * its affinity hosts tried):
+ *
+ * o tiered: the default.  At random, from the best tier -- or the tier
+ *   picked by the request's cost, if it sent one.
+ * o random: at random, from all of the tiers.
+ * o least-loaded: from the host with the lowest load per cpu, less the
+ *   share of its cpus that are free.
+ * o packed (or pack): from the most powerful host (the one with the
+ *   highest power index, whatever its load) that has a cpu free, and of
+ *   those, the one with the largest share of its cpus given out already:
+ *   so each host is filled, in order of power, before the next one is
+ *   used.  Dedicated build servers then take the load, and the desktops
+ *   (see scripts/watch-ssaver) are used the least.  A gang's cpus are
+ *   taken in the same order.
+ * o power-weighted: at random, from all of the tiers, but each host in
+ *   proportion to its free cpus times its tier.
+ * o spread: the same as tiered -- the compiles are spread over the
+ *   hosts of the best tier.
+ *
+ * Each policy is a type, with:
+ *
+ *	static const bool byTier;	// only look at the one tier.
+ *	static const dmucs_pick_t pick;	// how to pick, by the scores.
+ *	static double score(const DmucsHost *host, int tier, int numFree);
+ *
+ * where numFree is how many of the host's cpus are free.  The policy is
+ * a template parameter of DmucsDpropDb::pickCpu(), so that there is no
+ * virtual call for each host looked at: the dprop's policy is only looked
+ * up once for each request.  A new policy is a new type here, and a new
+ * case in DmucsDpropDb::getBestAvailCpu().
+ *
+ * The tiers are the hosts' own, from their power indices and loads (see
+ * DmucsHost::calcTier()): a policy ranks the hosts in and across the
+ * tiers, but has no say in which tier a host is in.
+ */
+
+enum dmucs_pick_t {
+    DMUCS_PICK_WEIGHTED,	// at random, in proportion to the scores.
+    DMUCS_PICK_BEST		// the first host with the highest score.
+};
+
+enum dmucs_policy_t {
+    DMUCS_POLICY_TIERED = 0,
+    DMUCS_POLICY_RANDOM,
+    DMUCS_POLICY_LEAST_LOADED,
+    DMUCS_POLICY_PACKED,
+    DMUCS_POLICY_POWER_WEIGHTED
+};
+
+dmucs_policy_t str2policy(const std::string &str);
+
+
+struct DmucsTieredPolicy
+{
+    static const bool byTier = true;
+    static const dmucs_pick_t pick = DMUCS_PICK_WEIGHTED;
+    static double score(const DmucsHost *host, int tier, int numFree) {
+	return numFree;
+    }
+};
+
+
+struct DmucsRandomPolicy
+{
+    static const bool byTier = false;
+    static const dmucs_pick_t pick = DMUCS_PICK_WEIGHTED;
+    static double score(const DmucsHost *host, int tier, int numFree) {
+	return numFree;
+    }
+};
+
+
+struct DmucsLeastLoadedPolicy
+{
+    static const bool byTier = false;
+    static const dmucs_pick_t pick = DMUCS_PICK_BEST;
+    static double score(const DmucsHost *host, int tier, int numFree) {
+	return (double) numFree / host->getNumSlots() - host->getLdAvg1();
+    }
+};
+
+
+struct DmucsPackedPolicy
+{
+    static const bool byTier = false;
+    static const dmucs_pick_t pick = DMUCS_PICK_BEST;
+    static double score(const DmucsHost *host, int tier, int numFree) {
+	int numLeased = host->getNumLeased();
+	return host->getPowerIndex() +
+	    (double) numLeased / (numLeased + numFree);
+    }
+};
+
+
+struct DmucsPowerWeightedPolicy
+{
+    static const bool byTier = false;
+    static const dmucs_pick_t pick = DMUCS_PICK_WEIGHTED;
+    static double score(const DmucsHost *host, int tier, int numFree) {
+	return (double) numFree * tier;
+    }
+};
+
+#endif
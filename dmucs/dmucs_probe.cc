@@ -0,0 +1,235 @@
+/*
+ * dmucs_probe.cc: the DMUCS distccd health prober.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs.h"
+#include "dmucs_probe.h"
+#include "dmucs_db.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+
+
+/* What goes down the pipe to the main thread for each probe. */
+struct probe_result_t {
+    DmucsHost *	host;
+    int		ok;
+};
+
+
+DmucsProber *DmucsProber::instance_ = NULL;
+
+
+DmucsProber *
+DmucsProber::getInstance()
+{
+    if (instance_ == NULL) {
+	instance_ = new DmucsProber();
+    }
+    return instance_;
+}
+
+
+DmucsProber::DmucsProber() : interval_(0)
+{
+    pipe_[0] = pipe_[1] = -1;
+}
+
+
+/*
+ * Make the pipe and spawn the thread that probes the hosts every
+ * "interval" seconds.
+ */
+bool
+DmucsProber::start(int interval)
+{
+    interval_ = interval;
+    if (pipe(pipe_) < 0) {
+	perror("pipe");
+	return false;
+    }
+    /* The main thread must never block reading results. */
+    fcntl(pipe_[0], F_SETFL, fcntl(pipe_[0], F_GETFL) | O_NONBLOCK);
+
+    pthread_attr_t tattr;
+    pthread_attr_init(&tattr);
+    /* We don't care about joining up this thread with its parent -- it
+       won't matter because both will die off together -- when the
+       server is killed. */
+    pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, &tattr, run, (void *) this) != 0) {
+	perror("pthread_create");
+	return false;
+    }
+    return true;
+}
+
+
+void *
+DmucsProber::run(void *arg)
+{
+    DmucsProber *prober = (DmucsProber *) arg;
+    while (1) {
+	struct timeval t = { prober->interval_, 0L };
+	select(0, NULL, NULL, NULL, &t);
+
+	std::vector<DmucsProbe> probes;
+	DmucsDb::getInstance()->getProbeTargets(probes);
+	prober->probeAll(probes);
+
+	for (std::vector<DmucsProbe>::iterator itr = probes.begin();
+	     itr != probes.end(); ++itr) {
+	    probe_result_t res = { itr->host_, itr->ok_ };
+	    /* Each write is smaller than PIPE_BUF, so it is atomic, and the
+	       reader always sees whole results. */
+	    if (write(prober->pipe_[1], &res, sizeof(res)) != sizeof(res)) {
+		perror("write probe result");
+	    }
+	}
+    }
+    return NULL;
+}
+
+
+void
+DmucsProber::probeAll(std::vector<DmucsProbe> &probes)
+{
+    for (unsigned int first = 0; first < probes.size();
+	 first += DMUCS_PROBE_BATCH) {
+	unsigned int last = first + DMUCS_PROBE_BATCH;
+	if (last > probes.size()) {
+	    last = probes.size();
+	}
+	probeBatch(probes, first, last);
+    }
+}
+
+
+/*
+ * Start a non-blocking connect to every host in [first, last), then wait
+ * for them all (up to DMUCS_PROBE_TIMEOUT) with one poll() loop.  A probe
+ * is good if the connect completes without error.
+ */
+void
+DmucsProber::probeBatch(std::vector<DmucsProbe> &probes,
+			unsigned int first, unsigned int last)
+{
+    std::vector<struct pollfd> fds;
+    std::vector<unsigned int> which;
+
+    for (unsigned int i = first; i < last; i++) {
+	probes[i].ok_ = false;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+	    perror("socket");
+	    continue;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = probes[i].ipAddr_;
+	sin.sin_port = htons(probes[i].port_);
+
+	if (connect(fd, (struct sockaddr *) &sin, sizeof(sin)) == 0) {
+	    probes[i].ok_ = true;
+	    close(fd);
+	} else if (errno == EINPROGRESS) {
+	    struct pollfd pfd;
+	    pfd.fd = fd;
+	    pfd.events = POLLOUT;
+	    pfd.revents = 0;
+	    fds.push_back(pfd);
+	    which.push_back(i);
+	} else {
+	    close(fd);
+	}
+    }
+
+    struct timeval start, now;
+    gettimeofday(&start, 0);
+    unsigned int pending = fds.size();
+    while (pending > 0) {
+	gettimeofday(&now, 0);
+	int elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+	    (now.tv_usec - start.tv_usec) / 1000;
+	if (elapsed >= DMUCS_PROBE_TIMEOUT) {
+	    break;
+	}
+	int n = poll(&fds[0], fds.size(), DMUCS_PROBE_TIMEOUT - elapsed);
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    break;
+	}
+	for (unsigned int j = 0; j < fds.size(); j++) {
+	    if (fds[j].fd < 0 || fds[j].revents == 0) {
+		continue;
+	    }
+	    int err = 0;
+	    socklen_t len = sizeof(err);
+	    if (getsockopt(fds[j].fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 &&
+		err == 0) {
+		probes[which[j]].ok_ = true;
+	    }
+	    close(fds[j].fd);
+	    fds[j].fd = -1;		// poll() ignores negative fds.
+	    pending--;
+	}
+    }
+
+    /* Anything still pending has timed out. */
+    for (unsigned int j = 0; j < fds.size(); j++) {
+	if (fds[j].fd >= 0) {
+	    close(fds[j].fd);
+	}
+    }
+}
+
+
+/*
+ * Called from the main loop when the pipe is readable: apply the results
+ * of the latest probes to the hosts.
+ */
+void
+DmucsProber::handleResults()
+{
+    probe_result_t res[64];
+    ssize_t n;
+    while ((n = read(pipe_[0], res, sizeof(res))) > 0) {
+	for (unsigned int i = 0; i < n / sizeof(res[0]); i++) {
+	    DMUCS_DEBUG((stderr, "probe of %s: %s\n",
+			 res[i].host->getName().c_str(),
+			 res[i].ok ? "ok" : "failed"));
+	    res[i].host->handleProbe(res[i].ok != 0);
+	}
+    }
+}
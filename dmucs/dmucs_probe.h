@@ -0,0 +1,82 @@
+#ifndef _DMUCS_PROBE_H_
+#define _DMUCS_PROBE_H_ 1
+
+/*
+ * dmucs_probe.h: the DMUCS distccd health prober.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <vector>
+
+class DmucsHost;
+
+
+/*
+ * A probe is one TCP connect to a host's distccd port.  A host can be up
+ * and sending load averages while its distccd is dead, and every compile
+ * sent there then falls back to the local machine -- so we check.
+ */
+struct DmucsProbe
+{
+    DmucsHost *		host_;
+    unsigned int	ipAddr_;
+    int			port_;
+    bool		ok_;
+
+    DmucsProbe(DmucsHost *host, unsigned int ipAddr, int port) :
+	host_(host), ipAddr_(ipAddr), port_(port), ok_(false) {}
+};
+
+
+/*
+ * The prober runs in its own thread: every interval it gets the list of
+ * hosts to probe from the db, and does non-blocking connects to all of
+ * them at once.  The results are written down a pipe, whose read end the
+ * server watches in its select loop, so that all changes to the db are
+ * still made by the main thread.
+ */
+class DmucsProber
+{
+public:
+    static DmucsProber *getInstance();
+
+    bool start(int interval);
+    int  getFd() const { return pipe_[0]; }
+    void handleResults();
+
+private:
+    DmucsProber();
+
+    static DmucsProber *instance_;
+
+    int interval_;		// seconds between rounds of probes.
+    int pipe_[2];
+
+    static void *run(void *bogus);
+    void probeAll(std::vector<DmucsProbe> &probes);
+    void probeBatch(std::vector<DmucsProbe> &probes,
+		    unsigned int first, unsigned int last);
+};
+
+/* How long to wait for a distccd to accept our connection (milliseconds). */
+#define DMUCS_PROBE_TIMEOUT	2000
+
+/* How many connects to have in flight at once. */
+#define DMUCS_PROBE_BATCH	256
+
+#endif
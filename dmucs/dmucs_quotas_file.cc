@@ -0,0 +1,132 @@
+/*
+ * dmucs_quotas_file.cc: code to read the quotas-info configuration file.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs.h"
+#include "dmucs_quotas_file.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+
+DmucsQuotasFile *DmucsQuotasFile::instance_ = NULL;
+
+
+DmucsQuotasFile *
+DmucsQuotasFile::getInstance(const std::string &file)
+{
+    if (instance_ == NULL) {
+	instance_ = new DmucsQuotasFile(file);
+    }
+    return instance_;
+}
+
+
+DmucsQuotasFile::DmucsQuotasFile(const std::string &quotasInfoFile) :
+    quotasInfoFile_(quotasInfoFile),
+    lastFileChangeTime_(0),
+    lastCheckTime_(0)
+{
+    (void) hasFileChanged();
+    readFileIntoDb();
+}
+
+
+void
+DmucsQuotasFile::readFileIntoDb() const
+{
+    db_.clear();
+
+    std::ifstream instr(quotasInfoFile_.c_str());
+    if (!instr) {
+	DMUCS_DEBUG((stderr, "Unable to open quotas-info file \"%s\"\n",
+		     quotasInfoFile_.c_str()));
+	return;
+    }
+
+    std::string line;
+    for (int lineno = 1; std::getline(instr, line); lineno++) {
+
+	/*
+	 * Each line is: who key value.  Comment lines start with #, and
+	 * these are skipped, as are lines containing only whitespace.
+	 */
+	std::istringstream linestr(line);
+	std::string who, key, value;
+	if (!(linestr >> who) || who[0] == '#') {
+	    continue;
+	}
+	if (!(linestr >> key >> value) ||
+	    (who.compare(0, 5, "user:") != 0 && who.compare(0, 3, "ip:") != 0)) {
+	    std::cout << "Bad input in line " << lineno << " of file " <<
+		quotasInfoFile_ << std::endl;
+	    continue;
+	}
+	db_[std::make_pair(who, key)] = value;
+    }
+}
+
+
+/* If the file modification time has changed since the last time this
+   was called, then return true AND update lastFileChangeTime_ to the
+   new modification time.  The file is stat'ed at most once a second. */
+bool
+DmucsQuotasFile::hasFileChanged() const
+{
+    time_t now = time(NULL);
+    if (now == lastCheckTime_) {
+	return false;
+    }
+    lastCheckTime_ = now;
+
+    struct stat st;
+    if (stat(quotasInfoFile_.c_str(), &st) != 0) {
+	/* No file means no settings: only re-read if we had some. */
+	return !db_.empty();
+    }
+
+    if (lastFileChangeTime_ != st.st_ctime) {
+	lastFileChangeTime_ = st.st_ctime;
+	return true;
+    }
+    return false;
+}
+
+
+/*
+ * Return the setting of key for who ("user:<login>" or "ip:<address>"),
+ * or for all the users or machines, or else defaultVal.
+ */
+int
+DmucsQuotasFile::getInt(const std::string &who, const std::string &key,
+			int defaultVal) const
+{
+    if (hasFileChanged()) {
+	readFileIntoDb();
+    }
+
+    quota_info_db_iter_t itr = db_.find(std::make_pair(who, key));
+    if (itr == db_.end()) {
+	std::string all = who.substr(0, who.find(':') + 1) + "*";
+	itr = db_.find(std::make_pair(all, key));
+    }
+    return (itr == db_.end()) ? defaultVal : atoi(itr->second.c_str());
+}
@@ -0,0 +1,87 @@
+#ifndef _DMUCS_QUOTAS_FILE_H_
+#define _DMUCS_QUOTAS_FILE_H_ 1
+
+/*
+ * dmucs_quotas_file.h: code to read the quotas-info configuration file.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <map>
+#include <string>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef PKGDATADIR
+const std::string QUOTAS_INFO_FILE = std::string(PKGDATADIR) + \
+	std::string("/") + std::string("quotas-info");
+#else
+const std::string QUOTAS_INFO_FILE = std::string(getenv("HOME")) + std::string("/.dmucs/quotas-info");
+#endif
+
+
+/*
+ * The quotas-info file holds the limits on, and the shares of, the users
+ * and client machines that ask for cpus.  Each line is:
+ *
+ *	<who> <key> <value>
+ *
+ * where <who> is "user:<login>" (the user a gethost client runs as),
+ * "ip:<address>" (the client machine), or "user:*" or "ip:*" for every
+ * user or machine that does not have its own setting for <key>.  The keys
+ * are:
+ *
+ * o max-cpus: the most cpus the user, or machine, may hold at once (0,
+ *   the default, for no limit).
+ * o weight: the share of the cpus that become free the user, or machine,
+ *   gets while others are waiting for them too (default 1) -- see
+ *   dmucs_fair.h.
+ *
+ * Comment lines start with #.  The file is re-read when it changes, and is
+ * optional.
+ */
+class DmucsQuotasFile
+{
+public:
+
+    static DmucsQuotasFile *getInstance(const std::string &quotasInfoFile);
+
+    int		getInt(const std::string &who, const std::string &key,
+		       int defaultVal) const;
+
+private:
+    // this is private so that it cannot be used (this is a Singleton).
+    DmucsQuotasFile(const std::string &quotasInfoFile);
+    ~DmucsQuotasFile();
+
+    static DmucsQuotasFile *instance_;
+    std::string quotasInfoFile_;
+
+    /* Maps (who, key) to the value string found in the file. */
+    typedef std::map<std::pair<std::string, std::string>, std::string>
+		quota_info_db_t;
+    typedef quota_info_db_t::const_iterator quota_info_db_iter_t;
+
+    mutable quota_info_db_t db_;
+    mutable time_t lastFileChangeTime_;
+    mutable time_t lastCheckTime_;
+
+    void readFileIntoDb() const;
+    bool hasFileChanged() const;
+};
+
+#endif
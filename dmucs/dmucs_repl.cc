@@ -0,0 +1,351 @@
+/*
+ * dmucs_repl.cc: keeping a standby DMUCS server up to date, and taking
+ * over when the primary server goes away.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs.h"
+#include "dmucs_repl.h"
+#include "dmucs_db.h"
+#include "dmucs_host.h"
+#include "dmucs_msg.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
+#include <vector>
+
+
+DmucsReplicator *DmucsReplicator::instance_ = NULL;
+
+
+DmucsReplicator *
+DmucsReplicator::getInstance()
+{
+    if (instance_ == NULL) {
+	instance_ = new DmucsReplicator();
+    }
+    return instance_;
+}
+
+
+DmucsReplicator::DmucsReplicator() :
+    nextPing_(0), primary_(NULL), failoverTime_(DMUCS_FAILOVER_TIME),
+    lastHeard_(0)
+{
+}
+
+
+/*
+ * A standby server has connected: send it everything we have, at the
+ * next flush().
+ */
+void
+DmucsReplicator::addStandby(Socket *sock)
+{
+    struct in_addr in;
+    in.s_addr = (in_addr_t) Speeraddr(sock);
+    fprintf(stderr, "Standby server %s connected\n", inet_ntoa(in));
+    standbys_.push_back(DmucsSendQueue(sock, DMUCS_REPL_MAX_QUEUE,
+				       DMUCS_REPL_STALL));
+    nextPing_ = time(NULL) + DMUCS_REPL_PING;
+    DmucsDb::getInstance()->replicate();
+}
+
+
+void
+DmucsReplicator::removeStandby(Socket *sock)
+{
+    std::list<DmucsSendQueue>::iterator itr = standbys_.begin();
+    while (itr != standbys_.end() && itr->getSocket() != sock) {
+	++itr;
+    }
+    if (itr == standbys_.end()) {
+	return;
+    }
+    fprintf(stderr, "Standby server disconnected\n");
+    standbys_.erase(itr);
+    if (standbys_.empty()) {
+	changedHosts_.clear();
+	pending_.clear();
+    }
+}
+
+
+void
+DmucsReplicator::hostChanged(DmucsHost *host)
+{
+    if (! standbys_.empty()) {
+	changedHosts_.insert(host);
+    }
+}
+
+
+void
+DmucsReplicator::leaseChanged(const DmucsDprop &dprop,
+			      const DmucsLease &lease)
+{
+    if (standbys_.empty()) {
+	return;
+    }
+    struct in_addr in;
+    in.s_addr = lease.hostIp_;
+    std::ostringstream rec;
+    rec << "lease " << lease.id_ << " " << inet_ntoa(in) << " " <<
+	(long) lease.expires_ << " " << lease.memMb_ << " '" << dprop <<
+	"'" << '\0';
+    pending_ += rec.str();
+}
+
+
+void
+DmucsReplicator::leaseReleased(const DmucsDprop &dprop,
+			       const DmucsLease &lease)
+{
+    if (standbys_.empty()) {
+	return;
+    }
+    std::ostringstream rec;
+    rec << "unlease " << lease.id_ << " '" << dprop << "'" << '\0';
+    pending_ += rec.str();
+}
+
+
+/*
+ * Send the standbys what has changed since the last flush: the hosts
+ * first, so that a lease never arrives before the host it is on.  This is
+ * called once each time around the server's select loop, and also sends
+ * what did not go the last time.
+ */
+void
+DmucsReplicator::flush()
+{
+    if (changedHosts_.empty() && pending_.empty()) {
+	if (isBacklogged()) {
+	    send(std::string());
+	}
+	return;
+    }
+
+    std::ostringstream out;
+    for (std::set<DmucsHost *>::iterator itr = changedHosts_.begin();
+	 itr != changedHosts_.end(); ++itr) {
+	DmucsHost *h = *itr;
+	out << "host " << inet_ntoa(h->ipAddr_) << " " <<
+	    h->getStateAsInt() << " " << h->ncpus_ << " " << h->pindex_ <<
+	    " " << h->ldavg1_ << " " << h->ldavg5_ << " " << h->ldavg10_ <<
+	    " " << (long) h->lastUpdate_ << " " << h->learnedPindex_ << " " <<
+	    h->nextPindex_ << " " << (int) h->breaker_ << " " <<
+	    (long) h->breakerDeadline_ << " " << h->speed_ << " " <<
+	    h->numTimings_ << " " << (long) h->drainDeadline_ << " " <<
+	    h->loadLevel_ << " " << h->slots_ << " '" << h->dprop_ << "'" <<
+	    '\0';
+    }
+    std::string buf = out.str() + pending_;
+    changedHosts_.clear();
+    pending_.clear();
+    send(buf);
+}
+
+
+/* Queue buf for each standby, and send what will go without blocking. */
+void
+DmucsReplicator::send(const std::string &buf)
+{
+    std::vector<Socket *> dead;
+    for (std::list<DmucsSendQueue>::iterator itr = standbys_.begin();
+	 itr != standbys_.end(); ++itr) {
+	if (! itr->send(buf)) {
+	    fprintf(stderr, "Standby server is not keeping up: dropping it\n");
+	    dead.push_back(itr->getSocket());
+	}
+    }
+    for (unsigned int i = 0; i < dead.size(); i++) {
+	removeFd(dead[i]);		// this calls removeStandby().
+    }
+}
+
+
+/* Return true if some standby has records queued that have not gone. */
+bool
+DmucsReplicator::isBacklogged() const
+{
+    for (std::list<DmucsSendQueue>::const_iterator itr = standbys_.begin();
+	 itr != standbys_.end(); ++itr) {
+	if (! itr->empty()) {
+	    return true;
+	}
+    }
+    return false;
+}
+
+
+/*
+ * Connect to the primary server and ask it for its db.  Return false if
+ * it can't be reached.
+ */
+bool
+DmucsReplicator::follow(const DmucsServerList &primary, int failoverTime)
+{
+    unsigned int which = 0;
+    Socket *sock = SopenServers(primary, 0, primary.size(), &which);
+    if (sock == NULL) {
+	return false;
+    }
+    const char msg[] = "replicate";
+    if (Swrite(sock, (void *) msg, sizeof(msg)) != sizeof(msg)) {
+	Sclose(sock);
+	return false;
+    }
+    fprintf(stderr, "Standing by for the primary server %s\n",
+	    primary[which].name_.c_str());
+    primary_ = sock;
+    failoverTime_ = failoverTime;
+    lastHeard_ = time(NULL);
+    Smaskset(primary_);
+    return true;
+}
+
+
+/* Read what the primary has sent us, and apply it to our db. */
+void
+DmucsReplicator::handleInput()
+{
+    char buf[BUFSIZE];
+    do {
+	if (Sgets(buf, BUFSIZE, primary_) == NULL) {
+	    fprintf(stderr, "The primary server has closed the connection\n");
+	    promote();
+	    return;
+	}
+	DMUCS_DEBUG((stderr, "Replicating -->%s<--\n", buf));
+	apply(buf);
+    } while (Stest(primary_) > 0);
+    lastHeard_ = time(NULL);
+}
+
+
+void
+DmucsReplicator::apply(const char *rec)
+{
+    /* The dprop is last, in quotes, since it may be empty. */
+    DmucsDprop dprop;
+    const char *q1 = strchr(rec, '\'');
+    const char *q2 = strrchr(rec, '\'');
+    if (q1 != NULL && q2 > q1) {
+	dprop = std::string(q1 + 1, q2 - q1 - 1);
+    }
+
+    DmucsDb *db = DmucsDb::getInstance();
+    unsigned long id;
+    char machname[64];
+    long expires;
+    int memMb = 0;		// not sent by older primaries.
+    if (strncmp(rec, "host ", 5) == 0) {
+	applyHost(rec, dprop);
+    } else if (sscanf(rec, "lease %lu %63s %ld %d", &id, machname,
+		      &expires, &memMb) >= 3) {
+	db->addOrphanLease(dprop, id, inet_addr(machname), (time_t) expires,
+			   memMb);
+    } else if (sscanf(rec, "unlease %lu", &id) == 1) {
+	db->releaseOrphanLease(dprop, id);
+    } else if (strcmp(rec, "ping") != 0) {
+	fprintf(stderr, "Got a bad record from the primary ->%s<-\n", rec);
+    }
+}
+
+
+void
+DmucsReplicator::applyHost(const char *rec, const DmucsDprop &dprop)
+{
+    char machname[64];
+    int state, ncpus, pindex, learned, next, breaker, numTimings;
+    float ldavg1, ldavg5, ldavg10, speed;
+    long lastUpdate, breakerDeadline;
+    long drainDeadline = 0;	// not sent by older primaries,
+    int loadLevel = -1;		// nor this,
+    int slots = 0;		// nor this.
+    if (sscanf(rec,
+	       "host %63s %d %d %d %f %f %f %ld %d %d %d %ld %f %d %ld %d %d",
+	       machname, &state, &ncpus, &pindex, &ldavg1, &ldavg5, &ldavg10,
+	       &lastUpdate, &learned, &next, &breaker, &breakerDeadline,
+	       &speed, &numTimings, &drainDeadline, &loadLevel, &slots) < 14) {
+	fprintf(stderr, "Got a bad host record from the primary ->%s<-\n",
+		rec);
+	return;
+    }
+
+    struct in_addr in;
+    in.s_addr = inet_addr(machname);
+    DmucsDb *db = DmucsDb::getInstance();
+    DmucsHost *host;
+    if (db->haveHost(in, dprop)) {
+	host = db->getHost(in, dprop);
+    } else {
+	host = new DmucsHost(in, dprop, ncpus, pindex, 0, slots);
+	db->addNewHost(host);
+    }
+    host->restore(state, ncpus, pindex, ldavg1, ldavg5, ldavg10,
+		  (time_t) lastUpdate, learned, next, (host_breaker_t) breaker,
+		  (time_t) breakerDeadline, speed, numTimings,
+		  (time_t) drainDeadline, loadLevel, slots);
+}
+
+
+/* The primary has gone away: start serving in its place. */
+void
+DmucsReplicator::promote()
+{
+    fprintf(stderr, "Taking over from the primary server\n");
+    Smaskunset(primary_);
+    Sclose(primary_);
+    primary_ = NULL;
+    DmucsDb::getInstance()->takeOver(time(NULL));
+}
+
+
+void
+DmucsReplicator::handleTimers(time_t now)
+{
+    if (primary_ != NULL) {
+	if (now >= lastHeard_ + failoverTime_) {
+	    fprintf(stderr, "Have not heard from the primary server in %d "
+		    "seconds\n", (int) (now - lastHeard_));
+	    promote();
+	}
+	return;
+    }
+    if (! standbys_.empty() && now >= nextPing_) {
+	pending_ += std::string("ping") + '\0';
+	nextPing_ = now + DMUCS_REPL_PING;
+    }
+}
+
+
+/* Return when handleTimers() has something to do, or 0 if never. */
+time_t
+DmucsReplicator::getNextDeadline() const
+{
+    if (primary_ != NULL) {
+	return lastHeard_ + failoverTime_;
+    }
+    return standbys_.empty() ? 0 : nextPing_;
+}
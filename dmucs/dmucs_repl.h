@@ -0,0 +1,126 @@
+#ifndef _DMUCS_REPL_H_
+#define _DMUCS_REPL_H_ 1
+
+/*
+ * dmucs_repl.h: keeping a standby DMUCS server up to date, and taking over
+ * when the primary server goes away.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <list>
+#include <set>
+#include <string>
+#include <time.h>
+#include "dmucs_dprop.h"
+#include "dmucs_sendq.h"
+#include "dmucs_servers.h"
+#include "COSMIC/HDR/sockets.h"
+
+class DmucsHost;
+struct DmucsLease;
+
+
+/*
+ * A standby server ("dmucs -S <primary>") connects to the primary and
+ * sends it "replicate".  The primary then sends it every host and lease it
+ * has, and after that a record each time one of them changes:
+ *
+ * o "host <ip> <state> <#cpus> <power index> <ldavg1> <ldavg5> <ldavg10>
+ *    <last update> <learned pindex> <next pindex> <breaker>
+ *    <breaker deadline> <msecs/KB> <#timings> <drain deadline>
+ *    <load level> <slots set by hand> '<dprop>'"
+ * o "lease <id> <host ip> <expires> <memory MB> '<dprop>'"  (a cpu given
+ *    out, or a lease renewed; the memory is what the lease holds of the
+ *    host's, 0 for none, and is left out by older primaries)
+ * o "unlease <id> '<dprop>'"  (a cpu given back)
+ * o "ping"  (sent every DMUCS_REPL_PING seconds, so the standby can tell
+ *    a hung primary from an idle one)
+ *
+ * Each record is a string with a null byte at the end, as the other
+ * messages are.  The records describe what the primary decided, not what
+ * it was told, so the standby's db ends up the same even though host
+ * picks are random.
+ *
+ * The primary never blocks on a standby: the records go through a
+ * DmucsSendQueue.  A standby that has DMUCS_REPL_MAX_QUEUE bytes waiting
+ * for it, or has taken none of them for DMUCS_REPL_STALL seconds, is
+ * dropped.  It will take over, or be restarted, and get everything again.
+ *
+ * The standby keeps the leases as orphans: cpus that are held, but not by
+ * any client connected to it.  If it hears nothing from the primary for
+ * the failover time, or the connection closes, it takes over: it starts
+ * serving host requests, and gives each orphaned lease "orphan-time"
+ * seconds (from the dprops-info file, default 60) for its client to claim
+ * it with a "claim <host ip>" message before the cpu is taken back.
+ *
+ * The clients and loadavg should be given both servers ("-s
+ * primary,standby"), so that they move over on their own, and the hosts
+ * keep reporting to the standby while the primary is up.
+ */
+class DmucsReplicator
+{
+public:
+    static DmucsReplicator *getInstance();
+
+    /* On the primary. */
+    void addStandby(Socket *sock);
+    void removeStandby(Socket *sock);
+    void hostChanged(DmucsHost *host);
+    void leaseChanged(const DmucsDprop &dprop, const DmucsLease &lease);
+    void leaseReleased(const DmucsDprop &dprop, const DmucsLease &lease);
+    void flush();
+    bool isBacklogged() const;
+
+    /* On a standby. */
+    bool follow(const DmucsServerList &primary, int failoverTime);
+    bool isStandby() const { return primary_ != NULL; }
+    Socket *getPrimary() const { return primary_; }
+    void handleInput();
+
+    void handleTimers(time_t now);
+    time_t getNextDeadline() const;
+
+private:
+    DmucsReplicator();
+
+    static DmucsReplicator *instance_;
+
+    std::list<DmucsSendQueue> standbys_;
+    std::set<DmucsHost *> changedHosts_; // to be sent at the next flush().
+    std::string		pending_;	// lease records, in order.
+    time_t		nextPing_;
+
+    Socket *		primary_;	// NULL unless we are a standby.
+    int			failoverTime_;	// seconds of silence we allow it.
+    time_t		lastHeard_;
+
+    void send(const std::string &buf);
+    void apply(const char *rec);
+    void applyHost(const char *rec, const DmucsDprop &dprop);
+    void promote();
+};
+
+#define DMUCS_REPL_PING		1	/* seconds between pings. */
+#define DMUCS_REPL_MAX_QUEUE	(8 * 1024 * 1024)
+					/* the most bytes we hold for a
+					   standby that is not reading. */
+#define DMUCS_REPL_STALL	10	/* drop a standby that reads nothing
+					   for this many seconds. */
+#define DMUCS_FAILOVER_TIME	3	/* the default failover time. */
+
+#endif
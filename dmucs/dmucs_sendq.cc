@@ -0,0 +1,95 @@
+/*
+ * dmucs_sendq.cc: what the server has to send on a socket it must never
+ * block on.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs_sendq.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <errno.h>
+
+
+DmucsSendQueue::DmucsSendQueue(Socket *sock, size_t maxBytes,
+			       int stallSecs) :
+    sock_(sock), maxBytes_(maxBytes), stallSecs_(stallSecs),
+    sentAt_(time(NULL)), failed_(false)
+{
+    fcntl(sock_->skt, F_SETFL, fcntl(sock_->skt, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(sock_->skt, SOL_SOCKET, SO_NOSIGPIPE, (char *) &on,
+	       sizeof(on));
+#endif
+}
+
+
+/* Queue the bytes, and send as many of the queued ones as will go. */
+bool
+DmucsSendQueue::send(const char *buf, size_t len)
+{
+    if (out_.empty()) {
+	sentAt_ = time(NULL);
+    }
+    if (failed_) {
+	return false;
+    }
+    out_.append(buf, len);
+    if (out_.size() > maxBytes_) {
+	failed_ = true;
+	return false;
+    }
+    return flush();
+}
+
+
+bool
+DmucsSendQueue::flush()
+{
+#ifdef MSG_NOSIGNAL
+    int flags = MSG_NOSIGNAL;	// a closed peer must not kill us.
+#else
+    int flags = 0;
+#endif
+    if (failed_) {
+	return false;
+    }
+    size_t sent = 0;
+    while (sent < out_.size()) {
+	ssize_t n = ::send(sock_->skt, out_.data() + sent,
+			   out_.size() - sent, flags);
+	if (n > 0) {
+	    sent += n;
+	} else if (n < 0 && errno == EINTR) {
+	    continue;
+	} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+	    break;
+	} else {
+	    failed_ = true;
+	    return false;
+	}
+    }
+    time_t now = time(NULL);
+    if (sent > 0) {
+	out_.erase(0, sent);
+	sentAt_ = now;
+    }
+    failed_ = ! out_.empty() && now - sentAt_ >= stallSecs_;
+    return ! failed_;
+}
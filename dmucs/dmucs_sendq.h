@@ -0,0 +1,67 @@
+#ifndef _DMUCS_SENDQ_H_
+#define _DMUCS_SENDQ_H_ 1
+
+/*
+ * dmucs_sendq.h: what the server has to send on a socket it must never
+ * block on.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <string>
+#include <time.h>
+#include "COSMIC/HDR/sockets.h"
+
+
+#define DMUCS_SENDQ_POLL	50	/* msecs between tries at sending
+					   what is queued. */
+
+
+/*
+ * Swrite() and Sputs() loop on a blocking send() until all of it is
+ * written, so a standby or peer server that stops reading would stall
+ * the server's one select loop for good.  Instead, the socket is made
+ * non-blocking, and what will not fit in its send buffer is kept here, up
+ * to maxBytes.  The server tries again every DMUCS_SENDQ_POLL msecs while
+ * there is something queued (the COSMIC select only waits for input).
+ *
+ * send() and flush() return false once the queue has overflowed, or has
+ * not gone down for stallSecs seconds, or the socket has failed, and go on
+ * returning false from then on: the caller then closes the socket.
+ */
+class DmucsSendQueue
+{
+public:
+    DmucsSendQueue(Socket *sock, size_t maxBytes, int stallSecs);
+
+    bool send(const char *buf, size_t len);
+    bool send(const std::string &str) { return send(str.data(), str.size()); }
+    bool flush();
+
+    bool empty() const { return out_.empty(); }
+    Socket *getSocket() const { return sock_; }
+
+private:
+    Socket *		sock_;
+    std::string		out_;		// not yet sent.
+    size_t		maxBytes_;
+    int			stallSecs_;
+    time_t		sentAt_;	// when some of out_ last went.
+    bool		failed_;
+};
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * dmucs_servers.cc: the list of DMUCS servers a client can talk to.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs_servers.h"
+#include "dmucs_unix_skt.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+DmucsServerList
+parseServerList(const std::string &str, int defaultPort)
+{
+    DmucsServerList servers;
+    std::string::size_type start = 0;
+    while (start < str.size()) {
+	std::string::size_type comma = str.find(',', start);
+	if (comma == std::string::npos) {
+	    comma = str.size();
+	}
+	std::string name = str.substr(start, comma - start);
+	int port = defaultPort;
+	std::string::size_type colon = name.find(':');
+	if (colon != std::string::npos) {
+	    port = atoi(name.c_str() + colon + 1);
+	    name.erase(colon);
+	}
+	if (! name.empty()) {
+	    servers.push_back(DmucsServer(name, port));
+	}
+	start = comma + 1;
+    }
+    return servers;
+}
+
+
+bool
+SresolveServer(const DmucsServer &server, struct sockaddr_in *sin)
+{
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(server.port_);
+    sin->sin_addr.s_addr = inet_addr(server.name_.c_str());
+    if (sin->sin_addr.s_addr == INADDR_NONE) {
+	struct hostent *he = gethostbyname(server.name_.c_str());
+	if (he == NULL) {
+	    return false;
+	}
+	memcpy(&sin->sin_addr.s_addr, he->h_addr_list[0],
+	       sizeof(sin->sin_addr.s_addr));
+    }
+    return true;
+}
+
+
+/*
+ * Start a non-blocking connect to the address.  Return the fd, or -1 if
+ * the connect failed at once.
+ */
+static int
+startConnect(const struct sockaddr_in &sin, bool *connected)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+	return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    *connected = (connect(fd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+    if (! *connected && errno != EINPROGRESS) {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+
+/* The connect on the fd has gone through. */
+static Socket *
+wrapConnected(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    /* Our requests are small, and we wait for the replies. */
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &on, sizeof(on));
+    return SwrapFd(fd, PM_CLIENT);
+}
+
+
+static long
+msecsSince(const struct timeval &then)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return (now.tv_sec - then.tv_sec) * 1000 +
+	(now.tv_usec - then.tv_usec) / 1000;
+}
+
+
+Socket *
+SopenServers(const DmucsServerList &servers, unsigned int first,
+	     unsigned int count, unsigned int *which)
+{
+    if (servers.empty()) {
+	return NULL;
+    }
+    if (count > servers.size()) {
+	count = servers.size();
+    }
+
+    std::vector<struct pollfd> fds;
+    std::vector<unsigned int> idx;		// the server of each fd.
+    std::vector<struct timeval> started;	// and when we tried it.
+    unsigned int next = 0;
+    struct timeval lastStart = { 0L, 0L };
+    int winner = -1;
+    int lastErr = ECONNREFUSED;		// why the last one failed.
+
+    while (winner < 0) {
+	/* Try the next server if the others are slow, or have failed. */
+	if (next < count &&
+	    (fds.empty() || msecsSince(lastStart) >= DMUCS_CONNECT_HEDGE)) {
+	    unsigned int i = (first + next++) % servers.size();
+	    struct sockaddr_in sin;
+	    bool connected = false;
+	    int fd = SresolveServer(servers[i], &sin) ?
+		startConnect(sin, &connected) : -1;
+	    if (fd < 0) {
+		lastErr = errno;
+		continue;
+	    }
+	    struct pollfd pfd;
+	    pfd.fd = fd;
+	    pfd.events = POLLOUT;
+	    pfd.revents = 0;
+	    fds.push_back(pfd);
+	    idx.push_back(i);
+	    gettimeofday(&lastStart, 0);
+	    started.push_back(lastStart);
+	    if (connected) {
+		winner = fds.size() - 1;
+		break;
+	    }
+	}
+	if (fds.empty()) {
+	    break;			// every server has failed.
+	}
+
+	/* Give up on the ones that have had long enough. */
+	for (unsigned int j = 0; j < fds.size(); ) {
+	    if (msecsSince(started[j]) >= DMUCS_CONNECT_TIMEOUT) {
+		lastErr = ETIMEDOUT;
+		close(fds[j].fd);
+		fds.erase(fds.begin() + j);
+		idx.erase(idx.begin() + j);
+		started.erase(started.begin() + j);
+	    } else {
+		j++;
+	    }
+	}
+	if (fds.empty()) {
+	    if (next < count) {
+		continue;
+	    }
+	    break;
+	}
+
+	int wait = (next < count) ? DMUCS_CONNECT_HEDGE : DMUCS_CONNECT_TIMEOUT;
+	wait -= msecsSince(lastStart);
+	if (wait < 0) {
+	    wait = 0;
+	}
+	int n = poll(&fds[0], fds.size(), wait);
+	if (n < 0 && errno != EINTR) {
+	    break;
+	}
+	for (unsigned int j = 0; n > 0 && j < fds.size(); ) {
+	    if (fds[j].revents == 0) {
+		j++;
+		continue;
+	    }
+	    int err = 0;
+	    socklen_t len = sizeof(err);
+	    if (getsockopt(fds[j].fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 &&
+		err == 0) {
+		winner = j;
+		break;
+	    }
+	    lastErr = err;
+	    close(fds[j].fd);		// refused: try the next one now.
+	    fds.erase(fds.begin() + j);
+	    idx.erase(idx.begin() + j);
+	    started.erase(started.begin() + j);
+	    lastStart.tv_sec = 0;
+	}
+    }
+
+    Socket *sock = NULL;
+    for (unsigned int j = 0; j < fds.size(); j++) {
+	if ((int) j != winner) {
+	    close(fds[j].fd);
+	    continue;
+	}
+	sock = wrapConnected(fds[j].fd);
+	*which = idx[j];
+    }
+    if (sock == NULL) {
+	errno = lastErr;
+    }
+    return sock;
+}
+
+
+int
+SstartConnect(const struct sockaddr_in &sin)
+{
+    bool connected;
+    return startConnect(sin, &connected);
+}
+
+
+Socket *
+SfinishConnect(int fd, bool *failed)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    *failed = false;
+    int n = poll(&pfd, 1, 0);
+    if (n == 0 || (n < 0 && errno == EINTR)) {
+	return NULL;			// still going.
+    }
+    int err = errno;
+    socklen_t len = sizeof(err);
+    if (n > 0 &&
+	getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+	return wrapConnected(fd);
+    }
+    close(fd);
+    errno = err;
+    *failed = true;
+    return NULL;
+}
@@ -0,0 +1,85 @@
+#ifndef _DMUCS_SERVERS_H_
+#define _DMUCS_SERVERS_H_ 1
+
+/*
+ * dmucs_servers.h: the list of DMUCS servers a client can talk to.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include "COSMIC/HDR/sockets.h"
+
+
+#define DMUCS_CONNECT_HEDGE	50	/* msecs to wait for a server to
+					   accept before also trying the
+					   next one. */
+#define DMUCS_CONNECT_TIMEOUT	1000	/* msecs to wait for any one
+					   server to accept. */
+
+
+struct DmucsServer
+{
+    std::string	name_;
+    int		port_;
+
+    DmucsServer(const std::string &name, int port) :
+	name_(name), port_(port) {}
+};
+
+typedef std::vector<DmucsServer> DmucsServerList;
+
+
+/*
+ * Parse a server list, "<server>[:<port>][,<server>[:<port>] ...]".  The
+ * servers are in order of preference: the first is the one to use while
+ * it is up.
+ */
+DmucsServerList parseServerList(const std::string &str, int defaultPort);
+
+/*
+ * Connect to the first server that will take the connection, of count
+ * servers from servers[first] on (wrapping around).  The connects are
+ * non-blocking: each server gets DMUCS_CONNECT_HEDGE msecs to accept
+ * before the next one is tried as well, and the first to accept wins.
+ * Return NULL if none do within DMUCS_CONNECT_TIMEOUT, or else set
+ * *which to the index of the server.
+ */
+Socket *SopenServers(const DmucsServerList &servers, unsigned int first,
+		     unsigned int count, unsigned int *which);
+
+/*
+ * Look up the server's address and port.  Return false if its name is
+ * unknown.  This may wait on the resolver for as long as it likes.
+ */
+bool SresolveServer(const DmucsServer &server, struct sockaddr_in *sin);
+
+/*
+ * For a caller that must not wait at all: look up the server's address
+ * with SresolveServer() once, up front.  Then start a connect to the
+ * address, and get its fd, or -1 if it failed at once, and call
+ * SfinishConnect() on the fd now and then, until it returns the Socket,
+ * or sets *failed (and closes the fd).  It returns NULL while the connect
+ * is still going.  Giving up on a slow one is up to the caller.
+ */
+int SstartConnect(const struct sockaddr_in &sin);
+Socket *SfinishConnect(int fd, bool *failed);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * dmucs_unix_skt.cc: Unix domain sockets, wrapped up as COSMIC Sockets.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs_unix_skt.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+
+static int
+fillAddr(struct sockaddr_un *sun, const char *path)
+{
+    if (strlen(path) >= sizeof(sun->sun_path)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    strcpy(sun->sun_path, path);
+    return 0;
+}
+
+
+/*
+ * Wrap fd in a Socket.  The type is never PM_SERVER, so that Sclose()
+ * does not try to tell the COSMIC PortMaster about it.
+ */
+Socket *
+SwrapFd(int fd, int type)
+{
+    Socket *skt = makeSocket((char *) "localhost", (char *) "", type);
+    skt->skt = fd;
+    return skt;
+}
+
+
+/*
+ * Listen on the Unix domain socket at path, replacing any old one that
+ * was left behind.
+ */
+Socket *
+SopenUnixServer(const char *path)
+{
+    struct sockaddr_un sun;
+    if (fillAddr(&sun, path) < 0) {
+	return NULL;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+	return NULL;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0 ||
+	listen(fd, 64) < 0) {
+	int err = errno;
+	close(fd);
+	errno = err;
+	return NULL;
+    }
+    return SwrapFd(fd, PM_ACCEPT);
+}
+
+
+Socket *
+SopenUnixClient(const char *path)
+{
+    struct sockaddr_un sun;
+    if (fillAddr(&sun, path) < 0) {
+	return NULL;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+	return NULL;
+    }
+    if (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+	int err = errno;
+	close(fd);
+	errno = err;
+	return NULL;
+    }
+    return SwrapFd(fd, PM_CLIENT);
+}
@@ -0,0 +1,39 @@
+#ifndef _DMUCS_UNIX_SKT_H_
+#define _DMUCS_UNIX_SKT_H_ 1
+
+/*
+ * dmucs_unix_skt.h: Unix domain sockets, wrapped up as COSMIC Sockets.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "COSMIC/HDR/sockets.h"
+
+/*
+ * The COSMIC Sputs(), Sgets(), Saccept(), Smaskset() and Sclose() work on
+ * any stream socket, so a Unix domain socket can be used just like the
+ * TCP ones, once it is in a Socket.  These return NULL on failure, with
+ * errno set.
+ */
+Socket *SopenUnixServer(const char *path);
+Socket *SopenUnixClient(const char *path);
+
+/* Wrap an open stream socket (of type PM_ACCEPT or PM_CLIENT) in a
+   Socket. */
+Socket *SwrapFd(int fd, int type);
+
+#endif
@@ -20,7 +20,9 @@
  */
 
 #include "dmucs.h"
-#include "dmucs_resolve.h"
+#include "dmucs_cpu_req.h"
+#include "dmucs_jobserver.h"
+#include "libdmucs.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -30,63 +32,102 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string>
+#include <vector>
 #include <sstream>
 #include <errno.h>
+#include <spawn.h>
 #include <signal.h>
-#include "COSMIC/HDR/sockets.h"
+#include <limits.h>
+#include <stdlib.h>
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
 
 
+#define HEDGE_POLL_MSECS	20	/* how often to look at a compile that
+					   may need a hedge. */
+
+
 extern char **environ;
 void usage(const char *prog);
+std::string distccHost(const dmucs_slot *slot);
+int runCommand(char *argv[]);
+int runHedged(dmucs_client *client, const char *dprop, char *argv[],
+	      dmucs_slot *slot, dmucs_slot *hedge, dmucs_slot **ran,
+	      struct timeval *start);
+bool isDistccFailure(int status);
+const char *getSourceFile(char *argv[], struct stat *st);
+long getSourceSize(char *argv[]);
+std::string getAffinityKey(char *argv[]);
 
 bool debugMode = false;
 
 
-void sigchld_handler(int stat)
-{
-    int childstat;
-    wait(&childstat);
-}
-
 int
 main(int argc, char *argv[])
 {
     /*
-     * o Open a client socket to the server ip/port.
+     * o Open a client socket to the server ip/port (see libdmucs.h).
      * o Send my IP address in a host request.
-     * o Read an IP address in a response.
+     * o Read an IP address in a response, waiting for one if we were
+     *   asked to.
      * o Assign the value DISTCC_HOSTS to the IP address in the env.
      * o Use execve to run the command passed in, with its args, on the
      *   command line.
-     * o Wait for the command to finish.
+     * o Wait for the command to finish.  If the server sent a hedge time
+     *   and the compile runs longer, race it on a second host (see
+     *   runHedged()).  If distcc could not do the compile on the remote
+     *   host, run the command again, locally.
+     * o Tell the server how the compile went, and how long it took, if
+     *   it asked us to.
      * o Close the client socket.
      */
 
-#if (! defined (__CYGWIN__) && ! defined(__FreeBSD__) && !defined(__APPLE__) )
-    /* install a SIGCHLD handler */
-    sigset(SIGCHLD, sigchld_handler);
-#endif
-
     /*
      * Process command-line arguments:
      *
-     * -s <server>, --server <server>: the name of the server machine.
+     * -s <server>, --server <server>: the name of the server machine, or
+     *     a list of them, "<server>[:<port>],..." in order of preference:
+     *     when one is down or does not answer, the next one is used.
      * -p <port>, --port <port>: the port number to listen on (default: 6714).
      * -D, --debug: debug mode (default: off)
      * -w, --wait: Time to wait in seconds for a host before falling back to localhost (default: 0)
+     * -a, --affinity: ask for the host(s) that compiled this file before,
+     *     so that their caches are warm (default: off)
+     * -j, --jobserver <max cpus>: run a whole build (e.g., make) as a
+     *     GNU make jobserver, holding up to <max cpus> cpus at once --
+     *     see dmucs_jobserver.h (default: off)
+     * -b, --broker <path>: get the host from the hostbroker listening on
+     *     <path>, if it is running (default: $DMUCS_BROKER, if set)
+     * -t, --type <labels>: the labels the host must have,
+     *     "<label>[,<label> ...]", with "!<label>" for one it must not
+     *     have -- see dmucs_labels.h (default: a host with no labels)
+     * -c, --class <class>: the priority class of the request:
+     *     interactive, ci or background -- see dmucs_fair.h (default:
+     *     $DMUCS_CLASS, if set, or interactive)
+     * -g, --gang <n>: get n cpus at once, or none, for a command that
+     *     runs n compiles (or link steps, or test shards) in parallel,
+     *     and put them all in DISTCC_HOSTS (default: 1)
+     * -m, --mem <MB>: the memory the command needs on the host, so that
+     *     it only gets a host with that much to spare -- see dmucs_host.h.
+     *     Such a request does not go through the hostbroker (default:
+     *     $DMUCS_MEM, if set, or not known)
      */
-    std::ostringstream serverName;
-    serverName << "@" << SERVER_MACH_NAME;
+    std::string serverName = SERVER_MACH_NAME;
     int serverPortNum = SERVER_PORT_NUM;
     char const*distingProp = "";
 	long timeout = 0;
+    bool affinity = false;
+    int jobserverCpus = 0;
+    const char *brokerPath = getenv("DMUCS_BROKER");
+    const char *prioClass = getenv("DMUCS_CLASS");
+    int gangCpus = 1;
+    const char *memMb = getenv("DMUCS_MEM");
 	
     int nextarg = 1;
     for (; nextarg < argc; nextarg++) {
@@ -95,8 +136,7 @@ main(int argc, char *argv[])
 		usage(argv[0]);
 		return -1;
 	    }
-	    serverName.seekp(1);     // remove everything after the first "@".
-	    serverName << argv[nextarg] << '\0';
+	    serverName = argv[nextarg];
 	} else if (strequ("-p", argv[nextarg]) ||
 		   strequ("--port", argv[nextarg])) {
 	    if (++nextarg >= argc) {
@@ -114,6 +154,43 @@ main(int argc, char *argv[])
 	} else if (strequ("-D", argv[nextarg]) ||
 		   strequ("--debug", argv[nextarg])) {
 	    debugMode = true;
+	} else if (strequ("-a", argv[nextarg]) ||
+		   strequ("--affinity", argv[nextarg])) {
+	    affinity = true;
+	} else if (strequ("-b", argv[nextarg]) ||
+		   strequ("--broker", argv[nextarg])) {
+	    if (++nextarg >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    brokerPath = argv[nextarg];
+	} else if (strequ("-c", argv[nextarg]) ||
+		   strequ("--class", argv[nextarg])) {
+	    if (++nextarg >= argc || dmucsPrioFromName(argv[nextarg]) < 0) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    prioClass = argv[nextarg];
+	} else if (strequ("-g", argv[nextarg]) ||
+		   strequ("--gang", argv[nextarg])) {
+	    if (++nextarg >= argc || (gangCpus = atoi(argv[nextarg])) < 1) {
+		usage(argv[0]);
+		return -1;
+	    }
+	} else if (strequ("-m", argv[nextarg]) ||
+		   strequ("--mem", argv[nextarg])) {
+	    if (++nextarg >= argc || atoi(argv[nextarg]) < 0) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    memMb = argv[nextarg];
+	} else if (strequ("-j", argv[nextarg]) ||
+		   strequ("--jobserver", argv[nextarg])) {
+	    if (++nextarg >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    jobserverCpus = atoi(argv[nextarg]);
 	} else if (strequ("-w", argv[nextarg]) ||
 			   strequ("--wait", argv[nextarg])) {
 		if (++nextarg >= argc) {
@@ -128,146 +205,468 @@ main(int argc, char *argv[])
     }
 
 
-    std::ostringstream clientPortStr;
-    clientPortStr << "c" << serverPortNum;
-    DMUCS_DEBUG((stderr, "doing Sopen with %s, %s\n",
-		 serverName.str().c_str(), clientPortStr.str().c_str()));
-    Socket *client_sock = Sopen((char *) serverName.str().c_str(),
-				(char *) clientPortStr.str().c_str());
-
+    /*
+     * Go through the hostbroker on this machine, if there is one: it
+     * answers much faster than the server.  If it is not running, talk to
+     * the server directly.  The cpus the broker holds were not picked for
+     * a job's memory, though.
+     */
+    if (memMb != NULL && atoi(memMb) <= 0) {
+	memMb = NULL;
+    }
+    dmucs_client *client = NULL;
+    if (brokerPath != NULL && jobserverCpus == 0 && memMb == NULL) {
+	DMUCS_DEBUG((stderr, "connecting to the broker at %s\n", brokerPath));
+	client = dmucs_open_broker(brokerPath);
+    }
+    if (client == NULL) {
+	DMUCS_DEBUG((stderr, "connecting to %s, port %d\n",
+		     serverName.c_str(), serverPortNum));
+	client = dmucs_open(serverName.c_str(), serverPortNum);
+    }
 
-    char remCompHostName[256];
     std::string resolved_name;
-	if (!client_sock) {
+    dmucs_slot slot;
+    bool sendDone = false;
+    if (client == NULL) {
 	fprintf(stderr, "WARNING: Could not connect to %s: %s\n",
-		serverName.str().c_str(), strerror(errno));
-   	sprintf(remCompHostName,"0.0.0.0");
+		serverName.c_str(), strerror(errno));
     } else {
-
-	char hostname[256];
-	if (gethostname(hostname, 256) < 0) {
-	    fprintf(stderr, "Could not get my hostname\n");
-	    Sclose(client_sock);
-	    return -1;
+	/* Tell the server how big the job is, so that big ones can be put
+	   on the fast hosts. */
+	long cost = getSourceSize(&argv[nextarg]);
+	if (cost > 0) {
+	    std::ostringstream costStr;
+	    costStr << cost;
+	    dmucs_set_option(client, "cost", costStr.str().c_str());
 	}
-	struct hostent *he = gethostbyname(hostname);
-	if (he == NULL) {
-	    fprintf(stderr, "Could not get my hostname\n");
-	    Sclose(client_sock);
-	    return -1;
+	if (prioClass != NULL && *prioClass != '\0') {
+	    dmucs_set_option(client, "prio", prioClass);
+	}
+	if (memMb != NULL) {
+	    dmucs_set_option(client, "mem", memMb);
+	}
+	if (affinity) {
+	    std::string key = getAffinityKey(&argv[nextarg]);
+	    if (! key.empty()) {
+		dmucs_set_option(client, "key", key.c_str());
+	    }
 	}
 
-	struct in_addr in;
-	memcpy(&in.s_addr, he->h_addr_list[0], sizeof(in.s_addr));
-
-	struct sockaddr sck;
-	socklen_t s = sizeof(sck);
-	getsockname(client_sock->skt, &sck, &s);
+	if (jobserverCpus > 0) {
+	    DmucsJobserver jobserver(client, distingProp, jobserverCpus);
+	    int status = jobserver.run(&argv[nextarg]);
+	    dmucs_close(client);
+	    return status;
+	}
 
-	std::ostringstream clientReqStr;
-	clientReqStr << "host " << inet_ntoa(in) << " " << distingProp;
-	
-	struct timeval begin, end;
-	gettimeofday(&begin, 0);
-		
-	do {
-		DMUCS_DEBUG((stderr, "Writing -->%s<-- to the server\n",
-				 clientReqStr.str().c_str()));
+	if (gangCpus > 1) {
+	    std::vector<dmucs_slot> slots(gangCpus);
+	    int got = dmucs_acquire_gang(client, gangCpus, distingProp,
+					 (timeout < 0) ? -1 : timeout * 1000,
+					 &slots[0]);
+	    if (got < 0) {
+		dmucs_close(client);
+		return -1;
+	    }
+	    if (got == gangCpus) {
+		char hosts[BUFSIZ];
+		if (dmucs_distcc_hosts(&slots[0], got, hosts,
+				       sizeof(hosts)) > 0) {
+		    resolved_name = hosts;
+		}
+		slot = slots[0];	// for the messages below.
+	    }
+	}
 
-		Sputs((char *) clientReqStr.str().c_str(), client_sock);
+	int got = (gangCpus > 1) ? 0 :
+	    dmucs_acquire(client, 1, distingProp,
+			  (timeout < 0) ? -1 : timeout * 1000, &slot);
+	if (got < 0) {
+	    dmucs_close(client);
+	    return -1;
+	}
+	if (got == 1) {
+	    DMUCS_DEBUG((stderr, "Got %s from the server\n", slot.name));
+	    sendDone = slot.report;
 
-		DMUCS_DEBUG((stderr, "Calling Sgets\n"));
-		if (Sgets(remCompHostName, 256, client_sock) == NULL) {
-			fprintf(stderr, "Got error from reading socket.\n");
-			Sclose(client_sock);
-			return -1;
-		}
-		DMUCS_DEBUG((stderr, "Got -->%s<-- from the server\n",
-				 remCompHostName));
-
-		/* If we get 0.0.0.0 that means there are no hosts left in the database. */
-		if (strncmp(remCompHostName, "0.0.0.0", strlen("0.0.0.0")) == 0) {
-			resolved_name = "";
-			if(timeout > 0) {
-				sleep(1);
-			}
-		} else {
-			/*
-			 * Convert the ip address to a hostname before putting it
-			 * in the environment as the value of DISTCC_HOSTS, so that
-			 * the output in the distccmon-text is nice.
-			 */
-			unsigned int cpuIpAddr = inet_addr(remCompHostName);
-			struct in_addr c;
-			c.s_addr = cpuIpAddr;
-
-			getHostName(resolved_name, c);
-
-			/*
-			 * Add /100 to the end of the DISTCC_HOSTS value.  This tells
-			 * distcc that there are 10 cpus on the machine, which should be
-			 * more than any machines already have.  Without this value, distcc
-			 * assumes there are most 4 cpus, and so will not put more than 4
-			 * compilations on that host at once, but instead, put the
-			 * compilations in BLOCKED state.
-			 *
-			 * NOTE: a better solution would be to read the hosts-info file
-			 * in this program and put the actual number of cpus after the '/'.
-			 * But, that is alot of work for this often-run program to do, so
-			 * for efficiency's sake we'll just do it this way.
-			 *
-			 * NOTE: even with a high value of 100 for the number of cpus,
-			 * we won't overload a machine with 100 compiles, because the
-			 * host-server (the 'dmucs' program) only gives out the host based
-			 * on the actual number of cpus on the host -- which it gets from
-			 * the hosts-info file.
-			 */
-			resolved_name += "/100,lzo";
-		}
-		gettimeofday(&end, 0);
-	} while (resolved_name.empty() && (timeout == -1 || ((end.tv_sec-begin.tv_sec) > timeout)));
+	    resolved_name = distccHost(&slot);
 	}
+    }
 		
-    std::ostringstream tmp;
-    tmp << "DISTCC_HOSTS=" << resolved_name;
-    DMUCS_DEBUG((stderr, "tmp is -->%s<--\n", tmp.str().c_str()));
-    if (putenv((char *) tmp.str().c_str()) != 0) {
+    DMUCS_DEBUG((stderr, "DISTCC_HOSTS is -->%s<--\n", resolved_name.c_str()));
+    if (setenv("DISTCC_HOSTS", resolved_name.c_str(), 1) != 0) {
 	fprintf(stderr, "Error putting DISTCC_HOSTS in the environment\n");
-	Sclose(client_sock);
+	dmucs_close(client);
 	return -1;
     }
 
+    /*
+     * If the user has not said otherwise, stop distcc from quietly
+     * compiling locally when the remote host fails: we want to know
+     * about it, so that we can tell the server.  We do the local
+     * compile ourselves in that case.
+     */
+    bool weHandleFallback = false;
+    if (!resolved_name.empty() && getenv("DISTCC_FALLBACK") == NULL) {
+	setenv("DISTCC_FALLBACK", "0", 1);
+	weHandleFallback = true;
+    }
+
 #if 0
     for (char **ep = environ; *ep ; ep++) {
 	printf("Env: %s\n", *ep);
     }
 #endif
 
-    int forkret = fork();
-    if (forkret == 0) {
-	/* child process */
-	if (execvp(argv[nextarg], &argv[nextarg]) < 0) {
-	    fprintf(stderr, "execvp %s failed: err %s\n", argv[nextarg], strerror(errno));
+    struct timeval start, finish;
+    gettimeofday(&start, 0);
+    dmucs_slot hedge;
+    dmucs_slot *ran = &slot;	// the cpu the compile that counts ran on.
+    int status = (sendDone && slot.hedge_ms > 0) ?
+	runHedged(client, distingProp, &argv[nextarg], &slot, &hedge, &ran,
+		  &start) :
+	runCommand(&argv[nextarg]);
+    gettimeofday(&finish, 0);
+    if (status < 0) {
+	dmucs_close(client);
+	return -1;
+    }
+
+    bool fellBack = false;
+    if (weHandleFallback && isDistccFailure(status)) {
+	fprintf(stderr, "WARNING: distcc failed on %s (status %d): "
+		"compiling locally\n", ran->name, WEXITSTATUS(status));
+	setenv("DISTCC_HOSTS", "localhost", 1);
+	fellBack = true;
+	status = runCommand(&argv[nextarg]);
+	if (status < 0) {
+	    dmucs_close(client);
 	    return -1;
 	}
-	    fprintf(stderr, "gethost: finished\n");
-	return 0;
-    } else if (forkret < 0) {
-	fprintf(stderr, "Failed to fork a process!\n");
+    }
+
+    if (sendDone) {
+	long msecs = (finish.tv_sec - start.tv_sec) * 1000 +
+	    (finish.tv_usec - start.tv_usec) / 1000;
+	dmucs_done(client, ran, WEXITSTATUS(status), fellBack, msecs,
+		   getSourceSize(&argv[nextarg]));
+    }
+
+    dmucs_close(client);
+
+    return WEXITSTATUS(status);
+}
+
+
+/*
+ * The DISTCC_HOSTS value for the cpu: "<name>/<slots>,lzo".  The slots
+ * after the '/' tell distcc how many compiles it may put on the host at
+ * once -- without them, distcc assumes at most 4, and puts the rest in
+ * BLOCKED state.  The server sends the host's slots (its cpus, or as
+ * many as it is set to run); an older one does not, and then we say 100,
+ * which is more than any host has.  That does not overload the host, as
+ * the server only gives it out as many times as it has slots.
+ */
+std::string
+distccHost(const dmucs_slot *slot)
+{
+    std::ostringstream host;
+    host << slot->name << "/" << (slot->slots > 0 ? slot->slots : 100)
+	 << ",lzo";
+    return host.str();
+}
+
+
+/*
+ * Start the command.  Return its pid, or -1 if it could not be run.
+ * posix_spawnp() does not copy our address space the way fork() does,
+ * which matters when we run for every compile.
+ */
+pid_t
+spawnCommand(char *argv[])
+{
+    pid_t child;
+    int err = posix_spawnp(&child, argv[0], NULL, NULL, argv, environ);
+    if (err != 0) {
+	fprintf(stderr, "posix_spawnp %s failed: err %s\n", argv[0],
+		strerror(err));
 	return -1;
     }
+    return child;
+}
+
 
-    /* parent process -- just wait for the child */
+/* Wait for the command to finish, and return its wait status. */
+int
+waitCommand(pid_t child)
+{
     int status = 0;
     pid_t pid = -1;
     do
     {
-        pid = waitpid(forkret, &status, 0);
+        pid = waitpid(child, &status, 0);
     } while (pid == -1 && errno == EINTR);
 
-    Sclose(client_sock);
+    return status;
+}
 
-    return WEXITSTATUS(status);
+
+/*
+ * Run the command, and wait for it to finish.  Return its wait status, or
+ * -1 if it could not be run.
+ */
+int
+runCommand(char *argv[])
+{
+    pid_t child = spawnCommand(argv);
+    return (child < 0) ? -1 : waitCommand(child);
+}
+
+
+/*
+ * Wait up to msecs for the command to finish.  Return true, with its wait
+ * status in *status, if it did, or with -1 in *status if it cannot be
+ * waited for.
+ */
+bool
+waitCommandFor(pid_t child, long msecs, int *status)
+{
+    struct timeval begin;
+    gettimeofday(&begin, 0);
+    while (1) {
+	pid_t pid = waitpid(child, status, WNOHANG);
+	if (pid == child) {
+	    return true;
+	}
+	if (pid == -1 && errno != EINTR) {
+	    *status = -1;
+	    return true;
+	}
+	struct timeval now;
+	gettimeofday(&now, 0);
+	long left = msecs - ((now.tv_sec - begin.tv_sec) * 1000 +
+			     (now.tv_usec - begin.tv_usec) / 1000);
+	if (left <= 0) {
+	    return false;
+	}
+	long wait = (left < HEDGE_POLL_MSECS) ? left : HEDGE_POLL_MSECS;
+	struct timeval t = { wait / 1000, (wait % 1000) * 1000 };
+	select(0, NULL, NULL, NULL, &t);
+    }
+}
+
+
+/*
+ * Return the index in argv of the output file of a compile that may be
+ * raced on a hedge, or -1.  It must be a "-c" of a source file with one
+ * "-o <file>", and have no "-M" options: the dependency files are named
+ * after the output, or written to stdout, and the two compiles would
+ * both write them.
+ */
+int
+getHedgeOutput(char *argv[])
+{
+    int out = -1;
+    bool compile = false;
+    for (int i = 1; argv[i] != NULL; i++) {
+	if (strcmp(argv[i], "-c") == 0) {
+	    compile = true;
+	} else if (strcmp(argv[i], "-o") == 0) {
+	    if (out >= 0 || argv[i + 1] == NULL) {
+		return -1;
+	    }
+	    out = ++i;
+	} else if (strncmp(argv[i], "-o", 2) == 0 ||
+		   strncmp(argv[i], "-M", 2) == 0 ||
+		   strncmp(argv[i], "-Wp,-M", 6) == 0) {
+	    return -1;
+	}
+    }
+    struct stat st;
+    return (compile && getSourceFile(argv, &st) != NULL) ? out : -1;
+}
+
+
+/*
+ * Run the command on the slot's host, as runCommand() does -- but if it
+ * is still running after the slot's hedge time, ask the server for a
+ * hedge, and race a copy of the command on that host, writing its output
+ * to a file of its own.  The first of the two to finish wins, unless
+ * distcc could not run it, and the other is killed, its cpu given back,
+ * and its output thrown away.  Set *ran to the winner's slot, and *start
+ * to when it was started.
+ */
+int
+runHedged(dmucs_client *client, const char *dprop, char *argv[],
+	  dmucs_slot *slot, dmucs_slot *hedge, dmucs_slot **ran,
+	  struct timeval *start)
+{
+    *ran = slot;
+    int out = getHedgeOutput(argv);
+    if (out < 0) {
+	return runCommand(argv);
+    }
+
+    pid_t child = spawnCommand(argv);
+    if (child < 0) {
+	return -1;
+    }
+    int status = -1;
+    if (waitCommandFor(child, slot->hedge_ms, &status)) {
+	return status;
+    }
+    if (dmucs_hedge(client, dprop, slot, hedge) != 1) {
+	DMUCS_DEBUG((stderr, "No hedge: waiting for %s\n", slot->name));
+	return waitCommand(child);
+    }
+
+    std::ostringstream tmp;
+    tmp << argv[out] << ".hedge." << getpid();
+    std::string tmpOut = tmp.str();
+    std::vector<char *> hedgeArgv;
+    for (int i = 0; argv[i] != NULL; i++) {
+	hedgeArgv.push_back((i == out) ? (char *) tmpOut.c_str() : argv[i]);
+    }
+    hedgeArgv.push_back(NULL);
+
+    DMUCS_DEBUG((stderr, "Racing the compile on %s against %s\n",
+		 hedge->name, slot->name));
+    setenv("DISTCC_HOSTS", distccHost(hedge).c_str(), 1);
+    struct timeval hedgeStart;
+    gettimeofday(&hedgeStart, 0);
+    pid_t hedgeChild = spawnCommand(&hedgeArgv[0]);
+    if (hedgeChild < 0) {
+	dmucs_release(client, hedge);
+	return waitCommand(child);
+    }
+
+    /* Wait for one of them to win. */
+    bool done = false, hedgeDone = false, hedgeWon = false;
+    int hedgeStatus = 0;
+    while (!done || !hedgeDone) {
+	int st;
+	pid_t pid = waitpid(-1, &st, 0);
+	if (pid == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    break;
+	}
+	if (pid == child) {
+	    done = true;
+	    status = st;
+	    if (!isDistccFailure(st)) {
+		break;
+	    }
+	} else if (pid == hedgeChild) {
+	    hedgeDone = true;
+	    hedgeStatus = st;
+	    if (!isDistccFailure(st)) {
+		hedgeWon = true;
+		break;
+	    }
+	}
+    }
+    if (hedgeWon ? !done : !hedgeDone) {
+	pid_t loser = hedgeWon ? child : hedgeChild;
+	kill(loser, SIGTERM);
+	waitCommand(loser);
+    }
+
+    if (!hedgeWon) {
+	unlink(tmpOut.c_str());
+	dmucs_release(client, hedge);
+	return status;
+    }
+    DMUCS_DEBUG((stderr, "The hedge on %s won\n", hedge->name));
+    dmucs_release(client, slot);
+    *ran = hedge;
+    *start = hedgeStart;
+    if (WIFEXITED(hedgeStatus) && WEXITSTATUS(hedgeStatus) == 0 &&
+	rename(tmpOut.c_str(), argv[out]) != 0) {
+	fprintf(stderr, "Could not rename %s to %s: %s\n", tmpOut.c_str(),
+		argv[out], strerror(errno));
+	return -1;
+    }
+    unlink(tmpOut.c_str());
+    return hedgeStatus;
+}
+
+
+/*
+ * Return the source file being compiled: the first argument that names a
+ * C, C++ or Objective-C file we can stat, or NULL if there is no such
+ * argument (e.g., when linking).
+ */
+const char *
+getSourceFile(char *argv[], struct stat *st)
+{
+    static const char *exts[] = { ".c", ".cc", ".cpp", ".cxx", ".c++", ".C",
+				  ".m", ".mm", ".i", ".ii", NULL };
+    for (; *argv != NULL; argv++) {
+	const char *dot = strrchr(*argv, '.');
+	if (dot == NULL || (*argv)[0] == '-') {
+	    continue;
+	}
+	for (int i = 0; exts[i] != NULL; i++) {
+	    if (strcmp(dot, exts[i]) == 0 && stat(*argv, st) == 0) {
+		return *argv;
+	    }
+	}
+    }
+    return NULL;
+}
+
+
+/*
+ * Return the size of the source file being compiled, so that the server
+ * can compare compile times of big and small files, or 0 if there is none.
+ */
+long
+getSourceSize(char *argv[])
+{
+    struct stat st;
+    return (getSourceFile(argv, &st) == NULL) ? 0 : (long) st.st_size;
+}
+
+
+/*
+ * Return the affinity key for this compile: the hash of the full path of
+ * the source file, or of the current directory if there is none.  The
+ * same file, compiled again, is then sent to the host that has its
+ * headers and objects in its caches.
+ */
+std::string
+getAffinityKey(char *argv[])
+{
+    struct stat st;
+    const char *src = getSourceFile(argv, &st);
+    char path[PATH_MAX];
+    if ((src != NULL && realpath(src, path) != NULL) ||
+	getcwd(path, sizeof(path)) != NULL) {
+	std::ostringstream key;
+	key << std::hex << dmucsHash(path);
+	return key.str();
+    }
+    return "";
+}
+
+
+/*
+ * distcc exits with a status from 100 to 118 when it, rather than the
+ * compiler, failed: the host could not be reached, the connection broke,
+ * the host was busy, etc.  101 means the command line was bad, which a
+ * local run will not fix, so that is not counted.
+ */
+bool
+isDistccFailure(int status)
+{
+    if (!WIFEXITED(status)) {
+	return false;
+    }
+    int exitStatus = WEXITSTATUS(status);
+    return (exitStatus >= 100 && exitStatus <= 118 && exitStatus != 101);
 }
 
 
@@ -276,5 +675,9 @@ void
 usage(const char *prog)
 {
     fprintf(stderr, "Usage: %s [-s|--server <server>] [-p|--port <port>] "
-	    "[-D|--debug] [-t|--type <typestr>] [-w|--wait <timeout>] <command> [args] \n\n", prog);
+	    "[-D|--debug] [-t|--type <typestr>] [-w|--wait <timeout>] "
+	    "[-a|--affinity] [-j|--jobserver <max cpus>] [-b|--broker <path>] "
+	    "[-c|--class <class>] [-g|--gang <n>] [-m|--mem <MB>] "
+	    "<command> [args] \n\n",
+	    prog);
 }
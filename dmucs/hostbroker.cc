@@ -0,0 +1,498 @@
+/*
+ * hostbroker.cc: a per-workstation broker between the "gethost" clients
+ * and the DMUCS server.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs.h"
+#include "dmucs_resolve.h"
+#include "dmucs_unix_skt.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <string>
+#include <sstream>
+#include <list>
+#include <map>
+#include <deque>
+#include "COSMIC/HDR/sockets.h"
+
+
+#define DMUCS_BROKER_WINDOW	5	/* recent demand is the number of
+					   requests in the last 5 seconds. */
+#define DMUCS_BROKER_IDLE	2	/* give spare cpus back to the server
+					   after they are idle this long. */
+#define DMUCS_BROKER_RENEW	10	/* renew the leases on the cpus we
+					   hold this often, in seconds: a
+					   lease-time must be longer. */
+
+
+/* A cpu we hold from the server. */
+struct BrokerCpu {
+    unsigned int	ip_;		// 0 for none.
+    std::string		name_;
+    std::string		dprop_;		// the dprop it was asked for.
+    int			slots_;		// its host's, 0 if not sent.
+    time_t		idleSince_;	// when it went into the pool.
+
+    BrokerCpu() : ip_(0), slots_(0), idleSince_(0) {}
+};
+
+
+static void usage(const char *prog);
+static bool connectServer();
+static void dropServer();
+static BrokerCpu askServer(const std::string &dprop,
+			   const std::string &opts);
+static void giveBack(const BrokerCpu &cpu);
+static void handleClient(Socket *sock);
+static void closeClient(Socket *sock);
+static void maintainPool(time_t now);
+
+bool debugMode = false;
+
+static std::string serverName;
+static std::string clientPort;
+static std::string reqPrefix;		// "host <my ip> "
+static std::string brokerDprop;
+static int maxSpare = 2;
+
+static Socket *server = NULL;		// our one connection to the server.
+static std::list<BrokerCpu> pool;	// spare cpus, newest first.
+static std::map<Socket *, BrokerCpu> clients; // the cpu each client has.
+static std::deque<time_t> recent;	// when the latest requests came.
+static time_t renewedAt = 0;		// when we last renewed our leases.
+static std::map<unsigned int, std::string> names;
+
+
+int
+main(int argc, char *argv[])
+{
+    /*
+     * The "gethost" clients on this machine talk to us over a Unix domain
+     * socket, instead of each one looking up its own address, opening a
+     * TCP connection to the server, and looking up the name of the host
+     * it is given:
+     *
+     * o Hold one connection to the server, and on it, a small pool of
+     *   spare cpus of the -t dprop -- as many as there were requests for
+     *   it in the last DMUCS_BROKER_WINDOW seconds, up to the -n maximum.
+     * o Give a client a spare cpu, and its name, straight away.  Only
+     *   ask the server if there are none, or if the client wants an
+     *   affinity host (which only the server can pick), or another
+     *   dprop (which we do not pool).
+     * o When the client closes its connection, put its cpu back in the
+     *   pool (or give it back, if it is of another dprop), and pass on
+     *   its "done" message, if it sent one.
+     * o Give spare cpus back to the server once they have been idle for
+     *   DMUCS_BROKER_IDLE seconds and demand has dropped.
+     * o Renew the leases on all the cpus we hold every
+     *   DMUCS_BROKER_RENEW seconds, for a dprop with a lease-time.
+     */
+
+    /*
+     * Process command-line arguments.
+     *
+     * -s <server>, --server <server>: the name of the server machine.
+     * -p <port>, --port <port>: the port number of the server.
+     * -t <distinguishing-type-str>: the dprop of the hosts to pool.
+     * -u <path>, --unix-socket <path>: where to listen for gethost
+     *    (default: /tmp/.dmucs-broker.<uid>).
+     * -n <num>, --spare <num>: the most spare cpus to hold (default: 2).
+     * -D, --debug: debug mode (default: off)
+     */
+    std::ostringstream sname;
+    sname << "@" << SERVER_MACH_NAME;
+    int serverPortNum = SERVER_PORT_NUM;
+    std::ostringstream path;
+    path << "/tmp/.dmucs-broker." << getuid();
+    std::string unixPath = path.str();
+
+    for (int i = 1; i < argc; i++) {
+	if (strequ("-s", argv[i]) || strequ("--server", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    sname.seekp(1);     // remove everything after the first "@".
+	    sname << argv[i] << '\0';
+	} else if (strequ("-p", argv[i]) || strequ("--port", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    serverPortNum = atoi(argv[i]);
+	} else if (strequ("-t", argv[i]) || strequ("--type", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    brokerDprop = argv[i];
+	} else if (strequ("-u", argv[i]) || strequ("--unix-socket", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    unixPath = argv[i];
+	} else if (strequ("-n", argv[i]) || strequ("--spare", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    maxSpare = atoi(argv[i]);
+	} else if (strequ("-D", argv[i]) || strequ("--debug", argv[i])) {
+	    debugMode = true;
+	} else {
+	    usage(argv[0]);
+	    return -1;
+	}
+    }
+    serverName = sname.str().c_str();
+    std::ostringstream cport;
+    cport << "c" << serverPortNum;
+    clientPort = cport.str();
+
+    char hostname[256];
+    if (gethostname(hostname, 256) < 0) {
+	fprintf(stderr, "Could not get my hostname\n");
+	return -1;
+    }
+    struct hostent *he = gethostbyname(hostname);
+    if (he == NULL) {
+	fprintf(stderr, "Could not get my hostname\n");
+	return -1;
+    }
+    struct in_addr in;
+    memcpy(&in.s_addr, he->h_addr_list[0], sizeof(in.s_addr));
+    reqPrefix = std::string("host ") + inet_ntoa(in) + " ";
+
+    /* A client that goes away before reading its reply must not kill us. */
+    signal(SIGPIPE, SIG_IGN);
+
+    Socket *listener = SopenUnixServer(unixPath.c_str());
+    if (listener == NULL) {
+	fprintf(stderr, "Could not listen on %s: %s\n", unixPath.c_str(),
+		strerror(errno));
+	return -1;
+    }
+    Smaskset(listener);
+    (void) connectServer();
+
+    while (1) {
+	Smasktime(1L, 0L);	// look after the pool at least once a second.
+	int result = Smaskwait();
+
+	if (result > 0) {
+	    if (Smaskisset(listener)) {
+		Socket *sock = Saccept(listener);
+		if (sock != NULL) {
+		    clients[sock] = BrokerCpu();
+		    Smaskset(sock);
+		}
+	    }
+	    /* handleClient() may close the client, so walk a copy. */
+	    std::list<Socket *> ready;
+	    for (std::map<Socket *, BrokerCpu>::iterator itr = clients.begin();
+		 itr != clients.end(); ++itr) {
+		if (Smaskisset(itr->first)) {
+		    ready.push_back(itr->first);
+		}
+	    }
+	    for (std::list<Socket *>::iterator itr = ready.begin();
+		 itr != ready.end(); ++itr) {
+		handleClient(*itr);
+	    }
+	    if (server != NULL && Smaskisset(server)) {
+		/* The server only talks to us when we ask it something, so
+		   this means it closed the connection: our cpus are gone. */
+		char buf[BUFSIZ];
+		if (Sgets(buf, sizeof(buf), server) == NULL) {
+		    fprintf(stderr, "Lost the connection to the server\n");
+		    dropServer();
+		}
+	    }
+	} else if (result < 0 && errno != EINTR) {
+	    fprintf(stderr, "ERROR: result %d\n", result);
+	}
+
+	maintainPool(time(NULL));
+    }
+}
+
+
+static bool
+connectServer()
+{
+    if (server != NULL) {
+	return true;
+    }
+    DMUCS_DEBUG((stderr, "doing Sopen with %s, %s\n", serverName.c_str(),
+		 clientPort.c_str()));
+    server = Sopen((char *) serverName.c_str(), (char *) clientPort.c_str());
+    if (server == NULL) {
+	fprintf(stderr, "Could not connect to %s: %s\n", serverName.c_str(),
+		strerror(errno));
+	return false;
+    }
+    Smaskset(server);
+    return true;
+}
+
+
+/*
+ * Close the connection to the server.  The server takes back all the cpus
+ * we held on it, so forget them: the clients using them finish their
+ * compiles, but their cpus do not come back to the pool.
+ */
+static void
+dropServer()
+{
+    if (server == NULL) {
+	return;
+    }
+    Smaskunset(server);
+    Sclose(server);
+    server = NULL;
+    pool.clear();
+    for (std::map<Socket *, BrokerCpu>::iterator itr = clients.begin();
+	 itr != clients.end(); ++itr) {
+	itr->second = BrokerCpu();
+    }
+}
+
+
+/*
+ * Ask the server for a cpu of the dprop.  The result's ip_ is 0 if it has
+ * none.
+ */
+static BrokerCpu
+askServer(const std::string &dprop, const std::string &opts)
+{
+    BrokerCpu cpu;
+    if (! connectServer()) {
+	return cpu;
+    }
+
+    std::string req = reqPrefix + dprop + opts;
+    DMUCS_DEBUG((stderr, "Writing -->%s<-- to the server\n", req.c_str()));
+    Sputs((char *) req.c_str(), server);
+    char reply[256];
+    if (Sgets(reply, sizeof(reply), server) == NULL) {
+	fprintf(stderr, "Got error from reading socket.\n");
+	dropServer();
+	return cpu;
+    }
+    /* The reply is "<ip-address> [<name>=<value> ...]". */
+    char *values = strchr(reply, ' ');
+    if (values != NULL) {
+	*values++ = '\0';
+    }
+    unsigned int ipAddr = inet_addr(reply);
+    if (ipAddr == 0 || ipAddr == INADDR_NONE) {
+	return cpu;
+    }
+
+    cpu.ip_ = ipAddr;
+    cpu.dprop_ = dprop;
+    char *slots = (values != NULL) ? strstr(values, "slots=") : NULL;
+    cpu.slots_ = (slots != NULL) ? atoi(slots + 6) : 0;
+    std::map<unsigned int, std::string>::iterator itr = names.find(ipAddr);
+    if (itr == names.end()) {
+	struct in_addr in;
+	in.s_addr = ipAddr;
+	getHostName(names[ipAddr], in);
+	itr = names.find(ipAddr);
+    }
+    cpu.name_ = itr->second;
+    return cpu;
+}
+
+
+static void
+giveBack(const BrokerCpu &cpu)
+{
+    if (server == NULL) {
+	return;
+    }
+    struct in_addr in;
+    in.s_addr = cpu.ip_;
+    std::string rel = std::string("release ") + inet_ntoa(in);
+    DMUCS_DEBUG((stderr, "Writing -->%s<-- to the server\n", rel.c_str()));
+    Sputs((char *) rel.c_str(), server);
+}
+
+
+/*
+ * Handle a message from a gethost client.  These are:
+ * o "host [<dprop>] [<name>=<value> ...]": the reply is
+ *   "<ip-address> name=<hostname> done=1 [slots=<n>]", or "0.0.0.0" if
+ *   there is no cpu for it.
+ * o "done <exit status> <fell back> [<msecs> <bytes>]": passed on to the
+ *   server, for the cpu the client has.
+ */
+static void
+handleClient(Socket *sock)
+{
+    char buf[BUFSIZ];
+    if (Sgets(buf, sizeof(buf), sock) == NULL) {
+	closeClient(sock);
+	return;
+    }
+    DMUCS_DEBUG((stderr, "Got -->%s<-- from a client\n", buf));
+    BrokerCpu &held = clients[sock];
+
+    if (strncmp(buf, "host", 4) == 0) {
+	std::istringstream instr(buf);
+	std::string word, dprop, opts;
+	bool affinity = false;
+	instr >> word;
+	while (instr >> word) {
+	    if (word.find('=') == std::string::npos) {
+		dprop = word;
+	    } else {
+		affinity = affinity || (word.compare(0, 4, "key=") == 0);
+		opts += " " + word;
+	    }
+	}
+
+	if (held.ip_ == 0 && dprop == brokerDprop) {
+	    recent.push_back(time(NULL));
+	    if (! affinity && ! pool.empty()) {
+		held = pool.front();
+		pool.pop_front();
+	    } else {
+		held = askServer(dprop, opts);
+	    }
+	} else if (held.ip_ == 0) {
+	    held = askServer(dprop, opts);
+	}
+
+	std::ostringstream reply;
+	struct in_addr in;
+	in.s_addr = held.ip_;
+	reply << inet_ntoa(in);
+	if (held.ip_ != 0) {
+	    reply << " name=" << held.name_ << " done=1";
+	    if (held.slots_ > 0) {
+		reply << " slots=" << held.slots_;
+	    }
+	}
+	Sputs((char *) reply.str().c_str(), sock);
+    } else if (strncmp(buf, "done", 4) == 0) {
+	int exitStatus = 0, fellBack = 0, msecs = 0;
+	long bytes = 0;
+	if (sscanf(buf, "done %d %d %d %ld", &exitStatus, &fellBack, &msecs,
+		   &bytes) >= 2 && held.ip_ != 0 && server != NULL) {
+	    struct in_addr in;
+	    in.s_addr = held.ip_;
+	    std::ostringstream done;
+	    done << "done " << exitStatus << " " << fellBack << " " << msecs <<
+		" " << bytes << " " << inet_ntoa(in);
+	    Sputs((char *) done.str().c_str(), server);
+	}
+    } else {
+	fprintf(stderr, "request not recognized: ->%s<-\n", buf);
+	closeClient(sock);
+    }
+}
+
+
+/*
+ * The client is done: its cpu goes back in the pool, or back to the server
+ * if it is not of the dprop we pool.
+ */
+static void
+closeClient(Socket *sock)
+{
+    std::map<Socket *, BrokerCpu>::iterator itr = clients.find(sock);
+    if (itr->second.ip_ != 0 && itr->second.dprop_ != brokerDprop) {
+	giveBack(itr->second);
+    } else if (itr->second.ip_ != 0) {
+	itr->second.idleSince_ = time(NULL);
+	pool.push_front(itr->second);
+    }
+    clients.erase(itr);
+    Smaskunset(sock);
+    Sclose(sock);
+}
+
+
+/*
+ * Keep as many spare cpus as there were requests in the last
+ * DMUCS_BROKER_WINDOW seconds, up to maxSpare.  Extra ones are given back
+ * once they have been idle for DMUCS_BROKER_IDLE seconds, so that a burst
+ * of compiles does not take cpus away from everyone else for long.  And
+ * renew the leases on the cpus we hold, spare or not, so that the server
+ * does not take them back.
+ */
+static void
+maintainPool(time_t now)
+{
+    while (! recent.empty() && recent.front() <= now - DMUCS_BROKER_WINDOW) {
+	recent.pop_front();
+    }
+    unsigned int target = recent.size();
+    if (target > (unsigned int) maxSpare) {
+	target = maxSpare;
+    }
+
+    while (pool.size() > target &&
+	   pool.back().idleSince_ <= now - DMUCS_BROKER_IDLE) {
+	giveBack(pool.back());
+	pool.pop_back();
+    }
+    while (pool.size() < target) {
+	BrokerCpu cpu = askServer(brokerDprop, "");
+	if (cpu.ip_ == 0) {
+	    break;
+	}
+	cpu.idleSince_ = now;
+	pool.push_front(cpu);
+    }
+
+    if (server == NULL || now - renewedAt < DMUCS_BROKER_RENEW) {
+	return;
+    }
+    renewedAt = now;
+    bool holding = ! pool.empty();
+    for (std::map<Socket *, BrokerCpu>::iterator itr = clients.begin();
+	 itr != clients.end() && ! holding; ++itr) {
+	holding = (itr->second.ip_ != 0);
+    }
+    if (holding) {
+	DMUCS_DEBUG((stderr, "Writing -->renew<-- to the server\n"));
+	Sputs((char *) "renew", server);
+    }
+}
+
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-s|--server <server>] [-p|--port <port>] "
+	    "[-t|--type <typestr>]\n\t[-u|--unix-socket <path>] "
+	    "[-n|--spare <num>] [-D|--debug]\n\n", prog);
+}
@@ -0,0 +1,633 @@
+/*
+ * libdmucs.cc: the C API for getting compilation hosts from the DMUCS
+ * server, in-process.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "dmucs.h"
+#include "libdmucs.h"
+#include "dmucs_resolve.h"
+#include "dmucs_unix_skt.h"
+#include "dmucs_servers.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <set>
+#include <string>
+#include <sstream>
+
+
+#define DMUCS_RETRY_MSECS	500	/* how often to ask again, while
+					   waiting for cpus. */
+#define DMUCS_REPLY_TIMEOUT	500	/* msecs to wait for a server to
+					   answer, before trying the next
+					   one, if there is one. */
+
+
+struct dmucs_client
+{
+    Socket *		sock_;
+    bool		viaBroker_;	// the broker knows who we are.
+    DmucsServerList	servers_;
+    unsigned int	current_;	// the server we are connected to.
+    std::multiset<unsigned int> held_;	// the cpus we hold from it.
+    std::string		clientIp_;	// sent in each host request.
+    std::map<std::string, std::string> options_;
+    pthread_mutex_t	mutex_;		// one request at a time.
+    volatile bool	closing_;
+
+    /* The acquire running in the background, if any. */
+    pthread_t		thread_;
+    bool		threadStarted_;
+    bool		asyncPending_;
+    int			asyncN_;
+    std::string		asyncDprop_;
+    int			asyncTimeout_;
+    dmucs_slot *	asyncSlots_;
+    dmucs_callback	asyncCb_;
+    void *		asyncArg_;
+
+    dmucs_client(Socket *sock, bool viaBroker) :
+	sock_(sock), viaBroker_(viaBroker), current_(0),
+	closing_(false),
+	threadStarted_(false), asyncPending_(false) {
+	pthread_mutex_init(&mutex_, NULL);
+    }
+    ~dmucs_client() {
+	pthread_mutex_destroy(&mutex_);
+    }
+};
+
+
+class ClientLock
+{
+    pthread_mutex_t *m_;
+public:
+    ClientLock(dmucs_client *c) : m_(&c->mutex_) { pthread_mutex_lock(m_); }
+    ~ClientLock() { pthread_mutex_unlock(m_); }
+};
+
+
+/*
+ * Connect to the first server that answers, of count servers from
+ * servers_[first] on.  Return false if none do.
+ */
+static bool
+connectToServer(dmucs_client *c, unsigned int first, unsigned int count)
+{
+    Socket *sock = SopenServers(c->servers_, first, count, &c->current_);
+    if (sock == NULL) {
+	return false;
+    }
+
+    /* Our address is the one the connection to the server goes out on:
+       no need to look up our own name. */
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    if (getsockname(sock->skt, (struct sockaddr *) &local, &len) < 0) {
+	perror("getsockname");
+	Sclose(sock);
+	return false;
+    }
+    c->sock_ = sock;
+    c->clientIp_ = inet_ntoa(local.sin_addr);
+    return true;
+}
+
+
+/*
+ * Connect to the next server after the one that has failed us.  If we
+ * hold cpus, claim them on the new connection: a standby server that has
+ * taken over from the old one is holding them for us (see dmucs_repl.h).
+ */
+static bool
+failOver(dmucs_client *c)
+{
+    ClientLock l(c);
+    if (c->viaBroker_ || c->sock_ != NULL || c->servers_.size() < 2) {
+	return false;
+    }
+    fprintf(stderr, "WARNING: lost the server %s: trying the others\n",
+	    c->servers_[c->current_].name_.c_str());
+    if (! connectToServer(c, c->current_ + 1, c->servers_.size())) {
+	return false;
+    }
+    for (std::multiset<unsigned int>::iterator itr = c->held_.begin();
+	 itr != c->held_.end(); ++itr) {
+	struct in_addr in;
+	in.s_addr = *itr;
+	std::string msg = std::string("claim ") + inet_ntoa(in);
+	Swrite(c->sock_, (char *) msg.c_str(), (int) msg.size() + 1);
+    }
+    return true;
+}
+
+
+dmucs_client *
+dmucs_open(const char *server, int port)
+{
+    dmucs_client *c = new dmucs_client(NULL, false);
+    c->servers_ = parseServerList((server != NULL) ? server : SERVER_MACH_NAME,
+				  (port != 0) ? port : SERVER_PORT_NUM);
+    if (! connectToServer(c, 0, c->servers_.size())) {
+	delete c;
+	return NULL;
+    }
+
+    /* Tell the server who we are, for its quotas (see dmucs_fair.h). */
+    struct passwd *pw = getpwuid(getuid());
+    const char *user = (pw != NULL) ? pw->pw_name : getenv("USER");
+    if (user != NULL && *user != '\0') {
+	c->options_["user"] = user;
+    }
+    return c;
+}
+
+
+dmucs_client *
+dmucs_open_broker(const char *path)
+{
+    Socket *sock = SopenUnixClient(path);
+    if (sock == NULL) {
+	return NULL;
+    }
+    return new dmucs_client(sock, true);
+}
+
+
+void
+dmucs_close(dmucs_client *c)
+{
+    if (c == NULL) {
+	return;
+    }
+    c->closing_ = true;		// stop any acquire that is waiting.
+    if (c->threadStarted_) {
+	pthread_join(c->thread_, NULL);
+    }
+    if (c->sock_ != NULL) {
+	Sclose(c->sock_);	// the server takes back our cpus.
+    }
+    delete c;
+}
+
+
+void
+dmucs_set_option(dmucs_client *c, const char *name, const char *value)
+{
+    ClientLock l(c);
+    c->options_[name] = value;
+}
+
+
+/*
+ * Wait for a reply on the socket.  Return false if none came in
+ * DMUCS_REPLY_TIMEOUT msecs.  With only the one server there is nothing
+ * to fail over to, and a busy server must not cost us every cpu we hold,
+ * so then we wait for as long as it takes.
+ */
+static bool
+waitReply(const dmucs_client *c, struct pollfd *pfd)
+{
+    int timeout = (c->viaBroker_ || c->servers_.size() < 2) ? -1 :
+	DMUCS_REPLY_TIMEOUT;
+    int n;
+    do {
+	n = poll(pfd, 1, timeout);
+    } while (n < 0 && errno == EINTR);
+    return n > 0;
+}
+
+
+/*
+ * Send one message, and read the reply if there is one.  Return false if
+ * the connection is gone.
+ */
+static bool
+sendMsg(dmucs_client *c, const std::string &msg, char *reply, int len)
+{
+    ClientLock l(c);
+    if (c->sock_ == NULL) {
+	return false;
+    }
+    /* This is what Sputs() sends, but it tells us if the write failed.  A
+       server that is up, but does not answer, has failed too.  And as the
+       server never sends anything we did not ask for, a connection with
+       something to read has been closed by the server. */
+    struct pollfd pfd;
+    pfd.fd = c->sock_->skt;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) != 0 ||
+	Swrite(c->sock_, (char *) msg.c_str(), (int) msg.size() + 1) <= 0 ||
+	(reply != NULL && (! waitReply(c, &pfd) ||
+			   Sgets(reply, len, c->sock_) == NULL))) {
+	Sclose(c->sock_);
+	c->sock_ = NULL;
+	return false;
+    }
+    return true;
+}
+
+
+/* Send a message that has no reply, to another server if need be. */
+static bool
+sendOrFailOver(dmucs_client *c, const std::string &msg)
+{
+    return sendMsg(c, msg, NULL, 0) ||
+	(failOver(c) && sendMsg(c, msg, NULL, 0));
+}
+
+
+/*
+ * Read one more reply, to a message sent with sendMsg().  Return false if
+ * the connection is gone.
+ */
+static bool
+readMsg(dmucs_client *c, char *reply, int len)
+{
+    ClientLock l(c);
+    if (c->sock_ == NULL) {
+	return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = c->sock_->skt;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (! waitReply(c, &pfd) ||
+	Sgets(reply, len, c->sock_) == NULL) {
+	Sclose(c->sock_);
+	c->sock_ = NULL;
+	return false;
+    }
+    return true;
+}
+
+
+/*
+ * A reply to a host request is "<ip-address> [<name>=<value> ...]".
+ * Split off the address, and look for the values we know about.  Return
+ * false if the address is 0.0.0.0: there are no hosts left in the
+ * database.  Set *gang to the value of "gang=", or 0.
+ */
+static bool
+parseReply(char *reply, dmucs_slot *slot, int *gang)
+{
+    char *values = strchr(reply, ' ');
+    if (values != NULL) {
+	*values++ = '\0';
+    }
+    unsigned int ipAddr = inet_addr(reply);
+    if (ipAddr == 0 || ipAddr == INADDR_NONE) {
+	return false;
+    }
+
+    char *g = (values != NULL) ? strstr(values, "gang=") : NULL;
+    *gang = (g != NULL) ? atoi(g + 5) : 0;
+
+    slot->ip = ipAddr;
+    slot->report = (values != NULL && strstr(values, "done=1") != NULL);
+    char *h = (values != NULL) ? strstr(values, "hedge=") : NULL;
+    slot->hedge_ms = (h != NULL) ? atol(h + 6) : 0;
+    char *s = (values != NULL) ? strstr(values, "slots=") : NULL;
+    slot->slots = (s != NULL) ? atoi(s + 6) : 0;
+    slot->name[0] = '\0';
+    char *name = (values != NULL) ? strstr(values, "name=") : NULL;
+    if (name != NULL) {
+	size_t n = strcspn(name + 5, " ");
+	if (n >= sizeof(slot->name)) {
+	    n = sizeof(slot->name) - 1;
+	}
+	memcpy(slot->name, name + 5, n);
+	slot->name[n] = '\0';
+    } else {
+	/* An older server: put the name in DISTCC_HOSTS rather than the
+	   address, so that the output in distccmon-text is nice. */
+	struct in_addr in;
+	in.s_addr = ipAddr;
+	std::string resolved;
+	getHostName(resolved, in);
+	strncpy(slot->name, resolved.c_str(), sizeof(slot->name) - 1);
+	slot->name[sizeof(slot->name) - 1] = '\0';
+    }
+    return true;
+}
+
+
+/*
+ * Ask for n cpus, all at once if n > 1.  Return the number we got: n, or
+ * 0 if there are not that many free -- or, from an older server that
+ * does not know about gangs, 1.  Return -1 if the connection failed.
+ */
+static int
+requestCpus(dmucs_client *c, const char *dprop, int n, dmucs_slot *slots,
+	    const std::string &extra = "")
+{
+    std::ostringstream req;
+    req << "host ";
+    if (! c->viaBroker_) {
+	req << c->clientIp_ << " ";
+    }
+    req << ((dprop != NULL) ? dprop : "");
+    {
+	ClientLock l(c);
+	for (std::map<std::string, std::string>::iterator itr =
+		 c->options_.begin(); itr != c->options_.end(); ++itr) {
+	    req << " " << itr->first << "=" << itr->second;
+	}
+    }
+    if (n > 1) {
+	req << " gang=" << n;
+    }
+    req << extra;
+
+    char reply[BUFSIZ];
+    if (! sendMsg(c, req.str(), reply, sizeof(reply))) {
+	return -1;
+    }
+    int gang = 0;
+    if (! parseReply(reply, &slots[0], &gang)) {
+	return 0;
+    }
+    for (int i = 1; i < gang && i < n; i++) {
+	int ignored;
+	if (! readMsg(c, reply, sizeof(reply)) ||
+	    ! parseReply(reply, &slots[i], &ignored)) {
+	    return -1;
+	}
+    }
+    return (gang > 1) ? gang : 1;
+}
+
+
+/*
+ * Wait DMUCS_RETRY_MSECS before asking again, or less if the time we
+ * were given is nearly up.  Return false if it is up.
+ */
+static bool
+waitToRetry(dmucs_client *c, const struct timeval &begin, int timeout_ms)
+{
+    if (timeout_ms == 0 || c->closing_) {
+	return false;
+    }
+    struct timeval now;
+    gettimeofday(&now, 0);
+    long elapsed = (now.tv_sec - begin.tv_sec) * 1000 +
+	(now.tv_usec - begin.tv_usec) / 1000;
+    long wait = DMUCS_RETRY_MSECS;
+    if (timeout_ms > 0) {
+	if (elapsed >= timeout_ms) {
+	    return false;
+	}
+	if (timeout_ms - elapsed < wait) {
+	    wait = timeout_ms - elapsed;
+	}
+    }
+    struct timeval t = { wait / 1000, (wait % 1000) * 1000 };
+    select(0, NULL, NULL, NULL, &t);
+    return true;
+}
+
+
+int
+dmucs_acquire(dmucs_client *c, int n, const char *dprop, int timeout_ms,
+	      dmucs_slot *slots)
+{
+    if (c->viaBroker_ && n > 1) {
+	n = 1;			// the broker gives one cpu per client.
+    }
+
+    struct timeval begin;
+    gettimeofday(&begin, 0);
+    int got = 0;
+    while (1) {
+	while (got < n) {
+	    int ret = requestCpus(c, dprop, 1, &slots[got]);
+	    if (ret < 0 && failOver(c)) {
+		ret = requestCpus(c, dprop, 1, &slots[got]);
+	    }
+	    if (ret < 0) {
+		fprintf(stderr, "Got error from reading socket.\n");
+		return -1;
+	    }
+	    if (ret == 0) {
+		break;
+	    }
+	    ClientLock l(c);
+	    c->held_.insert(slots[got++].ip);
+	}
+	if (got == n || ! waitToRetry(c, begin, timeout_ms)) {
+	    return got;
+	}
+    }
+}
+
+
+int
+dmucs_acquire_gang(dmucs_client *c, int n, const char *dprop,
+		   int timeout_ms, dmucs_slot *slots)
+{
+    if (c->viaBroker_ || n <= 1) {
+	return dmucs_acquire(c, n, dprop, timeout_ms, slots);
+    }
+
+    struct timeval begin;
+    gettimeofday(&begin, 0);
+    while (1) {
+	int ret = requestCpus(c, dprop, n, slots);
+	if (ret < 0 && failOver(c)) {
+	    ret = requestCpus(c, dprop, n, slots);
+	}
+	if (ret < 0) {
+	    fprintf(stderr, "Got error from reading socket.\n");
+	    return -1;
+	}
+	if (ret > 0) {
+	    {
+		ClientLock l(c);
+		for (int i = 0; i < ret; i++) {
+		    c->held_.insert(slots[i].ip);
+		}
+	    }
+	    if (ret == n) {
+		return n;
+	    }
+	    /* An older server gave us just one: get the rest one at a
+	       time. */
+	    int more = dmucs_acquire(c, n - ret, dprop, timeout_ms,
+				     slots + ret);
+	    return (more < 0) ? -1 : ret + more;
+	}
+	if (! waitToRetry(c, begin, timeout_ms)) {
+	    return 0;
+	}
+    }
+}
+
+
+static void *
+runAcquire(void *arg)
+{
+    dmucs_client *c = (dmucs_client *) arg;
+    int got = dmucs_acquire(c, c->asyncN_, c->asyncDprop_.c_str(),
+			    c->asyncTimeout_, c->asyncSlots_);
+    {
+	ClientLock l(c);
+	c->asyncPending_ = false;
+    }
+    c->asyncCb_(c, got, c->asyncSlots_, c->asyncArg_);
+    return NULL;
+}
+
+
+int
+dmucs_acquire_async(dmucs_client *c, int n, const char *dprop,
+		    int timeout_ms, dmucs_slot *slots, dmucs_callback cb,
+		    void *arg)
+{
+    {
+	ClientLock l(c);
+	if (c->asyncPending_) {
+	    return -1;
+	}
+	c->asyncPending_ = true;
+    }
+    if (c->threadStarted_) {
+	pthread_join(c->thread_, NULL);	// the last one is done.
+	c->threadStarted_ = false;
+    }
+
+    c->asyncN_ = n;
+    c->asyncDprop_ = (dprop != NULL) ? dprop : "";
+    c->asyncTimeout_ = timeout_ms;
+    c->asyncSlots_ = slots;
+    c->asyncCb_ = cb;
+    c->asyncArg_ = arg;
+    if (pthread_create(&c->thread_, NULL, runAcquire, (void *) c) != 0) {
+	perror("pthread_create");
+	ClientLock l(c);
+	c->asyncPending_ = false;
+	return -1;
+    }
+    c->threadStarted_ = true;
+    return 0;
+}
+
+
+int
+dmucs_hedge(dmucs_client *c, const char *dprop, const dmucs_slot *slot,
+	    dmucs_slot *hedge)
+{
+    if (c->viaBroker_) {
+	return 0;
+    }
+    /* No fail over: the compile goes on, and a hedge is not worth
+       waiting for. */
+    struct in_addr in;
+    in.s_addr = slot->ip;
+    int ret = requestCpus(c, dprop, 1, hedge,
+			  std::string(" hedge=") + inet_ntoa(in));
+    if (ret > 0) {
+	ClientLock l(c);
+	c->held_.insert(hedge->ip);
+    }
+    return ret;
+}
+
+
+int
+dmucs_release(dmucs_client *c, const dmucs_slot *slot)
+{
+    struct in_addr in;
+    in.s_addr = slot->ip;
+    std::string msg = std::string("release ") + inet_ntoa(in);
+    if (! sendOrFailOver(c, msg)) {
+	return -1;
+    }
+    ClientLock l(c);
+    std::multiset<unsigned int>::iterator itr = c->held_.find(slot->ip);
+    if (itr != c->held_.end()) {
+	c->held_.erase(itr);
+    }
+    return 0;
+}
+
+
+int
+dmucs_renew(dmucs_client *c, const dmucs_slot *slot)
+{
+    std::string msg = "renew";
+    if (slot != NULL) {
+	struct in_addr in;
+	in.s_addr = slot->ip;
+	msg += std::string(" ") + inet_ntoa(in);
+    }
+    return sendOrFailOver(c, msg) ? 0 : -1;
+}
+
+
+int
+dmucs_done(dmucs_client *c, const dmucs_slot *slot, int exit_status,
+	   int fell_back, long msecs, long bytes)
+{
+    struct in_addr in;
+    in.s_addr = slot->ip;
+    std::ostringstream msg;
+    msg << "done " << exit_status << " " << (fell_back ? 1 : 0) << " " <<
+	msecs << " " << bytes << " " << inet_ntoa(in);
+    return sendOrFailOver(c, msg.str()) ? 0 : -1;
+}
+
+
+int
+dmucs_distcc_hosts(const dmucs_slot *slots, int nslots, char *buf,
+		   size_t len)
+{
+    /* List each host once, with the number of its cpus we hold, so that
+       distcc runs no more compiles there than that. */
+    std::ostringstream hosts;
+    for (int i = 0; i < nslots; i++) {
+	bool seen = false;
+	int count = 0;
+	for (int j = 0; j < nslots; j++) {
+	    if (strcmp(slots[i].name, slots[j].name) == 0) {
+		seen = seen || (j < i);
+		count++;
+	    }
+	}
+	if (! seen) {
+	    hosts << ((i > 0) ? " " : "") << slots[i].name << "/" << count <<
+		",lzo";
+	}
+    }
+    if (hosts.str().size() >= len) {
+	return -1;
+    }
+    strcpy(buf, hosts.str().c_str());
+    return (int) hosts.str().size();
+}
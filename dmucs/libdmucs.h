@@ -0,0 +1,142 @@
+#ifndef _LIBDMUCS_H_
+#define _LIBDMUCS_H_ 1
+
+/*
+ * libdmucs.h: the C API for getting compilation hosts from the DMUCS
+ * server, in-process.
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * This is what "gethost" uses to talk to the server, for build tools that
+ * want to hold cpus themselves rather than run gethost for each compile:
+ *
+ *	dmucs_client *c = dmucs_open(NULL, 0);
+ *	dmucs_slot slots[4];
+ *	int n = dmucs_acquire(c, 4, NULL, 5000, slots);
+ *	... run up to n compiles on slots[0..n-1] ...
+ *	dmucs_close(c);		(gives back all the cpus)
+ *
+ * A client is one connection to the server, and all the cpus it holds
+ * are for the same dprop.  The calls are thread-safe.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dmucs_client dmucs_client;
+
+/* One cpu given out by the server. */
+typedef struct dmucs_slot {
+    unsigned int ip;		/* the host's address, in network order. */
+    char	name[256];	/* the host's name, for DISTCC_HOSTS. */
+    int		report;		/* 1 if the server wants a dmucs_done() for
+				   the compile run on this cpu. */
+    long	hedge_ms;	/* if the compile runs longer than this, it
+				   may be raced on a dmucs_hedge() cpu; 0
+				   if the server does not hedge. */
+    int		slots;		/* how many compiles the host may run at
+				   once, for DISTCC_HOSTS; 0 if the server
+				   did not say. */
+} dmucs_slot;
+
+/*
+ * Called from another thread when a dmucs_acquire_async() is finished,
+ * with what dmucs_acquire() would have returned.
+ */
+typedef void (*dmucs_callback)(dmucs_client *c, int nslots,
+			       dmucs_slot *slots, void *arg);
+
+
+/* Connect to the server (NULL and 0 mean the defaults gethost uses), or
+   to the hostbroker listening on "path".  Return NULL on failure.  The
+   server may be a list, "<server>[:<port>],...": the first one that
+   answers is used, and if it stops answering, the others are tried.
+   The cpus held are claimed from the new server, which has them if it
+   was the standby of the old one. */
+dmucs_client *dmucs_open(const char *server, int port);
+dmucs_client *dmucs_open_broker(const char *path);
+
+/* Give back all the cpus held, and close the connection. */
+void dmucs_close(dmucs_client *c);
+
+/* Set a host request option (see dmucs_cpu_req.h: e.g., "cost", "key")
+   that is sent with each request from now on.  dmucs_open() sets "user"
+   to the user we run as. */
+void dmucs_set_option(dmucs_client *c, const char *name, const char *value);
+
+/*
+ * Get up to n cpus of the dprop (NULL is the default dprop), waiting up
+ * to timeout_ms for them (0: don't wait, -1: wait until we have n).
+ * Return how many were put in slots, or -1 if the connection failed.  A
+ * hostbroker gives out one cpu per connection.
+ */
+int dmucs_acquire(dmucs_client *c, int n, const char *dprop, int timeout_ms,
+		  dmucs_slot *slots);
+
+/* The same, but return at once, and call cb when it is done.  Return -1
+   if an acquire is already in progress on this client.  slots must stay
+   valid until then. */
+int dmucs_acquire_async(dmucs_client *c, int n, const char *dprop,
+			int timeout_ms, dmucs_slot *slots, dmucs_callback cb,
+			void *arg);
+
+/* Get n cpus all at once, or none: the server gives out the gang when it
+   has n free, and holds the cpus that come free for it, in its turns,
+   until it does.  Return n, or 0 if the timeout passed first, or -1 on
+   failure.  Set the option "same" to "dprop" or "tier" for cpus all of
+   one dprop, or of one tier of one dprop.  (From an older server, or the
+   hostbroker, the cpus are got one at a time, as dmucs_acquire() does.) */
+int dmucs_acquire_gang(dmucs_client *c, int n, const char *dprop,
+		       int timeout_ms, dmucs_slot *slots);
+
+/* Ask, once, for a hedge: a cpu on another host than slot's, to race
+   the compile running on slot, which has gone past slot->hedge_ms.
+   Return 1, and fill in hedge, if we got one, or 0 if the server would
+   not give one (or we talk to it through the hostbroker), or -1 on
+   failure.  Give back the cpu of the compile that loses with
+   dmucs_release(). */
+int dmucs_hedge(dmucs_client *c, const char *dprop, const dmucs_slot *slot,
+		dmucs_slot *hedge);
+
+/* Give one cpu back, and keep the others. */
+int dmucs_release(dmucs_client *c, const dmucs_slot *slot);
+
+/* Start the lease on a cpu (or on all of them, if slot is NULL) again,
+   when the dprop has a lease-time. */
+int dmucs_renew(dmucs_client *c, const dmucs_slot *slot);
+
+/* Tell the server how the compile on a cpu went, when slot->report is
+   set: its exit status, whether it fell back to compiling locally, and
+   how long it took on how many bytes of source (0 if not known). */
+int dmucs_done(dmucs_client *c, const dmucs_slot *slot, int exit_status,
+	       int fell_back, long msecs, long bytes);
+
+/* Write the DISTCC_HOSTS value for the slots ("<name>/<n>,lzo ...") to
+   buf.  Return its length, or -1 if it did not fit. */
+int dmucs_distcc_hosts(const dmucs_slot *slots, int nslots, char *buf,
+		       size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
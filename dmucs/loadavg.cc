@@ -20,6 +20,7 @@
  */
 
 #include "dmucs.h"
+#include "dmucs_servers.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -40,6 +41,7 @@
 extern char **environ;
 void usage(const char *prog);
 void sleep();
+long getMemMb();
 
 
 bool debugMode = false;
@@ -62,16 +64,25 @@ main(int argc, char *argv[])
     /*
      * Process command-line arguments.
      *
-     * -s <server>, --server <server>: the name of the server machine.
+     * -s <server>, --server <server>: the name of the server machine, or
+     *    a list of them, "<server>[:<port>],..." -- the load average is
+     *    sent to each of them.
      * -p <port>, --port <port>: the port number to listen on (default: 6714).
      * -t <distinguishing-type-str>: a string that indicates which type
-     *    of host the compilation machine is.
+     *    of host the compilation machine is: its labels,
+     *    "<label>[,<label> ...]", any of which a host request may ask
+     *    for (see dmucs_labels.h).
+     * -m <MB>, --mem <MB>: the memory of the compilation machine, or
+     *    "auto" to find it out, sent with the load average so that the
+     *    server does not give out more of it than there is -- see
+     *    dmucs_host.h.  Only newer servers understand this (default: not
+     *    sent)
      * -D, --debug: debug mode (default: off)
      */
-    std::ostringstream serverName;
-    serverName << "@" << SERVER_MACH_NAME;
+    std::string serverName = SERVER_MACH_NAME;
     int serverPortNum = SERVER_PORT_NUM;
     std::string distingProp = "";
+    long memMb = 0;
 
     for (int i = 1; i < argc; i++) {
 	if (strequ("-s", argv[i]) || strequ("--server", argv[i])) {
@@ -79,8 +90,7 @@ main(int argc, char *argv[])
 		usage(argv[0]);
 		return -1;
 	    }
-	    serverName.seekp(1);     // remove everything after the first "@".
-	    serverName << argv[i] << '\0';
+	    serverName = argv[i];
 	} else if (strequ("-p", argv[i]) || strequ("--port", argv[i])) {
 	    if (++i >= argc) {
 		usage(argv[0]);
@@ -93,6 +103,12 @@ main(int argc, char *argv[])
 		return -1;
 	    }
 	    distingProp = argv[i];
+	} else if (strequ("-m", argv[i]) || strequ("--mem", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    memMb = strequ("auto", argv[i]) ? getMemMb() : atol(argv[i]);
 	} else if (strequ("-D", argv[i]) || strequ("--debug", argv[i])) {
 	    debugMode = true;
 	} else {
@@ -101,8 +117,7 @@ main(int argc, char *argv[])
 	}
     }
 
-    std::ostringstream clientPortStr;
-    clientPortStr << "c" << serverPortNum;
+    DmucsServerList servers = parseServerList(serverName, serverPortNum);
 
     char hostname[256];
     if (gethostname(hostname, 256) < 0) {
@@ -118,23 +133,9 @@ main(int argc, char *argv[])
     memcpy(&in.s_addr, he->h_addr_list[0], sizeof(in.s_addr));
 
     while (1) {
-	DMUCS_DEBUG((stderr, "doing Sopen with %s, %s\n",
-		     serverName.str().c_str(), clientPortStr.str().c_str()));
-	Socket *client_sock = Sopen((char *) serverName.str().c_str(),
-				    (char *) clientPortStr.str().c_str());
-	if (!client_sock) {
-	    fprintf(stderr, "Could not open client: %s\n", strerror(errno));
-	    Sclose(client_sock);
-	    sleep();
-	    continue;
-	}
-
-	DMUCS_DEBUG((stderr, "got socket: %s\n", Sprtskt(client_sock)));
-
 	FILE *output = popen("uptime", "r");
 	if (output == NULL) {
 	    fprintf(stderr, "Failed to get load avg\n");
-	    Sclose(client_sock);
 	    sleep();
 	    continue;
 	}
@@ -171,11 +172,27 @@ main(int argc, char *argv[])
 
 	std::string clientReqStr = "load " + std::string(inet_ntoa(in)) +
             std::string(ldStr) + std::string(" ") + distingProp;
-	DMUCS_DEBUG((stderr, "Writing -->%s<-- to the server\n",
-                     clientReqStr.c_str()));
+	if (memMb > 0) {
+	    std::ostringstream memStr;
+	    memStr << " mem=" << memMb;
+	    clientReqStr += memStr.str();
+	}
 
-	Sputs((char *) clientReqStr.c_str(), client_sock);
-	Sclose(client_sock);
+	/* Every server hears from us, so that a standby one knows the
+	   hosts, too.  One that is down does not hold up the others. */
+	for (unsigned int i = 0; i < servers.size(); i++) {
+	    unsigned int which;
+	    Socket *client_sock = SopenServers(servers, i, 1, &which);
+	    if (!client_sock) {
+		fprintf(stderr, "Could not open client to %s: %s\n",
+			servers[i].name_.c_str(), strerror(errno));
+		continue;
+	    }
+	    DMUCS_DEBUG((stderr, "Writing -->%s<-- to %s\n",
+			 clientReqStr.c_str(), servers[i].name_.c_str()));
+	    Sputs((char *) clientReqStr.c_str(), client_sock);
+	    Sclose(client_sock);
+	}
 
 	sleep();
     }
@@ -188,9 +205,26 @@ void sleep()
     select(0, NULL, NULL, NULL, &t);
 }
 
+/* Return the memory of this machine, in MB, or 0 if we can't tell. */
+long
+getMemMb()
+{
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0) {
+	return (long) ((double) pages * pageSize / (1024 * 1024));
+    }
+#endif
+    fprintf(stderr, "Could not find out how much memory there is\n");
+    return 0;
+}
+
+
 void
 usage(const char *prog)
 {
     fprintf(stderr, "Usage: %s [-s|--server <server>] [-p|--port <port>] "
-	    "[-t|--type <str>] [-D|--debug]\n\n", prog);
+	    "[-t|--type <str>] [-m|--mem <MB>|auto] [-D|--debug]\n\n",
+	    prog);
 }
@@ -24,8 +24,17 @@
 #include "dmucs_dprop.h"
 #include "dmucs_msg.h"
 #include "dmucs_hosts_file.h"
+#include "dmucs_dprops_file.h"
+#include "dmucs_quotas_file.h"
 #include "dmucs_host.h"
 #include "dmucs_db.h"
+#include "dmucs_fair.h"
+#include "dmucs_admin.h"
+#include "dmucs_probe.h"
+#include "dmucs_peers.h"
+#include "dmucs_repl.h"
+#include "dmucs_sendq.h"
+#include "dmucs_servers.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -34,6 +43,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string>
 #include <errno.h>
 #include <time.h>
@@ -43,11 +53,11 @@
 
 
 static void spawn_stats_thread();
-static void spawn_silent_thread();
-static void *doSilentSearch(void *bogus);
 static void *updateStats(void *bogus);
 static void usage(const char *prog);
 static void handleReq(Socket *server, DmucsDb *db);
+static void setWaitTime(DmucsDb *db);
+static void handleTimers(DmucsDb *db);
 static char* peer2buf(const Socket *server, char *buf);
 
 void addFd(Socket *sock);
@@ -56,6 +66,8 @@ void removeFd(Socket *sock);
 bool debugMode = false;
 
 std::string hostsInfoFile = HOSTS_INFO_FILE;
+std::string dpropsInfoFile = DPROPS_INFO_FILE;
+std::string quotasInfoFile = QUOTAS_INFO_FILE;
 
 static std::list<Socket *> fdList;
 static std::map<Socket *, DmucsDprop> dpropMap;
@@ -83,6 +95,19 @@ main(int argc, char *argv[])
      *	   o if unavailable, remove the host from whatever set it is in.
      *   o receive monitoring requests from the monitoring clients.
      * 	   o package up the data structures and send the info in the reply.
+     *   o receive the results of probing the hosts' distccd ports.
+     *	   o take hosts whose distccd isn't answering out of the db.
+     *	   o put them back once enough probes in a row have succeeded.
+     *   o wake up when a host or lease deadline passes.
+     *	   o move hosts we haven't heard from to the silent state.
+     *	   o take back cpus whose leases have expired.
+     *   o send the changes to the db to our standby servers, if any.
+     *   o or, as a standby server, receive them from the primary.
+     *	   o take over if the primary server goes away.
+     *   o borrow cpus from the servers of other sites, when we have none
+     *     free, and lend them ours.
+     *   o hold the cpus that come free for the users waiting for them, in
+     *     turn.
      * 
      * Command-line arguments:
      *   o -D: display debugging output.  (Assumes -s.) Optional.
@@ -97,9 +122,26 @@ main(int argc, char *argv[])
      * -p <port>, --port <port>: the port number to listen on (default: 9714).
      * -D, --debug: debug mode (default: off)
      * -H, --hosts-info-file <filename>: specify the hosts info file location.
+     * -C, --dprops-info-file <filename>: specify the dprops info file
+     *     location.
+     * -Q, --quotas-info-file <filename>: specify the quotas info file
+     *     location (see dmucs_quotas_file.h).
+     * -P, --probe-interval <secs>: probe the hosts' distccd ports every
+     *     <secs> seconds (default: 0, do not probe).
+     * -S, --standby <server>[:<port>]: be a standby server for the primary
+     *     server given: keep a copy of its db, and take over when it goes
+     *     away (see dmucs_repl.h).
+     * -F, --failover-time <secs>: take over if we hear nothing from the
+     *     primary for <secs> seconds (default: 3).
+     * -R, --peers <server>[:<port>],...: borrow cpus from these servers,
+     *     when we have none free (see dmucs_peers.h).
      */
 
     int serverPortNum = SERVER_PORT_NUM;
+    int probeInterval = 0;
+    std::string primaryName;
+    int failoverTime = DMUCS_FAILOVER_TIME;
+    std::string peerNames;
 
 #ifndef HAVE_GETHOSTBYADDR_R
 #ifdef HAVE_GETHOSTBYADDR
@@ -124,6 +166,46 @@ main(int argc, char *argv[])
 		return -1;
 	    }
 	    hostsInfoFile = argv[i];
+	} else if (strequ("-C", argv[i]) ||
+		   strequ("--dprops-info-file", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    dpropsInfoFile = argv[i];
+	} else if (strequ("-Q", argv[i]) ||
+		   strequ("--quotas-info-file", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    quotasInfoFile = argv[i];
+	} else if (strequ("-P", argv[i]) ||
+		   strequ("--probe-interval", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    probeInterval = atoi(argv[i]);
+	} else if (strequ("-S", argv[i]) || strequ("--standby", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    primaryName = argv[i];
+	} else if (strequ("-F", argv[i]) ||
+		   strequ("--failover-time", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    failoverTime = atoi(argv[i]);
+	} else if (strequ("-R", argv[i]) || strequ("--peers", argv[i])) {
+	    if (++i >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    peerNames = argv[i];
 	} else {
 	    usage(argv[0]);
 	    return -1;
@@ -147,11 +229,8 @@ main(int argc, char *argv[])
 	return -1;
     }
 
-    /*
-     * Spawn a thread to periodically search the database for hosts
-     * that have been silent.  Move these hosts to the SILENT state.
-     */
-    spawn_silent_thread();
+    /* Seed the random picks of hosts (see dmucs_policy.h), once. */
+    srandom((unsigned int) time(NULL) ^ (unsigned int) getpid());
 
     /*
      * Spawn a thread to periodically collect statistics and print them
@@ -159,6 +238,42 @@ main(int argc, char *argv[])
      */
     spawn_stats_thread();
 
+    /*
+     * Start probing the hosts' distccd ports, if asked to.  The results
+     * come back to us on a pipe.
+     */
+    DmucsProber *prober = NULL;
+    if (probeInterval > 0) {
+	prober = DmucsProber::getInstance();
+	db->setProbePorts();
+	if (prober->start(probeInterval)) {
+	    Smaskfdset(prober->getFd());
+	} else {
+	    prober = NULL;
+	}
+    }
+
+
+    /*
+     * As a standby, get the primary server's db, and keep it up to date.
+     */
+    DmucsReplicator *repl = DmucsReplicator::getInstance();
+    if (!primaryName.empty() &&
+	!repl->follow(parseServerList(primaryName, SERVER_PORT_NUM),
+		      failoverTime)) {
+	fprintf(stderr, "Could not reach the primary server %s: "
+		"running as the primary.\n", primaryName.c_str());
+    }
+
+
+    /*
+     * Connect to the servers we may borrow cpus from.
+     */
+    DmucsPeers *peers = DmucsPeers::getInstance();
+    if (!peerNames.empty()) {
+	peers->setPeers(parseServerList(peerNames, SERVER_PORT_NUM));
+    }
+
 
     Smaskset(server);
 
@@ -166,12 +281,19 @@ main(int argc, char *argv[])
     while (1) {
 
 	DMUCS_DEBUG((stderr, "\n------- Server: calling select ---------\n"));
-               
+
+	/* Don't sleep past the next silent-host or lease deadline. */
+	setWaitTime(db);
 	int result = Smaskwait();
 	DMUCS_DEBUG((stderr, "select returned %d\n", result));
 
 	if (result > 0) {	// something is available to be read
 
+	    /* Hear from the primary first: if it has gone, we take over
+	       before we look at the claims its clients send us. */
+	    if (repl->isStandby() && Smaskisset(repl->getPrimary())) {
+		repl->handleInput();
+	    }
 	    std::list<Socket*>::const_iterator it;
 	    for (it = fdList.begin(); it != fdList.end(); ++it) {
 		if (Smaskisset(*it)) {
@@ -193,11 +315,27 @@ main(int argc, char *argv[])
 		    handleReq(sock_req, db);
 		}
 	    }
+	    if (prober && Smaskfdisset(prober->getFd())) {
+		prober->handleResults();
+		/* Pick up a changed probe-port for the next round. */
+		db->setProbePorts();
+	    }
+	    peers->handleInput();
 	} else if (result < 0) {
 	    // Error condition
 	    fprintf(stderr, "ERROR: result %d\n", result);
-	} else { // result == 0.
-	    fprintf(stderr, "Select timeout...\n");
+	}
+	// result == 0: a deadline has come up.
+
+	/* A standby's db is changed only by the primary. */
+	if (!repl->isStandby()) {
+	    handleTimers(db);
+	}
+	repl->handleTimers(time(NULL));
+	repl->flush();
+	peers->handleTimers(time(NULL));
+	if (!repl->isStandby()) {
+	    DmucsFairShare::getInstance()->dispatch(time(NULL));
 	}
     }
 
@@ -212,7 +350,7 @@ main(int argc, char *argv[])
 
 
 static void
-spawn_silent_thread()
+spawn_stats_thread()
 {
     pthread_attr_t tattr;
     pthread_attr_init(&tattr);
@@ -221,38 +359,79 @@ spawn_silent_thread()
        server is killed. */
     pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
     pthread_t thread_id;
-    if (pthread_create(&thread_id, &tattr, doSilentSearch,
-		       (void *) NULL) != 0) {
+    if (pthread_create(&thread_id, &tattr, updateStats, (void *) NULL) != 0) {
 	perror("pthread_create");
 	return;
     }
 }
 
 
+/*
+ * Set the select() timeout so that we wake up when the earliest host or
+ * lease deadline in the database comes due, or it is time to ping the
+ * standby servers (or to give up on the primary), or to tell the peers
+ * what we have free, or to stop holding cpus for waiting clients.  With
+ * no deadlines pending we wait forever.  While a standby or a peer has
+ * bytes queued that would not go, or a connect to a peer is under way, we
+ * come back every DMUCS_SENDQ_POLL msecs to see to it.
+ */
 static void
-spawn_stats_thread()
+setWaitTime(DmucsDb *db)
 {
-    pthread_attr_t tattr;
-    pthread_attr_init(&tattr);
-    /* We don't care about joining up this thread with its parent -- it
-       won't matter because both will die off together -- when the
-       server is killed. */
-    pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
-    pthread_t thread_id;
-    if (pthread_create(&thread_id, &tattr, updateStats, (void *) NULL) != 0) {
-	perror("pthread_create");
+    DmucsReplicator *repl = DmucsReplicator::getInstance();
+    time_t next = repl->isStandby() ? 0 : db->getNextDeadline();
+    time_t t = repl->getNextDeadline();
+    if (t != 0 && (next == 0 || t < next)) {
+	next = t;
+    }
+    t = DmucsPeers::getInstance()->getNextDeadline();
+    if (t != 0 && (next == 0 || t < next)) {
+	next = t;
+    }
+    t = DmucsFairShare::getInstance()->getNextDeadline();
+    if (t != 0 && (next == 0 || t < next)) {
+	next = t;
+    }
+    time_t now = time(NULL);
+    if ((repl->isBacklogged() || DmucsPeers::getInstance()->isBacklogged()) &&
+	(next == 0 || next > now)) {
+	Smasktime(0L, DMUCS_SENDQ_POLL * 1000L);
 	return;
     }
+    if (next == 0) {
+	Smasktime(0L, 0L);		// no timeout.
+	return;
+    }
+    if (next > now) {
+	Smasktime((long) (next - now), 0L);
+    } else {
+	Smasktime(0L, 1L);		// already due: just poll.
+    }
 }
 
 
-static void *
-doSilentSearch(void *bogus /* not used */)
+static void
+handleTimers(DmucsDb *db)
 {
-    while (1) {
-	struct timeval t = { 60L, 0L };		// 60 seconds.
-	select(0, NULL, NULL, NULL, &t);
-	DmucsDb::getInstance()->handleSilentHosts();
+    std::list<const Socket *> expired;
+    db->handleTimers(time(NULL), expired);
+
+    /* Close the connections whose leases were taken back, so the clients
+       see it. */
+    for (std::list<const Socket *>::iterator itr = expired.begin();
+	 itr != expired.end(); ++itr) {
+	removeFd((Socket *) *itr);
+    }
+
+    /* Tell the clients waiting for draining hosts that they are drained
+       (or put back in service), and hang up on them. */
+    DmucsDb::dmucs_drain_replies_t replies;
+    db->getDrainReplies(replies);
+    for (DmucsDb::dmucs_drain_replies_t::iterator itr = replies.begin();
+	 itr != replies.end(); ++itr) {
+	Socket *sock = (Socket *) itr->first;
+	Sputs((char *) itr->second.c_str(), sock);
+	removeFd(sock);
     }
 }
 
@@ -260,16 +439,17 @@ doSilentSearch(void *bogus /* not used */)
 static void *
 updateStats(void *bogus /* not used */)
 {
-    int served, max, avail;
+    int served, max, avail, tierMoves;
     char buf[32];
     while (1) {
-	DmucsDb::getInstance()->getStatsFromDb(&served, &max, &avail);
+	DmucsDb::getInstance()->getStatsFromDb(&served, &max, &avail,
+					       &tierMoves);
 	time_t t = time(NULL);
 	(void) ctime_r(&t, buf);
 	/* There is a newline on the end of buf -- remove it. */
 	buf[strlen(buf) - 1] = '\0';
-	fprintf(stderr, "[%s] Hosts Served: %d  Max/Avail: %d/%d\n",
-		buf, served, max, avail);
+	fprintf(stderr, "[%s] Hosts Served: %d  Max/Avail: %d/%d  "
+		"Tier moves: %d\n", buf, served, max, avail, tierMoves);
 
 	struct timeval sleepTime = { 60L, 0L };		// 60 seconds.
 	select(0, NULL, NULL, NULL, &sleepTime);
@@ -291,6 +471,15 @@ handleReq(Socket *sock_req, DmucsDb *db)
 	return;
     }
 
+    /* A standby only answers monitor requests: the clients go on to the
+       primary, while it is up. */
+    if (DmucsReplicator::getInstance()->isStandby() &&
+	strncmp(buf, "monitor", 7) != 0) {
+	DMUCS_DEBUG((stderr, "Standby: ignoring -->%s<--\n", buf));
+	removeFd(sock_req);
+	return;
+    }
+
     DmucsMsg *msg = DmucsMsg::parseMsg(sock_req, buf);
     if (msg == NULL) {
 	fprintf(stderr, "Got bad message on socket.  Continuing.\n");
@@ -327,6 +516,11 @@ addFd(Socket *sock)
 void
 removeFd(Socket *sock)
 {
+    DmucsReplicator::getInstance()->removeStandby(sock);
+    DmucsPeers::getInstance()->removeSocket(sock);
+    DmucsFairShare::getInstance()->removeSocket(sock);
+    DmucsDb::getInstance()->removeDrainWaiter(sock);
+    DmucsAdmin::getInstance()->removeSocket(sock);
     Smaskunset(sock);
     fdList.remove(sock);
     Sclose(sock);
@@ -338,7 +532,11 @@ static void
 usage(const char *prog)
 {
     fprintf(stderr, "Usage: %s [-p|--port <port>] [-D|--debug] "
-	    "[-H|--hosts-info-file <file>]\n\n", prog);
+	    "[-H|--hosts-info-file <file>] [-C|--dprops-info-file <file>]\n"
+	    "\t[-Q|--quotas-info-file <file>]\n"
+	    "\t[-P|--probe-interval <secs>] [-S|--standby <server>[:<port>]]\n"
+	    "\t[-F|--failover-time <secs>] [-R|--peers <server>[:<port>],...]"
+	    "\n\n", prog);
 }
 
 
@@ -145,7 +145,9 @@ main(int argc, char *argv[])
 static void
 dumpSummaryInfo(std::ostringstream &availHosts, std::ostringstream &overHosts,
                 std::ostringstream &unavailHosts,
-                std::ostringstream &silentHosts, std::ostringstream &unkHosts)
+                std::ostringstream &silentHosts,
+                std::ostringstream &unreachHosts,
+                std::ostringstream &drainHosts, std::ostringstream &unkHosts)
 {
     if (! availHosts.str().empty())
         std::cout << "Avail: " << availHosts.str() << '\n';
@@ -155,12 +157,18 @@ dumpSummaryInfo(std::ostringstream &availHosts, std::ostringstream &overHosts,
         std::cout << "Unavail: " << unavailHosts.str() << '\n';
     if (! silentHosts.str().empty())
         std::cout << "Silent: " << silentHosts.str() << '\n';
+    if (! unreachHosts.str().empty())
+        std::cout << "Unreachable: " << unreachHosts.str() << '\n';
+    if (! drainHosts.str().empty())
+        std::cout << "Draining: " << drainHosts.str() << '\n';
     if (! unkHosts.str().empty())
         std::cout << "Unknown state: " << unkHosts.str() << '\n';
     availHosts.str("");
     overHosts.str("");
     unavailHosts.str("");
     silentHosts.str("");
+    unreachHosts.str("");
+    drainHosts.str("");
     unkHosts.str("");
 }    
 
@@ -173,6 +181,9 @@ parseResults(const char *resultStr)
      * D: <distinguishingProp> // a string that distinguishes these hosts.
      * H: <ip-addr> <int>      // a host, its ip address, and its state.
      * C <tier>: <ipaddr>/<#cpus>
+     * B: <ip-addr> open|half-open  // a host whose circuit breaker tripped.
+     * R: <ip-addr> <#leases> <secs> // a draining host, the compiles left
+     *				     // on it, and the secs to its deadline.
      *
      * o The state is represented by an integer representing the
      *   host_status_t enum value.
@@ -185,13 +196,15 @@ parseResults(const char *resultStr)
      * Available Hosts: <host list>.
      * Silent Hosts: host/#cpus ...
      * Unavailable Hosts: host/#cpus ...
+     * Unreachable Hosts: host/#cpus ...
+     * Draining Hosts: host/#cpus ...
      *
      * <repeat above for each distinguishing prop>
      */
 
     std::istringstream instr(resultStr);
     std::ostringstream unkHosts, availHosts, unavailHosts, overHosts,
-        silentHosts;
+        silentHosts, unreachHosts, drainHosts;
 
     while (1) {
 
@@ -199,7 +212,7 @@ parseResults(const char *resultStr)
 	instr >> firstChar;
 	if (instr.eof()) {
             dumpSummaryInfo(availHosts, overHosts, unavailHosts, silentHosts,
-                            unkHosts);
+                            unreachHosts, drainHosts, unkHosts);
 	    break;
 	}
 	switch (firstChar) {
@@ -210,7 +223,7 @@ parseResults(const char *resultStr)
                information on the previous set, print it out now, and
                clear it. */
             dumpSummaryInfo(availHosts, overHosts, unavailHosts, silentHosts,
-                            unkHosts);
+                            unreachHosts, drainHosts, unkHosts);
           
             std::string distProp;
             instr.ignore();		// eat ':'
@@ -256,6 +269,8 @@ parseResults(const char *resultStr)
 	    case STATUS_UNAVAILABLE: ostr = &unavailHosts; break;
 	    case STATUS_OVERLOADED: ostr = &overHosts; break;
 	    case STATUS_SILENT: ostr = &silentHosts; break;
+	    case STATUS_UNREACHABLE: ostr = &unreachHosts; break;
+	    case STATUS_DRAINING: ostr = &drainHosts; break;
 	    case STATUS_UNKNOWN:
 	    default: ostr = &unkHosts;
 	    }
@@ -315,6 +330,38 @@ parseResults(const char *resultStr)
 	    std::cout << '\n';
 	    break;
 	}
+	case 'B': {
+	    std::string ipstr, breaker;
+	    /* Read in ': <ip-address> open|half-open' */
+	    instr.ignore();		// eat ':'
+	    instr >> ipstr >> breaker;
+
+	    unsigned int addr = inet_addr(ipstr.c_str());
+	    struct hostent *he = gethostbyaddr((char *)&addr, sizeof(addr),
+					       AF_INET);
+	    std::cout << "Breaker " << breaker << ": " <<
+		(he ? he->h_name : ipstr.c_str()) << '\n';
+	    break;
+	}
+	case 'R': {
+	    std::string ipstr;
+	    int leases;
+	    long secs;
+	    /* Read in ': <ip-address> <#leases> <secs>' */
+	    instr.ignore();		// eat ':'
+	    instr >> ipstr >> leases >> secs;
+
+	    unsigned int addr = inet_addr(ipstr.c_str());
+	    struct hostent *he = gethostbyaddr((char *)&addr, sizeof(addr),
+					       AF_INET);
+	    std::cout << "Draining: " << (he ? he->h_name : ipstr.c_str()) <<
+		", " << leases << " compiles left";
+	    if (secs > 0) {
+		std::cout << ", taken out in " << secs << " secs";
+	    }
+	    std::cout << '\n';
+	    break;
+	}
 	default:
 	    std::string line;
 	    std::getline(instr, line);
@@ -24,6 +24,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fstream>
+#include <iostream>
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -35,6 +36,7 @@
 
 extern char **environ;
 void usage(const char *prog);
+static int sendBatch(Socket *sock, const char *file);
 
 bool debugMode = false;
 
@@ -56,6 +58,14 @@ main(int argc, char *argv[])
      * -p <port>, --port <port>: the port number to send to (default: 6714).
      * -D, --debug: debug mode (default: off)
      * -ip <address>: The machine IP to add or remove from the server (default: localhost's IP).
+     * -d, --drain: drain the host instead of removing it: it gets no more
+     *	compiles, and is removed when those on it are done.
+     * --deadline <secs>: remove a draining host after that long anyway.
+     * -w, --wait: wait until the host is drained.  The exit status is 0
+     *	only if no compiles were left on it.
+     * -b <file>, --batch <file>: instead, do the operations in the file
+     *	('-' for stdin), one per line, all at once (see dmucs_admin.h --
+     *	the hosts may be given by name).
      */
     std::ostringstream serverName;
     serverName << "@" << SERVER_MACH_NAME;
@@ -63,6 +73,10 @@ main(int argc, char *argv[])
     char * distingProp = "";
 	char * suppliedIP = NULL;
 	char * suppliedHost = NULL;
+    bool drain = false;
+    int deadline = 0;
+    bool wait = false;
+    const char *batchFile = NULL;
 
     int nextarg = 1;
     for (; nextarg < argc; nextarg++) {
@@ -106,6 +120,25 @@ main(int argc, char *argv[])
 			return -1;
 	    }
 		suppliedHost = argv[nextarg];
+	} else if (strequ("-d", argv[nextarg]) ||
+		   strequ("--drain", argv[nextarg])) {
+	    drain = true;
+	} else if (strequ("--deadline", argv[nextarg])) {
+	    if (++nextarg >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    deadline = atoi(argv[nextarg]);
+	} else if (strequ("-b", argv[nextarg]) ||
+		   strequ("--batch", argv[nextarg])) {
+	    if (++nextarg >= argc) {
+		usage(argv[0]);
+		return -1;
+	    }
+	    batchFile = argv[nextarg];
+	} else if (strequ("-w", argv[nextarg]) ||
+		   strequ("--wait", argv[nextarg])) {
+	    wait = true;
 	} else {
 	    /* We are looking at the command to run, supposedly. */
 	    break;
@@ -123,6 +156,12 @@ main(int argc, char *argv[])
 	return -1;
     }
 
+    if (batchFile != NULL) {
+	int result = sendBatch(client_sock, batchFile);
+	Sclose(client_sock);
+	return result;
+    }
+
     char hostname[256];
     if (gethostname(hostname, 256) < 0) {
 	fprintf(stderr, "Could not get my hostname\n");
@@ -146,26 +185,131 @@ main(int argc, char *argv[])
     /* If the name of the program is "addhost", then send "up" to the
        dmucs server.  Otherwise, send "down". */
     const char *op = (strstr(argv[0], "addhost") != NULL) ? "up" : "down";
+    if (drain && strcmp(op, "down") == 0) {
+	op = "drain";
+    } else {
+	wait = false;
+    }
 
     std::ostringstream clientReqStr;
 	char const* ip = suppliedIP ? suppliedIP : inet_ntoa(in);
     clientReqStr << "status " << ip << " " << op << " "
 	<< (distingProp ? distingProp : "");
+    if (drain && deadline > 0) {
+	clientReqStr << " deadline=" << deadline;
+    }
+    if (wait) {
+	clientReqStr << " wait=1";
+    }
     DMUCS_DEBUG((stderr, "Writing -->%s<-- to the server\n",
 		 clientReqStr.str().c_str()));
 
     Sputs((char *) clientReqStr.str().c_str(), client_sock);
 
+    int result = 0;
+    if (wait) {
+	/* The server answers "drained <#compiles left>" when the host is
+	   out, or "cancelled" if it was put back first. */
+	char reply[64];
+	if (Sgets(reply, sizeof(reply), client_sock) == NULL) {
+	    fprintf(stderr, "Lost the server while waiting for %s to drain\n",
+		    ip);
+	    result = -1;
+	} else {
+	    printf("%s: %s\n", ip, reply);
+	    int left = -1;
+	    if (sscanf(reply, "drained %d", &left) != 1 || left != 0) {
+		result = 1;
+	    }
+	}
+    }
+
     Sclose(client_sock);
 
-    return 0;
+    return result;
 }
 
 
 
+/*
+ * Send the operations in the file to the server, as "admin" messages of
+ * no more than BATCH_MSG_SIZE bytes, then commit them, and print the
+ * server's reply.  Return 0 if they were all done.
+ */
+#define BATCH_MSG_SIZE	900	/* the server reads up to 1024 bytes. */
+
+static int
+sendBatch(Socket *sock, const char *file)
+{
+    std::ifstream infile;
+    if (strcmp(file, "-") != 0) {
+	infile.open(file);
+	if (!infile) {
+	    fprintf(stderr, "Could not open %s\n", file);
+	    return -1;
+	}
+    }
+    std::istream &in = (strcmp(file, "-") == 0) ? std::cin : infile;
+
+    std::string line, msg;
+    int lineNum = 0;
+    while (std::getline(in, line)) {
+	lineNum++;
+	std::istringstream linestr(line);
+	std::string op, host, rest;
+	if (!(linestr >> op) || op[0] == '#') {
+	    continue;		// skip blank lines and comments.
+	}
+	if (!(linestr >> host)) {
+	    fprintf(stderr, "%s:%d: no host\n", file, lineNum);
+	    return -1;
+	}
+	std::getline(linestr, rest);
+
+	/* The server wants the hosts' IP addresses. */
+	struct hostent *he = gethostbyname(host.c_str());
+	if (he == NULL) {
+	    fprintf(stderr, "%s:%d: unknown host %s\n", file, lineNum,
+		    host.c_str());
+	    return -1;
+	}
+	struct in_addr in;
+	memcpy(&in.s_addr, he->h_addr_list[0], sizeof(in.s_addr));
+	std::string opstr = op + " " + inet_ntoa(in) + rest;
+
+	if (!msg.empty() && msg.size() + opstr.size() + 2 > BATCH_MSG_SIZE) {
+	    DMUCS_DEBUG((stderr, "Writing -->%s<-- to the server\n",
+			 msg.c_str()));
+	    Sputs((char *) msg.c_str(), sock);
+	    msg.clear();
+	}
+	msg += msg.empty() ? "admin " : "; ";
+	msg += opstr;
+    }
+    if (!msg.empty()) {
+	DMUCS_DEBUG((stderr, "Writing -->%s<-- to the server\n",
+		     msg.c_str()));
+	Sputs((char *) msg.c_str(), sock);
+    }
+    Sputs((char *) "admin commit", sock);
+
+    /* The server answers "ok <#operations>", or "error <n>: <why>" if it
+       did none of them. */
+    char reply[256];
+    if (Sgets(reply, sizeof(reply), sock) == NULL) {
+	fprintf(stderr, "Lost the server before it answered\n");
+	return -1;
+    }
+    printf("%s\n", reply);
+    return (strncmp(reply, "ok", 2) == 0) ? 0 : 1;
+}
+
+
 void
 usage(const char *prog)
 {
     fprintf(stderr, "Usage: %s [-s|--server <server>] [-p|--port <port>] "
-	    "[-t|--type <str>] [-D|--debug] [-ip <address>] [--host <hostname>] <command> [args] \n\n", prog);
+	    "[-t|--type <str>] [-D|--debug] [-ip <address>] [--host <hostname>] <command> [args] \n"
+	    "\t[-d|--drain [--deadline <secs>] [-w|--wait]] "
+	    "[-b|--batch <file>]\n\n", prog);
 }
@@ -0,0 +1,95 @@
+#!/bin/bash
+#
+# test-admin.sh: run a server on the loopback interface, and check that
+# it takes a batch of admin operations (see dmucs_admin.h) as a whole:
+# all of it or none of it, and that a host an "up" of the batch brings up
+# may be changed by the operations after it.
+#
+# Run by "make check", from the build directory.  $DMUCS may name the
+# dmucs program to run.
+#
+# Copyright (C) 2005, 2006  Victor T. Norman
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+#
+
+DMUCS=${DMUCS:-./dmucs}
+PORT=$((20000 + $$ % 10000))
+
+if [ ! -x "$DMUCS" ]; then
+    echo "$0: no $DMUCS to run"
+    exit 77
+fi
+
+dir=`mktemp -d /tmp/dmucs-check.XXXXXX` || exit 1
+pids=""
+cleanup() {
+    if [ -n "$pids" ]; then
+	kill -9 $pids 2>/dev/null
+	wait $pids 2>/dev/null
+    fi
+    rm -rf "$dir"
+}
+trap cleanup 0
+
+fail() {
+    echo "FAILED: $*"
+    echo "--- server:"; cat "$dir/server.log"
+    exit 1
+}
+
+# Send a batch of operations, and commit it: "commit <ops>".  Set $reply
+# to the server's answer.
+commit() {
+    exec 3<>/dev/tcp/127.0.0.1/$PORT || fail "could not connect"
+    printf 'admin %s\0admin commit\0' "$1" >&3
+    IFS= read -r -d '' -t 5 reply <&3
+    exec 3>&-
+}
+
+# Ask for a cpu on a new connection, and set $reply to the address given.
+ask() {
+    exec 4<>/dev/tcp/127.0.0.1/$PORT || fail "could not connect"
+    printf 'host 127.0.0.9\0' >&4
+    IFS= read -r -d '' -t 5 reply <&4
+    reply=${reply%% *}
+    exec 4>&-
+}
+
+# The host is in the hosts-info file, but not in the db: it has sent no
+# load reports.
+echo "localhost 2 1" > "$dir/hosts-info"
+: > "$dir/dprops-info"
+: > "$dir/quotas-info"
+
+$DMUCS -H "$dir/hosts-info" -C "$dir/dprops-info" \
+    -Q "$dir/quotas-info" -p $PORT > "$dir/server.log" 2>&1 &
+pids=$!
+sleep 0.5
+
+# A bad operation after the "up": none of the batch is done.
+commit "up 127.0.0.1; pindex 127.0.0.7 5"
+[ "${reply%%:*}" = "error 2" ] || fail "a bad batch got '$reply'"
+ask
+[ "$reply" = "0.0.0.0" ] || fail "part of a bad batch was done"
+
+# The "up" brings the host up, and the "pindex" after it may change it.
+commit "up 127.0.0.1; pindex 127.0.0.1 5"
+[ "$reply" = "ok 2" ] || fail "up then pindex got '$reply'"
+ask
+[ "$reply" = "127.0.0.1" ] || fail "the host brought up gave '$reply'"
+
+echo "PASSED"
+exit 0
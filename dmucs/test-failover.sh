@@ -0,0 +1,148 @@
+#!/bin/bash
+#
+# test-failover.sh: run a primary and a standby server on the loopback
+# interface, kill the primary while clients hold cpus from it, and check
+# that the standby takes over: it has heard of the cpus given back, it
+# keeps the lease a client claims, and it takes back the one no client
+# claims after orphan-time.
+#
+# Run by "make check", from the build directory.  $DMUCS may name the
+# dmucs program to run.
+#
+# Copyright (C) 2005, 2006  Victor T. Norman
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+#
+
+DMUCS=${DMUCS:-./dmucs}
+PRIMARY=$((20000 + $$ % 10000))
+STANDBY=$((PRIMARY + 1))
+ORPHAN_TIME=2
+
+if [ ! -x "$DMUCS" ]; then
+    echo "$0: no $DMUCS to run"
+    exit 77
+fi
+
+dir=`mktemp -d /tmp/dmucs-check.XXXXXX` || exit 1
+pids=""
+cleanup() {
+    if [ -n "$pids" ]; then
+	kill -9 $pids 2>/dev/null
+	wait $pids 2>/dev/null
+    fi
+    rm -rf "$dir"
+}
+trap cleanup 0
+
+fail() {
+    echo "FAILED: $*"
+    echo "--- primary:"; cat "$dir/primary.log"
+    echo "--- standby:"; cat "$dir/standby.log"
+    exit 1
+}
+
+# Send one message on a new connection: "send <port> <msg>".
+send() {
+    exec 5<>/dev/tcp/127.0.0.1/$1 || fail "could not connect to $1"
+    printf '%s\0' "$2" >&5
+    exec 5>&-
+}
+
+# Ask for a cpu on a new connection, on the fd, and set $reply to the
+# address given: "ask <fd> <port>".
+ask() {
+    eval "exec $1<>/dev/tcp/127.0.0.1/$2" || fail "could not connect to $2"
+    printf 'host 127.0.0.9\0' >&$1
+    IFS= read -r -d '' -t 5 reply <&$1
+    reply=${reply%% *}
+}
+
+# The host has three cpus.
+echo "localhost 3 1" > "$dir/hosts-info"
+echo "* orphan-time $ORPHAN_TIME" > "$dir/dprops-info"
+: > "$dir/quotas-info"
+files="-H $dir/hosts-info -C $dir/dprops-info -Q $dir/quotas-info"
+
+$DMUCS $files -p $PRIMARY > "$dir/primary.log" 2>&1 &
+primary=$!
+pids="$primary"
+sleep 0.5
+$DMUCS $files -p $STANDBY -S 127.0.0.1:$PRIMARY -F 2 \
+    > "$dir/standby.log" 2>&1 &
+pids="$pids $!"
+sleep 0.5
+
+# The first load report adds the host, and the second gives it its load.
+for i in 1 2; do
+    send $PRIMARY "load 127.0.0.1 0.10 0.10 0.10"
+    send $STANDBY "load 127.0.0.1 0.10 0.10 0.10"
+done
+
+# Two clients take both cpus from the primary.
+ask 3 $PRIMARY
+[ "$reply" = "127.0.0.1" ] || fail "the primary gave out '$reply'"
+ask 4 $PRIMARY
+[ "$reply" = "127.0.0.1" ] || fail "the primary gave out '$reply'"
+
+# A third takes the last cpu, and gives it back.
+ask 5 $PRIMARY
+[ "$reply" = "127.0.0.1" ] || fail "the primary gave out '$reply'"
+printf 'release 127.0.0.1\0' >&5
+exec 5>&-
+sleep 0.5
+
+# The standby answers no host requests while the primary is up.
+exec 6<>/dev/tcp/127.0.0.1/$STANDBY
+printf 'host 127.0.0.9\0' >&6
+IFS= read -r -d '' -t 1 reply <&6 && fail "the standby answered '$reply'"
+exec 6>&-
+
+{ kill -9 $primary && wait $primary; } 2>/dev/null
+exec 3>&- 4>&-
+
+# One client fails over and claims its cpu; the other never comes back.
+exec 3<>/dev/tcp/127.0.0.1/$STANDBY || fail "could not reach the standby"
+printf 'claim 127.0.0.1\0' >&3
+sleep 0.5
+grep -q "Taking over" "$dir/standby.log" ||
+    fail "the standby did not take over"
+grep -q "claimed its lease" "$dir/standby.log" || fail "the claim was lost"
+
+# The cpu given back is free; the other two are still held: one
+# claimed, one orphaned.
+ask 5 $STANDBY
+[ "$reply" = "127.0.0.1" ] || fail "the cpu given back is not free"
+ask 4 $STANDBY
+[ "$reply" = "0.0.0.0" ] || fail "the standby gave out '$reply' too soon"
+exec 4>&-
+
+# The orphan goes back after orphan-time; the claimed cpu stays held.
+sleep $((ORPHAN_TIME + 1))
+ask 4 $STANDBY
+[ "$reply" = "127.0.0.1" ] || fail "the orphan was not taken back"
+ask 6 $STANDBY
+[ "$reply" = "0.0.0.0" ] || fail "the claimed lease was taken back"
+exec 6>&-
+
+# The claiming client is done: its cpu comes back.
+exec 3>&-
+sleep 0.5
+ask 6 $STANDBY
+[ "$reply" = "127.0.0.1" ] || fail "the claimed cpu did not come back"
+exec 4>&- 5>&- 6>&-
+
+echo "PASSED"
+exit 0
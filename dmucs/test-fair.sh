@@ -0,0 +1,129 @@
+#!/bin/bash
+#
+# test-fair.sh: run a server on the loopback interface, and check how it
+# shares out its cpus (see dmucs_fair.h): the cpus kept back for
+# interactive work, the users' quotas, and the cpus held for the users
+# waiting in turn.
+#
+# Run by "make check", from the build directory.  $DMUCS may name the
+# dmucs program to run.
+#
+# Copyright (C) 2005, 2006  Victor T. Norman
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+#
+
+DMUCS=${DMUCS:-./dmucs}
+PORT=$((20000 + $$ % 10000))
+LINGER=2			# DMUCS_FAIR_LINGER
+
+if [ ! -x "$DMUCS" ]; then
+    echo "$0: no $DMUCS to run"
+    exit 77
+fi
+
+dir=`mktemp -d /tmp/dmucs-check.XXXXXX` || exit 1
+pids=""
+cleanup() {
+    if [ -n "$pids" ]; then
+	kill -9 $pids 2>/dev/null
+	wait $pids 2>/dev/null
+    fi
+    rm -rf "$dir"
+}
+trap cleanup 0
+
+fail() {
+    echo "FAILED: $*"
+    echo "--- server:"; cat "$dir/server.log"
+    exit 1
+}
+
+# Send one message on a new connection: "send <msg>".
+send() {
+    exec 9<>/dev/tcp/127.0.0.1/$PORT || fail "could not connect"
+    printf '%s\0' "$1" >&9
+    exec 9>&-
+}
+
+# Open a client connection on the fd: "connect <fd>".
+connect() {
+    eval "exec $1<>/dev/tcp/127.0.0.1/$PORT" || fail "could not connect"
+}
+
+# Ask for a cpu on the client's fd, and check the address given:
+# "expect <fd> <options> <address>".
+expect() {
+    printf 'host 127.0.0.9 %s\0' "$2" >&$1
+    IFS= read -r -d '' -t 5 reply <&$1
+    reply=${reply%% *}
+    [ "$reply" = "$3" ] || fail "'$2' got '$reply', not '$3'"
+}
+
+# The host has four cpus, and interactive work has the last of them.
+echo "localhost 4 1" > "$dir/hosts-info"
+echo "* reserve-interactive 25" > "$dir/dprops-info"
+echo "user:alice max-cpus 1" > "$dir/quotas-info"
+
+$DMUCS -H "$dir/hosts-info" -C "$dir/dprops-info" \
+    -Q "$dir/quotas-info" -p $PORT > "$dir/server.log" 2>&1 &
+pids=$!
+sleep 0.5
+
+# The first load report adds the host, and the second gives it its load.
+send "load 127.0.0.1 0.10 0.10 0.10"
+send "load 127.0.0.1 0.10 0.10 0.10"
+
+# Background work may not take the cpu kept for interactive work.
+connect 3
+for i in 1 2 3; do
+    expect 3 "user=bg prio=background" 127.0.0.1
+done
+expect 3 "user=bg prio=background" 0.0.0.0
+connect 4
+expect 4 "user=dev" 127.0.0.1
+exec 3>&- 4>&-
+sleep $((LINGER + 1))
+
+# A user may not go over its quota, but the others may have cpus.
+connect 3
+expect 3 "user=alice" 127.0.0.1
+expect 3 "user=alice" 0.0.0.0
+connect 4
+expect 4 "user=bob" 127.0.0.1
+exec 3>&- 4>&-
+sleep $((LINGER + 1))
+
+# One user holds every cpu, and two more wait for one.  The cpus that
+# come free are held for the two that waited, and not given to a user who
+# asks after them.
+connect 3
+for i in 1 2 3 4; do
+    expect 3 "user=hog" 127.0.0.1
+done
+connect 4
+expect 4 "user=carol" 0.0.0.0
+connect 5
+expect 5 "user=dave" 0.0.0.0
+printf 'release 127.0.0.1\0release 127.0.0.1\0' >&3
+sleep 0.5
+connect 6
+expect 6 "user=erin" 0.0.0.0
+expect 4 "user=carol" 127.0.0.1
+expect 5 "user=dave" 127.0.0.1
+exec 3>&- 4>&- 5>&- 6>&-
+
+echo "PASSED"
+exit 0
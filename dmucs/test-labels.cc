@@ -0,0 +1,161 @@
+/*
+ * test-labels.cc: check how host dprops are matched against the
+ * predicates of host requests, and the DmucsBitset the server indexes
+ * its hosts by (see dmucs_labels.h).
+ *
+ * Run by "make check".
+ *
+ * Copyright (C) 2005, 2006  Victor T. Norman
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <stdio.h>
+#include "dmucs_labels.h"
+
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+	if (! (cond)) { \
+	    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, \
+		    #cond); \
+	    failures++; \
+	} \
+    } while (0)
+
+
+/* The bits in a word of a DmucsBitset. */
+static const unsigned int W = 8 * sizeof(unsigned long);
+
+
+static void
+checkLabels()
+{
+    DmucsLabels l = dprop2labels("linux-x86_64,linux-generic");
+    CHECK(l.size() == 2 && l[0] == "linux-x86_64" && l[1] == "linux-generic");
+
+    /* Empty labels are dropped. */
+    l = dprop2labels(",a,,b,");
+    CHECK(l.size() == 2 && l[0] == "a" && l[1] == "b");
+    CHECK(dprop2labels("").empty());
+}
+
+
+static void
+checkMatches()
+{
+    /* A host may have more labels than the request asks for. */
+    CHECK(dpropMatches("a,b", "a"));
+    CHECK(dpropMatches("a,b", "b,a"));
+    CHECK(! dpropMatches("a", "a,b"));
+    CHECK(! dpropMatches("ab", "a"));
+
+    /* Negation: the host must not have the label. */
+    CHECK(dpropMatches("a,b", "!c"));
+    CHECK(! dpropMatches("a,b", "!b"));
+    CHECK(! dpropMatches("a,b", "a,!b"));
+    CHECK(dpropMatches("a,c", "a,!b"));
+    CHECK(dpropMatches("", "!a"));
+
+    /* The empty predicate is the default pool: only the hosts with no
+       labels. */
+    CHECK(dpropMatches("", ""));
+    CHECK(! dpropMatches("a", ""));
+    CHECK(! dpropMatches("", "a"));
+}
+
+
+static void
+checkBitset()
+{
+    /* fill() on and around a word boundary. */
+    DmucsBitset s;
+    s.fill(0);
+    CHECK(! s.any());
+    CHECK(s.next(0) == -1);
+
+    s.fill(W);
+    CHECK(s.test(0) && s.test(W - 1) && ! s.test(W));
+    CHECK(s.next(W - 1) == (int) W - 1);
+    CHECK(s.next(W) == -1);
+
+    s.fill(W + 1);
+    CHECK(s.test(W) && ! s.test(W + 1));
+    CHECK(s.next(W) == (int) W);
+    CHECK(s.next(W + 1) == -1);
+
+    s.fill(W - 1);
+    CHECK(s.test(W - 2) && ! s.test(W - 1));
+
+    /* next() across words, and past the end. */
+    DmucsBitset t;
+    t.set(W - 1);
+    t.set(W);
+    t.set(3 * W + 5);
+    CHECK(t.next(0) == (int) W - 1);
+    CHECK(t.next(W) == (int) W);
+    CHECK(t.next(W + 1) == (int) (3 * W + 5));
+    CHECK(t.next(3 * W + 6) == -1);
+    CHECK(t.next(10 * W) == -1);
+    CHECK(! t.test(10 * W));
+
+    /* intersect() of sets of unequal lengths, either way round. */
+    DmucsBitset longer, shorter;
+    longer.set(1);
+    longer.set(2 * W + 1);
+    shorter.set(1);
+    shorter.set(2);
+
+    DmucsBitset a = longer;
+    a.intersect(shorter);
+    CHECK(a.test(1) && ! a.test(2) && ! a.test(2 * W + 1));
+    CHECK(a.next(2) == -1);
+
+    DmucsBitset b = shorter;
+    b.intersect(longer);
+    CHECK(b.test(1) && ! b.test(2) && ! b.test(2 * W + 1));
+    CHECK(b.next(2) == -1);
+
+    DmucsBitset c = longer;
+    c.intersect(DmucsBitset());
+    CHECK(! c.any());
+
+    /* subtract() of sets of unequal lengths. */
+    DmucsBitset d = longer;
+    d.subtract(shorter);
+    CHECK(! d.test(1) && d.test(2 * W + 1));
+
+    DmucsBitset e = shorter;
+    e.subtract(longer);
+    CHECK(! e.test(1) && e.test(2));
+    CHECK(e.next(0) == 2);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    checkLabels();
+    checkMatches();
+    checkBitset();
+    if (failures > 0) {
+	fprintf(stderr, "%d checks FAILED\n", failures);
+	return 1;
+    }
+    printf("PASSED\n");
+    return 0;
+}